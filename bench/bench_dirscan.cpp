@@ -0,0 +1,338 @@
+/*
+ * dirscan_bench: generates synthetic corpora and measures Scanner throughput.
+ *
+ * Usage:
+ *   dirscan_bench [--dir <path>] [--scale <n>] [--corpus tiny,huge,deep,long]
+ *                 [--repeat <n>] [--threads <n>] [--csv] [--keep]
+ *
+ * Each corpus is generated once under --dir (default: a temp directory),
+ * then scanned in literal and regex mode. Per run it reports files/s, MB/s,
+ * hits/s and the process's peak RSS so far. --csv prints one machine-readable
+ * line per run for release gating.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "scanner.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char* const kNeedle = "needle_token";
+const char* const kRegex = "needle_[a-z]+";
+
+struct Corpus {
+	std::string name;
+	fs::path root;
+	size_t files = 0;
+	size_t bytes = 0;
+};
+
+struct BenchConfig {
+	fs::path dir = fs::temp_directory_path() / "dirscan_bench";
+	unsigned scale = 1;
+	std::vector<std::string> corpora = { "tiny", "huge", "deep", "long" };
+	unsigned repeat = 3;
+	unsigned threads = 0;
+	bool csv = false;
+	bool keep = false;
+};
+
+size_t peakRssBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+	return static_cast<size_t>(usage.ru_maxrss);        // bytes
+#else
+	return static_cast<size_t>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+#endif
+}
+
+// Produces log-like text; roughly one line in 'hitEvery' contains the needle.
+class TextGenerator {
+public:
+	explicit TextGenerator(unsigned seed) : rng_(seed) {}
+
+	void appendLine(std::string& out, size_t length, unsigned hitEvery)
+	{
+		static const char* const words[] = {
+			"INFO", "request", "served", "in", "ms", "user", "session", "cache",
+			"miss", "the", "of", "and", "connection", "closed", "retry", "ok",
+		};
+		const size_t start = out.size();
+		bool hit = hitEvery != 0 && rng_() % hitEvery == 0;
+		size_t hitAt = hit ? rng_() % (length / 2 + 1) : length + 1;
+		while (out.size() - start < length) {
+			if (hit && out.size() - start >= hitAt) {
+				out += kNeedle;
+				out += ' ';
+				hit = false;
+				continue;
+			}
+			out += words[rng_() % (sizeof(words) / sizeof(words[0]))];
+			out += ' ';
+		}
+		out += '\n';
+	}
+
+private:
+	std::mt19937 rng_;
+};
+
+void writeFile(const fs::path& path, const std::string& content, Corpus& corpus)
+{
+	std::ofstream ofs(path, std::ios::binary);
+	ofs.write(content.data(), static_cast<std::streamsize>(content.size()));
+	corpus.files++;
+	corpus.bytes += content.size();
+}
+
+// Many small files spread over a few hundred directories.
+void generateTiny(Corpus& corpus, unsigned scale, TextGenerator& gen)
+{
+	const size_t count = 20000 * scale;
+	std::string content;
+	for (size_t i = 0; i < count; ++i) {
+		fs::path dir = corpus.root / ("d" + std::to_string(i % 256));
+		if (i < 256) {
+			fs::create_directories(dir);
+		}
+		content.clear();
+		for (int line = 0; line < 4; ++line) {
+			gen.appendLine(content, 60, 40);
+		}
+		writeFile(dir / ("f" + std::to_string(i) + ".log"), content, corpus);
+	}
+}
+
+// A few very large files.
+void generateHuge(Corpus& corpus, unsigned scale, TextGenerator& gen)
+{
+	fs::create_directories(corpus.root);
+	const size_t bytesPerFile = size_t(32) * 1024 * 1024 * scale;
+	std::string content;
+	for (int i = 0; i < 4; ++i) {
+		content.clear();
+		content.reserve(bytesPerFile + 256);
+		while (content.size() < bytesPerFile) {
+			gen.appendLine(content, 100, 5000);
+		}
+		writeFile(corpus.root / ("huge" + std::to_string(i) + ".log"), content, corpus);
+	}
+}
+
+// A binary tree of directories, 12 levels deep, with two files per leaf.
+void generateDeep(Corpus& corpus, unsigned scale, TextGenerator& gen)
+{
+	const int depth = 12;
+	std::string content;
+	std::vector<fs::path> level = { corpus.root };
+	for (int d = 0; d < depth; ++d) {
+		std::vector<fs::path> next;
+		for (const auto& dir : level) {
+			next.push_back(dir / "a");
+			next.push_back(dir / "b");
+		}
+		level.swap(next);
+	}
+	for (const auto& leaf : level) {
+		fs::create_directories(leaf);
+		for (unsigned f = 0; f < 2 * scale; ++f) {
+			content.clear();
+			for (int line = 0; line < 20; ++line) {
+				gen.appendLine(content, 80, 100);
+			}
+			writeFile(leaf / ("f" + std::to_string(f) + ".txt"), content, corpus);
+		}
+	}
+}
+
+// Files made of very long lines (64 KiB each).
+void generateLong(Corpus& corpus, unsigned scale, TextGenerator& gen)
+{
+	fs::create_directories(corpus.root);
+	std::string content;
+	for (unsigned i = 0; i < 50 * scale; ++i) {
+		content.clear();
+		for (int line = 0; line < 16; ++line) {
+			gen.appendLine(content, 64 * 1024, 4);
+		}
+		writeFile(corpus.root / ("long" + std::to_string(i) + ".log"), content, corpus);
+	}
+}
+
+Corpus generate(const std::string& name, const BenchConfig& config)
+{
+	Corpus corpus;
+	corpus.name = name;
+	corpus.root = config.dir / name;
+	fs::remove_all(corpus.root);
+
+	TextGenerator gen(12345); // fixed seed: identical corpora across runs
+	if (name == "tiny") {
+		generateTiny(corpus, config.scale, gen);
+	}
+	else if (name == "huge") {
+		generateHuge(corpus, config.scale, gen);
+	}
+	else if (name == "deep") {
+		generateDeep(corpus, config.scale, gen);
+	}
+	else if (name == "long") {
+		generateLong(corpus, config.scale, gen);
+	}
+	else {
+		std::cerr << "Unknown corpus: " << name << "\n";
+	}
+	return corpus;
+}
+
+struct RunResult {
+	double seconds = 0;
+	size_t files = 0;
+	size_t hits = 0;
+};
+
+RunResult runScan(const Corpus& corpus, bool useRegex, const BenchConfig& config)
+{
+	ScanOptions options;
+	options.query = useRegex ? kRegex : kNeedle;
+	options.useRegex = useRegex;
+	options.numThreads = config.threads;
+
+	std::string error;
+	auto scanner = Scanner::create(options, error);
+	if (!scanner) {
+		std::cerr << "Error: " << error << "\n";
+		std::exit(1);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	scanner->run(corpus.root, [](const FileMatches&) {});
+	auto end = std::chrono::steady_clock::now();
+
+	StatusSnapshot progress = scanner->progress();
+	return { std::chrono::duration<double>(end - start).count(), progress.filesScanned, progress.totalHits };
+}
+
+std::vector<std::string> splitList(const std::string& list)
+{
+	std::vector<std::string> items;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		if (!item.empty()) {
+			items.push_back(item);
+		}
+	}
+	return items;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	BenchConfig config;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--dir" && i + 1 < argc) {
+			config.dir = argv[++i];
+		}
+		else if (arg == "--scale" && i + 1 < argc) {
+			config.scale = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+		}
+		else if (arg == "--corpus" && i + 1 < argc) {
+			config.corpora = splitList(argv[++i]);
+		}
+		else if (arg == "--repeat" && i + 1 < argc) {
+			config.repeat = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+		}
+		else if (arg == "--threads" && i + 1 < argc) {
+			config.threads = static_cast<unsigned>(std::max(0, std::atoi(argv[++i])));
+		}
+		else if (arg == "--csv") {
+			config.csv = true;
+		}
+		else if (arg == "--keep") {
+			config.keep = true;
+		}
+		else {
+			std::cerr << "Usage: " << argv[0]
+				<< " [--dir <path>] [--scale <n>] [--corpus tiny,huge,deep,long]"
+				<< " [--repeat <n>] [--threads <n>] [--csv] [--keep]\n";
+			return 1;
+		}
+	}
+
+	if (config.csv) {
+		std::printf("corpus,mode,files,bytes,seconds,files_per_s,mb_per_s,hits,hits_per_s,peak_rss_mb\n");
+	}
+	else {
+		std::printf("%-6s %-8s %10s %10s %12s %10s %12s %10s\n",
+			"corpus", "mode", "files", "seconds", "files/s", "MB/s", "hits/s", "rss MB");
+	}
+
+	for (const auto& name : config.corpora) {
+		Corpus corpus = generate(name, config);
+		if (corpus.files == 0) {
+			continue;
+		}
+		for (bool useRegex : { false, true }) {
+			// Best of N: the least noisy figure for regression gating
+			RunResult best;
+			for (unsigned r = 0; r < config.repeat; ++r) {
+				RunResult result = runScan(corpus, useRegex, config);
+				if (r == 0 || result.seconds < best.seconds) {
+					best = result;
+				}
+			}
+			const double mb = static_cast<double>(corpus.bytes) / (1024.0 * 1024.0);
+			const double rssMb = static_cast<double>(peakRssBytes()) / (1024.0 * 1024.0);
+			const char* mode = useRegex ? "regex" : "literal";
+			if (config.csv) {
+				std::printf("%s,%s,%zu,%zu,%.4f,%.1f,%.1f,%zu,%.1f,%.1f\n",
+					name.c_str(), mode, best.files, corpus.bytes, best.seconds,
+					best.files / best.seconds, mb / best.seconds,
+					best.hits, best.hits / best.seconds, rssMb);
+			}
+			else {
+				std::printf("%-6s %-8s %10zu %10.3f %12.0f %10.1f %12.0f %10.1f\n",
+					name.c_str(), mode, best.files, best.seconds,
+					best.files / best.seconds, mb / best.seconds,
+					best.hits / best.seconds, rssMb);
+			}
+			std::fflush(stdout);
+		}
+		if (!config.keep) {
+			fs::remove_all(corpus.root);
+		}
+	}
+	return 0;
+}
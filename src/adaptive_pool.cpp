@@ -0,0 +1,69 @@
+#include "adaptive_pool.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cstdlib>
+#include <ctime>
+#endif
+
+unsigned adaptPoolSize(const PoolSample& sample)
+{
+	unsigned next = sample.active;
+	const uint64_t busy = sample.busyNanos;
+	const bool starving = sample.idleNanos > busy;
+	const bool blocked = busy > 0 && sample.cpuNanos * 2 < busy;
+	const double cpuUsed = sample.intervalNanos > 0
+		? static_cast<double>(sample.cpuNanos) / static_cast<double>(sample.intervalNanos) : 0.0;
+	const bool coresUsed = cpuUsed >= sample.cores;
+	const bool hostLoaded = sample.otherLoad >= sample.cores;
+
+	if (starving) {
+		next = sample.active - 1;
+	}
+	else if (coresUsed && sample.active > sample.cores) {
+		next = sample.active - 1;
+	}
+	else if (hostLoaded && blocked) {
+		next = sample.active - 1;   // held off the CPU, not waiting for I/O
+	}
+	else if (blocked && sample.queued >= sample.active && !coresUsed && !hostLoaded) {
+		next = sample.active + std::max(1u, sample.active / 4);
+	}
+	return std::clamp(next, sample.minWorkers, sample.maxWorkers);
+}
+
+uint64_t threadCpuNanos()
+{
+#ifdef _WIN32
+	FILETIME created, exited, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) {
+		return 0;
+	}
+	auto ticks = [](const FILETIME& t) {
+		return (static_cast<uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime;
+	};
+	return (ticks(kernel) + ticks(user)) * 100; // 100 ns units
+#else
+	timespec now;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0) {
+		return 0;
+	}
+	return static_cast<uint64_t>(now.tv_sec) * 1000000000 + static_cast<uint64_t>(now.tv_nsec);
+#endif
+}
+
+double systemLoadAverage()
+{
+#ifdef _WIN32
+	return -1;
+#else
+	double load = 0;
+	return getloadavg(&load, 1) == 1 ? load : -1;
+#endif
+}
@@ -0,0 +1,65 @@
+#ifndef ADAPTIVE_POOL_H
+#define ADAPTIVE_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Time accounting of one worker thread, read by the pool controller.
+ *        Only the owning thread writes; one instance per cache line.
+ */
+struct alignas(64) WorkerLoad {
+    std::atomic<uint64_t> busyNanos{ 0 };   // wall time spent on files
+    std::atomic<uint64_t> cpuNanos{ 0 };    // CPU time spent on those files
+    std::atomic<uint64_t> idleNanos{ 0 };   // wall time waiting for the queue
+
+    // Owner thread: adds to one counter without a read-modify-write.
+    static void add(std::atomic<uint64_t>& counter, uint64_t nanos)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + nanos, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * @brief What the controller saw during one sampling interval. The times are
+ *        sums over the active workers.
+ */
+struct PoolSample {
+    unsigned active = 1;          // workers allowed to take work
+    unsigned minWorkers = 1;
+    unsigned maxWorkers = 1;
+    unsigned cores = 1;
+    size_t queued = 0;            // items waiting in the work queue
+    uint64_t intervalNanos = 0;
+    uint64_t busyNanos = 0;
+    uint64_t cpuNanos = 0;
+    uint64_t idleNanos = 0;
+    double otherLoad = -1;        // runnable threads outside this pool; < 0 if unknown
+};
+
+/**
+ * @brief The pool size to use for the next interval.
+ *
+ * - Workers mostly waiting for the queue: the walker or read stage is the
+ *   bottleneck, so one worker is parked.
+ * - A backlog while the workers spend under half of their busy time on the
+ *   CPU: they are blocked on I/O (NFS, cloud volumes), so the pool grows by a
+ *   quarter, unless the cores are already used up by this scan or by others.
+ * - The pool using more CPU than there are cores, or other load saturating
+ *   the host while the workers are held off the CPU: one worker is parked.
+ * Otherwise the size stays, always within [minWorkers, maxWorkers].
+ */
+unsigned adaptPoolSize(const PoolSample& sample);
+
+/**
+ * @brief CPU time consumed by the calling thread, in nanoseconds (0 where unavailable).
+ */
+uint64_t threadCpuNanos();
+
+/**
+ * @brief The one-minute system load average, or -1 where unavailable.
+ */
+double systemLoadAverage();
+
+#endif // ADAPTIVE_POOL_H
@@ -0,0 +1,586 @@
+#include "async_reader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include "stage_timer.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(DIRSCAN_HAVE_IO_URING)
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#if !defined(_WIN32) && defined(DIRSCAN_HAVE_IO_URING)
+
+/**
+ * @brief The minimum of an io_uring: one submission and one completion ring
+ *        mapped from the kernel, driven by a single thread.
+ */
+class IoUring {
+public:
+	IoUring() = default;
+	IoUring(const IoUring&) = delete;
+	IoUring& operator=(const IoUring&) = delete;
+
+	~IoUring()
+	{
+		if (sqes_ != nullptr) {
+			munmap(sqes_, sqesSize_);
+		}
+		if (cqRing_ != nullptr && cqRing_ != sqRing_) {
+			munmap(cqRing_, cqRingSize_);
+		}
+		if (sqRing_ != nullptr) {
+			munmap(sqRing_, sqRingSize_);
+		}
+		if (fd_ >= 0) {
+			::close(fd_);
+		}
+	}
+
+	// False if the kernel has no io_uring or refuses it (e.g. seccomp in containers).
+	bool init(unsigned entries)
+	{
+		io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+		fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+		if (fd_ < 0) {
+			return false;
+		}
+
+		sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single) {
+			sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+		}
+		sqRing_ = mapRing(sqRingSize_, IORING_OFF_SQ_RING);
+		if (sqRing_ == nullptr) {
+			return false;
+		}
+		cqRing_ = single ? sqRing_ : mapRing(cqRingSize_, IORING_OFF_CQ_RING);
+		sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+		sqes_ = static_cast<io_uring_sqe*>(mapRing(sqesSize_, IORING_OFF_SQES));
+		if (cqRing_ == nullptr || sqes_ == nullptr) {
+			return false;
+		}
+
+		char* sq = static_cast<char*>(sqRing_);
+		sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+		sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		char* cq = static_cast<char*>(cqRing_);
+		cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+		return true;
+	}
+
+	// The next free submission entry, zeroed. Callers never queue more entries
+	// than the ring holds, because every slot has a bounded number of
+	// operations in flight.
+	io_uring_sqe& nextSqe()
+	{
+		unsigned tail = *sqTail_ + pending_;
+		unsigned index = tail & sqMask_;
+		sqArray_[index] = index;
+		io_uring_sqe& sqe = sqes_[index];
+		std::memset(&sqe, 0, sizeof(sqe));
+		++pending_;
+		return sqe;
+	}
+
+	// Publishes queued entries, hands the kernel every entry it has not
+	// consumed yet (the SQ head trails the tail by those) and waits for at
+	// least one completion. Entries the kernel refuses for now (EAGAIN, EBUSY,
+	// or a short submission) stay in the ring and are offered again by the
+	// next call, once a completion has been waited for. False if the ring is
+	// unusable, or if nothing is in flight that could make room.
+	bool submitAndWait()
+	{
+		const unsigned tail = *sqTail_ + pending_;
+		std::atomic_ref<unsigned>(*sqTail_).store(tail, std::memory_order_release);
+		pending_ = 0;
+		while (true) {
+			const unsigned unsubmitted = tail - std::atomic_ref<unsigned>(*sqHead_).load(std::memory_order_acquire);
+			if (unsubmitted == 0 && inKernel_ == 0) {
+				return true; // nothing to submit or wait for
+			}
+			const unsigned wait = inKernel_ > 0 ? 1u : 0u;
+			const long rc = syscall(__NR_io_uring_enter, fd_, unsubmitted, wait,
+				wait != 0 ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+			if (rc < 0 && errno == EINTR) {
+				continue;
+			}
+			if (rc < 0 && errno != EAGAIN && errno != EBUSY) {
+				return false;
+			}
+			inKernel_ += rc > 0 ? static_cast<unsigned>(rc) : 0u;
+			if (rc >= 0 && static_cast<unsigned>(rc) == unsubmitted) {
+				if (wait != 0) {
+					return true;
+				}
+				continue; // everything is in; now wait for it
+			}
+			// Some entries were refused, and the kernel did not wait
+			if (inKernel_ == 0) {
+				return false;
+			}
+			long waited;
+			do {
+				waited = syscall(__NR_io_uring_enter, fd_, 0u, 1u, IORING_ENTER_GETEVENTS, nullptr, 0);
+			} while (waited < 0 && errno == EINTR);
+			return waited >= 0;
+		}
+	}
+
+	template <typename Handler>
+	void reap(Handler&& handler)
+	{
+		unsigned head = *cqHead_;
+		while (head != std::atomic_ref<unsigned>(*cqTail_).load(std::memory_order_acquire)) {
+			const io_uring_cqe& cqe = cqes_[head & cqMask_];
+			handler(cqe.user_data, cqe.res);
+			++head;
+			--inKernel_;
+			std::atomic_ref<unsigned>(*cqHead_).store(head, std::memory_order_release);
+		}
+	}
+
+private:
+	void* mapRing(size_t size, off_t offset)
+	{
+		void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+		return p == MAP_FAILED ? nullptr : p;
+	}
+
+	int fd_ = -1;
+	void* sqRing_ = nullptr;
+	void* cqRing_ = nullptr;
+	size_t sqRingSize_ = 0;
+	size_t cqRingSize_ = 0;
+	io_uring_sqe* sqes_ = nullptr;
+	size_t sqesSize_ = 0;
+	unsigned* sqHead_ = nullptr;
+	unsigned* sqTail_ = nullptr;
+	unsigned* sqArray_ = nullptr;
+	unsigned sqMask_ = 0;
+	unsigned* cqHead_ = nullptr;
+	unsigned* cqTail_ = nullptr;
+	unsigned cqMask_ = 0;
+	io_uring_cqe* cqes_ = nullptr;
+	unsigned pending_ = 0;  // entries filled but not yet published
+	unsigned inKernel_ = 0; // entries consumed by the kernel whose completion is not reaped
+};
+
+#endif
+
+const char* defaultBackend()
+{
+#ifdef _WIN32
+	return "iocp";
+#elif defined(DIRSCAN_HAVE_IO_URING)
+	return "io_uring";
+#else
+	return "threads";
+#endif
+}
+
+} // namespace
+
+AsyncReader::AsyncReader(BoundedFileQueue& input, BoundedQueue<LoadedFile>& output,
+	unsigned depth, size_t largeFile)
+	: input_(input), output_(output), depth_(std::max(1u, depth)), largeFile_(largeFile),
+	  backend_(defaultBackend())
+{
+}
+
+FileBuffer AsyncReader::takeBuffer(size_t minCapacity)
+{
+	FileBuffer buffer;
+	{
+		std::lock_guard<std::mutex> lock(poolMutex_);
+		auto it = std::find_if(pool_.begin(), pool_.end(),
+			[minCapacity](const FileBuffer& b) { return b.capacity >= minCapacity; });
+		if (it == pool_.end() && !pool_.empty()) {
+			it = pool_.end() - 1; // grown below
+		}
+		if (it != pool_.end()) {
+			buffer = std::move(*it);
+			pool_.erase(it);
+		}
+	}
+	buffer.size = 0;
+	buffer.reserve(minCapacity, 0);
+	return buffer;
+}
+
+void AsyncReader::recycle(LoadedFile& file)
+{
+	file.loaded = false;
+	if (file.buffer.capacity == 0) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(poolMutex_);
+	if (pool_.size() < 2 * static_cast<size_t>(depth_)) {
+		pool_.push_back(std::move(file.buffer));
+	}
+	file.buffer = FileBuffer{};
+}
+
+void AsyncReader::run()
+{
+#ifdef _WIN32
+	if (runIocp()) {
+		return;
+	}
+#elif defined(DIRSCAN_HAVE_IO_URING)
+	if (runIoUring()) {
+		return;
+	}
+#endif
+	backend_ = "threads";
+	runThreads();
+}
+
+void AsyncReader::runThreads()
+{
+	StageProfile* profile = StageProfile::current();
+	std::vector<std::thread> threads;
+	threads.reserve(depth_);
+	for (unsigned t = 0; t < depth_; ++t) {
+		threads.emplace_back([this, profile, t]() {
+			ProfileScope scope(profile, "reader", static_cast<int>(t));
+			PathRef path;
+			std::string error;
+			while (input_.pop(path)) {
+				LoadedFile file;
+				file.path = std::move(path);
+				file.buffer = takeBuffer(0);
+				file.loaded = readWholeFile(file.path.c_str(), file.buffer, largeFile_, error) == ReadStatus::Read;
+				if (!file.loaded) {
+					recycle(file);
+				}
+				output_.push(std::move(file));
+			}
+			});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+#if !defined(_WIN32) && defined(DIRSCAN_HAVE_IO_URING)
+
+bool AsyncReader::runIoUring()
+{
+	// A file is opened and stat'ed by path at the same time, so sizing its
+	// buffer never blocks the ring: up to two entries per slot
+	IoUring ring;
+	if (!ring.init(2 * depth_)) {
+		return false;
+	}
+
+	enum class Stage { Opening, Reading };
+	constexpr uint64_t kStatTag = uint64_t(1) << 32; // user_data of a STATX, above the slot index
+	constexpr size_t kUnsizedBuffer = 64 * 1024;      // first buffer for a file statx could not size
+	struct Slot {
+		LoadedFile file;
+		Stage stage = Stage::Opening;
+		unsigned opening = 0; // open and statx not completed yet
+		int fd = -1;
+		bool sized = false;  // statx succeeded
+		size_t expected = 0; // size reported by statx
+		struct statx stx;
+	};
+	std::vector<Slot> slots(depth_);
+	std::vector<unsigned> freeSlots;
+	for (unsigned i = depth_; i-- > 0;) {
+		freeSlots.push_back(i);
+	}
+	unsigned inFlight = 0;
+
+	auto finish = [&](unsigned index, bool loaded) {
+		Slot& slot = slots[index];
+		if (slot.fd >= 0) {
+			::close(slot.fd);
+			slot.fd = -1;
+		}
+		slot.file.loaded = loaded;
+		if (!loaded) {
+			recycle(slot.file); // the matcher opens it again and reports the error
+		}
+		output_.push(std::move(slot.file));
+		slot.file = LoadedFile{};
+		freeSlots.push_back(index);
+	};
+	auto submitRead = [&](unsigned index) {
+		Slot& slot = slots[index];
+		FileBuffer& buffer = slot.file.buffer;
+		if (buffer.size == buffer.capacity) {
+			buffer.reserve(buffer.capacity * 2, buffer.size);
+		}
+		io_uring_sqe& sqe = ring.nextSqe();
+		sqe.opcode = IORING_OP_READ;
+		sqe.fd = slot.fd;
+		sqe.addr = reinterpret_cast<uint64_t>(buffer.data.get() + buffer.size);
+		sqe.len = static_cast<uint32_t>(std::min<size_t>(buffer.capacity - buffer.size, 1u << 30));
+		sqe.off = buffer.size;
+		sqe.user_data = index;
+		slot.stage = Stage::Reading;
+		++inFlight;
+	};
+	auto start = [&](PathRef&& path) {
+		unsigned index = freeSlots.back();
+		freeSlots.pop_back();
+		Slot& slot = slots[index];
+		slot.file.path = std::move(path);
+		slot.stage = Stage::Opening;
+		slot.opening = 2;
+		slot.sized = false;
+		io_uring_sqe& open = ring.nextSqe();
+		open.opcode = IORING_OP_OPENAT;
+		open.fd = AT_FDCWD;
+		open.addr = reinterpret_cast<uint64_t>(slot.file.path.c_str());
+		open.open_flags = O_RDONLY | O_CLOEXEC;
+		open.user_data = index;
+		io_uring_sqe& stat = ring.nextSqe();
+		stat.opcode = IORING_OP_STATX;
+		stat.fd = AT_FDCWD;
+		stat.addr = reinterpret_cast<uint64_t>(slot.file.path.c_str());
+		stat.len = STATX_SIZE;
+		stat.off = reinterpret_cast<uint64_t>(&slot.stx); // the statx buffer
+		stat.user_data = kStatTag | index;
+		inFlight += 2;
+	};
+	auto complete = [&](uint64_t userData, int res) {
+		const unsigned index = static_cast<unsigned>(userData & (kStatTag - 1));
+		Slot& slot = slots[index];
+		--inFlight;
+		if (slot.stage == Stage::Opening) {
+			if ((userData & kStatTag) != 0) {
+				slot.sized = res == 0 && (slot.stx.stx_mask & STATX_SIZE) != 0;
+				slot.expected = slot.sized ? static_cast<size_t>(slot.stx.stx_size) : 0;
+			}
+			else if (res >= 0) {
+				slot.fd = res;
+			}
+			if (--slot.opening > 0) {
+				return; // the other one is still running, and may write to the slot
+			}
+			if (slot.fd < 0) {
+				finish(index, false);
+				return;
+			}
+			if (slot.expected >= largeFile_ && slot.expected > 0) {
+				finish(index, false); // mapped by the matcher
+				return;
+			}
+			// Without a size, the buffer grows as the reads fill it
+			slot.file.buffer = takeBuffer(slot.sized ? slot.expected + 1 : kUnsizedBuffer);
+			submitRead(index);
+			return;
+		}
+		if (res == -EINTR || res == -EAGAIN) {
+			submitRead(index);
+		}
+		else if (res < 0) {
+			finish(index, false);
+		}
+		else if (res == 0) {
+			finish(index, true);
+		}
+		else {
+			FileBuffer& buffer = slot.file.buffer;
+			buffer.size += static_cast<size_t>(res);
+			// A short read at the reported size is EOF; otherwise keep reading.
+			if (slot.sized && buffer.size >= slot.expected && buffer.size < buffer.capacity) {
+				finish(index, true);
+			}
+			else {
+				submitRead(index);
+			}
+		}
+	};
+
+	while (true) {
+		PathRef path;
+		while (!freeSlots.empty() && input_.tryPop(path)) {
+			start(std::move(path));
+		}
+		if (inFlight == 0) {
+			if (!input_.pop(path)) {
+				break; // finished and drained
+			}
+			start(std::move(path));
+		}
+		if (!ring.submitAndWait()) {
+			// The ring is unusable. Its buffers may still be written by the
+			// kernel, so they are abandoned; the matchers reread those files.
+			for (unsigned index = 0; index < slots.size(); ++index) {
+				if (!slots[index].file.path.empty()) {
+					slots[index].file.buffer.data.release();
+					slots[index].file.buffer = FileBuffer{};
+					finish(index, false);
+				}
+			}
+			runThreads();
+			return true;
+		}
+		ring.reap(complete);
+	}
+	return true;
+}
+
+#else
+
+bool AsyncReader::runIoUring()
+{
+	return false;
+}
+
+#endif
+
+#ifdef _WIN32
+
+bool AsyncReader::runIocp()
+{
+	HANDLE port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+	if (port == nullptr) {
+		return false;
+	}
+
+	struct Slot {
+		OVERLAPPED overlapped;
+		LoadedFile file;
+		HANDLE handle = INVALID_HANDLE_VALUE;
+		size_t expected = 0;
+	};
+	std::vector<Slot> slots(depth_); // never resized: the kernel holds &overlapped
+	std::vector<unsigned> freeSlots;
+	for (unsigned i = depth_; i-- > 0;) {
+		freeSlots.push_back(i);
+	}
+	unsigned inFlight = 0;
+
+	auto finish = [&](unsigned index, bool loaded) {
+		Slot& slot = slots[index];
+		if (slot.handle != INVALID_HANDLE_VALUE) {
+			CloseHandle(slot.handle);
+			slot.handle = INVALID_HANDLE_VALUE;
+		}
+		slot.file.loaded = loaded;
+		if (!loaded) {
+			recycle(slot.file);
+		}
+		output_.push(std::move(slot.file));
+		slot.file = LoadedFile{};
+		freeSlots.push_back(index);
+	};
+	auto issueRead = [&](unsigned index) {
+		Slot& slot = slots[index];
+		FileBuffer& buffer = slot.file.buffer;
+		if (buffer.size == buffer.capacity) {
+			buffer.reserve(buffer.capacity * 2, buffer.size);
+		}
+		std::memset(&slot.overlapped, 0, sizeof(slot.overlapped));
+		slot.overlapped.Offset = static_cast<DWORD>(buffer.size & 0xFFFFFFFFu);
+		slot.overlapped.OffsetHigh = static_cast<DWORD>(static_cast<uint64_t>(buffer.size) >> 32);
+		DWORD chunk = static_cast<DWORD>(std::min<size_t>(buffer.capacity - buffer.size, 1u << 30));
+		// Completion packets are queued for synchronous successes as well.
+		if (ReadFile(slot.handle, buffer.data.get() + buffer.size, chunk, nullptr, &slot.overlapped)
+			|| GetLastError() == ERROR_IO_PENDING) {
+			++inFlight;
+			return;
+		}
+		finish(index, GetLastError() == ERROR_HANDLE_EOF);
+	};
+	auto start = [&](PathRef&& path) {
+		unsigned index = freeSlots.back();
+		freeSlots.pop_back();
+		Slot& slot = slots[index];
+		slot.file.path = std::move(path);
+		slot.handle = CreateFileW(slot.file.path.c_str(), GENERIC_READ,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+			OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		LARGE_INTEGER size;
+		if (slot.handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(slot.handle, &size)
+			|| CreateIoCompletionPort(slot.handle, port, index, 0) == nullptr) {
+			finish(index, false);
+			return;
+		}
+		slot.expected = static_cast<size_t>(size.QuadPart);
+		if (slot.expected >= largeFile_ && slot.expected > 0) {
+			finish(index, false); // mapped by the matcher
+			return;
+		}
+		slot.file.buffer = takeBuffer(slot.expected + 1);
+		issueRead(index);
+	};
+
+	while (true) {
+		PathRef path;
+		while (!freeSlots.empty() && input_.tryPop(path)) {
+			start(std::move(path));
+		}
+		if (inFlight == 0) {
+			if (!freeSlots.empty() && input_.pop(path)) {
+				start(std::move(path));
+				continue; // the open may have finished without a read in flight
+			}
+			break;
+		}
+
+		DWORD bytes = 0;
+		ULONG_PTR key = 0;
+		OVERLAPPED* overlapped = nullptr;
+		BOOL ok = GetQueuedCompletionStatus(port, &bytes, &key, &overlapped, INFINITE);
+		if (overlapped == nullptr) {
+			break; // the port itself failed
+		}
+		const unsigned index = static_cast<unsigned>(key);
+		--inFlight;
+		FileBuffer& buffer = slots[index].file.buffer;
+		if (!ok) {
+			finish(index, GetLastError() == ERROR_HANDLE_EOF);
+		}
+		else if (bytes == 0) {
+			finish(index, true);
+		}
+		else {
+			buffer.size += bytes;
+			if (buffer.size >= slots[index].expected && buffer.size < buffer.capacity) {
+				finish(index, true);
+			}
+			else {
+				issueRead(index);
+			}
+		}
+	}
+	CloseHandle(port);
+	return true;
+}
+
+#else
+
+bool AsyncReader::runIocp()
+{
+	return false;
+}
+
+#endif
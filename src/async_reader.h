@@ -0,0 +1,78 @@
+#ifndef ASYNC_READER_H
+#define ASYNC_READER_H
+
+#include <cstddef>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "bounded_file_queue.h"
+#include "file_reader.h"
+
+/**
+ * @brief A file handed from the read stage to a matcher thread.
+ *        If 'loaded' is false the contents were not read (the file is large
+ *        enough to be mapped, or the read failed) and the matcher opens the
+ *        file itself, which also reports any error.
+ */
+struct LoadedFile {
+    PathRef path;      // NUL-terminated native path, see path_arena.h
+    FileBuffer buffer;
+    bool loaded = false;
+};
+
+/**
+ * @brief Read stage that keeps many file reads in flight, so a small pool of
+ *        matcher threads is not left waiting on high-latency storage.
+ *
+ * Paths are taken from 'input' and loaded files pushed to 'output'. Backends:
+ *   - io_uring on Linux (raw syscalls, no liburing needed): one thread drives
+ *     up to 'depth' open+read operations at a time;
+ *   - overlapped I/O with a completion port on Windows: likewise;
+ *   - elsewhere, or if the kernel refuses a ring: 'depth' threads doing
+ *     blocking reads.
+ * Files of at least 'largeFile' bytes are passed through unread, since
+ * mapping them is cheaper than copying. Buffers come from a pool that the
+ * matcher threads refill through recycle().
+ */
+class AsyncReader {
+public:
+    AsyncReader(BoundedFileQueue& input, BoundedQueue<LoadedFile>& output,
+                unsigned depth, size_t largeFile = FileReader::kDefaultMmapThreshold);
+
+    AsyncReader(const AsyncReader&) = delete;
+    AsyncReader& operator=(const AsyncReader&) = delete;
+
+    /**
+     * @brief Loads files until 'input' is finished and drained. Does not
+     *        finish 'output'; the caller does once run() returns.
+     */
+    void run();
+
+    /**
+     * @brief Returns a consumed file's buffer to the pool. Thread-safe.
+     */
+    void recycle(LoadedFile& file);
+
+    /**
+     * @brief The backend run() used (or will try first): "io_uring", "iocp" or "threads".
+     */
+    const char* backendName() const { return backend_; }
+
+private:
+    FileBuffer takeBuffer(size_t minCapacity);
+    void runThreads();
+    bool runIoUring();
+    bool runIocp();
+
+    BoundedFileQueue& input_;
+    BoundedQueue<LoadedFile>& output_;
+    unsigned depth_;
+    size_t largeFile_;
+    const char* backend_;
+
+    std::mutex poolMutex_;
+    std::vector<FileBuffer> pool_;
+};
+
+#endif // ASYNC_READER_H
@@ -1,91 +1,316 @@
-#include <queue>
-#include <mutex>
-#include <condition_variable>
-#include <filesystem>
+#ifndef BOUNDED_FILE_QUEUE_H
+#define BOUNDED_FILE_QUEUE_H
+
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "path_arena.h"
+#include "stage_timer.h"
 
-class BoundedFileQueue {
+// Bounded lock-free multi-producer/multi-consumer ring (Vyukov's
+// sequence-number design), used for file paths and for loaded files. Each cell carries a sequence number that
+// says whether it is free for the producer at 'pos' or full for the consumer
+// at 'pos'; producers and consumers only contend on their own position counter.
+// Threads that find the ring full/empty spin briefly and then sleep on an
+// atomic epoch, which is only notified when someone is actually waiting.
+template <typename T>
+class BoundedQueue {
 public:
     // Constructor sets the maximum size of the queue (number of file paths to hold).
-    explicit BoundedFileQueue(size_t maxSize)
-        : maxSize_(maxSize), finished_(false) {}
+    // The capacity is rounded up to a power of two.
+    explicit BoundedQueue(size_t maxSize)
+        : capacity_(roundUpToPowerOfTwo(maxSize)),
+          mask_(capacity_ - 1),
+          cells_(new Cell[capacity_])
+    {
+        for (size_t i = 0; i < capacity_; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
 
-    // Producer: push a path into the queue if there's room, or wait until there is.
-    void push(const std::filesystem::path& path) {
-        std::unique_lock<std::mutex> lock(mutex_);
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // Producer: push an item into the queue if there's room, or wait until there is.
+    // Once finished, further items are dropped.
+    void push(const T& item) {
+        T copy(item);
+        push(std::move(copy));
+    }
 
-        // Wait until there's space or we're finished
-        condProducer_.wait(lock, [this]() {
-            return queue_.size() < maxSize_ || finished_;
+    void push(T&& item) {
+        StageTimer timer(Stage::QueuePush);
+        waitUntil(popEpoch_, waitingProducers_, [&]() {
+            return finished_.load(std::memory_order_acquire) || tryPushRange(&item, 1) == 1;
         });
+        wake(pushEpoch_, waitingConsumers_, false);
+    }
 
-        if (finished_) {
-            // If finished_ is set, we don't enqueue further items
-            return;
+    // Producer: pushes 'item' if there is room right now, without waiting.
+    // Returns false, leaving 'item' as it was, if the queue is full or finished.
+    bool tryPush(T&& item) {
+        if (finished_.load(std::memory_order_acquire) || tryPushRange(&item, 1) != 1) {
+            return false;
         }
-
-        queue_.push(path);
-
-        // Notify a consumer that there is now at least one item
-        condConsumer_.notify_one();
+        wake(pushEpoch_, waitingConsumers_, false);
+        return true;
     }
 
-    // Consumer: pop a path from the queue if available, or wait until there's one.
-    // Returns false if the queue is empty *and* the queue is finished (no more items).
-    bool pop(std::filesystem::path& path) {
-        std::unique_lock<std::mutex> lock(mutex_);
+    // Producer: moves all of 'items' into the queue, claiming as many consecutive
+    // cells per atomic operation as are free. Clears 'items'.
+    // Returns how many were enqueued (fewer only if the queue was finished).
+    size_t pushBatch(std::vector<T>& items) {
+        StageTimer timer(Stage::QueuePush);
+        size_t done = 0;
+        while (done < items.size()) {
+            waitUntil(popEpoch_, waitingProducers_, [&]() {
+                if (finished_.load(std::memory_order_acquire)) {
+                    return true;
+                }
+                size_t n = tryPushRange(items.data() + done, items.size() - done);
+                done += n;
+                return n > 0;
+            });
+            if (finished_.load(std::memory_order_acquire)) {
+                break;
+            }
+            wake(pushEpoch_, waitingConsumers_, true);
+        }
+        items.clear();
+        return done;
+    }
 
-        // Wait until we have something to pop or we are finished
-        condConsumer_.wait(lock, [this]() {
-            return !queue_.empty() || finished_;
+    // Consumer: pop an item from the queue if available, or wait until there's one.
+    // Returns false if the queue is empty *and* the queue is finished (no more items),
+    // or as soon as it is cancelled.
+    bool pop(T& item) {
+        StageTimer timer(Stage::QueuePop);
+        bool got = false;
+        waitUntil(pushEpoch_, waitingConsumers_, [&]() {
+            got = !isCancelled() && tryPopRange(&item, 1) == 1;
+            return got || isDrained();
         });
+        if (got) {
+            wake(popEpoch_, waitingProducers_, false);
+        }
+        return got;
+    }
 
-        // If empty and finished, no more items will ever arrive
-        if (queue_.empty()) {
+    // Consumer: pops one item if one is ready, without waiting.
+    bool tryPop(T& item) {
+        if (isCancelled() || tryPopRange(&item, 1) != 1) {
             return false;
         }
-
-        path = queue_.front();
-        queue_.pop();
-
-        // Notify the producer that there is space now
-        condProducer_.notify_one();
+        wake(popEpoch_, waitingProducers_, false);
         return true;
     }
 
+    // Consumer: pops up to 'maxItems' items into 'out' (replacing its contents),
+    // waiting for at least one. Returns 0 once the queue is finished and drained,
+    // or cancelled.
+    size_t popBatch(std::vector<T>& out, size_t maxItems) {
+        StageTimer timer(Stage::QueuePop);
+        out.resize(maxItems);
+        size_t got = 0;
+        waitUntil(pushEpoch_, waitingConsumers_, [&]() {
+            got = isCancelled() ? 0 : tryPopRange(out.data(), maxItems);
+            return got > 0 || isDrained();
+        });
+        out.resize(got);
+        if (got > 0) {
+            wake(popEpoch_, waitingProducers_, true);
+        }
+        return got;
+    }
+
     // Signals no more items will be produced
     void setFinished() {
-        std::lock_guard<std::mutex> lock(mutex_);
-        finished_ = true;
+        finished_.store(true, std::memory_order_seq_cst);
 
         // Wake up any waiting producer and consumer
-        condProducer_.notify_all();
-        condConsumer_.notify_all();
+        wake(pushEpoch_, waitingConsumers_, true);
+        wake(popEpoch_, waitingProducers_, true);
+    }
+
+    // Stops the queue early: like setFinished(), and every pop fails from now
+    // on even if items are left (they are freed with the queue). Used to end
+    // a scan once its result limit is reached. Safe from any thread.
+    void cancel() {
+        cancelled_.store(true, std::memory_order_seq_cst);
+        setFinished();
     }
 
-    bool isFinished() 
+    bool isCancelled() const
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return finished_;
+        return cancelled_.load(std::memory_order_acquire);
     }
 
-    bool isEmpty() 
+    bool isFinished() const
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return queue_.empty();
+        return finished_.load(std::memory_order_acquire);
     }
 
+    bool isEmpty() const
+    {
+        return size() == 0;
+    }
 
+    // True once the queue is finished and every item was popped, or it was cancelled.
+    bool isDrained() const
+    {
+        return isCancelled() || (finished_.load(std::memory_order_acquire) && isEmpty());
+    }
 
+    // Approximate number of queued items (exact when no push/pop is in flight).
+    size_t size() const
+    {
+        size_t tail = enqueuePos_.load(std::memory_order_acquire);
+        size_t head = dequeuePos_.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
 
+private:
+    struct alignas(64) Cell {
+        std::atomic<size_t> sequence{ 0 };
+        T value;
+    };
 
+    static size_t roundUpToPowerOfTwo(size_t n) {
+        size_t capacity = 2;
+        while (capacity < n) {
+            capacity <<= 1;
+        }
+        return capacity;
+    }
 
-private:
-    std::queue<std::filesystem::path> queue_;
-    std::mutex mutex_;
-    std::condition_variable condProducer_;
-    std::condition_variable condConsumer_;
-    const size_t maxSize_;
+    // Claims up to 'count' consecutive free cells with one CAS and fills them.
+    size_t tryPushRange(T* items, size_t count) {
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        size_t n = 0;
+        while (true) {
+            n = 0;
+            while (n < count && n < capacity_) {
+                size_t seq = cells_[(pos + n) & mask_].sequence.load(std::memory_order_acquire);
+                if (seq != pos + n) {
+                    break;
+                }
+                ++n;
+            }
+            if (n == 0) {
+                size_t seq = cells_[pos & mask_].sequence.load(std::memory_order_acquire);
+                if (static_cast<std::ptrdiff_t>(seq - pos) < 0) {
+                    return 0; // full
+                }
+                pos = enqueuePos_.load(std::memory_order_relaxed); // lost a race, retry
+                continue;
+            }
+            if (enqueuePos_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            Cell& cell = cells_[(pos + i) & mask_];
+            cell.value = std::move(items[i]);
+            cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return n;
+    }
+
+    // Claims up to 'count' consecutive full cells with one CAS and empties them.
+    size_t tryPopRange(T* out, size_t count) {
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        size_t n = 0;
+        while (true) {
+            n = 0;
+            while (n < count && n < capacity_) {
+                size_t seq = cells_[(pos + n) & mask_].sequence.load(std::memory_order_acquire);
+                if (seq != pos + n + 1) {
+                    break;
+                }
+                ++n;
+            }
+            if (n == 0) {
+                size_t seq = cells_[pos & mask_].sequence.load(std::memory_order_acquire);
+                if (static_cast<std::ptrdiff_t>(seq - (pos + 1)) < 0) {
+                    return 0; // empty
+                }
+                pos = dequeuePos_.load(std::memory_order_relaxed); // lost a race, retry
+                continue;
+            }
+            if (dequeuePos_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            Cell& cell = cells_[(pos + i) & mask_];
+            out[i] = std::move(cell.value);
+            cell.value = T();
+            cell.sequence.store(pos + i + capacity_, std::memory_order_release);
+        }
+        return n;
+    }
 
-    bool finished_;
+    // Runs 'attempt' until it succeeds: a short spin first, then sleeping on
+    // 'epoch' until the other side bumps it.
+    template <typename Attempt>
+    static void waitUntil(std::atomic<uint32_t>& epoch, std::atomic<int>& waiters, Attempt&& attempt) {
+        for (int spin = 0; spin < 64; ++spin) {
+            if (attempt()) {
+                return;
+            }
+            if (spin >= 16) {
+                std::this_thread::yield();
+            }
+        }
+        while (true) {
+            uint32_t seen = epoch.load(std::memory_order_acquire);
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // Re-check after announcing ourselves, so a concurrent wake() cannot be missed.
+            if (attempt()) {
+                waiters.fetch_sub(1, std::memory_order_relaxed);
+                return;
+            }
+            epoch.wait(seen, std::memory_order_acquire);
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Bumps 'epoch' and wakes sleepers, but only if anyone is waiting on it.
+    static void wake(std::atomic<uint32_t>& epoch, std::atomic<int>& waiters, bool all) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        epoch.fetch_add(1, std::memory_order_release);
+        if (all) {
+            epoch.notify_all();
+        }
+        else {
+            epoch.notify_one();
+        }
+    }
+
+    const size_t capacity_;
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+
+    alignas(64) std::atomic<size_t> enqueuePos_{ 0 };
+    alignas(64) std::atomic<size_t> dequeuePos_{ 0 };
+    alignas(64) std::atomic<bool> finished_{ false };
+    std::atomic<bool> cancelled_{ false };
+
+    std::atomic<uint32_t> pushEpoch_{ 0 };     // bumped after pushes, consumers sleep on it
+    std::atomic<uint32_t> popEpoch_{ 0 };      // bumped after pops, producers sleep on it
+    std::atomic<int> waitingConsumers_{ 0 };
+    std::atomic<int> waitingProducers_{ 0 };
 };
+
+// Paths live in the walkers' PathArena slabs; see path_arena.h.
+using BoundedFileQueue = BoundedQueue<PathRef>;
+
+#endif // BOUNDED_FILE_QUEUE_H
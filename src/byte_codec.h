@@ -0,0 +1,83 @@
+#ifndef BYTE_CODEC_H
+#define BYTE_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Little-endian encoding helpers for the on-disk index and cache files.
+
+inline void putU32(std::string& out, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+}
+
+inline void putU64(std::string& out, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+}
+
+// A u32 length followed by the bytes.
+inline void putBytes(std::string& out, std::string_view bytes)
+{
+    putU32(out, static_cast<uint32_t>(bytes.size()));
+    out.append(bytes);
+}
+
+inline void putVarint(std::string& out, uint32_t v)
+{
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+/**
+ * @brief Bounds-checked reads over a loaded file; 'ok' turns false on the
+ *        first overrun and every later read returns zero/empty.
+ */
+struct ByteCursor {
+    std::string_view data;
+    size_t pos = 0;
+    bool ok = true;
+
+    uint64_t unsignedOf(size_t width)
+    {
+        if (!ok || data.size() - pos < width) {
+            ok = false;
+            return 0;
+        }
+        uint64_t v = 0;
+        for (size_t i = 0; i < width; ++i) {
+            v |= static_cast<uint64_t>(static_cast<unsigned char>(data[pos + i])) << (8 * i);
+        }
+        pos += width;
+        return v;
+    }
+    uint32_t u32() { return static_cast<uint32_t>(unsignedOf(4)); }
+    uint64_t u64() { return unsignedOf(8); }
+
+    std::string_view bytes(uint64_t n)
+    {
+        if (!ok || data.size() - pos < n) {
+            ok = false;
+            return {};
+        }
+        std::string_view v = data.substr(pos, static_cast<size_t>(n));
+        pos += static_cast<size_t>(n);
+        return v;
+    }
+
+    // Reads what putBytes() wrote.
+    std::string_view sized() { return bytes(u32()); }
+
+    bool atEnd() const { return ok && pos == data.size(); }
+};
+
+#endif // BYTE_CODEC_H
@@ -0,0 +1,269 @@
+#include "case_fold.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+// Upper- or titlecase letters first, first+stride, ... last, each mapping to
+// its lowercase form at +delta (Unicode simple case folding, CaseFolding.txt).
+struct CaseRange {
+	uint32_t first;
+	uint32_t last;
+	uint32_t stride;
+	int32_t delta;
+};
+
+constexpr CaseRange kCaseRanges[] = {
+	{ 0x41, 0x5A, 1, 32 },       // Basic Latin
+	{ 0xC0, 0xD6, 1, 32 },       // Latin-1
+	{ 0xD8, 0xDE, 1, 32 },
+	{ 0x100, 0x12E, 2, 1 },      // Latin Extended-A
+	{ 0x132, 0x136, 2, 1 },
+	{ 0x139, 0x147, 2, 1 },
+	{ 0x14A, 0x176, 2, 1 },
+	{ 0x178, 0x178, 1, -121 },
+	{ 0x179, 0x17D, 2, 1 },
+	{ 0x182, 0x184, 2, 1 },      // Latin Extended-B
+	{ 0x187, 0x187, 1, 1 },
+	{ 0x18B, 0x18B, 1, 1 },
+	{ 0x191, 0x191, 1, 1 },
+	{ 0x198, 0x198, 1, 1 },
+	{ 0x1A0, 0x1A4, 2, 1 },
+	{ 0x1A7, 0x1A7, 1, 1 },
+	{ 0x1AC, 0x1AC, 1, 1 },
+	{ 0x1AF, 0x1AF, 1, 1 },
+	{ 0x1B3, 0x1B5, 2, 1 },
+	{ 0x1B8, 0x1B8, 1, 1 },
+	{ 0x1BC, 0x1BC, 1, 1 },
+	{ 0x1C4, 0x1C4, 1, 2 },      // DZ with caron: upper, title and lower case
+	{ 0x1C5, 0x1C5, 1, 1 },
+	{ 0x1C7, 0x1C7, 1, 2 },
+	{ 0x1C8, 0x1C8, 1, 1 },
+	{ 0x1CA, 0x1CA, 1, 2 },
+	{ 0x1CB, 0x1DB, 2, 1 },
+	{ 0x1DE, 0x1EE, 2, 1 },
+	{ 0x1F1, 0x1F1, 1, 2 },
+	{ 0x1F2, 0x1F4, 2, 1 },
+	{ 0x1F8, 0x21E, 2, 1 },
+	{ 0x222, 0x232, 2, 1 },
+	{ 0x386, 0x386, 1, 38 },     // Greek
+	{ 0x388, 0x38A, 1, 37 },
+	{ 0x38C, 0x38C, 1, 64 },
+	{ 0x38E, 0x38F, 1, 63 },
+	{ 0x391, 0x3A1, 1, 32 },
+	{ 0x3A3, 0x3AB, 1, 32 },
+	{ 0x3D8, 0x3EE, 2, 1 },
+	{ 0x3F4, 0x3F4, 1, -60 },
+	{ 0x400, 0x40F, 1, 80 },     // Cyrillic
+	{ 0x410, 0x42F, 1, 32 },
+	{ 0x460, 0x480, 2, 1 },
+	{ 0x48A, 0x4BE, 2, 1 },
+	{ 0x4C0, 0x4C0, 1, 15 },
+	{ 0x4C1, 0x4CD, 2, 1 },
+	{ 0x4D0, 0x52E, 2, 1 },
+	{ 0x531, 0x556, 1, 48 },     // Armenian
+	{ 0x10A0, 0x10C5, 1, 7264 }, // Georgian
+	{ 0x1E00, 0x1E94, 2, 1 },    // Latin Extended Additional
+	{ 0x1E9E, 0x1E9E, 1, -7615 },
+	{ 0x1EA0, 0x1EFE, 2, 1 },
+	{ 0x2126, 0x2126, 1, -7517 }, // Ohm, Kelvin and Angstrom signs
+	{ 0x212A, 0x212A, 1, -8383 },
+	{ 0x212B, 0x212B, 1, -8262 },
+	{ 0x2160, 0x216F, 1, 16 },   // Roman numerals
+	{ 0x24B6, 0x24CF, 1, 26 },   // Circled letters
+	{ 0x2C00, 0x2C2F, 1, 48 },   // Glagolitic
+	{ 0xFF21, 0xFF3A, 1, 32 },   // Fullwidth Latin
+	{ 0x10400, 0x10427, 1, 40 }, // Deseret
+};
+
+// Letters with more than two case forms; any one of them stands for all
+constexpr uint32_t kCaseOrbits[][kMaxCaseForms] = {
+	{ 0x4B, 0x6B, 0x212A },      // K k, Kelvin sign
+	{ 0x53, 0x73, 0x17F },       // S s, long s
+	{ 0xC5, 0xE5, 0x212B },      // A with ring, Angstrom sign
+	{ 0xB5, 0x39C, 0x3BC },      // micro sign, Greek mu
+	{ 0x1C4, 0x1C5, 0x1C6 },
+	{ 0x1C7, 0x1C8, 0x1C9 },
+	{ 0x1CA, 0x1CB, 0x1CC },
+	{ 0x1F1, 0x1F2, 0x1F3 },
+	{ 0x392, 0x3B2, 0x3D0 },     // beta, beta symbol
+	{ 0x395, 0x3B5, 0x3F5 },     // epsilon, lunate epsilon
+	{ 0x398, 0x3B8, 0x3D1, 0x3F4 }, // theta, theta symbols
+	{ 0x399, 0x3B9, 0x345, 0x1FBE }, // iota, ypogegrammeni
+	{ 0x39A, 0x3BA, 0x3F0 },     // kappa, kappa symbol
+	{ 0x3A0, 0x3C0, 0x3D6 },     // pi, pi symbol
+	{ 0x3A1, 0x3C1, 0x3F1 },     // rho, rho symbol
+	{ 0x3A3, 0x3C2, 0x3C3 },     // sigma, final sigma
+	{ 0x3A6, 0x3C6, 0x3D5 },     // phi, phi symbol
+	{ 0x3A9, 0x3C9, 0x2126 },    // omega, Ohm sign
+	{ 0x1E60, 0x1E61, 0x1E9B },  // s with dot above, long s with dot
+};
+
+const CaseRange* upperRange(uint32_t codePoint)
+{
+	for (const auto& range : kCaseRanges) {
+		if (codePoint >= range.first && codePoint <= range.last && (codePoint - range.first) % range.stride == 0) {
+			return &range;
+		}
+	}
+	return nullptr;
+}
+
+uint32_t toLower(uint32_t codePoint)
+{
+	const CaseRange* range = upperRange(codePoint);
+	return range ? static_cast<uint32_t>(static_cast<int32_t>(codePoint) + range->delta) : codePoint;
+}
+
+uint32_t toUpper(uint32_t codePoint)
+{
+	for (const auto& range : kCaseRanges) {
+		const uint32_t upper = static_cast<uint32_t>(static_cast<int32_t>(codePoint) - range.delta);
+		if (upper >= range.first && upper <= range.last && (upper - range.first) % range.stride == 0) {
+			return upper;
+		}
+	}
+	return codePoint;
+}
+
+} // namespace
+
+uint32_t decodeUtf8(std::string_view text, size_t& pos)
+{
+	const auto byte = [&](size_t i) { return static_cast<unsigned char>(text[i]); };
+	const unsigned char lead = byte(pos);
+	size_t length = 0;
+	uint32_t codePoint = 0;
+	uint32_t minimum = 0;
+	if (lead < 0x80) {
+		++pos;
+		return lead;
+	}
+	if (lead >= 0xC2 && lead <= 0xDF) {
+		length = 2;
+		codePoint = lead & 0x1F;
+		minimum = 0x80;
+	}
+	else if (lead >= 0xE0 && lead <= 0xEF) {
+		length = 3;
+		codePoint = lead & 0x0F;
+		minimum = 0x800;
+	}
+	else if (lead >= 0xF0 && lead <= 0xF4) {
+		length = 4;
+		codePoint = lead & 0x07;
+		minimum = 0x10000;
+	}
+	if (length == 0 || pos + length > text.size()) {
+		++pos;
+		return kInvalidUtf8 | lead;
+	}
+	for (size_t i = 1; i < length; ++i) {
+		if ((byte(pos + i) & 0xC0) != 0x80) {
+			++pos;
+			return kInvalidUtf8 | lead;
+		}
+		codePoint = (codePoint << 6) | (byte(pos + i) & 0x3F);
+	}
+	if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+		++pos;
+		return kInvalidUtf8 | lead;
+	}
+	pos += length;
+	return codePoint;
+}
+
+void appendUtf8(uint32_t codePoint, std::string& out)
+{
+	if ((codePoint & kInvalidUtf8) != 0) {
+		out += static_cast<char>(codePoint & 0xFF);
+	}
+	else if (codePoint < 0x80) {
+		out += static_cast<char>(codePoint);
+	}
+	else if (codePoint < 0x800) {
+		out += static_cast<char>(0xC0 | (codePoint >> 6));
+		out += static_cast<char>(0x80 | (codePoint & 0x3F));
+	}
+	else if (codePoint < 0x10000) {
+		out += static_cast<char>(0xE0 | (codePoint >> 12));
+		out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+		out += static_cast<char>(0x80 | (codePoint & 0x3F));
+	}
+	else {
+		out += static_cast<char>(0xF0 | (codePoint >> 18));
+		out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+		out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+		out += static_cast<char>(0x80 | (codePoint & 0x3F));
+	}
+}
+
+size_t caseForms(uint32_t codePoint, uint32_t (&forms)[kMaxCaseForms])
+{
+	forms[0] = codePoint;
+	if ((codePoint & kInvalidUtf8) != 0) {
+		return 1;
+	}
+	for (const auto& orbit : kCaseOrbits) {
+		if (std::find(std::begin(orbit), std::end(orbit), codePoint) == std::end(orbit)) {
+			continue;
+		}
+		size_t count = 1;
+		for (uint32_t other : orbit) {
+			if (other != 0 && other != codePoint) {
+				forms[count++] = other;
+			}
+		}
+		return count;
+	}
+	uint32_t other = toLower(codePoint);
+	if (other == codePoint) {
+		other = toUpper(codePoint);
+	}
+	if (other == codePoint) {
+		return 1;
+	}
+	forms[1] = other;
+	return 2;
+}
+
+bool isUppercase(uint32_t codePoint)
+{
+	return (codePoint & kInvalidUtf8) == 0 && upperRange(codePoint) != nullptr;
+}
+
+CaseFolding literalFolding(std::string_view needle)
+{
+	uint32_t forms[kMaxCaseForms];
+	for (size_t pos = 0; pos < needle.size(); ) {
+		const uint32_t codePoint = decodeUtf8(needle, pos);
+		if (codePoint >= 0x80 && caseForms(codePoint, forms) > 1) {
+			return CaseFolding::Unicode;
+		}
+	}
+	return CaseFolding::Ascii;
+}
+
+bool hasUppercase(std::string_view pattern, bool isRegex)
+{
+	for (size_t pos = 0; pos < pattern.size(); ) {
+		if (isRegex && pattern[pos] == '\\' && pos + 1 < pattern.size()) {
+			// Skip the escape, and the braces or hex digits of \p{..}, \x{..}, \xHH
+			const char escape = pattern[pos + 1];
+			pos += 2;
+			if ((escape == 'p' || escape == 'P' || escape == 'x') && pos < pattern.size() && pattern[pos] == '{') {
+				const size_t close = pattern.find('}', pos);
+				pos = close == std::string_view::npos ? pattern.size() : close + 1;
+			}
+			else if (escape == 'x') {
+				pos = std::min(pos + 2, pattern.size());
+			}
+			continue;
+		}
+		if (isUppercase(decodeUtf8(pattern, pos))) {
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,63 @@
+#ifndef CASE_FOLD_H
+#define CASE_FOLD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief How a case-insensitive literal compares letters: only ASCII ones
+ *        (a byte-wise mask, vectorizable), or by Unicode simple case folding
+ *        of UTF-8 code points, which a needle needs once it has a non-ASCII
+ *        letter.
+ */
+enum class CaseFolding { None, Ascii, Unicode };
+
+/**
+ * @brief The folding a case-insensitive search for 'needle' needs: Ascii
+ *        unless it has a non-ASCII code point with other case forms.
+ */
+CaseFolding literalFolding(std::string_view needle);
+
+/**
+ * @brief Marks a byte that is not part of valid UTF-8; decodeUtf8() returns
+ *        kInvalidUtf8 | byte for it.
+ */
+constexpr uint32_t kInvalidUtf8 = 0x80000000u;
+
+/**
+ * @brief Decodes the code point at 'pos' and advances past it. Malformed,
+ *        overlong or truncated sequences yield one byte at a time.
+ */
+uint32_t decodeUtf8(std::string_view text, size_t& pos);
+
+/**
+ * @brief Appends the UTF-8 encoding of 'codePoint' (or the raw byte of a
+ *        kInvalidUtf8 value) to 'out'.
+ */
+void appendUtf8(uint32_t codePoint, std::string& out);
+
+constexpr size_t kMaxCaseForms = 4;
+
+/**
+ * @brief The code points equal to 'codePoint' under simple case folding,
+ *        itself first (e.g. k, K and the Kelvin sign), written to 'forms'.
+ *        Covers Latin, Greek, Cyrillic, Armenian, Georgian, Glagolitic,
+ *        fullwidth Latin and Deseret; other code points have no other forms.
+ * @return How many forms were written, 1 to kMaxCaseForms.
+ */
+size_t caseForms(uint32_t codePoint, uint32_t (&forms)[kMaxCaseForms]);
+
+/**
+ * @brief True if 'codePoint' is an upper- or titlecase letter.
+ */
+bool isUppercase(uint32_t codePoint);
+
+/**
+ * @brief For smart case: true if 'pattern' has an uppercase letter. In a
+ *        regex, escaped characters (\S, \W, \p{Lu}, ...) do not count.
+ */
+bool hasUppercase(std::string_view pattern, bool isRegex);
+
+#endif // CASE_FOLD_H
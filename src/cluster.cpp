@@ -0,0 +1,1027 @@
+#include "cluster.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <string_view>
+#include <thread>
+#include "byte_codec.h"
+#include "ignore_rules.h"
+#include "parallel_walker.h"
+#include "result_writer.h"
+#include "socket_channel.h"
+#include "stage_timer.h"
+#include "structured_output.h"
+
+// Frames of the agent protocol. The coordinator opens with Hello, which the
+// agent answers with Ready (or Refused, closing the connection, also when the
+// token is wrong: nothing else is read before it matches); after that
+// each List is answered with a Listing, and each Scan with any number of
+// Results, Progress and Error frames and a final Done. A List or Scan the
+// agent cannot serve is answered with Refused instead.
+//
+// Payloads (byte_codec.h encodings):
+//   Hello     magic, u32 version, token, scan options (see encodeOptions)
+//   List      path
+//   Scan      u32 unit, path, u8 depth limited, u32 max depth
+//   Ready     u8 the agent has an index of its root
+//   Listing   u8 has files, u32 count, count x name
+//   Results   Binary records (structured_output.h)
+//   Progress  u64 files scanned, u64 hits, current file
+//   Error     message
+//   Done      u32 unit, u64 files scanned, u64 hits
+//   Refused   message
+// Paths are relative to the agent's root, '/'-separated and UTF-8.
+
+namespace {
+
+namespace fs = std::filesystem;
+
+enum class Message : uint8_t {
+	Hello = 1,
+	List,
+	Scan,
+	Ready = 16,
+	Listing,
+	Results,
+	Progress,
+	Error,
+	Done,
+	Refused,
+};
+
+constexpr std::string_view kMagic = "dirscan-agent";
+constexpr uint32_t kProtocolVersion = 3;                // 3: Binary records carry each line's full length
+constexpr size_t kAnyAgent = SIZE_MAX;
+constexpr unsigned kMaxSplitDepth = 4;                  // deepest directory the coordinator lists
+constexpr size_t kResultFrameSize = 256 * 1024;         // agents send records in frames of about this size
+constexpr auto kProgressInterval = std::chrono::milliseconds(500);
+constexpr auto kHangUpCheck = std::chrono::milliseconds(50);   // how often a scanning agent looks for a closed connection
+
+bool send(Channel& channel, Message type, std::string_view payload = {})
+{
+	return channel.send(static_cast<uint8_t>(type), payload);
+}
+
+void putU8(std::string& out, uint8_t v)
+{
+	out.push_back(static_cast<char>(v));
+}
+
+uint8_t getU8(ByteCursor& in)
+{
+	return static_cast<uint8_t>(in.unsignedOf(1));
+}
+
+void putStrings(std::string& out, const std::vector<std::string>& strings)
+{
+	putU32(out, static_cast<uint32_t>(strings.size()));
+	for (const auto& s : strings) {
+		putBytes(out, s);
+	}
+}
+
+void getStrings(ByteCursor& in, std::vector<std::string>& strings)
+{
+	const uint32_t count = in.u32();
+	for (uint32_t i = 0; i < count && in.ok; ++i) {
+		strings.emplace_back(in.sized());
+	}
+}
+
+void putTime(std::string& out, const std::optional<std::chrono::system_clock::time_point>& time)
+{
+	putU8(out, time ? 1 : 0);
+	const auto nanos = time ? std::chrono::duration_cast<std::chrono::nanoseconds>(time->time_since_epoch()).count() : 0;
+	putU64(out, static_cast<uint64_t>(nanos));
+}
+
+void getTime(ByteCursor& in, std::optional<std::chrono::system_clock::time_point>& time)
+{
+	const bool present = getU8(in) != 0;
+	const auto nanos = std::chrono::nanoseconds(static_cast<int64_t>(in.u64()));
+	if (present) {
+		time = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(nanos));
+	}
+}
+
+// What an agent needs to reproduce the coordinator's scan: the query and the
+// filters. Threads, I/O depth, index and cache are the agent's own business.
+std::string encodeOptions(const ScanOptions& options)
+{
+	std::string out;
+	putBytes(out, options.query);
+	putU8(out, static_cast<uint8_t>((options.useRegex ? 1 : 0) | (options.ignoreCase ? 2 : 0)
+		| (options.smartCase ? 4 : 0) | (options.ignoreFiles ? 8 : 0) | (options.patternsIgnoreCase ? 16 : 0)
+		| (options.filesWithMatches ? 32 : 0) | (options.decompress ? 64 : 0) | (options.filePattern ? 128 : 0)));
+	putBytes(out, options.filePattern.value_or(""));
+	putStrings(out, options.patterns);
+	putStrings(out, options.includePatterns);
+	putStrings(out, options.excludePatterns);
+	putStrings(out, options.excludeDirPatterns);
+	putStrings(out, options.binaryPatterns);
+	putU64(out, options.maxFileSize);
+	putTime(out, options.modifiedAfter);
+	putTime(out, options.modifiedBefore);
+	putU64(out, options.maxCount);
+	putU64(out, options.maxFiles);
+	putU8(out, static_cast<uint8_t>(options.binaryFiles));
+	putU64(out, options.decompressLimit);
+	return out;
+}
+
+bool decodeOptions(ByteCursor& in, ScanOptions& options)
+{
+	options.query = in.sized();
+	const uint8_t flags = getU8(in);
+	options.useRegex = (flags & 1) != 0;
+	options.ignoreCase = (flags & 2) != 0;
+	options.smartCase = (flags & 4) != 0;
+	options.ignoreFiles = (flags & 8) != 0;
+	options.patternsIgnoreCase = (flags & 16) != 0;
+	options.filesWithMatches = (flags & 32) != 0;
+	options.decompress = (flags & 64) != 0;
+	const std::string_view filePattern = in.sized();
+	if ((flags & 128) != 0) {
+		options.filePattern = std::string(filePattern);
+	}
+	getStrings(in, options.patterns);
+	getStrings(in, options.includePatterns);
+	getStrings(in, options.excludePatterns);
+	getStrings(in, options.excludeDirPatterns);
+	getStrings(in, options.binaryPatterns);
+	options.maxFileSize = in.u64();
+	getTime(in, options.modifiedAfter);
+	getTime(in, options.modifiedBefore);
+	options.maxCount = static_cast<size_t>(in.u64());
+	options.maxFiles = static_cast<size_t>(in.u64());
+	const uint8_t binaryFiles = getU8(in);
+	options.decompressLimit = static_cast<size_t>(in.u64());
+	if (binaryFiles > static_cast<uint8_t>(BinaryFiles::Text)) {
+		return false;
+	}
+	options.binaryFiles = static_cast<BinaryFiles>(binaryFiles);
+	return in.atEnd();
+}
+
+// Compares in a time that depends on neither where the two differ nor the
+// length of the one given, so a peer cannot guess the token byte by byte
+bool sameToken(std::string_view given, std::string_view expected)
+{
+	unsigned char diff = given.size() == expected.size() ? 0 : 1;
+	for (size_t i = 0; i < expected.size(); ++i) {
+		diff |= static_cast<unsigned char>(expected[i] ^ (i < given.size() ? given[i] : 0));
+	}
+	return diff == 0;
+}
+
+std::string utf8Of(const fs::path& path)
+{
+	const auto u8 = path.generic_u8string();
+	return std::string(u8.begin(), u8.end());
+}
+
+fs::path pathOfUtf8(std::string_view text)
+{
+	return fs::path(std::u8string(text.begin(), text.end()));
+}
+
+std::string joinPath(const std::string& directory, std::string_view name)
+{
+	return directory.empty() ? std::string(name) : directory + "/" + std::string(name);
+}
+
+// Whether units can be scanned as trees of their own: globs with '/' and
+// ignore files are relative to the top of the scan, so they need it whole.
+bool canSplit(const ScanOptions& options)
+{
+	auto anchored = [](const std::vector<std::string>& patterns) {
+		return std::any_of(patterns.begin(), patterns.end(),
+			[](const std::string& pattern) { return pattern.find('/') != std::string::npos; });
+	};
+	return !options.ignoreFiles && !anchored(options.includePatterns) && !anchored(options.excludePatterns)
+		&& !anchored(options.excludeDirPatterns) && !anchored(options.binaryPatterns)
+		&& !(options.filePattern && options.filePattern->find('/') != std::string::npos);
+}
+
+// True if 'path' is 'root' or lies below it (both canonical)
+bool isWithin(const fs::path& path, const fs::path& root)
+{
+	auto p = path.begin();
+	for (auto r = root.begin(); r != root.end(); ++r, ++p) {
+		if (r->empty() && std::next(r) == root.end()) {
+			break; // trailing separator of the root
+		}
+		if (p == path.end() || *p != *r) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Streams an agent's matches back to the coordinator: each worker
+ *        collects Binary records and sends them as one frame once it holds
+ *        kResultFrameSize bytes, and when it is done. Once a send fails, or
+ *        abandon() is called, the scan is cancelled and nothing more is sent.
+ */
+class AgentResultHandler final : public ScanHandler {
+public:
+	AgentResultHandler(Channel& channel, Scanner& scanner, bool namesOnly)
+		: channel_(channel), scanner_(scanner), namesOnly_(namesOnly)
+	{
+	}
+
+	// Sends unless the coordinator is gone; a failed send cancels the scan
+	bool forward(Message type, std::string_view payload)
+	{
+		if (abandoned_.load() || send(channel_, type, payload)) {
+			return !abandoned_.load();
+		}
+		abandon();
+		return false;
+	}
+
+	void abandon()
+	{
+		abandoned_.store(true);
+		scanner_.cancel();
+	}
+
+	bool abandoned() const { return abandoned_.load(); }
+
+	void onStart(unsigned numWorkers) override
+	{
+		buffers_ = std::vector<Buffer>(numWorkers);
+	}
+
+	void onFileMatches(const FileMatches& file, unsigned worker) override
+	{
+		Buffer& buffer = buffers_[worker];
+		appendBinaryRecord(buffer.records, file, pathBytes(file.path, buffer.path), namesOnly_);
+		if (buffer.records.size() >= kResultFrameSize) {
+			flush(buffer);
+		}
+	}
+
+	void onWorkerDone(unsigned worker) override
+	{
+		flush(buffers_[worker]);
+	}
+
+	void onError(const std::string& message) override
+	{
+		forward(Message::Error, message);
+	}
+
+private:
+	struct alignas(64) Buffer {
+		std::string records;
+		std::string path; // path conversion where paths are not narrow
+	};
+
+	void flush(Buffer& buffer)
+	{
+		if (!buffer.records.empty()) {
+			forward(Message::Results, buffer.records);
+			buffer.records.clear();
+		}
+	}
+
+	Channel& channel_;
+	Scanner& scanner_;
+	bool namesOnly_;
+	std::atomic<bool> abandoned_{ false };
+	std::vector<Buffer> buffers_; // one per worker
+};
+
+} // namespace
+
+// ---------------------------------------------------------------- agent
+
+ScanAgent::ScanAgent(const AgentOptions& options, std::unique_ptr<Listener> listener)
+	: options_(options), listener_(std::move(listener))
+{
+	// Reported paths start with the root, so make it absolute once
+	options_.root = fs::absolute(options.root).lexically_normal();
+	if (!options_.root.has_filename() && options_.root.has_relative_path()) {
+		options_.root = options_.root.parent_path();
+	}
+	std::error_code ec;
+	canonicalRoot_ = fs::weakly_canonical(options_.root, ec);
+}
+
+ScanAgent::~ScanAgent()
+{
+	stop();
+}
+
+std::unique_ptr<ScanAgent> ScanAgent::create(const AgentOptions& options, std::string& error)
+{
+	std::error_code ec;
+	if (!fs::is_directory(options.root, ec)) {
+		error = options.root.string() + " is not a directory";
+		return nullptr;
+	}
+	if (options.token.empty()) {
+		error = "an agent needs a token (--agent-token or DIRSCAN_AGENT_TOKEN)";
+		return nullptr;
+	}
+	std::unique_ptr<Listener> listener = Listener::listen(options.address, error);
+	if (!listener) {
+		return nullptr;
+	}
+	return std::unique_ptr<ScanAgent>(new ScanAgent(options, std::move(listener)));
+}
+
+unsigned short ScanAgent::port() const
+{
+	return listener_->port();
+}
+
+void ScanAgent::serve()
+{
+	struct Session {
+		std::thread thread;
+		std::shared_ptr<std::atomic<bool>> finished;
+	};
+	std::vector<Session> sessions;
+	while (!stopped_.load()) {
+		// Join the sessions that ended, so a long-running agent does not pile up threads
+		for (auto it = sessions.begin(); it != sessions.end();) {
+			if (it->finished->load()) {
+				it->thread.join();
+				it = sessions.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+
+		std::shared_ptr<Channel> channel = listener_->accept(std::chrono::milliseconds(200));
+		if (!channel) {
+			continue;
+		}
+		auto finished = std::make_shared<std::atomic<bool>>(false);
+		{
+			std::lock_guard<std::mutex> lock(connectionsMutex_);
+			connections_.push_back(channel.get());
+		}
+		sessions.push_back(Session{ std::thread([this, channel, finished]() {
+			serveConnection(*channel);
+			{
+				std::lock_guard<std::mutex> lock(connectionsMutex_);
+				connections_.erase(std::find(connections_.begin(), connections_.end(), channel.get()));
+			}
+			finished->store(true);
+		}), finished });
+	}
+	for (auto& session : sessions) {
+		session.thread.join();
+	}
+}
+
+void ScanAgent::stop()
+{
+	stopped_.store(true);
+	std::lock_guard<std::mutex> lock(connectionsMutex_);
+	for (Channel* channel : connections_) {
+		channel->shutdown();
+	}
+	for (Scanner* scanner : scanners_) {
+		scanner->cancel();
+	}
+}
+
+size_t ScanAgent::activeScans() const
+{
+	std::lock_guard<std::mutex> lock(connectionsMutex_);
+	return scanners_.size();
+}
+
+void ScanAgent::serveConnection(Channel& channel)
+{
+	uint8_t type = 0;
+	std::string payload;
+	std::string error;
+	if (!channel.receive(type, payload, error) || type != static_cast<uint8_t>(Message::Hello)) {
+		return;
+	}
+	ByteCursor hello{ payload };
+	ScanOptions base;
+	if (hello.bytes(kMagic.size()) != kMagic || hello.u32() != kProtocolVersion) {
+		send(channel, Message::Refused, "unsupported protocol version");
+		return;
+	}
+	const std::string_view token = hello.sized();
+	if (!hello.ok || !sameToken(token, options_.token)) {
+		send(channel, Message::Refused, "wrong agent token");
+		return;
+	}
+	if (!decodeOptions(hello, base)) {
+		send(channel, Message::Refused, "malformed scan options");
+		return;
+	}
+	base.numThreads = options_.numThreads;
+	base.ioThreads = options_.ioThreads;
+	base.ioDepth = options_.ioDepth;
+	if (!Scanner::create(base, error)) {
+		send(channel, Message::Refused, error);
+		return;
+	}
+	std::string ready;
+	putU8(ready, options_.indexPath ? 1 : 0);
+	send(channel, Message::Ready, ready);
+
+	// Maps a requested path onto the tree, refusing anything that leaves it
+	auto resolve = [&](std::string_view relative, fs::path& directory, std::string& problem) {
+		const fs::path normal = pathOfUtf8(relative).lexically_normal();
+		if (normal.has_root_path() || (!normal.empty() && *normal.begin() == "..")) {
+			problem = "path outside the served tree: " + std::string(relative);
+			return false;
+		}
+		directory = normal.empty() || normal == "." ? options_.root : (options_.root / normal).lexically_normal();
+		if (!directory.has_filename() && directory.has_relative_path()) {
+			directory = directory.parent_path();
+		}
+		std::error_code ec;
+		const fs::path canonical = fs::weakly_canonical(directory, ec);
+		if (ec || !isWithin(canonical, canonicalRoot_)) {
+			problem = "path outside the served tree: " + std::string(relative);
+			return false;
+		}
+		if (!fs::is_directory(directory, ec)) {
+			problem = "not a directory: " + directory.string();
+			return false;
+		}
+		return true;
+	};
+
+	IgnoreFilter excludedDirs({});
+	for (const auto& patterns : base.excludeDirPatterns) {
+		excludedDirs.addExcludeDir(patterns, base.patternsIgnoreCase, error); // validated by Scanner::create
+	}
+
+	while (channel.receive(type, payload, error)) {
+		ByteCursor in{ payload };
+		fs::path directory;
+		if (type == static_cast<uint8_t>(Message::List)) {
+			const std::string_view relative = in.sized();
+			if (!in.atEnd() || !resolve(relative, directory, error)) {
+				send(channel, Message::Refused, in.ok ? error : "malformed request");
+				continue;
+			}
+			// Subdirectories the walk would enter, and whether anything else is there
+			std::vector<std::string> names;
+			bool hasFiles = false;
+			const size_t rootLength = rootPathLength(directory);
+			std::error_code ec;
+			for (fs::directory_iterator it(directory, fs::directory_options::skip_permission_denied, ec), end;
+				!ec && it != end; it.increment(ec)) {
+				if (!it->is_directory(ec) || it->is_symlink(ec)) {
+					hasFiles = hasFiles || !it->is_directory(ec);
+				}
+				else if (!excludedDirs.ignores(nullptr, it->path(), rootLength, true)) {
+					names.push_back(utf8Of(it->path().filename()));
+				}
+			}
+			std::sort(names.begin(), names.end());
+			std::string listing;
+			putU8(listing, hasFiles ? 1 : 0);
+			putStrings(listing, names);
+			send(channel, Message::Listing, listing);
+		}
+		else if (type == static_cast<uint8_t>(Message::Scan)) {
+			const uint32_t unit = in.u32();
+			const std::string_view relative = in.sized();
+			const bool depthLimited = getU8(in) != 0;
+			const uint32_t maxDepth = in.u32();
+			if (!in.atEnd() || !resolve(relative, directory, error)) {
+				send(channel, Message::Refused, in.ok ? error : "malformed request");
+				continue;
+			}
+			ScanOptions options = base;
+			if (depthLimited) {
+				options.maxDepth = maxDepth;
+			}
+			if (options_.indexPath && directory == options_.root) {
+				options.indexPath = options_.indexPath; // the index speaks for the whole root only
+			}
+			std::unique_ptr<Scanner> scanner = Scanner::create(options, error);
+			if (!scanner) {
+				send(channel, Message::Refused, error);
+				continue;
+			}
+			{
+				std::lock_guard<std::mutex> lock(connectionsMutex_);
+				if (stopped_.load()) {
+					return;
+				}
+				scanners_.push_back(scanner.get());
+			}
+			AgentResultHandler handler(channel, *scanner, options.filesWithMatches);
+
+			// Report progress while the unit is scanned. The coordinator sends
+			// nothing before Done, so anything to receive means it hung up
+			// (--first, or it failed): the scan is then cancelled.
+			std::mutex doneMutex;
+			std::condition_variable doneChanged;
+			bool done = false;
+			std::thread ticker([&]() {
+				auto nextProgress = std::chrono::steady_clock::now() + kProgressInterval;
+				std::unique_lock<std::mutex> lock(doneMutex);
+				while (!doneChanged.wait_for(lock, kHangUpCheck, [&] { return done; })) {
+					if (channel.readable(std::chrono::milliseconds(0))) {
+						handler.abandon();
+						break;
+					}
+					if (std::chrono::steady_clock::now() < nextProgress) {
+						continue;
+					}
+					nextProgress += kProgressInterval;
+					const StatusSnapshot status = scanner->progress();
+					std::string progress;
+					putU64(progress, status.filesScanned);
+					putU64(progress, status.totalHits);
+					putBytes(progress, status.currentFile);
+					if (!handler.forward(Message::Progress, progress)) {
+						break;
+					}
+				}
+				});
+			scanner->run(directory, handler);
+			{
+				std::lock_guard<std::mutex> lock(doneMutex);
+				done = true;
+			}
+			doneChanged.notify_one();
+			ticker.join();
+			{
+				std::lock_guard<std::mutex> lock(connectionsMutex_);
+				scanners_.erase(std::find(scanners_.begin(), scanners_.end(), scanner.get()));
+			}
+			if (handler.abandoned()) {
+				return;
+			}
+
+			const StatusSnapshot status = scanner->progress();
+			std::string result;
+			putU32(result, unit);
+			putU64(result, status.filesScanned);
+			putU64(result, status.totalHits);
+			if (!send(channel, Message::Done, result)) {
+				return;
+			}
+		}
+		else {
+			send(channel, Message::Refused, "unexpected request");
+			return;
+		}
+	}
+}
+
+// ---------------------------------------------------------------- coordinator
+
+// A subtree handed to one agent
+struct ClusterScan::Unit {
+	uint32_t id = 0;
+	std::string path;                       // relative to the agents' roots, '/'-separated
+	std::optional<unsigned> maxDepth;       // 0 for the files of a directory that was split
+	size_t owner = kAnyAgent;               // the agent whose tree it is, or kAnyAgent
+};
+
+// One agent's connection and counters; guarded by ClusterScan::mutex_
+struct ClusterScan::AgentState {
+	std::string name;                       // as given in ClusterOptions::agents
+	Channel* channel = nullptr;             // while connected
+	size_t doneFiles = 0;                   // counts of its finished units
+	size_t doneHits = 0;
+	size_t liveFiles = 0;                   // the unit in progress, from its last Progress
+	size_t liveHits = 0;
+	std::string currentFile;
+	std::chrono::steady_clock::time_point updated;
+};
+
+/**
+ * @brief The units not handed out yet. In a shared tree, an agent that finds
+ *        it empty waits while the tree is still being planned or units are in
+ *        flight, since a lost unit comes back.
+ */
+class ClusterScan::WorkQueue {
+public:
+	explicit WorkQueue(bool shared) : shared_(shared) {}
+
+	// In a shared tree the first agent connected plans for everyone
+	bool claimPlanning()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		const bool first = !planClaimed_;
+		planClaimed_ = true;
+		return first;
+	}
+
+	void add(std::vector<Unit> units)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (auto& unit : units) {
+				unit.id = nextId_++;
+				units_.push_back(std::move(unit));
+			}
+			planned_ = true;
+		}
+		changed_.notify_all();
+	}
+
+	// The next unit 'agent' may search; false once there is none left
+	bool take(size_t agent, Unit& unit)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true) {
+			const auto it = std::find_if(units_.begin(), units_.end(),
+				[agent](const Unit& u) { return u.owner == agent || u.owner == kAnyAgent; });
+			if (!closed_ && it != units_.end()) {
+				unit = std::move(*it);
+				units_.erase(it);
+				++inFlight_;
+				return true;
+			}
+			if (closed_ || !shared_ || (planned_ && inFlight_ == 0)) {
+				return false;
+			}
+			changed_.wait(lock);
+		}
+	}
+
+	// A unit taken is done, or is handed back for another agent
+	void finished(const Unit&)
+	{
+		settle(nullptr);
+	}
+
+	void giveBack(Unit unit)
+	{
+		settle(&unit);
+	}
+
+	// Stops handing out units
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			closed_ = true;
+		}
+		changed_.notify_all();
+	}
+
+private:
+	void settle(Unit* returned)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			--inFlight_;
+			if (returned) {
+				units_.push_front(std::move(*returned));
+			}
+		}
+		changed_.notify_all();
+	}
+
+	const bool shared_;
+	std::mutex mutex_;
+	std::condition_variable changed_;
+	std::deque<Unit> units_;
+	uint32_t nextId_ = 0;
+	size_t inFlight_ = 0;
+	bool planClaimed_ = false;
+	bool planned_ = false;
+	bool closed_ = false;
+};
+
+ClusterScan::ClusterScan(const ScanOptions& options, const ClusterOptions& cluster)
+	: options_(options), cluster_(cluster)
+{
+	for (const auto& name : cluster_.agents) {
+		agents_.push_back(std::make_unique<AgentState>());
+		agents_.back()->name = name;
+	}
+}
+
+ClusterScan::~ClusterScan() = default;
+
+std::unique_ptr<ClusterScan> ClusterScan::create(const ScanOptions& options, const ClusterOptions& cluster,
+	std::string& error)
+{
+	if (cluster.agents.empty()) {
+		error = "no agents given";
+		return nullptr;
+	}
+	if (cluster.token.empty()) {
+		error = "agents need a token (--agent-token or DIRSCAN_AGENT_TOKEN)";
+		return nullptr;
+	}
+	if (options.indexPath || options.cachePath) {
+		error = "--index and --cache are not available with agents (start each agent with its own --index)";
+		return nullptr;
+	}
+	if (!Scanner::create(options, error)) {
+		return nullptr;
+	}
+	return std::unique_ptr<ClusterScan>(new ClusterScan(options, cluster));
+}
+
+void ClusterScan::run(const std::filesystem::path& directory, ScanHandler& handler)
+{
+	std::string relative = utf8Of(directory.lexically_normal());
+	while (!relative.empty() && relative.back() == '/') {
+		relative.pop_back();
+	}
+	if (relative == ".") {
+		relative.clear();
+	}
+
+	stopping_.store(false);
+	reportedFiles_.store(0);
+	unitsServed_.store(0);
+	WorkQueue work(cluster_.sharedTree);
+	handler.onStart(static_cast<unsigned>(agents_.size()));
+
+	// One thread per agent: it plans (or, in a shared tree, waits for the plan),
+	// then asks for units until none is left for it
+	StageProfile* profile = StageProfile::current();
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < agents_.size(); ++i) {
+		threads.emplace_back([&, i]() {
+			ProfileScope scope(profile, "agent", static_cast<int>(i));
+			runAgent(i, relative, work, handler);
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+void ClusterScan::runAgent(size_t agent, const std::string& directory, WorkQueue& work, ScanHandler& handler)
+{
+	AgentState& state = *agents_[agent];
+	std::string error;
+	uint8_t type = 0;
+	std::string payload;
+
+	auto finish = [&]() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		state.channel = nullptr;
+		state.liveFiles = 0;
+		state.liveHits = 0;
+	};
+
+	std::unique_ptr<Channel> channel = Channel::connect(state.name, error);
+	if (!channel) {
+		reportError(error, handler);
+		handler.onWorkerDone(static_cast<unsigned>(agent));
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		state.channel = channel.get();
+		if (stopping_.load()) {
+			channel->shutdown();
+		}
+	}
+
+	std::string hello(kMagic);
+	putU32(hello, kProtocolVersion);
+	putBytes(hello, cluster_.token);
+	hello += encodeOptions(options_);
+	send(*channel, Message::Hello, hello);
+	if (!channel->receive(type, payload, error) || type != static_cast<uint8_t>(Message::Ready)) {
+		reportError(state.name + ": " + (type == static_cast<uint8_t>(Message::Refused) ? payload : error), handler);
+		finish();
+		handler.onWorkerDone(static_cast<unsigned>(agent));
+		return;
+	}
+	const bool indexed = ByteCursor{ payload }.unsignedOf(1) != 0;
+
+	// Cut the tree into units: each agent its own, or the first one for all
+	if (!cluster_.sharedTree || work.claimPlanning()) {
+		const size_t sharing = cluster_.sharedTree ? agents_.size() : 1;
+		const bool split = canSplit(options_) && !(indexed && !cluster_.sharedTree);
+		planUnits(*channel, agent, directory, split ? static_cast<unsigned>(cluster_.unitsPerAgent * sharing) : 1,
+			work, handler);
+	}
+
+	Unit unit;
+	BinaryRecord record;
+	while (work.take(agent, unit)) {
+		std::string request;
+		putU32(request, unit.id);
+		putBytes(request, unit.path);
+		putU8(request, unit.maxDepth ? 1 : 0);
+		putU32(request, unit.maxDepth.value_or(0));
+
+		bool reported = false;  // some of the unit's matches were passed on
+		bool done = false;
+		bool broken = !send(*channel, Message::Scan, request);
+		if (broken) {
+			error = "connection to " + state.name + " closed";
+		}
+		while (!done && !broken) {
+			if (!channel->receive(type, payload, error)) {
+				broken = true;
+				break;
+			}
+			ByteCursor in{ payload };
+			switch (static_cast<Message>(type)) {
+			case Message::Results:
+				while (in.ok && !in.atEnd()) {
+					if (!readBinaryRecord(in, record)) {
+						error = "malformed results from " + state.name;
+						broken = true;
+						break;
+					}
+					reported = true;
+					if (options_.maxFiles != 0) {
+						const size_t rank = reportedFiles_.fetch_add(1);
+						if (rank >= options_.maxFiles) {
+							continue;
+						}
+						if (rank + 1 == options_.maxFiles) {
+							stopAll(work);
+						}
+					}
+					const fs::path path = cluster_.sharedTree ? fs::path(std::string(record.path))
+						: fs::path(state.name + ":" + std::string(record.path));
+					StageTimer timer(Stage::Format);
+					handler.onFileMatches(FileMatches{ path, record.lines, record.spans, record.binary },
+						static_cast<unsigned>(agent));
+				}
+				break;
+			case Message::Progress: {
+				const uint64_t files = in.u64();
+				const uint64_t hits = in.u64();
+				const std::string_view current = in.sized();
+				std::lock_guard<std::mutex> lock(mutex_);
+				state.liveFiles = static_cast<size_t>(files);
+				state.liveHits = static_cast<size_t>(hits);
+				state.currentFile = std::string(current);
+				state.updated = std::chrono::steady_clock::now();
+				break;
+			}
+			case Message::Error:
+				reportError(state.name + ": " + payload, handler);
+				break;
+			case Message::Refused:
+				reportError(state.name + ": " + payload, handler);
+				done = true;
+				break;
+			case Message::Done: {
+				in.u32();
+				const uint64_t files = in.u64();
+				const uint64_t hits = in.u64();
+				std::lock_guard<std::mutex> lock(mutex_);
+				state.doneFiles += static_cast<size_t>(files);
+				state.doneHits += static_cast<size_t>(hits);
+				state.liveFiles = 0;
+				state.liveHits = 0;
+				done = true;
+				unitsServed_.fetch_add(1);
+				break;
+			}
+			default:
+				error = "unexpected message from " + state.name;
+				broken = true;
+				break;
+			}
+		}
+		if (!done) {
+			// The connection is gone. Another agent can take the unit over,
+			// unless it would report some of the same matches again.
+			if (cluster_.sharedTree && !reported && !stopping_.load()) {
+				work.giveBack(std::move(unit));
+			}
+			else {
+				work.finished(unit);
+				if (!stopping_.load()) {
+					error += " (results of " + (unit.path.empty() ? std::string(".") : unit.path) + " incomplete)";
+				}
+			}
+			reportError(error, handler);
+			break;
+		}
+		work.finished(unit);
+	}
+	finish();
+	handler.onWorkerDone(static_cast<unsigned>(agent));
+}
+
+bool ClusterScan::planUnits(Channel& channel, size_t agent, const std::string& directory, unsigned targetUnits,
+	WorkQueue& work, ScanHandler& handler)
+{
+	const std::string& name = agents_[agent]->name;
+	const size_t owner = cluster_.sharedTree ? kAnyAgent : agent;
+	struct Pending {
+		std::string path;
+		unsigned depth;
+	};
+	std::vector<Unit> units;
+	std::deque<Pending> frontier{ Pending{ directory, 0 } };
+
+	// Breadth first: list the shallowest directory left until there are enough
+	// units, or the next one is too deep to split (every later one is as deep)
+	while (!frontier.empty() && units.size() + frontier.size() < targetUnits) {
+		const Pending next = frontier.front();
+		if (next.depth >= kMaxSplitDepth || (options_.maxDepth && next.depth >= *options_.maxDepth)) {
+			break;
+		}
+		std::string request;
+		putBytes(request, next.path);
+		uint8_t type = 0;
+		std::string payload;
+		std::string error;
+		if (!send(channel, Message::List, request) || !channel.receive(type, payload, error)) {
+			reportError(error.empty() ? "connection to " + name + " closed" : error, handler);
+			// In a shared tree the whole directory is left to the others
+			work.add(cluster_.sharedTree ? std::vector<Unit>{ Unit{ 0, directory, options_.maxDepth, owner } }
+				: std::vector<Unit>{});
+			return false;
+		}
+		frontier.pop_front();
+		if (type == static_cast<uint8_t>(Message::Refused)) {
+			reportError(name + ": " + payload, handler); // e.g. not a directory there
+			continue;
+		}
+		ByteCursor in{ payload };
+		const bool hasFiles = getU8(in) != 0;
+		std::vector<std::string> names;
+		getStrings(in, names);
+		if (type != static_cast<uint8_t>(Message::Listing) || !in.atEnd()) {
+			reportError("malformed listing from " + name, handler);
+			continue;
+		}
+		if (hasFiles) {
+			units.push_back(Unit{ 0, next.path, 0u, owner });
+		}
+		for (const auto& entry : names) {
+			frontier.push_back(Pending{ joinPath(next.path, entry), next.depth + 1 });
+		}
+	}
+
+	for (const auto& pending : frontier) {
+		Unit unit{ 0, pending.path, std::nullopt, owner };
+		if (options_.maxDepth) {
+			unit.maxDepth = *options_.maxDepth - pending.depth;
+		}
+		units.push_back(std::move(unit));
+	}
+	work.add(std::move(units));
+	return true;
+}
+
+void ClusterScan::stopAll(WorkQueue& work)
+{
+	stopping_.store(true);
+	work.close();
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (const auto& agent : agents_) {
+		if (agent->channel) {
+			agent->channel->shutdown();
+		}
+	}
+}
+
+void ClusterScan::reportError(const std::string& message, ScanHandler& handler)
+{
+	if (stopping_.load()) {
+		return; // connections closed on purpose
+	}
+	errorCount_.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		lastError_ = message;
+	}
+	handler.onError(message);
+}
+
+StatusSnapshot ClusterScan::progress() const
+{
+	StatusSnapshot snapshot;
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::chrono::steady_clock::time_point newest{};
+	for (const auto& agent : agents_) {
+		snapshot.filesScanned += agent->doneFiles + agent->liveFiles;
+		snapshot.totalHits += agent->doneHits + agent->liveHits;
+		if (!agent->currentFile.empty() && agent->updated > newest) {
+			newest = agent->updated;
+			snapshot.currentFile = agent->name + ":" + agent->currentFile;
+		}
+	}
+	snapshot.errors = errorCount_.load(std::memory_order_relaxed);
+	return snapshot;
+}
+
+std::string ClusterScan::lastError() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return lastError_;
+}
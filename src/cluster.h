@@ -0,0 +1,186 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include "scanner.h"
+#include "worker_status.h"
+
+class Channel;
+class Listener;
+
+/**
+ * @brief Settings of a scan agent (--agent): the tree it serves and the
+ *        resources it scans with. The query and filters come from the
+ *        coordinator with each connection.
+ */
+struct AgentOptions {
+    std::filesystem::path root;             // Only paths below this are searched
+    std::string address;                    // "[host:]port" to listen on; no host = loopback only
+    std::string token;                      // Shared secret coordinators must present; required
+    unsigned numThreads = 0;                // As ScanOptions::numThreads
+    unsigned ioThreads = 0;                 // As ScanOptions::ioThreads
+    unsigned ioDepth = 0;                   // As ScanOptions::ioDepth
+    std::optional<std::filesystem::path> indexPath; // Trigram index of 'root'; the root is then
+                                                     // searched as one unit, with the index
+};
+
+/**
+ * @brief Serves scans of one directory tree to coordinators (ClusterScan)
+ *        over TCP. Each connection gets its own thread; the coordinator sends
+ *        the scan options once, then asks for directory listings and subtree
+ *        scans, and the agent streams back the matches as Binary records (see
+ *        structured_output.h). Requests for paths outside the root are refused.
+ *
+ * A coordinator is only served if its first frame carries the agent's token.
+ * The token and the results travel unencrypted, so an agent listening beyond
+ * the loopback interface belongs on a trusted network.
+ */
+class ScanAgent {
+public:
+    /**
+     * @brief Starts listening.
+     * @return nullptr (and sets 'error') if the root is not a directory, the
+     *         token is empty or the address cannot be bound.
+     */
+    static std::unique_ptr<ScanAgent> create(const AgentOptions& options, std::string& error);
+
+    ~ScanAgent();
+
+    ScanAgent(const ScanAgent&) = delete;
+    ScanAgent& operator=(const ScanAgent&) = delete;
+
+    // The port listened on (useful with port 0)
+    unsigned short port() const;
+
+    /**
+     * @brief Accepts and serves connections until stop(); then waits for the
+     *        connections being served to end.
+     */
+    void serve();
+
+    /**
+     * @brief Makes serve() return, and ends the open connections and the
+     *        scans they run. Thread-safe.
+     */
+    void stop();
+
+    // Units being scanned right now, over all connections
+    size_t activeScans() const;
+
+private:
+    ScanAgent(const AgentOptions& options, std::unique_ptr<Listener> listener);
+
+    void serveConnection(Channel& channel);
+
+    AgentOptions options_;
+    std::filesystem::path canonicalRoot_;
+    std::unique_ptr<Listener> listener_;
+    std::atomic<bool> stopped_{ false };
+
+    mutable std::mutex connectionsMutex_;
+    std::vector<Channel*> connections_; // being served, shut down by stop()
+    std::vector<Scanner*> scanners_;    // running a unit, cancelled by stop()
+};
+
+/**
+ * @brief How a ClusterScan spreads its work.
+ */
+struct ClusterOptions {
+    std::vector<std::string> agents;        // "host:port" of each agent
+    std::string token;                      // AgentOptions::token of the agents
+    bool sharedTree = false;                // All agents see the same tree (a shared or replicated
+                                            // filesystem): each unit goes to whichever agent is free.
+                                            // Otherwise each agent searches its own tree.
+    size_t unitsPerAgent = 8;               // Split the tree into about this many units per agent
+};
+
+/**
+ * @brief A scan spread over remote ScanAgents, with the same interface as
+ *        Scanner: results arrive through a ScanHandler, worker 'i' being the
+ *        connection to agent 'i'.
+ *
+ * The tree is cut into units by listing directories on the agents: a
+ * directory becomes one unit for its own files and one per subdirectory,
+ * breadth first, until there are ClusterOptions::unitsPerAgent units per
+ * agent. Each agent is handed its next unit as soon as it reports the last
+ * one done, so fast agents take more of the tree. In a shared tree a unit
+ * lost with its agent is handed to another one, unless some of its matches
+ * were already reported.
+ */
+class ClusterScan {
+public:
+    /**
+     * @brief Checks the query and options locally, before any agent is contacted.
+     * @return nullptr (and sets 'error') if they are invalid, use --index or
+     *         --cache (which agents keep locally), or no token is given.
+     */
+    static std::unique_ptr<ClusterScan> create(const ScanOptions& options, const ClusterOptions& cluster,
+                                               std::string& error);
+
+    ~ClusterScan();
+
+    ClusterScan(const ClusterScan&) = delete;
+    ClusterScan& operator=(const ClusterScan&) = delete;
+
+    /**
+     * @brief Scans 'directory', relative to each agent's root ("" or "." for
+     *        all of it), and blocks until every unit is done or no agent is
+     *        left. Agents that cannot be reached are reported as errors.
+     *        Without a shared tree, reported paths are prefixed with the
+     *        agent's address and a ':' ("node1:7000:/archive/a.log").
+     *        With ScanOptions::maxFiles, connections are closed once that
+     *        many files were reported.
+     */
+    void run(const std::filesystem::path& directory, ScanHandler& handler);
+
+    /**
+     * @brief Progress of all agents so far; may be called from any thread while run() is active.
+     */
+    StatusSnapshot progress() const;
+
+    /**
+     * @brief The most recent error message, or "none".
+     */
+    std::string lastError() const;
+
+    /**
+     * @brief True if an agent scanned at least one unit of the last run() to
+     *        the end, or the run stopped at ScanOptions::maxFiles; false if
+     *        no agent could be reached, accept the token or serve the path.
+     */
+    bool served() const { return unitsServed_.load() > 0 || stopping_.load(); }
+
+private:
+    struct Unit;
+    struct AgentState;
+    class WorkQueue;
+
+    ClusterScan(const ScanOptions& options, const ClusterOptions& cluster);
+
+    void runAgent(size_t agent, const std::string& directory, WorkQueue& work, ScanHandler& handler);
+    bool planUnits(Channel& channel, size_t agent, const std::string& directory, unsigned targetUnits,
+                   WorkQueue& work, ScanHandler& handler);
+    void stopAll(WorkQueue& work);
+    void reportError(const std::string& message, ScanHandler& handler);
+
+    ScanOptions options_;
+    ClusterOptions cluster_;
+    std::vector<std::unique_ptr<AgentState>> agents_;
+    std::atomic<size_t> reportedFiles_{ 0 };
+    std::atomic<size_t> unitsServed_{ 0 };  // units an agent reported done
+    std::atomic<bool> stopping_{ false };   // --first reached: close everything, report no more
+
+    std::atomic<size_t> errorCount_{ 0 };
+    mutable std::mutex mutex_;              // guards the agents' counters and lastError_
+    std::string lastError_ = "none";
+};
+
+#endif // CLUSTER_H
@@ -0,0 +1,314 @@
+#include "decompress.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include "stage_timer.h"
+
+// Each codec is optional, detected at configure time (src/CMakeLists.txt)
+#ifndef DIRSCAN_HAVE_ZLIB
+#define DIRSCAN_HAVE_ZLIB 0
+#endif
+#ifndef DIRSCAN_HAVE_LZMA
+#define DIRSCAN_HAVE_LZMA 0
+#endif
+#ifndef DIRSCAN_HAVE_ZSTD
+#define DIRSCAN_HAVE_ZSTD 0
+#endif
+
+#if DIRSCAN_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#if DIRSCAN_HAVE_LZMA
+#include <lzma.h>
+#endif
+#if DIRSCAN_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+constexpr size_t kMinOutput = 64 * 1024;
+
+// Bytes the decoder may write next, growing 'output' if it is full; 0 once
+// more than 'limit' bytes came out. A pooled buffer may be larger than
+// 'limit', so the room is capped rather than the capacity.
+size_t room(FileBuffer& output, size_t limit, size_t inputSize)
+{
+	const size_t cap = limit < SIZE_MAX ? limit + 1 : limit;
+	if (output.size >= cap) {
+		return 0;
+	}
+	if (output.size == output.capacity) {
+		// Text usually compresses 4-10x: start there and double
+		const size_t wanted = output.capacity == 0 ? std::max(kMinOutput, inputSize * 4) : output.capacity * 2;
+		output.reserve(std::min(wanted, cap), output.size);
+	}
+	return std::min(output.capacity, cap) - output.size;
+}
+
+std::string tooLarge(size_t limit)
+{
+	return "decompressed size exceeds " + std::to_string(limit) + " bytes";
+}
+
+#if DIRSCAN_HAVE_ZLIB
+bool inflateGzip(std::string_view input, FileBuffer& output, size_t limit, std::string& error)
+{
+	z_stream zs{};
+	if (inflateInit2(&zs, 15 + 16) != Z_OK) { // 16: gzip wrapper
+		error = "could not set up zlib";
+		return false;
+	}
+	struct End {
+		z_stream& zs;
+		~End() { inflateEnd(&zs); }
+	} end{ zs };
+
+	size_t consumed = 0;
+	while (true) {
+		const size_t available = room(output, limit, input.size());
+		if (available == 0) {
+			error = tooLarge(limit);
+			return false;
+		}
+		// zlib counts in uInt, so very large inputs and outputs go in pieces
+		const size_t inChunk = std::min<size_t>(input.size() - consumed, UINT_MAX);
+		const size_t outRoom = std::min<size_t>(available, UINT_MAX);
+		zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data() + consumed));
+		zs.avail_in = static_cast<uInt>(inChunk);
+		zs.next_out = reinterpret_cast<Bytef*>(output.data.get() + output.size);
+		zs.avail_out = static_cast<uInt>(outRoom);
+		const int ret = inflate(&zs, Z_NO_FLUSH);
+		consumed += inChunk - zs.avail_in;
+		output.size += outRoom - zs.avail_out;
+
+		if (ret == Z_STREAM_END) {
+			// Another member may follow, as in `cat a.gz b.gz`; trailing junk is ignored like gzip does
+			if (detectCompression(input.substr(consumed)) != Compression::Gzip) {
+				return true;
+			}
+			inflateReset(&zs);
+		}
+		else if (ret == Z_BUF_ERROR && consumed == input.size()) {
+			error = "unexpected end of data";
+			return false;
+		}
+		else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			error = zs.msg ? zs.msg : "corrupt data";
+			return false;
+		}
+	}
+}
+#endif
+
+#if DIRSCAN_HAVE_LZMA
+bool inflateXz(std::string_view input, FileBuffer& output, size_t limit, std::string& error)
+{
+	lzma_stream stream = LZMA_STREAM_INIT;
+	if (lzma_stream_decoder(&stream, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+		error = "could not set up liblzma";
+		return false;
+	}
+	struct End {
+		lzma_stream& stream;
+		~End() { lzma_end(&stream); }
+	} end{ stream };
+
+	stream.next_in = reinterpret_cast<const uint8_t*>(input.data());
+	stream.avail_in = input.size();
+	while (true) {
+		const size_t outRoom = room(output, limit, input.size());
+		if (outRoom == 0) {
+			error = tooLarge(limit);
+			return false;
+		}
+		stream.next_out = reinterpret_cast<uint8_t*>(output.data.get() + output.size);
+		stream.avail_out = outRoom;
+		// LZMA_CONCATENATED only reports the end once told the input is complete
+		const lzma_ret ret = lzma_code(&stream, stream.avail_in == 0 ? LZMA_FINISH : LZMA_RUN);
+		output.size += outRoom - stream.avail_out;
+
+		if (ret == LZMA_STREAM_END) {
+			return true;
+		}
+		if (ret != LZMA_OK) {
+			error = ret == LZMA_BUF_ERROR ? "unexpected end of data"
+				: ret == LZMA_MEM_ERROR ? "out of memory" : "corrupt data";
+			return false;
+		}
+	}
+}
+#endif
+
+#if DIRSCAN_HAVE_ZSTD
+bool inflateZstd(std::string_view input, FileBuffer& output, size_t limit, std::string& error)
+{
+	ZSTD_DStream* stream = ZSTD_createDStream();
+	if (stream == nullptr || ZSTD_isError(ZSTD_initDStream(stream))) {
+		ZSTD_freeDStream(stream);
+		error = "could not set up libzstd";
+		return false;
+	}
+	struct End {
+		ZSTD_DStream* stream;
+		~End() { ZSTD_freeDStream(stream); }
+	} end{ stream };
+
+	ZSTD_inBuffer in{ input.data(), input.size(), 0 };
+	while (true) {
+		const size_t outRoom = room(output, limit, input.size());
+		if (outRoom == 0) {
+			error = tooLarge(limit);
+			return false;
+		}
+		ZSTD_outBuffer out{ output.data.get() + output.size, outRoom, 0 };
+		const size_t hint = ZSTD_decompressStream(stream, &out, &in);
+		output.size += out.pos;
+		if (ZSTD_isError(hint)) {
+			error = ZSTD_getErrorName(hint);
+			return false;
+		}
+		// 0: a frame just ended; more input may hold further frames
+		if (in.pos == in.size && hint == 0) {
+			return true;
+		}
+		if (in.pos == in.size && out.pos < out.size) {
+			error = "unexpected end of data";
+			return false;
+		}
+	}
+}
+#endif
+
+} // namespace
+
+Compression detectCompression(std::string_view head)
+{
+	if (head.substr(0, 2) == std::string_view("\x1f\x8b", 2)) {
+		return Compression::Gzip;
+	}
+	if (head.substr(0, 6) == std::string_view("\xfd" "7zXZ\0", 6)) {
+		return Compression::Xz;
+	}
+	if (head.substr(0, 4) == std::string_view("\x28\xb5\x2f\xfd", 4)) {
+		return Compression::Zstd;
+	}
+	return Compression::None;
+}
+
+const char* compressionName(Compression kind)
+{
+	switch (kind) {
+	case Compression::Gzip:
+		return "gzip";
+	case Compression::Xz:
+		return "xz";
+	case Compression::Zstd:
+		return "zstd";
+	case Compression::None:
+		break;
+	}
+	return "none";
+}
+
+bool canDecompress(Compression kind)
+{
+	switch (kind) {
+	case Compression::Gzip:
+		return DIRSCAN_HAVE_ZLIB != 0;
+	case Compression::Xz:
+		return DIRSCAN_HAVE_LZMA != 0;
+	case Compression::Zstd:
+		return DIRSCAN_HAVE_ZSTD != 0;
+	case Compression::None:
+		break;
+	}
+	return false;
+}
+
+bool decompress(Compression kind, std::string_view input, FileBuffer& output, size_t limit, std::string& error)
+{
+	StageTimer timer(Stage::Decompress);
+	output.size = 0;
+	switch (kind) {
+#if DIRSCAN_HAVE_ZLIB
+	case Compression::Gzip:
+		return inflateGzip(input, output, limit, error);
+#endif
+#if DIRSCAN_HAVE_LZMA
+	case Compression::Xz:
+		return inflateXz(input, output, limit, error);
+#endif
+#if DIRSCAN_HAVE_ZSTD
+	case Compression::Zstd:
+		return inflateZstd(input, output, limit, error);
+#endif
+	case Compression::None:
+		error = "not a compressed file";
+		return false;
+	default:
+		break;
+	}
+	error = std::string(compressionName(kind)) + " support was not built in";
+	return false;
+}
+
+DecompressStage::DecompressStage(BoundedFileQueue& input, BoundedQueue<LoadedFile>& output, size_t limit)
+	: input_(input), output_(output), limit_(limit)
+{
+}
+
+void DecompressStage::run(const std::function<void(const std::string&)>& onError)
+{
+	std::string error;
+	FileReader reader; // maps large files, so the compressed bytes are never copied
+	PathRef path;
+	while (input_.pop(path)) {
+		LoadedFile file;
+		file.buffer = takeBuffer();
+		if (!inflate(path, reader, file.buffer, error)) {
+			onError(error);
+			recycle(file);
+			continue;
+		}
+		file.path = std::move(path);
+		file.loaded = true;
+		output_.push(std::move(file));
+	}
+}
+
+bool DecompressStage::inflate(const PathRef& path, FileReader& reader, FileBuffer& output, std::string& error) const
+{
+	if (!reader.open(path.c_str(), error)) {
+		return false;
+	}
+	const bool inflated = decompress(detectCompression(reader.contents()), reader.contents(), output, limit_, error);
+	reader.close();
+	if (!inflated) {
+		error = "Could not decompress: " + path.toPath().string() + " - " + error;
+	}
+	return inflated;
+}
+
+FileBuffer DecompressStage::takeBuffer()
+{
+	std::lock_guard<std::mutex> lock(poolMutex_);
+	if (pool_.empty()) {
+		return FileBuffer{};
+	}
+	FileBuffer buffer = std::move(pool_.back());
+	pool_.pop_back();
+	return buffer;
+}
+
+void DecompressStage::recycle(LoadedFile& file)
+{
+	if (!file.buffer.data || file.buffer.capacity > kMaxPooledBuffer) {
+		file.buffer = FileBuffer{};
+		return;
+	}
+	file.buffer.size = 0;
+	std::lock_guard<std::mutex> lock(poolMutex_);
+	pool_.push_back(std::move(file.buffer));
+}
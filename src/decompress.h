@@ -0,0 +1,87 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "async_reader.h"
+#include "bounded_file_queue.h"
+#include "file_reader.h"
+
+/**
+ * @brief Compressed formats recognized by their magic bytes.
+ */
+enum class Compression { None, Gzip, Xz, Zstd };
+
+/**
+ * @brief The format of a file whose contents begin with 'head', or None.
+ */
+Compression detectCompression(std::string_view head);
+
+const char* compressionName(Compression kind);
+
+/**
+ * @brief True if this build can decompress 'kind' (zlib, liblzma and libzstd
+ *        are each optional at configure time).
+ */
+bool canDecompress(Compression kind);
+
+/**
+ * @brief Streams 'input' through the decoder for 'kind' into 'output',
+ *        growing it as the data comes out. Concatenated gzip members and xz or
+ *        zstd frames are decoded in sequence.
+ * @param limit Largest decompressed size accepted; more is an error (guards
+ *              against decompression bombs)
+ * @param error Receives a description of the problem on failure
+ */
+bool decompress(Compression kind, std::string_view input, FileBuffer& output, size_t limit,
+                std::string& error);
+
+/**
+ * @brief Pipeline stage between the matcher threads and themselves: workers
+ *        hand it the paths of files they found to be compressed, and it hands
+ *        back the decompressed contents, so inflating one file overlaps with
+ *        matching others. run() is called on each of the stage's threads.
+ *        Buffers come from a pool that the matcher threads refill through
+ *        recycle().
+ */
+class DecompressStage {
+public:
+    static constexpr size_t kDefaultLimit = size_t(1) << 30; // 1 GiB
+
+    DecompressStage(BoundedFileQueue& input, BoundedQueue<LoadedFile>& output,
+                    size_t limit = kDefaultLimit);
+
+    DecompressStage(const DecompressStage&) = delete;
+    DecompressStage& operator=(const DecompressStage&) = delete;
+
+    /**
+     * @brief Decompresses files until 'input' is finished and drained, reporting
+     *        unreadable or corrupt ones to 'onError'. Does not finish 'output'.
+     */
+    void run(const std::function<void(const std::string&)>& onError);
+
+    /**
+     * @brief Returns a consumed file's buffer to the pool. Thread-safe.
+     */
+    void recycle(LoadedFile& file);
+
+private:
+    // Buffers larger than this are freed rather than pooled
+    static constexpr size_t kMaxPooledBuffer = size_t(64) << 20;
+
+    FileBuffer takeBuffer();
+    bool inflate(const PathRef& path, FileReader& reader, FileBuffer& output, std::string& error) const;
+
+    BoundedFileQueue& input_;
+    BoundedQueue<LoadedFile>& output_;
+    size_t limit_;
+
+    std::mutex poolMutex_;
+    std::vector<FileBuffer> pool_;
+};
+
+#endif // DECOMPRESS_H
@@ -1,222 +1,27 @@
-#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <filesystem>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <optional>
-#include <regex>
-#include <sstream>
+#include <string>
 #include <thread>
-#include <vector>
-#include "bounded_file_queue.h"
 #include "dirscan.h"
-
-struct StatusData {
-	size_t filesScanned = 0;
-	std::string currentFile;
-	size_t fileHits = 0;
-	size_t totalHits = 0;
-	std::string lastError = "none";
-};
-
-static StatusData g_status;
-static std::mutex g_statusMutex;
-static std::mutex g_outputMutex;
-static std::mutex g_resultsMutex;  // Protects g_resultsFile
-static std::ofstream g_resultsFile;
-static std::atomic<size_t> g_filesProcessed{ 0 };
-
-// Clear screen & print table
-static void printStatusTable()
-{
-	std::cout << "\033[2J\033[H"; // ANSI: clear and move cursor home
-	std::cout
-		<< "----------------------------------------------------\n"
-		<< "| Files Scanned: " << g_status.filesScanned << "\n"
-		<< "| Current File:  " << g_status.currentFile << "\n"
-		<< "| Total hits:    " << g_status.totalHits << "\n"
-		<< "|                                                  \n"
-		<< "| Last Error:    " << g_status.lastError << "\n"
-		<< "----------------------------------------------------\n";
-	std::cout.flush();
-}
-
-static std::string sanitizeLine(const std::string& line)
-{
-	std::ostringstream oss;
-	oss << std::noshowbase << std::hex; // Setup hex output without "0x"
-
-	for (unsigned char c : line) {
-		// If it's a normal printable ASCII character (excluding DEL = 127),
-		// or space/tab, keep as-is:
-		if ((c >= 32 && c < 127) || c == '\t') {
-			oss << c;
-		}
-		else {
-			// Otherwise, escape as \x?? with two hex digits
-			oss << "\\x" << std::setw(2) << std::setfill('0') << (int)c;
-		}
-	}
-	return oss.str();
-}
-
-/**
- * @brief Truncates a line around a match, and highlights the match.
- * @param line The line of text to process
- * @param query The query string to match
- * @param maxContext Maximum number of characters to include around the match
- * @return A new string with the match highlighted, and possibly truncated.
- */
-static std::string truncateAndHighlightMatch(const std::string& line,
-	const std::string& query,
-	size_t maxContext = 160)
-{
-	// Find where the query first appears
-	size_t pos = line.find(query);
-	if (pos == std::string::npos) {
-		// No match found in this line.
-		// Optionally truncate line if it's very long,
-		// but here let's just return it uncolored:
-		if (line.size() > maxContext) {
-			return line.substr(0, maxContext) + "...(truncated)";
-		}
-		return line;
-	}
-
-	// We have a match. Let's define how many chars to include around the match.
-	// Example: we want 80 chars before, plus the match, plus 80 after = 160 total
-	// or up to line boundaries.
-	size_t contextRadius = maxContext / 2; // e.g. 80 if maxContext=160
-
-	// Calculate start index of the snippet
-	// Make sure we don't go beyond the beginning:
-	size_t start = (pos > contextRadius) ? pos - contextRadius : 0;
-
-	// Calculate the end index
-	// We'll at least include the entire match, plus some context after.
-	size_t end = pos + query.size() + contextRadius;
-	if (end > line.size()) {
-		end = line.size();
-	}
-
-	// Extract the snippet
-	std::string snippet = line.substr(start, end - start);
-
-	// For clarity, if we truncated from the left:
-	bool truncatedLeft = (start > 0);
-	// If we truncated from the right:
-	bool truncatedRight = (end < line.size());
-
-	// Insert the color codes into the snippet for the match
-	// But note: 'pos' was relative to the entire line,
-	// we need its position in the snippet:
-	size_t snippetMatchPos = pos - start;
-
-	// Insert reset code after the match
-	snippet.insert(snippetMatchPos + query.size(), "\033[0m");
-	// Insert red code before the match
-	snippet.insert(snippetMatchPos, "\033[31m");
-
-	// Append some indicator if truncated
-	if (truncatedLeft) {
-		snippet = "... " + snippet;
-	}
-	if (truncatedRight) {
-		snippet += " ...";
-	}
-
-	return snippet;
-}
-
-/**
- * @brief Reads a file line by line, searching for a query (regex or substring).
- *        If matched, prints the result to stdout.
- */
-static void searchInFile(const std::filesystem::path& filePath,
-	const std::string& query,
-	bool use_regex)
-{
-	// Attempt to open file
-	std::ifstream ifs(filePath, std::ios::binary);
-	if (!ifs.is_open()) {
-		std::lock_guard<std::mutex> lock(g_statusMutex);
-		g_status.lastError = "Could not open: " + filePath.string();
-		return;
-	}
-
-	// Prepare regex if needed
-	std::regex pattern;
-	if (use_regex) {
-		try {
-			pattern = std::regex(query);
-		}
-		catch (const std::regex_error&) {
-			std::lock_guard<std::mutex> lock(g_statusMutex);
-			g_status.lastError = "Invalid regex: " + query;
-			return;
-		}
-	}
-
-	// A local container for lines that matched
-	struct MatchInfo {
-		size_t lineNumber;
-		std::string text;
-	};
-	std::vector<MatchInfo> matches;
-	matches.reserve(100); // arbitrary
-
-	std::string line;
-	size_t lineNumber = 1;
-	while (std::getline(ifs, line)) {
-		bool found = false;
-		if (use_regex) {
-			if (std::regex_search(line, pattern)) {
-				found = true;
-			}
-		}
-		else {
-			if (line.find(query) != std::string::npos) {
-				found = true;
-			}
-		}
-
-		if (found) {
-			// Use our new function, with a 180-char window around the match
-			std::string snippet = truncateAndHighlightMatch(line, query, 180);
-			snippet = sanitizeLine(snippet);
-			matches.push_back(MatchInfo{ lineNumber, std::move(snippet) });
-
-			// Update status counters
-			{
-				std::lock_guard<std::mutex> lock(g_statusMutex);
-				g_status.fileHits++;
-				g_status.totalHits++;
-			}
-		}
-		++lineNumber;
-	}
-
-	g_filesProcessed.fetch_add(1, std::memory_order_relaxed);
-
-	{
-		std::lock_guard<std::mutex> lock(g_statusMutex);
-		g_status.filesScanned++; // done scanning this file
-	}
-
-	// If we found any matches, write them to the results file
-	if (!matches.empty()) {
-		std::lock_guard<std::mutex> outLock(g_resultsMutex);
-		g_resultsFile << "Matches in file: " << filePath.string()
-			<< " (" << matches.size() << " hits)\n";
-		for (auto& m : matches) {
-			g_resultsFile << "    Line " << m.lineNumber << ": "
-				<< m.text << "\n";
-		}
-		g_resultsFile << "\n"; // extra blank line
-		g_resultsFile.flush();
-	}
-}
+#include "result_writer.h"
+#include "scanner.h"
+#include "stage_timer.h"
+#include "status_display.h"
+#include "structured_output.h"
+#include "text_output.h"
+#include "trigram_index.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 /**
  * @brief Recursively scans the specified directory, searching files for a query.
@@ -224,180 +29,191 @@ static void searchInFile(const std::filesystem::path& filePath,
  * @param directory Path of directory to search
  * @param use_regex If true, 'query' is interpreted as a regular expression
  * @param filePattern If present, a wildcard like "*.txt", "*.cpp", etc.
+ * @param orderedOutput If true, results are written sorted by file path
  */
 void searchInDirectory(const std::string& query,
 	const std::filesystem::path& directory,
 	bool use_regex,
-	const std::optional<std::string>& filePattern)
+	const std::optional<std::string>& filePattern,
+	bool orderedOutput)
 {
-	// Open results file (overwrite if it existed).
-	{
-		std::lock_guard<std::mutex> lock(g_resultsMutex);
-		g_resultsFile.open("search_results.txt", std::ios::out | std::ios::trunc);
-		if (!g_resultsFile.is_open()) {
-			std::cerr << "Error: Could not open search_results.txt for writing.\n";
+	ScanOptions options;
+	options.query = query;
+	options.useRegex = use_regex;
+	options.filePattern = filePattern;
+	searchInDirectory(options, directory, orderedOutput);
+}
+
+namespace {
+
+// Runs 'scan' (a Scanner or a ClusterScan) over 'directory' with the results
+// file, the writer thread and the status display that 'output' and
+// 'progress' ask for.
+template <typename Scan>
+void runWithOutput(Scan& scan, const ScanOptions& options,
+	const std::filesystem::path& directory,
+	bool orderedOutput,
+	ProgressMode progress,
+	const OutputOptions& output)
+{
+	std::string error;
+
+	// Time the stages of every thread from here on (the writer's included)
+	std::unique_ptr<StageProfile> profile;
+	if (output.stats || output.tracePath) {
+		profile = std::make_unique<StageProfile>(output.tracePath.has_value());
+	}
+	ProfileScope profileScope(profile.get(), "main");
+
+	// Open the results file (overwrite if it existed), or use stdout for "-"
+	const bool structured = output.format != OutputFormat::Text;
+	const std::filesystem::path resultsPath = output.path ? *output.path
+		: structured ? std::filesystem::path("-") : std::filesystem::path("search_results.txt");
+	const bool toStdout = resultsPath == "-";
+	std::ofstream resultsFile;
+	if (!toStdout) {
+		resultsFile.open(resultsPath, std::ios::out | std::ios::trunc | std::ios::binary);
+		if (!resultsFile.is_open()) {
+			std::cerr << "Error: Could not open " << resultsPath.string() << " for writing.\n";
 			return;
 		}
 	}
+#ifdef _WIN32
+	else {
+		_setmode(_fileno(stdout), _O_BINARY); // no \r\n translation in records
+	}
+#endif
+	std::ostream& results = toStdout ? std::cout : resultsFile;
 
-	// 1. Create a bounded queue with a capacity to handle concurrency without storing everything
-	const size_t MAX_QUEUE_SIZE = 10000;  // tune as needed
-	BoundedFileQueue fileQueue(MAX_QUEUE_SIZE);
+	// All result output goes through one writer thread. Records on stdout are
+	// usually read as they come, so they are streamed rather than buffered.
+	ResultWriter resultWriter(results, orderedOutput, structured && toStdout);
+	std::unique_ptr<ScanHandler> handler;
+	if (structured) {
+		handler = std::make_unique<StructuredResultHandler>(resultWriter, output.format,
+			options.filesWithMatches, options.patterns.size() > 1, output.maxLineBytes);
+	}
+	else {
+		handler = std::make_unique<TextResultHandler>(resultWriter, options.filesWithMatches, options.patterns);
+	}
 
-	// Pre-build a regex for the wildcard pattern if specified
-	std::optional<std::regex> wildcardRegex;
-	if (filePattern.has_value()) {
-		try {
-			wildcardRegex = std::regex(wildcardToRegex(filePattern.value()),
-				std::regex::icase); // 'icase' for case-insensitive, if desired
+	// Monitor thread: draws the status every interval. The counters are read
+	// without locks; the error text only when the error count moved. With the
+	// results on stdout, the status goes to stderr.
+	std::ostream& statusOut = toStdout ? std::cerr : std::cout;
+	StatusRenderer renderer(statusOut, progress, isTerminal(toStdout ? stderr : stdout));
+	std::string lastError = scan.lastError();
+	size_t errorsSeen = 0;
+	auto draw = [&](bool final) {
+		StatusSnapshot status = scan.progress();
+		if (status.errors != errorsSeen) {
+			errorsSeen = status.errors;
+			lastError = scan.lastError();
 		}
-		catch (const std::exception& e) {
-			std::lock_guard<std::mutex> lock(g_outputMutex);
-			std::cerr << "Error: Invalid file pattern: " << filePattern.value()
-				<< " - " << e.what() << std::endl;
-			// We could return early or ignore the pattern. Here, let's just return.
-			return;
+		if (final) {
+			renderer.finish(status, lastError);
 		}
-	}
+		else {
+			renderer.update(status, lastError);
+		}
+	};
 
-	// Monitor thread: prints status in interval
+	std::mutex doneMutex;
+	std::condition_variable doneChanged;
+	bool done = false;
 	std::thread monitor([&]() {
 		using namespace std::chrono_literals;
-		while (true) {
-			std::this_thread::sleep_for(500ms);
-			bool done = fileQueue.isFinished() && fileQueue.isEmpty();
-			{
-				std::lock_guard<std::mutex> lock(g_statusMutex);
-				printStatusTable();
-			}
-			if (done) {
-				break;
-			}
+		std::unique_lock<std::mutex> lock(doneMutex);
+		while (!doneChanged.wait_for(lock, 500ms, [&] { return done; })) {
+			draw(false);
 		}
 		});
 
-	// Producer thread enumerates the directory
-	std::thread producer([&]() {
-		try {
-			for (auto& entry : std::filesystem::recursive_directory_iterator(
-				directory,
-				std::filesystem::directory_options::skip_permission_denied))
-			{
-				try {
-					if (!entry.is_regular_file()) {
-						continue;
-					}
-					const auto& filePath = entry.path();
+	scan.run(directory, *handler);
 
-					auto u8name = filePath.filename().u8string();  // yields a std::u8string
-					// Convert std::u8string -> std::string (raw bytes in UTF-8)
-					std::string normalName(u8name.begin(), u8name.end());
-
-					if (wildcardRegex.has_value()) {
-						if (!matchesWildcard(normalName, wildcardRegex.value())) {
-							continue;
-						}
-					}
-					fileQueue.push(filePath);
-				}
-				catch (std::exception& e) {
-					std::lock_guard<std::mutex> lock(g_statusMutex);
-					auto u8 = entry.path().u8string();  // std::u8string
-					std::string pathStr(u8.begin(), u8.end());  // convert to std::string by copying raw bytes
-					g_status.lastError = "Error reading an entry: " + pathStr + "/n" + e.what();
-				}
-			}
-		}
-		catch (std::exception& ex) {
-			std::lock_guard<std::mutex> lock(g_statusMutex);
-			g_status.lastError = "Error scanning directory: " + directory.string() + "/n" + ex.what();
-		}
-		fileQueue.setFinished();
-		});
+	{
+		std::lock_guard<std::mutex> lock(doneMutex);
+		done = true;
+	}
+	doneChanged.notify_one();
+	monitor.join();
 
-	// 2. Spawn consumer (worker) threads
-	unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
-	std::vector<std::thread> workers;
-	workers.reserve(numThreads);
+	// Write out what is left and stop the writer thread
+	resultWriter.finish();
 
-	for (unsigned int i = 0; i < numThreads; ++i) {
-		workers.emplace_back([&]() {
-			while (true) {
-				std::filesystem::path filePath;
-				if (!fileQueue.pop(filePath)) {
-					break;
-				}
+	draw(true);
 
-				{
-					std::lock_guard<std::mutex> lock(g_statusMutex);
-					auto u8 = filePath.u8string();  // std::u8string
-					g_status.currentFile = std::string(u8.begin(), u8.end());
-					g_status.fileHits = 0; // reset each time we start a new file
-				}
-				searchInFile(filePath, query, use_regex);
-			}
-			});
+	if (output.stats) {
+		profile->writeReport(statusOut);
 	}
-
-	// 3. Wait for producer to finish
-	producer.join();
-
-	// 4. Wait for all consumers
-	for (auto& w : workers) {
-		w.join();
+	if (output.tracePath && !profile->writeTrace(*output.tracePath, error)) {
+		std::cerr << "Error: " << error << std::endl;
 	}
+}
 
-	// Wait for monitor
-	monitor.join();
+} // namespace
 
-	// Optionally print a final summary
-	{
-		std::lock_guard<std::mutex> lock(g_statusMutex);
-		printStatusTable();
+void searchInDirectory(const ScanOptions& options,
+	const std::filesystem::path& directory,
+	bool orderedOutput,
+	ProgressMode progress,
+	const OutputOptions& output)
+{
+	// Compile the query and file pattern once, before anything is opened
+	std::string error;
+	std::unique_ptr<Scanner> scanner = Scanner::create(options, error);
+	if (!scanner) {
+		std::cerr << "Error: " << error << std::endl;
+		return;
 	}
+	runWithOutput(*scanner, options, directory, orderedOutput, progress, output);
 }
 
-
-static std::string wildcardToRegex(const std::string& wildcard)
+bool searchCluster(const ScanOptions& options,
+	const ClusterOptions& cluster,
+	const std::filesystem::path& directory,
+	bool orderedOutput,
+	ProgressMode progress,
+	const OutputOptions& output)
 {
-	std::string regexStr;
-	regexStr.reserve(wildcard.size() * 2 + 2);
-	regexStr.append("^"); // match start of string
+	std::string error;
+	std::unique_ptr<ClusterScan> scan = ClusterScan::create(options, cluster, error);
+	if (!scan) {
+		std::cerr << "Error: " << error << std::endl;
+		return false;
+	}
+	runWithOutput(*scan, options, directory, orderedOutput, progress, output);
+	if (!scan->served()) {
+		std::cerr << "Error: no agent served the scan (last error: " << scan->lastError() << ")" << std::endl;
+		return false;
+	}
+	return true;
+}
 
-	for (char c : wildcard) {
-		switch (c) {
-		case '*':
-			// .* => matches zero or more of any character
-			regexStr.append(".*");
-			break;
-		case '?':
-			// . => matches exactly one of any character
-			regexStr.append(".");
-			break;
-			// Escape regex special characters
-		case '.':
-		case '\\':
-		case '+':
-		case '^':
-		case '$':
-		case '(':
-		case ')':
-		case '{':
-		case '}':
-		case '[':
-		case ']':
-		case '|':
-		case '/':
-			regexStr.push_back('\\');
-			regexStr.push_back(c);
-			break;
-		default:
-			// Ordinary character
-			regexStr.push_back(c);
-			break;
-		}
-	}
+bool serveAgent(const AgentOptions& options)
+{
+	std::string error;
+	std::unique_ptr<ScanAgent> agent = ScanAgent::create(options, error);
+	if (!agent) {
+		std::cerr << "Error: " << error << std::endl;
+		return false;
+	}
+	std::cout << "Serving " << options.root.string() << " on port " << agent->port() << std::endl;
+	agent->serve();
+	return true;
+}
 
-	regexStr.append("$"); // match end of string
-	return regexStr;
-}
\ No newline at end of file
+bool buildSearchIndex(const std::filesystem::path& directory,
+	const std::filesystem::path& indexPath)
+{
+	std::string error;
+	TrigramIndex::BuildStats stats;
+	unsigned numThreads = std::max(1u, std::thread::hardware_concurrency());
+	if (!TrigramIndex::build(directory, indexPath, numThreads, stats, error)) {
+		std::cerr << "Error: " << error << std::endl;
+		return false;
+	}
+	std::cout << "Indexed " << stats.files << " files (" << stats.bytes << " bytes, "
+		<< stats.trigrams << " trigrams) into " << indexPath.string() << "\n";
+	return true;
+}
@@ -3,51 +3,84 @@
 
 #include <string>
 #include <filesystem>
-#include <vector>
 #include <optional>
-#include <regex>
-
-
-/**
- * @brief Convert a wildcard pattern (e.g. "*.txt") to a std::regex string (e.g. "^.*\\.txt$")
- *
- * Supported wildcards:
- *   - `*` matches zero or more characters (except directory separators)
- *   - `?` matches exactly one character
- *
- * @param wildcard A string containing the wildcard expression.
- * @return A valid std::string that can be used to construct a std::regex.
- */
-static std::string wildcardToRegex(const std::string& wildcard);
-
-/**
- * @brief Helper function that checks if a given filename matches a wildcard (e.g. "*.txt").
- * @param filename The filename to test.
- * @param wildcardRegex A pre-built regex from wildcardToRegex().
- * @return true if it matches, false otherwise.
- */
-static bool matchesWildcard(const std::string& filename, const std::regex& wildcardRegex) {
-    return std::regex_match(filename, wildcardRegex);
-}
-
-static void searchInFile(const std::filesystem::path& filePath,
-                         const std::string& query,
-                         bool use_regex);
+#include "cluster.h"
+#include "scanner.h"
+#include "status_display.h"
+#include "structured_output.h"
 
 
 /**
  * @brief Recursively scans the specified directory, searching files for a query.
+ *        Matches are written to search_results.txt in the current directory and
+ *        a status table is shown on stdout while the scan runs (on a terminal). For in-process
+ *        use without file output, see Scanner in scanner.h.
  * @param query Substring or regex query
  * @param directory Path of directory to search
  * @param use_regex If true, 'query' is interpreted as a regular expression
  * @param filePattern If present, a wildcard like "*.txt", "*.cpp", etc.
+ * @param orderedOutput If true, results are written sorted by file path once
+ *        the scan finishes; otherwise they stream out as workers fill buffers.
  */
 void searchInDirectory(const std::string& query,
                        const std::filesystem::path& directory,
                        bool use_regex,
-                       const std::optional<std::string>& filePattern);
+                       const std::optional<std::string>& filePattern,
+                       bool orderedOutput = false);
 
+/**
+ * @brief Where and how searchInDirectory writes its results.
+ */
+struct OutputOptions {
+    OutputFormat format = OutputFormat::Text;
+    std::optional<std::filesystem::path> path; // "-" = stdout; default search_results.txt
+                                               // for Text, stdout for the other formats
+    size_t maxLineBytes = 0;                   // Structured formats: cut lines; 0 = full lines
+    bool stats = false;                        // Print per-stage timings at the end (stage_timer.h)
+    std::optional<std::filesystem::path> tracePath; // Write a Chrome trace of the scan's threads
+};
 
+/**
+ * @brief Same as above, with every Scanner option available.
+ * @param progress How progress is shown on stdout (see status_display.h). By
+ *        default the table is redrawn in place on a terminal, and only the
+ *        final summary is printed when stdout is a pipe or a file.
+ * @param output Result format and destination; when it is stdout, progress
+ *        is shown on stderr instead.
+ */
+void searchInDirectory(const ScanOptions& options,
+                       const std::filesystem::path& directory,
+                       bool orderedOutput = false,
+                       ProgressMode progress = ProgressMode::Auto,
+                       const OutputOptions& output = OutputOptions());
+
+/**
+ * @brief Same as above, spread over remote agents (see ClusterScan in
+ *        cluster.h). 'directory' is relative to each agent's root; results
+ *        and progress are shown as for a local scan.
+ * @return false (the error is printed) if the scan could not be set up or
+ *         no agent served any of it (see ClusterScan::served()).
+ */
+bool searchCluster(const ScanOptions& options,
+                   const ClusterOptions& cluster,
+                   const std::filesystem::path& directory,
+                   bool orderedOutput = false,
+                   ProgressMode progress = ProgressMode::Auto,
+                   const OutputOptions& output = OutputOptions());
 
+/**
+ * @brief Runs a scan agent for ClusterScan coordinators (--agent) until the
+ *        process is stopped.
+ * @return false if it could not start (the error is printed).
+ */
+bool serveAgent(const AgentOptions& options);
+
+/**
+ * @brief Writes a trigram index of 'directory' to 'indexPath' for later scans
+ *        with ScanOptions::indexPath (--index), and prints a summary.
+ * @return false if the index could not be written (the error is printed).
+ */
+bool buildSearchIndex(const std::filesystem::path& directory,
+                      const std::filesystem::path& indexPath);
 
 #endif // GREP_H
@@ -0,0 +1,266 @@
+#include "file_reader.h"
+
+#include <cstring>
+#include "stage_timer.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr size_t kMinBufferSize = 64 * 1024;
+
+// Minimal RAII wrapper around the platform's file handle.
+class NativeFile {
+public:
+	explicit NativeFile(const std::filesystem::path::value_type* path)
+	{
+#ifdef _WIN32
+		handle_ = CreateFileW(path, GENERIC_READ,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+#else
+		fd_ = ::open(path, O_RDONLY | O_CLOEXEC);
+#endif
+	}
+
+	~NativeFile()
+	{
+#ifdef _WIN32
+		if (handle_ != INVALID_HANDLE_VALUE) {
+			CloseHandle(handle_);
+		}
+#else
+		if (fd_ >= 0) {
+			::close(fd_);
+		}
+#endif
+	}
+
+	NativeFile(const NativeFile&) = delete;
+	NativeFile& operator=(const NativeFile&) = delete;
+
+	bool isOpen() const
+	{
+#ifdef _WIN32
+		return handle_ != INVALID_HANDLE_VALUE;
+#else
+		return fd_ >= 0;
+#endif
+	}
+
+	// Size reported by the filesystem; may be 0 for pseudo-files.
+	size_t size() const
+	{
+#ifdef _WIN32
+		LARGE_INTEGER size;
+		return GetFileSizeEx(handle_, &size) ? static_cast<size_t>(size.QuadPart) : 0;
+#else
+		struct stat st;
+		return fstat(fd_, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+#endif
+	}
+
+	// Maps the first 'size' bytes read-only; nullptr on failure.
+	void* map(size_t size) const
+	{
+#ifdef _WIN32
+		HANDLE mapping = CreateFileMappingW(handle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr) {
+			return nullptr;
+		}
+		void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+		CloseHandle(mapping); // the view keeps the mapping alive
+		return view;
+#else
+		void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd_, 0);
+		if (view == MAP_FAILED) {
+			return nullptr;
+		}
+		madvise(view, size, MADV_SEQUENTIAL);
+		return view;
+#endif
+	}
+
+	// Reads up to 'size' bytes; returns the count, 0 at EOF, or -1 on error.
+	long long read(char* dest, size_t size) const
+	{
+#ifdef _WIN32
+		DWORD chunk = size > 0x40000000 ? 0x40000000 : static_cast<DWORD>(size);
+		DWORD got = 0;
+		if (!ReadFile(handle_, dest, chunk, &got, nullptr)) {
+			return -1;
+		}
+		return got;
+#else
+		while (true) {
+			ssize_t got = ::read(fd_, dest, size);
+			if (got >= 0 || errno != EINTR) {
+				return got;
+			}
+		}
+#endif
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE handle_ = INVALID_HANDLE_VALUE;
+#else
+	int fd_ = -1;
+#endif
+};
+
+void unmap(void* view, size_t size)
+{
+#ifdef _WIN32
+	(void)size;
+	UnmapViewOfFile(view);
+#else
+	munmap(view, size);
+#endif
+}
+
+} // namespace
+
+FileReader::FileReader(size_t mmapThreshold)
+	: mmapThreshold_(mmapThreshold)
+{
+}
+
+FileReader::~FileReader()
+{
+	close();
+}
+
+void FileReader::close()
+{
+	if (mapping_ != nullptr) {
+		unmap(mapping_, mappedSize_);
+		mapping_ = nullptr;
+		mappedSize_ = 0;
+	}
+	contents_ = {};
+}
+
+void FileBuffer::reserve(size_t minCapacity, size_t keep)
+{
+	if (capacity >= minCapacity) {
+		return;
+	}
+	size_t newCapacity = capacity < kMinBufferSize ? kMinBufferSize : capacity;
+	while (newCapacity < minCapacity) {
+		newCapacity *= 2;
+	}
+	std::unique_ptr<char[]> grown(new char[newCapacity]);
+	if (keep > 0) {
+		std::memcpy(grown.get(), data.get(), keep);
+	}
+	data = std::move(grown);
+	capacity = newCapacity;
+}
+
+namespace {
+
+// Read to EOF rather than trusting the reported size: the file may be
+// growing, or a pseudo-file that reports 0.
+bool readToEnd(const NativeFile& file, size_t sizeHint, FileBuffer& buffer)
+{
+	buffer.size = 0;
+	buffer.reserve(sizeHint + 1, 0);
+	while (true) {
+		if (buffer.size == buffer.capacity) {
+			buffer.reserve(buffer.capacity * 2, buffer.size);
+		}
+		long long got = file.read(buffer.data.get() + buffer.size, buffer.capacity - buffer.size);
+		if (got < 0) {
+			return false;
+		}
+		if (got == 0) {
+			return true;
+		}
+		buffer.size += static_cast<size_t>(got);
+	}
+}
+
+// Only built for error messages, so the happy path never converts.
+std::string displayName(const std::filesystem::path::value_type* path)
+{
+	return std::filesystem::path(path).string();
+}
+
+} // namespace
+
+ReadStatus readWholeFile(const std::filesystem::path& path, FileBuffer& buffer,
+	size_t largeFile, std::string& error)
+{
+	return readWholeFile(path.c_str(), buffer, largeFile, error);
+}
+
+ReadStatus readWholeFile(const std::filesystem::path::value_type* path, FileBuffer& buffer,
+	size_t largeFile, std::string& error)
+{
+	StageTimer openTimer(Stage::Open);
+	NativeFile file(path);
+	if (!file.isOpen()) {
+		error = "Could not open: " + displayName(path);
+		return ReadStatus::Failed;
+	}
+	const size_t size = file.size();
+	openTimer.stop();
+	if (size >= largeFile && size > 0) {
+		return ReadStatus::TooLarge;
+	}
+	StageTimer readTimer(Stage::Read);
+	if (!readToEnd(file, size, buffer)) {
+		error = "Could not read: " + displayName(path);
+		return ReadStatus::Failed;
+	}
+	return ReadStatus::Read;
+}
+
+bool FileReader::open(const std::filesystem::path& path, std::string& error)
+{
+	return open(path.c_str(), error);
+}
+
+bool FileReader::open(const std::filesystem::path::value_type* path, std::string& error)
+{
+	close();
+
+	StageTimer openTimer(Stage::Open);
+	NativeFile file(path);
+	if (!file.isOpen()) {
+		error = "Could not open: " + displayName(path);
+		return false;
+	}
+	const size_t size = file.size();
+	openTimer.stop();
+
+	StageTimer readTimer(Stage::Read);
+	if (size >= mmapThreshold_ && size > 0) {
+		if (void* view = file.map(size)) {
+			mapping_ = view;
+			mappedSize_ = size;
+			contents_ = std::string_view(static_cast<const char*>(view), size);
+			return true;
+		}
+		// Mapping can fail (e.g. on some network filesystems); read it instead.
+	}
+
+	if (!readToEnd(file, size, buffer_)) {
+		error = "Could not read: " + displayName(path);
+		return false;
+	}
+	contents_ = buffer_.view();
+	return true;
+}
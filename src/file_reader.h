@@ -0,0 +1,86 @@
+#ifndef FILE_READER_H
+#define FILE_READER_H
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief A growable byte buffer that can be handed between threads.
+ */
+struct FileBuffer {
+    std::unique_ptr<char[]> data;
+    size_t capacity = 0;
+    size_t size = 0;    // bytes in use
+
+    // Grows to at least 'minCapacity' bytes, keeping the first 'keep' bytes.
+    void reserve(size_t minCapacity, size_t keep);
+
+    std::string_view view() const { return std::string_view(data.get(), size); }
+};
+
+enum class ReadStatus { Read, TooLarge, Failed };
+
+/**
+ * @brief Reads all of 'path' into 'buffer' with blocking reads, to EOF.
+ *        Files reporting a size of at least 'largeFile' bytes are left unread
+ *        (TooLarge), so callers can map them instead.
+ * @param error Receives a description of the problem on failure
+ */
+ReadStatus readWholeFile(const std::filesystem::path& path, FileBuffer& buffer,
+                         size_t largeFile, std::string& error);
+
+// Same, for a NUL-terminated native path (e.g. PathRef::c_str()), without a path copy.
+ReadStatus readWholeFile(const std::filesystem::path::value_type* path, FileBuffer& buffer,
+                         size_t largeFile, std::string& error);
+
+/**
+ * @brief Exposes a whole file as one contiguous byte range.
+ *
+ * Files at or above the mmap threshold are memory-mapped; smaller ones are
+ * read into a buffer that is owned by the reader and reused for every file,
+ * so a worker thread keeps one reader and allocates only when a file is
+ * larger than anything it has seen. Not thread-safe: use one per thread.
+ */
+class FileReader {
+public:
+    static constexpr size_t kDefaultMmapThreshold = 1 << 20; // 1 MiB
+
+    explicit FileReader(size_t mmapThreshold = kDefaultMmapThreshold);
+    ~FileReader();
+
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+
+    /**
+     * @brief Opens 'path' and loads or maps its contents, closing any previous file.
+     * @param error Receives a description of the problem on failure
+     * @return false if the file could not be opened or read.
+     */
+    bool open(const std::filesystem::path& path, std::string& error);
+    bool open(const std::filesystem::path::value_type* path, std::string& error);
+
+    /**
+     * @brief The bytes of the currently open file (valid until the next open/close).
+     */
+    std::string_view contents() const { return contents_; }
+
+    /**
+     * @brief True if the current file is memory-mapped rather than buffered.
+     */
+    bool isMapped() const { return mapping_ != nullptr; }
+
+    void close();
+
+private:
+    size_t mmapThreshold_;
+    FileBuffer buffer_;
+
+    std::string_view contents_;
+    void* mapping_ = nullptr;
+    size_t mappedSize_ = 0;
+};
+
+#endif // FILE_READER_H
@@ -0,0 +1,193 @@
+#include "file_search.h"
+
+#include <algorithm>
+#include <cstring>
+#include "matcher.h"
+
+namespace {
+
+// Leading bytes of formats that are never worth searching as text.
+constexpr std::string_view kBinaryMagic[] = {
+	std::string_view("\x7f" "ELF", 4),         // ELF executables and objects
+	std::string_view("\xcf\xfa\xed\xfe", 4),   // Mach-O (64-bit)
+	std::string_view("\x89" "PNG", 4),
+	std::string_view("GIF8", 4),
+	std::string_view("\xff\xd8\xff", 3),       // JPEG
+	std::string_view("PK\x03\x04", 4),         // zip, jar, docx, ...
+	// Compressed streams: the scanner decompresses them first where it can (decompress.h)
+	std::string_view("\x1f\x8b", 2),           // gzip
+	std::string_view("\xfd" "7zXZ", 5),        // xz
+	std::string_view("\x28\xb5\x2f\xfd", 4),   // zstd
+	std::string_view("7z\xbc\xaf\x27\x1c", 6),
+	std::string_view("%PDF-", 5),
+};
+
+} // namespace
+
+bool looksBinary(std::string_view data)
+{
+	for (std::string_view magic : kBinaryMagic) {
+		if (data.substr(0, magic.size()) == magic) {
+			return true;
+		}
+	}
+	const size_t probe = std::min(data.size(), kBinaryProbeSize);
+	return std::memchr(data.data(), '\0', probe) != nullptr;
+}
+
+size_t searchContents(std::string_view data,
+	const Matcher& matcher,
+	std::vector<LineMatch>& matches,
+	std::vector<MatchSpan>& spans,
+	WorkerStatus& status,
+	size_t maxMatches,
+	bool countLines)
+{
+	matches.clear();
+	spans.clear();
+
+	size_t lineNumber = 1;   // line number of the byte at 'counted'
+	size_t counted = 0;      // newlines before this offset are in lineNumber
+	size_t pos = 0;          // always the start of a line
+	while (pos < data.size()) {
+		size_t candidate = matcher.findCandidate(data, pos);
+		if (candidate == std::string_view::npos) {
+			break;
+		}
+
+		// Expand the candidate to its enclosing line [lineStart, lineEnd)
+		size_t lineStart = pos;
+		if (candidate > pos) {
+			size_t nl = data.rfind('\n', candidate - 1);
+			if (nl != std::string_view::npos && nl >= pos) {
+				lineStart = nl + 1;
+			}
+		}
+		size_t lineEnd = data.find('\n', candidate);
+		if (lineEnd == std::string_view::npos) {
+			lineEnd = data.size();
+		}
+		std::string_view line = data.substr(lineStart, lineEnd - lineStart);
+
+		const size_t firstSpan = spans.size();
+		if (size_t spanCount = matcher.findAll(line, spans)) {
+			lineNumber += static_cast<size_t>(
+				std::count(data.begin() + counted, data.begin() + lineStart, '\n'));
+			counted = lineStart;
+			matches.push_back(LineMatch{ lineNumber, line, firstSpan, spanCount, lineStart });
+
+			// Update status counters (thread-local, no lock)
+			status.addHit();
+			if (matches.size() == maxMatches) {
+				return 0; // the rest of 'data' is not needed
+			}
+		}
+		pos = lineEnd + 1;
+	}
+
+	if (!countLines) {
+		return 0;
+	}
+	return (lineNumber - 1) + static_cast<size_t>(std::count(data.begin() + counted, data.end(), '\n'));
+}
+
+ChunkedFile::ChunkedFile(std::filesystem::path path, std::unique_ptr<FileReader> reader, size_t chunkSize,
+	size_t maxMatches)
+	: path_(std::move(path)), reader_(std::move(reader)), maxMatches_(maxMatches)
+{
+	const std::string_view data = reader_->contents();
+	chunkSize = std::max<size_t>(chunkSize, 1);
+	size_t begin = 0;
+	while (begin < data.size()) {
+		size_t end = data.size();
+		if (data.size() - begin > chunkSize) {
+			size_t nl = data.find('\n', begin + chunkSize - 1);
+			end = nl == std::string_view::npos ? data.size() : nl + 1;
+		}
+		Chunk chunk;
+		chunk.data = data.substr(begin, end - begin);
+		chunk.offset = begin;
+		chunks_.push_back(std::move(chunk));
+		begin = end;
+	}
+	remaining_.store(chunks_.size(), std::memory_order_relaxed);
+}
+
+bool ChunkedFile::claim(size_t& index)
+{
+	if (next_.load(std::memory_order_relaxed) >= chunks_.size()) {
+		return false;
+	}
+	index = next_.fetch_add(1, std::memory_order_relaxed);
+	return index < chunks_.size();
+}
+
+bool ChunkedFile::search(size_t index, const Matcher& matcher, WorkerStatus& status)
+{
+	// Each chunk may find up to the limit; hits are counted once the merge
+	// has kept the first 'maxMatches_', so they agree with the lines reported
+	Chunk& chunk = chunks_[index];
+	WorkerStatus uncounted;
+	chunk.newlines = searchContents(chunk.data, matcher, chunk.matches, chunk.spans, uncounted, maxMatches_, true);
+	if (!completeChunk()) {
+		return false;
+	}
+	status.addHit(merged_.size());
+	return true;
+}
+
+bool ChunkedFile::completeChunk()
+{
+	// The release/acquire pair makes every chunk's results visible to the merger.
+	if (remaining_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+		return false;
+	}
+	size_t total = 0;
+	for (const auto& c : chunks_) {
+		total += c.matches.size();
+	}
+	if (maxMatches_ != 0) {
+		total = std::min(total, maxMatches_);
+	}
+	merged_.reserve(total);
+	size_t linesBefore = 0;
+	for (auto& c : chunks_) {
+		for (const auto& match : c.matches) {
+			if (merged_.size() < total) {
+				merged_.push_back(LineMatch{ linesBefore + match.lineNumber, match.line,
+					mergedSpans_.size(), match.spanCount, c.offset + match.offset });
+				mergedSpans_.insert(mergedSpans_.end(), c.spans.begin() + match.firstSpan,
+					c.spans.begin() + match.firstSpan + match.spanCount);
+			}
+		}
+		linesBefore += c.newlines;
+		std::vector<LineMatch>().swap(c.matches);
+		std::vector<MatchSpan>().swap(c.spans);
+	}
+	return true;
+}
+
+void ChunkBoard::publish(std::shared_ptr<ChunkedFile> file)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	files_.push_back(std::move(file));
+	published_.store(files_.size(), std::memory_order_release);
+}
+
+bool ChunkBoard::claim(std::shared_ptr<ChunkedFile>& file, size_t& index)
+{
+	if (empty()) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(mutex_);
+	while (!files_.empty()) {
+		if (files_.front()->claim(index)) {
+			file = files_.front();
+			return true;
+		}
+		// Every chunk is claimed; whoever searches the last one reports it.
+		files_.erase(files_.begin());
+		published_.store(files_.size(), std::memory_order_release);
+	}
+	return false;
+}
@@ -0,0 +1,146 @@
+#ifndef FILE_SEARCH_H
+#define FILE_SEARCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include "file_reader.h"
+#include "result_cache.h"
+#include "scanner.h"
+#include "worker_status.h"
+
+class Matcher;
+
+/**
+ * @brief Searches a whole buffer for the query and adds one hit to 'status'
+ *        per matching line. The matcher runs over the raw bytes; line
+ *        boundaries and line numbers are only worked out around candidates.
+ * @param matches Reused per-thread container; filled with views into 'data'
+ *        and line numbers counted from 1 at the start of 'data'.
+ * @param spans Reused per-thread container for the matches within each line.
+ *        Each line is run through the matcher once, for its spans.
+ * @param maxMatches Stop after this many matching lines; 0 = no limit.
+ * @param countLines If true, the newlines of all of 'data' are counted.
+ *        Not done if the search stopped at 'maxMatches'.
+ * @return The number of newlines in 'data' if 'countLines' is set, else 0.
+ */
+size_t searchContents(std::string_view data,
+                      const Matcher& matcher,
+                      std::vector<LineMatch>& matches,
+                      std::vector<MatchSpan>& spans,
+                      WorkerStatus& status,
+                      size_t maxMatches = 0,
+                      bool countLines = false);
+
+/**
+ * @brief Bytes looked at by looksBinary(), like git's and grep's heuristics.
+ */
+constexpr size_t kBinaryProbeSize = 8192;
+
+/**
+ * @brief Cheap binary-file check on the bytes already read: true if 'data'
+ *        starts with the magic number of a common binary format (executables,
+ *        images, archives, compressed streams, PDF) or has a NUL byte in its
+ *        first kBinaryProbeSize bytes. Only that prefix is touched, so a
+ *        memory-mapped file faults in one or two pages at most.
+ */
+bool looksBinary(std::string_view data);
+
+/**
+ * @brief One large file searched by several workers at once.
+ *
+ * The file is split into byte ranges of about 'chunkSize' that end just
+ * after a newline, so no line straddles two chunks. Workers claim chunks,
+ * search them independently and record each chunk's newline count; whoever
+ * completes the last chunk rebuilds the file's line numbers from those
+ * counts and reports the merged matches in line order.
+ *
+ * With a match limit each chunk stops at the limit, and the merge keeps the
+ * first 'maxMatches'. A chunk that stopped early leaves its newline count
+ * short, but then no later chunk's matches are needed.
+ */
+class ChunkedFile {
+public:
+    /**
+     * @brief Takes over 'reader', which holds the open file, and splits it.
+     * @param maxMatches Matching lines to report at most; 0 = no limit.
+     */
+    ChunkedFile(std::filesystem::path path, std::unique_ptr<FileReader> reader, size_t chunkSize,
+                size_t maxMatches = 0);
+
+    const std::filesystem::path& path() const { return path_; }
+    size_t chunkCount() const { return chunks_.size(); }
+
+    /**
+     * @brief Claims the next unsearched chunk; false once all are claimed.
+     */
+    bool claim(size_t& index);
+
+    /**
+     * @brief Searches chunk 'index'. The call that finishes the last chunk
+     *        adds the merged hits to 'status'.
+     * @return true for the call that finished the last chunk; merged() is
+     *         then complete and stays valid as long as this object.
+     */
+    bool search(size_t index, const Matcher& matcher, WorkerStatus& status);
+
+    /**
+     * @brief Marks a claimed chunk done without searching it, once the scan
+     *        was cancelled. Returns like search(), but merged() is incomplete.
+     */
+    bool skip() { return completeChunk(); }
+
+    const std::vector<LineMatch>& merged() const { return merged_; }
+    const std::vector<MatchSpan>& mergedSpans() const { return mergedSpans_; }
+
+    // Set by the creator; carried along for the result cache and the report.
+    FileStamp stamp;
+    bool stamped = false;
+    bool binary = false;
+
+private:
+    bool completeChunk();
+
+    struct Chunk {
+        std::string_view data;
+        size_t offset = 0;                 // of 'data' in the file
+        size_t newlines = 0;
+        std::vector<LineMatch> matches;    // line numbers and offsets relative to the chunk
+        std::vector<MatchSpan> spans;
+    };
+
+    std::filesystem::path path_;
+    std::unique_ptr<FileReader> reader_;   // keeps the bytes mapped
+    std::vector<Chunk> chunks_;
+    std::vector<LineMatch> merged_;
+    std::vector<MatchSpan> mergedSpans_;
+    size_t maxMatches_;
+    std::atomic<size_t> next_{ 0 };
+    std::atomic<size_t> remaining_;
+};
+
+/**
+ * @brief Chunked files with chunks left to claim, shared by all workers.
+ */
+class ChunkBoard {
+public:
+    void publish(std::shared_ptr<ChunkedFile> file);
+
+    /**
+     * @brief Claims a chunk of any published file; false if none is left.
+     */
+    bool claim(std::shared_ptr<ChunkedFile>& file, size_t& index);
+
+    bool empty() const { return published_.load(std::memory_order_acquire) == 0; }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<ChunkedFile>> files_;
+    std::atomic<size_t> published_{ 0 };   // files_.size(), readable without the lock
+};
+
+#endif // FILE_SEARCH_H
@@ -0,0 +1,292 @@
+#include "glob.h"
+
+namespace {
+
+// wildmatch-style results: the abort codes let a failed '*' give up early
+// instead of retrying every split point, which keeps matching polynomial.
+enum MatchResult { MATCH, NO_MATCH, ABORT_ALL, ABORT_TO_STARSTAR };
+
+inline char foldAscii(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+bool isSpecial(char c)
+{
+	return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+} // namespace
+
+std::optional<Glob> Glob::compile(std::string_view pattern, bool caseInsensitive, std::string& error)
+{
+	Glob glob;
+	glob.caseInsensitive_ = caseInsensitive;
+
+	std::string source(pattern);
+	// A bare extension (".txt") means "files with this extension".
+	if (source.size() > 1 && source[0] == '.' && source.find_first_of("*?[\\/") == std::string::npos) {
+		source.insert(source.begin(), '*');
+	}
+	if (source.empty()) {
+		error = "Empty file pattern";
+		return std::nullopt;
+	}
+	glob.matchesPath_ = source.find('/') != std::string::npos;
+
+	auto fold = [caseInsensitive](char c) { return caseInsensitive ? foldAscii(c) : c; };
+
+	for (size_t i = 0; i < source.size(); ++i) {
+		const char c = source[i];
+		if (c == '*') {
+			if (i + 1 < source.size() && source[i + 1] == '*') {
+				i++;
+				if (i + 1 < source.size() && source[i + 1] == '/') {
+					i++;
+					glob.tokens_.push_back({ TokenKind::StarStarSlash });
+				}
+				else {
+					glob.tokens_.push_back({ TokenKind::StarStar });
+				}
+				glob.matchesPath_ = true;
+			}
+			else {
+				glob.tokens_.push_back({ TokenKind::Star });
+			}
+		}
+		else if (c == '?') {
+			glob.tokens_.push_back({ TokenKind::Any });
+		}
+		else if (c == '[') {
+			std::bitset<256> set;
+			size_t j = i + 1;
+			bool negate = j < source.size() && (source[j] == '!' || source[j] == '^');
+			if (negate) {
+				j++;
+			}
+			bool first = true;
+			while (j < source.size() && (source[j] != ']' || first)) {
+				unsigned char lo = static_cast<unsigned char>(source[j]);
+				unsigned char hi = lo;
+				if (j + 2 < source.size() && source[j + 1] == '-' && source[j + 2] != ']') {
+					hi = static_cast<unsigned char>(source[j + 2]);
+					j += 2;
+				}
+				for (unsigned v = lo; v <= hi; ++v) {
+					set.set(v);
+					if (caseInsensitive) {
+						set.set(static_cast<unsigned char>(foldAscii(static_cast<char>(v))));
+					}
+				}
+				first = false;
+				j++;
+			}
+			if (j >= source.size()) {
+				error = "Unterminated '[' in file pattern: " + std::string(pattern);
+				return std::nullopt;
+			}
+			if (negate) {
+				set.flip();
+			}
+			set.reset('/');
+			glob.classes_.push_back(set);
+			glob.tokens_.push_back({ TokenKind::Class, 0, glob.classes_.size() - 1 });
+			i = j;
+		}
+		else if (c == '\\' && i + 1 < source.size()) {
+			glob.tokens_.push_back({ TokenKind::Literal, fold(source[++i]) });
+		}
+		else {
+			glob.tokens_.push_back({ TokenKind::Literal, fold(c) });
+		}
+	}
+
+	// Recognize the common shapes so they skip the token matcher.
+	const bool leadingStar = source[0] == '*' && (source.size() < 2 || source[1] != '*');
+	const bool trailingStar = source.back() == '*' && (source.size() < 2 || source[source.size() - 2] != '*');
+	std::string_view body(source);
+	if (leadingStar) {
+		body.remove_prefix(1);
+	}
+	else if (trailingStar) {
+		body.remove_suffix(1);
+	}
+	bool plain = true;
+	for (char b : body) {
+		plain = plain && !isSpecial(b);
+	}
+	if (plain && !glob.matchesPath_) {
+		glob.shape_ = leadingStar ? Shape::Suffix : trailingStar ? Shape::Prefix : Shape::Exact;
+		glob.fixed_.reserve(body.size());
+		for (char b : body) {
+			glob.fixed_.push_back(fold(b));
+		}
+	}
+	return glob;
+}
+
+bool Glob::equalsFolded(std::string_view a, std::string_view b) const
+{
+	if (a.size() != b.size()) {
+		return false;
+	}
+	if (!caseInsensitive_) {
+		return a == b;
+	}
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (foldAscii(a[i]) != b[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Glob::matches(std::string_view text) const
+{
+	switch (shape_) {
+	case Shape::Exact:
+		return equalsFolded(text, fixed_);
+	case Shape::Suffix:
+		return text.size() >= fixed_.size()
+			&& equalsFolded(text.substr(text.size() - fixed_.size()), fixed_);
+	case Shape::Prefix:
+		return text.size() >= fixed_.size()
+			&& equalsFolded(text.substr(0, fixed_.size()), fixed_)
+			&& text.find('/') == std::string_view::npos;
+	case Shape::Generic:
+		break;
+	}
+	return matchTokens(0, text, 0) == MATCH;
+}
+
+int Glob::matchTokens(size_t ti, std::string_view text, size_t pos) const
+{
+	for (; ti < tokens_.size(); ++ti) {
+		const Token& token = tokens_[ti];
+		switch (token.kind) {
+		case TokenKind::Literal: {
+			if (pos == text.size()) {
+				return ABORT_ALL;
+			}
+			char c = caseInsensitive_ ? foldAscii(text[pos]) : text[pos];
+			if (c != token.literal) {
+				return NO_MATCH;
+			}
+			pos++;
+			break;
+		}
+		case TokenKind::Any:
+			if (pos == text.size()) {
+				return ABORT_ALL;
+			}
+			if (text[pos] == '/') {
+				return NO_MATCH;
+			}
+			pos++;
+			break;
+		case TokenKind::Class:
+			if (pos == text.size()) {
+				return ABORT_ALL;
+			}
+			if (!classes_[token.classIndex].test(static_cast<unsigned char>(text[pos]))) {
+				return NO_MATCH;
+			}
+			pos++;
+			break;
+		case TokenKind::Star:
+			// Trailing '*' matches the rest unless it would have to cross a '/'.
+			if (ti + 1 == tokens_.size()) {
+				return text.find('/', pos) == std::string_view::npos ? MATCH : ABORT_TO_STARSTAR;
+			}
+			for (;; ++pos) {
+				int r = matchTokens(ti + 1, text, pos);
+				if (r != NO_MATCH) {
+					return r;
+				}
+				if (pos == text.size()) {
+					return ABORT_ALL;
+				}
+				if (text[pos] == '/') {
+					return ABORT_TO_STARSTAR;
+				}
+			}
+		case TokenKind::StarStar:
+			if (ti + 1 == tokens_.size()) {
+				return MATCH;
+			}
+			for (;; ++pos) {
+				int r = matchTokens(ti + 1, text, pos);
+				if (r != NO_MATCH && r != ABORT_TO_STARSTAR) {
+					return r;
+				}
+				if (pos == text.size()) {
+					return ABORT_ALL;
+				}
+			}
+		case TokenKind::StarStarSlash:
+			// Zero directories, then after each '/'.
+			while (true) {
+				int r = matchTokens(ti + 1, text, pos);
+				if (r != NO_MATCH && r != ABORT_TO_STARSTAR) {
+					return r;
+				}
+				size_t slash = text.find('/', pos);
+				if (slash == std::string_view::npos) {
+					return ABORT_ALL;
+				}
+				pos = slash + 1;
+			}
+		}
+	}
+	return pos == text.size() ? MATCH : NO_MATCH;
+}
+
+bool GlobSet::addPatterns(std::vector<Glob>& list, std::string_view patterns,
+	bool caseInsensitive, std::string& error)
+{
+	while (!patterns.empty()) {
+		size_t comma = patterns.find(',');
+		std::string_view one = patterns.substr(0, comma);
+		if (!one.empty()) {
+			std::optional<Glob> glob = Glob::compile(one, caseInsensitive, error);
+			if (!glob) {
+				return false;
+			}
+			list.push_back(std::move(*glob));
+		}
+		if (comma == std::string_view::npos) {
+			break;
+		}
+		patterns.remove_prefix(comma + 1);
+	}
+	return true;
+}
+
+bool GlobSet::addInclude(std::string_view patterns, bool caseInsensitive, std::string& error)
+{
+	return addPatterns(includes_, patterns, caseInsensitive, error);
+}
+
+bool GlobSet::addExclude(std::string_view patterns, bool caseInsensitive, std::string& error)
+{
+	return addPatterns(excludes_, patterns, caseInsensitive, error);
+}
+
+bool GlobSet::anyMatches(const std::vector<Glob>& list, std::string_view relativePath,
+	std::string_view name)
+{
+	for (const auto& glob : list) {
+		if (glob.matches(glob.matchesPath() ? relativePath : name)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool GlobSet::accepts(std::string_view relativePath, std::string_view name) const
+{
+	if (!includes_.empty() && !anyMatches(includes_, relativePath, name)) {
+		return false;
+	}
+	return !anyMatches(excludes_, relativePath, name);
+}
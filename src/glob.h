@@ -0,0 +1,99 @@
+#ifndef GLOB_H
+#define GLOB_H
+
+#include <bitset>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A compiled shell-style wildcard pattern.
+ *
+ * Supported syntax:
+ *   - `*`      any run of characters except '/'
+ *   - `**`     any run of characters including '/'; when followed by '/'
+ *              it may also match zero directories
+ *   - `?`      exactly one character except '/'
+ *   - `[a-z]`  a character class; `[!a-z]` or `[^a-z]` negates it
+ *   - `\x`     the literal character x
+ *
+ * A pattern without '/' is matched against the file name only; a pattern
+ * containing '/' is matched against the path relative to the scan root.
+ * Common shapes (`*.log`, `name*`, plain names) are recognized at compile
+ * time and matched with a single comparison; matching never allocates.
+ */
+class Glob {
+public:
+    /**
+     * @brief Compiles 'pattern'. A bare extension such as ".txt" is treated as "*.txt".
+     * @return std::nullopt (and sets 'error') if the pattern is malformed.
+     */
+    static std::optional<Glob> compile(std::string_view pattern, bool caseInsensitive,
+                                       std::string& error);
+
+    /**
+     * @brief True if the pattern must see the relative path rather than the file name.
+     */
+    bool matchesPath() const { return matchesPath_; }
+
+    /**
+     * @brief Matches 'text' (a file name or relative path using '/' separators).
+     */
+    bool matches(std::string_view text) const;
+
+private:
+    enum class Shape { Exact, Suffix, Prefix, Generic };
+    enum class TokenKind { Literal, Any, Class, Star, StarStar, StarStarSlash };
+
+    struct Token {
+        TokenKind kind;
+        char literal = 0;      // TokenKind::Literal (already case-folded)
+        size_t classIndex = 0; // TokenKind::Class, index into classes_
+    };
+
+    Glob() = default;
+
+    bool equalsFolded(std::string_view a, std::string_view b) const;
+    int matchTokens(size_t ti, std::string_view text, size_t pos) const;
+
+    Shape shape_ = Shape::Generic;
+    bool caseInsensitive_ = false;
+    bool matchesPath_ = false;
+    std::string fixed_;                 // literal part for the Exact/Suffix/Prefix shapes
+    std::vector<Token> tokens_;
+    std::vector<std::bitset<256>> classes_;
+};
+
+/**
+ * @brief Include and exclude glob lists applied to files found by the walk.
+ *        A file is accepted if it matches any include (or there are none)
+ *        and no exclude.
+ */
+class GlobSet {
+public:
+    /**
+     * @brief Adds one pattern, or several separated by commas.
+     * @return false (and sets 'error') if a pattern is malformed.
+     */
+    bool addInclude(std::string_view patterns, bool caseInsensitive, std::string& error);
+    bool addExclude(std::string_view patterns, bool caseInsensitive, std::string& error);
+
+    bool empty() const { return includes_.empty() && excludes_.empty(); }
+
+    /**
+     * @brief 'relativePath' uses '/' separators; 'name' is its last component.
+     */
+    bool accepts(std::string_view relativePath, std::string_view name) const;
+
+private:
+    static bool addPatterns(std::vector<Glob>& list, std::string_view patterns,
+                            bool caseInsensitive, std::string& error);
+    static bool anyMatches(const std::vector<Glob>& list, std::string_view relativePath,
+                           std::string_view name);
+
+    std::vector<Glob> includes_;
+    std::vector<Glob> excludes_;
+};
+
+#endif // GLOB_H
@@ -0,0 +1,140 @@
+#include "ignore_rules.h"
+
+#include <fstream>
+#include <iterator>
+#include "parallel_walker.h"
+
+namespace {
+
+std::string_view lastComponent(std::string_view path)
+{
+	const size_t slash = path.rfind('/');
+	return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+} // namespace
+
+IgnoreRules::IgnoreRules(std::shared_ptr<const IgnoreRules> parent, size_t baseLength)
+	: parent_(std::move(parent)), baseLength_(baseLength)
+{
+}
+
+void IgnoreRules::parse(std::string_view text)
+{
+	while (!text.empty()) {
+		const size_t newline = text.find('\n');
+		std::string_view line = text.substr(0, newline);
+		text.remove_prefix(newline == std::string_view::npos ? text.size() : newline + 1);
+
+		if (!line.empty() && line.back() == '\r') {
+			line.remove_suffix(1);
+		}
+		// Trailing spaces do not count unless escaped with a backslash
+		while (!line.empty() && line.back() == ' ' && !(line.size() > 1 && line[line.size() - 2] == '\\')) {
+			line.remove_suffix(1);
+		}
+		if (line.empty() || line.front() == '#') {
+			continue;
+		}
+
+		const bool negated = line.front() == '!';
+		if (negated) {
+			line.remove_prefix(1);
+		}
+		const bool directoryOnly = !line.empty() && line.back() == '/';
+		if (directoryOnly) {
+			line.remove_suffix(1);
+		}
+		bool anchored = line.find('/') != std::string_view::npos;
+		if (!line.empty() && line.front() == '/') {
+			line.remove_prefix(1);
+		}
+		if (line.empty()) {
+			continue;
+		}
+
+		// Escape a leading '.', which glob.h would otherwise read as "*.ext"
+		std::string pattern(line);
+		if (pattern.front() == '.') {
+			pattern.insert(pattern.begin(), '\\');
+		}
+		std::string error;
+		std::optional<Glob> glob = Glob::compile(pattern, false, error);
+		if (!glob) {
+			continue;
+		}
+		anchored = anchored || glob->matchesPath();
+		rules_.push_back(Rule{ std::move(*glob), negated, directoryOnly, anchored });
+	}
+}
+
+bool IgnoreRules::ignores(std::string_view relative, bool isDirectory) const
+{
+	const std::string_view name = lastComponent(relative);
+	for (const IgnoreRules* rules = this; rules; rules = rules->parent_.get()) {
+		// The path as seen from the directory holding the ignore file
+		std::string_view below = relative;
+		if (rules->baseLength_ != 0) {
+			below = relative.size() > rules->baseLength_ ? relative.substr(rules->baseLength_ + 1) : std::string_view();
+		}
+		for (auto it = rules->rules_.rbegin(); it != rules->rules_.rend(); ++it) {
+			if (it->directoryOnly && !isDirectory) {
+				continue;
+			}
+			if (it->glob.matches(it->anchored ? below : name)) {
+				return !it->negated;
+			}
+		}
+	}
+	return false;
+}
+
+IgnoreFilter::IgnoreFilter(std::vector<std::string> ruleFiles)
+	: ruleFiles_(std::move(ruleFiles))
+{
+}
+
+bool IgnoreFilter::addExcludeDir(std::string_view patterns, bool caseInsensitive, std::string& error)
+{
+	return excludedDirs_.addExclude(patterns, caseInsensitive, error);
+}
+
+std::shared_ptr<const IgnoreRules> IgnoreFilter::enter(const std::filesystem::path& dir, size_t rootLength,
+	std::shared_ptr<const IgnoreRules> parent) const
+{
+	std::shared_ptr<IgnoreRules> rules;
+	for (const auto& name : ruleFiles_) {
+		std::ifstream file(dir / name, std::ios::binary);
+		if (!file) {
+			continue;
+		}
+		const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if (!rules) {
+			const size_t baseLength = withRelativePath(dir, rootLength,
+				[](std::string_view relative) { return relative.size(); });
+			rules = std::make_shared<IgnoreRules>(parent, baseLength);
+		}
+		rules->parse(text);
+	}
+	if (!rules || rules->empty()) {
+		return parent;
+	}
+	return rules;
+}
+
+bool IgnoreFilter::ignores(const IgnoreRules* rules, const std::filesystem::path& path, size_t rootLength,
+	bool isDirectory) const
+{
+	return withRelativePath(path, rootLength, [&](std::string_view relative) {
+		if (isDirectory) {
+			const std::string_view name = lastComponent(relative);
+			if (!ruleFiles_.empty() && name == ".git") {
+				return true;
+			}
+			if (!excludedDirs_.empty() && !excludedDirs_.accepts(relative, name)) {
+				return true;
+			}
+		}
+		return rules != nullptr && rules->ignores(relative, isDirectory);
+	});
+}
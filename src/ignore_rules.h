@@ -0,0 +1,101 @@
+#ifndef IGNORE_RULES_H
+#define IGNORE_RULES_H
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "glob.h"
+
+/**
+ * @brief The rules of the ignore files (.gitignore, .ignore) in one directory,
+ *        chained to those of the directories above it.
+ *
+ * Rules follow gitignore syntax: '#' comments, '!' re-includes, a trailing '/'
+ * matches directories only, and a pattern with a '/' other than a trailing one
+ * is anchored to the directory holding the file, while one without matches
+ * the name at any depth below it. Patterns use glob.h syntax (including `**`)
+ * and are case-sensitive. Within a file the last matching rule wins; rules of
+ * deeper directories win over those of their parents. Immutable once built,
+ * so a subtree's walker threads share it.
+ */
+class IgnoreRules {
+public:
+    /**
+     * @param parent Rules of the enclosing directory (may be null)
+     * @param baseLength Bytes of the directory's path relative to the scan root
+     */
+    IgnoreRules(std::shared_ptr<const IgnoreRules> parent, size_t baseLength);
+
+    /**
+     * @brief Adds the rules of one ignore file's contents. Malformed patterns
+     *        are skipped, as git does.
+     */
+    void parse(std::string_view text);
+
+    bool empty() const { return rules_.empty(); }
+
+    /**
+     * @brief True if 'relative' (the path from the scan root, '/' separators)
+     *        is excluded by these rules or the ones they inherit.
+     */
+    bool ignores(std::string_view relative, bool isDirectory) const;
+
+private:
+    struct Rule {
+        Glob glob;
+        bool negated;
+        bool directoryOnly;
+        bool anchored;       // matched against the path below the directory, not the name
+    };
+
+    std::shared_ptr<const IgnoreRules> parent_;
+    size_t baseLength_;
+    std::vector<Rule> rules_;
+};
+
+/**
+ * @brief Prunes the walk: directories matching an --exclude-dir glob or an
+ *        ignore rule are not entered, and ignored files are not reported.
+ *        Used by ParallelWalker; thread-safe.
+ */
+class IgnoreFilter {
+public:
+    /**
+     * @param ruleFiles Names of the ignore files read in every directory, in
+     *                  increasing precedence (e.g. ".gitignore", ".ignore");
+     *                  if not empty, ".git" directories are skipped as well
+     */
+    explicit IgnoreFilter(std::vector<std::string> ruleFiles);
+
+    /**
+     * @brief Adds --exclude-dir globs (comma-separated). A pattern without '/'
+     *        matches a directory's name, one with '/' its path from the root.
+     * @return false (and sets 'error') if a pattern is malformed.
+     */
+    bool addExcludeDir(std::string_view patterns, bool caseInsensitive, std::string& error);
+
+    bool empty() const { return ruleFiles_.empty() && excludedDirs_.empty(); }
+
+    /**
+     * @brief The rules in force inside 'dir': its own ignore files on top of
+     *        'parent', or 'parent' itself if it has none.
+     */
+    std::shared_ptr<const IgnoreRules> enter(const std::filesystem::path& dir, size_t rootLength,
+                                             std::shared_ptr<const IgnoreRules> parent) const;
+
+    /**
+     * @brief True if the walker should skip 'path' (a directory if 'isDirectory'),
+     *        found under a root of 'rootLength' bytes (see rootPathLength()).
+     */
+    bool ignores(const IgnoreRules* rules, const std::filesystem::path& path, size_t rootLength,
+                 bool isDirectory) const;
+
+private:
+    std::vector<std::string> ruleFiles_;
+    GlobSet excludedDirs_;
+};
+
+#endif // IGNORE_RULES_H
@@ -0,0 +1,148 @@
+#ifndef JSON_TEXT_H
+#define JSON_TEXT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Helpers for writing JSON by hand into a reused buffer (structured output
+// and --progress=json), without building a document first.
+
+/**
+ * @brief Whether 'text' is well-formed UTF-8 (no overlongs, surrogates or
+ *        code points past U+10FFFF). ASCII runs are skipped eight bytes at a time.
+ */
+inline bool isValidUtf8(std::string_view text)
+{
+    const auto* p = reinterpret_cast<const unsigned char*>(text.data());
+    const auto* end = p + text.size();
+    while (p < end) {
+        if (end - p >= 8) {
+            uint64_t word = 0;
+            for (int i = 0; i < 8; ++i) {
+                word |= static_cast<uint64_t>(p[i]) << (8 * i);
+            }
+            if ((word & 0x8080808080808080ull) == 0) {
+                p += 8;
+                continue;
+            }
+        }
+        const unsigned char c = *p;
+        if (c < 0x80) {
+            ++p;
+            continue;
+        }
+        size_t length;
+        uint32_t min;
+        uint32_t cp;
+        if ((c & 0xe0) == 0xc0) {
+            length = 2, min = 0x80, cp = c & 0x1f;
+        }
+        else if ((c & 0xf0) == 0xe0) {
+            length = 3, min = 0x800, cp = c & 0x0f;
+        }
+        else if ((c & 0xf8) == 0xf0) {
+            length = 4, min = 0x10000, cp = c & 0x07;
+        }
+        else {
+            return false;
+        }
+        if (static_cast<size_t>(end - p) < length) {
+            return false;
+        }
+        for (size_t i = 1; i < length; ++i) {
+            if ((p[i] & 0xc0) != 0x80) {
+                return false;
+            }
+            cp = (cp << 6) | (p[i] & 0x3f);
+        }
+        if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) {
+            return false;
+        }
+        p += length;
+    }
+    return true;
+}
+
+/**
+ * @brief Appends 'text' as a quoted JSON string. Quotes, backslashes and
+ *        control characters are escaped; other bytes are copied, so 'text'
+ *        should be valid UTF-8 (see appendJsonBytes()).
+ */
+inline void appendJsonString(std::string& out, std::string_view text)
+{
+    static constexpr char kHex[] = "0123456789abcdef";
+    out += '"';
+    size_t run = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        const unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(text.data() + run, i - run);
+        run = i + 1;
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            out += "\\u00";
+            out += kHex[c >> 4];
+            out += kHex[c & 0xf];
+        }
+    }
+    out.append(text.data() + run, text.size() - run);
+    out += '"';
+}
+
+/**
+ * @brief Appends 'bytes' in standard base64 with padding.
+ */
+inline void appendBase64(std::string& out, std::string_view bytes)
+{
+    static constexpr char kDigits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i = 0;
+    for (; i + 3 <= bytes.size(); i += 3) {
+        const uint32_t v = (static_cast<uint32_t>(static_cast<unsigned char>(bytes[i])) << 16)
+            | (static_cast<uint32_t>(static_cast<unsigned char>(bytes[i + 1])) << 8)
+            | static_cast<unsigned char>(bytes[i + 2]);
+        out += kDigits[v >> 18];
+        out += kDigits[(v >> 12) & 63];
+        out += kDigits[(v >> 6) & 63];
+        out += kDigits[v & 63];
+    }
+    if (i < bytes.size()) {
+        uint32_t v = static_cast<uint32_t>(static_cast<unsigned char>(bytes[i])) << 16;
+        if (i + 1 < bytes.size()) {
+            v |= static_cast<uint32_t>(static_cast<unsigned char>(bytes[i + 1])) << 8;
+        }
+        out += kDigits[v >> 18];
+        out += kDigits[(v >> 12) & 63];
+        out += i + 1 < bytes.size() ? kDigits[(v >> 6) & 63] : '=';
+        out += '=';
+    }
+}
+
+/**
+ * @brief Appends the member "name":"bytes" if 'bytes' is valid UTF-8, else
+ *        "name_base64":"..." so file contents and paths survive unchanged.
+ */
+inline void appendJsonBytes(std::string& out, std::string_view name, std::string_view bytes)
+{
+    out += '"';
+    out += name;
+    if (isValidUtf8(bytes)) {
+        out += "\":";
+        appendJsonString(out, bytes);
+    }
+    else {
+        out += "_base64\":\"";
+        appendBase64(out, bytes);
+        out += '"';
+    }
+}
+
+#endif // JSON_TEXT_H
@@ -0,0 +1,675 @@
+#include "literal_search.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#define DIRSCAN_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define DIRSCAN_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DIRSCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define DIRSCAN_TARGET_AVX2
+#endif
+
+namespace {
+
+constexpr size_t npos = std::string_view::npos;
+
+// Where the prefilter looks: a candidate at 'p' needs hay[p + i1] | m1 == v1,
+// hay[p + i2] | m2 == v2 (masks are 0 for case-sensitive bytes) and 'span'
+// bytes from p on.
+struct Probe {
+	size_t i1;
+	size_t i2;
+	size_t span;
+	unsigned char v1;
+	unsigned char v2;
+	unsigned char m1;
+	unsigned char m2;
+};
+
+// A verified occurrence
+struct Found {
+	size_t start;
+	size_t length;
+};
+
+// Rough frequency rank of each byte in text and logs (higher = more common).
+// Only the relative order matters: it decides which needle bytes to filter on.
+constexpr std::array<unsigned char, 256> makeByteRanks()
+{
+	std::array<unsigned char, 256> ranks{};
+	for (int c = 0; c < 256; ++c) {
+		unsigned char r = 10; // control bytes and non-ASCII are rare
+		if (c >= 'a' && c <= 'z') r = 160;
+		else if (c >= 'A' && c <= 'Z') r = 100;
+		else if (c >= '0' && c <= '9') r = 130;
+		else if (c >= 33 && c < 127) r = 80; // punctuation
+		ranks[c] = r;
+	}
+	const char* common = "etaoinsrhldcu"; // most common letters first
+	for (int i = 0; common[i] != '\0'; ++i) {
+		ranks[static_cast<unsigned char>(common[i])] = static_cast<unsigned char>(240 - i * 5);
+	}
+	ranks[' '] = 255;
+	ranks['\n'] = 200;
+	ranks['\t'] = 150;
+	ranks['0'] = 150;
+	ranks['1'] = 150;
+	ranks['.'] = 140;
+	ranks[','] = 140;
+	ranks[':'] = 120;
+	ranks['/'] = 120;
+	ranks['_'] = 120;
+	ranks['-'] = 120;
+	return ranks;
+}
+
+constexpr std::array<unsigned char, 256> kByteRanks = makeByteRanks();
+
+inline unsigned countTrailingZeros(unsigned long long x)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return static_cast<unsigned>(index);
+#else
+	return static_cast<unsigned>(__builtin_ctzll(x));
+#endif
+}
+
+// (a[i] | mask[i]) == lower[i] for i < n: the ASCII case-insensitive compare,
+// 16 bytes at a time, then 8, then one by one.
+inline bool foldedEqual(const unsigned char* a, const unsigned char* lower, const unsigned char* mask, size_t n)
+{
+	size_t i = 0;
+#if defined(DIRSCAN_SIMD_X86)
+	for (; i + 16 <= n; i += 16) {
+		const __m128i folded = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i)));
+		const __m128i expected = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lower + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(folded, expected)) != 0xFFFF) {
+			return false;
+		}
+	}
+#elif defined(DIRSCAN_SIMD_NEON)
+	for (; i + 16 <= n; i += 16) {
+		const uint8x16_t eq = vceqq_u8(vorrq_u8(vld1q_u8(a + i), vld1q_u8(mask + i)), vld1q_u8(lower + i));
+		if (vminvq_u8(eq) != 0xFF) {
+			return false;
+		}
+	}
+#endif
+	for (; i + 8 <= n; i += 8) {
+		uint64_t x, m, l;
+		std::memcpy(&x, a + i, 8);
+		std::memcpy(&m, mask + i, 8);
+		std::memcpy(&l, lower + i, 8);
+		if ((x | m) != l) {
+			return false;
+		}
+	}
+	for (; i < n; ++i) {
+		if ((a[i] | mask[i]) != lower[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Candidate verifiers. kFolds says whether the prefilter bytes need their
+// case mask applied; the case-sensitive kernels skip it.
+struct ExactVerify {
+	static constexpr bool kFolds = false;
+	const unsigned char* needle;
+	size_t nlen;
+
+	bool operator()(const unsigned char* hay, size_t, size_t cand, Found& found) const
+	{
+		if (std::memcmp(hay + cand, needle, nlen) != 0) {
+			return false;
+		}
+		found = { cand, nlen };
+		return true;
+	}
+};
+
+struct AsciiFoldVerify {
+	static constexpr bool kFolds = true;
+	const unsigned char* lower;
+	const unsigned char* mask;
+	size_t nlen;
+
+	bool operator()(const unsigned char* hay, size_t, size_t cand, Found& found) const
+	{
+		if (!foldedEqual(hay + cand, lower, mask, nlen)) {
+			return false;
+		}
+		found = { cand, nlen };
+		return true;
+	}
+};
+
+// Matches one of the case forms starting at 'pos' (or ending there, going
+// backwards). UTF-8 is prefix- and suffix-free, so at most one form fits.
+inline bool matchForward(const LiteralSearcher::CaseForms& forms, const unsigned char* hay, size_t len, size_t& pos)
+{
+	for (unsigned f = 0; f < forms.count; ++f) {
+		const size_t n = forms.lengths[f];
+		if (n <= len - pos && std::memcmp(hay + pos, forms.bytes[f], n) == 0) {
+			pos += n;
+			return true;
+		}
+	}
+	return false;
+}
+
+inline bool matchBackward(const LiteralSearcher::CaseForms& forms, const unsigned char* hay, size_t& pos)
+{
+	for (unsigned f = 0; f < forms.count; ++f) {
+		const size_t n = forms.lengths[f];
+		if (n <= pos && std::memcmp(hay + pos - n, forms.bytes[f], n) == 0) {
+			pos -= n;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Unicode folding: the candidate is where the anchor code point begins; the
+// code points after it are matched forwards and those before it backwards.
+struct UnicodeFoldVerify {
+	static constexpr bool kFolds = true;
+	const LiteralSearcher::CaseForms* forms;
+	size_t count;
+	size_t anchor;
+
+	bool operator()(const unsigned char* hay, size_t len, size_t cand, Found& found) const
+	{
+		size_t end = cand;
+		for (size_t c = anchor; c < count; ++c) {
+			if (!matchForward(forms[c], hay, len, end)) {
+				return false;
+			}
+		}
+		size_t start = cand;
+		for (size_t c = anchor; c-- > 0;) {
+			if (!matchBackward(forms[c], hay, start)) {
+				return false;
+			}
+		}
+		found = { start, end - start };
+		return true;
+	}
+};
+
+template <typename Verify>
+using Kernel = size_t (*)(const unsigned char* hay, size_t len, const Probe& probe,
+	const Verify& verify, Found& found);
+
+// Candidates from 'p' on: memchr on the rarest byte (a byte loop when it is
+// folded), then the second byte and the verifier. Returns the candidate.
+template <typename Verify>
+size_t scalarFind(const unsigned char* hay, size_t len, size_t p, const Probe& probe,
+	const Verify& verify, Found& found)
+{
+	if (len < probe.span) {
+		return npos;
+	}
+	const size_t last = len - probe.span; // last possible candidate
+	while (p <= last) {
+		size_t cand = p;
+		if constexpr (Verify::kFolds) {
+			while (cand <= last && (hay[cand + probe.i1] | probe.m1) != probe.v1) {
+				++cand;
+			}
+			if (cand > last) {
+				return npos;
+			}
+		}
+		else {
+			const void* hit = std::memchr(hay + p + probe.i1, probe.v1, last - p + 1);
+			if (hit == nullptr) {
+				return npos;
+			}
+			cand = static_cast<size_t>(static_cast<const unsigned char*>(hit) - hay) - probe.i1;
+		}
+		if ((hay[cand + probe.i2] | probe.m2) == probe.v2 && verify(hay, len, cand, found)) {
+			return cand;
+		}
+		p = cand + 1;
+	}
+	return npos;
+}
+
+template <typename Verify>
+size_t scalarKernel(const unsigned char* hay, size_t len, const Probe& probe,
+	const Verify& verify, Found& found)
+{
+	return scalarFind(hay, len, 0, probe, verify, found);
+}
+
+// Verifies the candidate starts flagged in 'mask' ('stride' mask bits per byte).
+// Returns true once the search is decided; 'result' is then the hit or npos.
+template <typename Verify>
+inline bool verifyCandidates(unsigned long long mask, unsigned stride, size_t p, size_t last,
+	const unsigned char* hay, size_t len, const Verify& verify, Found& found, size_t& result)
+{
+	const unsigned long long lane = (1ull << stride) - 1;
+	while (mask != 0) {
+		const unsigned bit = countTrailingZeros(mask);
+		const size_t cand = p + bit / stride;
+		if (cand > last) {
+			result = npos;
+			return true;
+		}
+		if (verify(hay, len, cand, found)) {
+			result = cand;
+			return true;
+		}
+		mask &= ~(lane << bit);
+	}
+	return false;
+}
+
+// Finishes the last partial block with the scalar kernel.
+template <typename Verify>
+inline size_t finishTail(size_t p, const unsigned char* hay, size_t len, const Probe& probe,
+	const Verify& verify, Found& found)
+{
+	if (p > len - probe.span) {
+		return npos;
+	}
+	return scalarFind(hay, len, p, probe, verify, found);
+}
+
+#if defined(DIRSCAN_SIMD_X86)
+
+template <typename Verify>
+size_t sse2Find(const unsigned char* hay, size_t len, const Probe& probe, const Verify& verify, Found& found)
+{
+	if (len < probe.span) {
+		return npos;
+	}
+	const size_t last = len - probe.span;
+	const size_t maxOff = probe.i1 > probe.i2 ? probe.i1 : probe.i2;
+	const __m128i v1 = _mm_set1_epi8(static_cast<char>(probe.v1));
+	const __m128i v2 = _mm_set1_epi8(static_cast<char>(probe.v2));
+	const __m128i m1 = _mm_set1_epi8(static_cast<char>(probe.m1));
+	const __m128i m2 = _mm_set1_epi8(static_cast<char>(probe.m2));
+	size_t p = 0;
+	while (p + maxOff + 16 <= len) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + p + probe.i1));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + p + probe.i2));
+		if constexpr (Verify::kFolds) {
+			a = _mm_or_si128(a, m1);
+			b = _mm_or_si128(b, m2);
+		}
+		const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+			_mm_and_si128(_mm_cmpeq_epi8(a, v1), _mm_cmpeq_epi8(b, v2))));
+		if (mask != 0) {
+			size_t result;
+			if (verifyCandidates(mask, 1, p, last, hay, len, verify, found, result)) {
+				return result;
+			}
+		}
+		p += 16;
+	}
+	return finishTail(p, hay, len, probe, verify, found);
+}
+
+template <typename Verify>
+DIRSCAN_TARGET_AVX2
+size_t avx2Find(const unsigned char* hay, size_t len, const Probe& probe, const Verify& verify, Found& found)
+{
+	if (len < probe.span) {
+		return npos;
+	}
+	const size_t last = len - probe.span;
+	const size_t maxOff = probe.i1 > probe.i2 ? probe.i1 : probe.i2;
+	const __m256i v1 = _mm256_set1_epi8(static_cast<char>(probe.v1));
+	const __m256i v2 = _mm256_set1_epi8(static_cast<char>(probe.v2));
+	const __m256i m1 = _mm256_set1_epi8(static_cast<char>(probe.m1));
+	const __m256i m2 = _mm256_set1_epi8(static_cast<char>(probe.m2));
+	size_t p = 0;
+	while (p + maxOff + 32 <= len) {
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + p + probe.i1));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + p + probe.i2));
+		if constexpr (Verify::kFolds) {
+			a = _mm256_or_si256(a, m1);
+			b = _mm256_or_si256(b, m2);
+		}
+		const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+			_mm256_and_si256(_mm256_cmpeq_epi8(a, v1), _mm256_cmpeq_epi8(b, v2))));
+		if (mask != 0) {
+			size_t result;
+			if (verifyCandidates(mask, 1, p, last, hay, len, verify, found, result)) {
+				return result;
+			}
+		}
+		p += 32;
+	}
+	return finishTail(p, hay, len, probe, verify, found);
+}
+
+bool cpuHasAvx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#elif defined(DIRSCAN_SIMD_NEON)
+
+template <typename Verify>
+size_t neonFind(const unsigned char* hay, size_t len, const Probe& probe, const Verify& verify, Found& found)
+{
+	if (len < probe.span) {
+		return npos;
+	}
+	const size_t last = len - probe.span;
+	const size_t maxOff = probe.i1 > probe.i2 ? probe.i1 : probe.i2;
+	const uint8x16_t v1 = vdupq_n_u8(probe.v1);
+	const uint8x16_t v2 = vdupq_n_u8(probe.v2);
+	const uint8x16_t m1 = vdupq_n_u8(probe.m1);
+	const uint8x16_t m2 = vdupq_n_u8(probe.m2);
+	size_t p = 0;
+	while (p + maxOff + 16 <= len) {
+		uint8x16_t a = vld1q_u8(hay + p + probe.i1);
+		uint8x16_t b = vld1q_u8(hay + p + probe.i2);
+		if constexpr (Verify::kFolds) {
+			a = vorrq_u8(a, m1);
+			b = vorrq_u8(b, m2);
+		}
+		const uint8x16_t eq = vandq_u8(vceqq_u8(a, v1), vceqq_u8(b, v2));
+		// Narrow to a 64-bit mask with 4 bits per byte (NEON has no movemask).
+		const unsigned long long mask = vget_lane_u64(
+			vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+		if (mask != 0) {
+			size_t result;
+			if (verifyCandidates(mask, 4, p, last, hay, len, verify, found, result)) {
+				return result;
+			}
+		}
+		p += 16;
+	}
+	return finishTail(p, hay, len, probe, verify, found);
+}
+
+#endif
+
+struct KernelChoice {
+	Kernel<ExactVerify> exact;
+	Kernel<AsciiFoldVerify> ascii;
+	Kernel<UnicodeFoldVerify> unicode;
+	const char* name;
+};
+
+KernelChoice selectKernel()
+{
+#if defined(DIRSCAN_SIMD_X86)
+	if (cpuHasAvx2()) {
+		return { avx2Find<ExactVerify>, avx2Find<AsciiFoldVerify>, avx2Find<UnicodeFoldVerify>, "avx2" };
+	}
+	return { sse2Find<ExactVerify>, sse2Find<AsciiFoldVerify>, sse2Find<UnicodeFoldVerify>, "sse2" };
+#elif defined(DIRSCAN_SIMD_NEON)
+	return { neonFind<ExactVerify>, neonFind<AsciiFoldVerify>, neonFind<UnicodeFoldVerify>, "neon" };
+#else
+	return { scalarKernel<ExactVerify>, scalarKernel<AsciiFoldVerify>, scalarKernel<UnicodeFoldVerify>, "scalar" };
+#endif
+}
+
+const KernelChoice& activeKernel()
+{
+	static const KernelChoice choice = selectKernel();
+	return choice;
+}
+
+} // namespace
+
+LiteralSearcher::LiteralSearcher(std::string needle, bool ignoreCase)
+	: needle_(std::move(needle))
+{
+	if (ignoreCase) {
+		folding_ = literalFolding(needle_);
+	}
+	if (folding_ == CaseFolding::Unicode) {
+		prepareUnicode();
+		return;
+	}
+	const std::vector<bool> usable(needle_.size(), true);
+	if (folding_ == CaseFolding::None) {
+		pickRareBytes(needle_, std::string(needle_.size(), '\0'), usable);
+		return;
+	}
+	folded_ = needle_;
+	foldMask_.assign(needle_.size(), '\0');
+	for (size_t i = 0; i < needle_.size(); ++i) {
+		const char lower = static_cast<char>(needle_[i] | 0x20);
+		if (lower >= 'a' && lower <= 'z') {
+			folded_[i] = lower;
+			foldMask_[i] = 0x20;
+		}
+	}
+	pickRareBytes(folded_, foldMask_, usable);
+}
+
+void LiteralSearcher::prepareUnicode()
+{
+	for (size_t pos = 0; pos < needle_.size();) {
+		uint32_t codePoints[kMaxCaseForms];
+		const size_t count = caseForms(decodeUtf8(needle_, pos), codePoints);
+		CaseForms entry;
+		entry.count = static_cast<unsigned char>(count);
+		for (size_t f = 0; f < count; ++f) {
+			std::string bytes;
+			appendUtf8(codePoints[f], bytes);
+			entry.lengths[f] = static_cast<unsigned char>(bytes.size());
+			std::memcpy(entry.bytes[f], bytes.data(), bytes.size());
+		}
+		forms_.push_back(entry);
+	}
+	auto shortest = [](const CaseForms& forms) { return *std::min_element(forms.lengths, forms.lengths + forms.count); };
+	auto longest = [](const CaseForms& forms) { return *std::max_element(forms.lengths, forms.lengths + forms.count); };
+	for (const auto& forms : forms_) {
+		minLength_ += shortest(forms);
+	}
+
+	// Prefilter bytes of a run of code points whose forms share a length, so
+	// their offsets from the run's start are fixed. A byte is usable if all
+	// forms agree on it, or differ only in the case bit 0x20 (U+00E9/U+00C9: C3 A9/C3 89).
+	struct Run {
+		size_t first = 0;
+		size_t end = 0; // code point after the run
+		std::string values;
+		std::string masks;
+		std::vector<bool> usable;
+		size_t usableCount = 0;
+	};
+	auto runAt = [&](size_t first) {
+		Run run;
+		run.first = first;
+		run.end = first;
+		for (; run.end < forms_.size() && shortest(forms_[run.end]) == longest(forms_[run.end]); ++run.end) {
+			const CaseForms& forms = forms_[run.end];
+			for (size_t j = 0; j < forms.lengths[0]; ++j) {
+				bool same = true;
+				bool sameFolded = true;
+				const unsigned char first0 = static_cast<unsigned char>(forms.bytes[0][j]);
+				for (size_t f = 1; f < forms.count; ++f) {
+					const unsigned char b = static_cast<unsigned char>(forms.bytes[f][j]);
+					same = same && b == first0;
+					sameFolded = sameFolded && (b | 0x20) == (first0 | 0x20);
+				}
+				const unsigned char mask = same ? 0 : 0x20;
+				run.values += static_cast<char>(first0 | mask);
+				run.masks += static_cast<char>(mask);
+				run.usable.push_back(same || sameFolded);
+				run.usableCount += (same || sameFolded) ? 1 : 0;
+			}
+		}
+		return run;
+	};
+	Run best;
+	for (size_t c = 0; c < forms_.size();) {
+		Run run = runAt(c);
+		c = std::max(run.end, c + 1);
+		if (run.usableCount > best.usableCount) {
+			best = std::move(run);
+		}
+	}
+	hasPrefilter_ = best.usableCount != 0 && pickRareBytes(best.values, best.masks, best.usable);
+	if (!hasPrefilter_) {
+		return;
+	}
+	anchor_ = best.first;
+	for (size_t c = 0; c < forms_.size(); ++c) {
+		if (c < anchor_) {
+			slack_ += longest(forms_[c]) - shortest(forms_[c]);
+		}
+		else {
+			span_ += shortest(forms_[c]);
+		}
+	}
+}
+
+bool LiteralSearcher::pickRareBytes(std::string_view values, std::string_view masks, const std::vector<bool>& usable)
+{
+	// A folded byte matches both its forms, so it is as common as the commoner one
+	auto rank = [&](size_t i) {
+		const auto value = static_cast<unsigned char>(values[i]);
+		const auto other = static_cast<unsigned char>(value & ~static_cast<unsigned char>(masks[i]));
+		return std::max(kByteRanks[value], kByteRanks[other]);
+	};
+	size_t first = npos;
+	for (size_t i = 0; i < values.size(); ++i) {
+		if (usable[i] && (first == npos || rank(i) < rank(first))) {
+			first = i;
+		}
+	}
+	if (first == npos) {
+		return false;
+	}
+	size_t second = npos;
+	for (size_t i = 0; i < values.size(); ++i) {
+		if (usable[i] && i != first && (second == npos || rank(i) < rank(second))) {
+			second = i;
+		}
+	}
+	if (second == npos) {
+		second = first; // a one-byte needle checks its byte twice
+	}
+	rare1_ = first;
+	rare2_ = second;
+	value1_ = static_cast<unsigned char>(values[first]);
+	value2_ = static_cast<unsigned char>(values[second]);
+	mask1_ = static_cast<unsigned char>(masks[first]);
+	mask2_ = static_cast<unsigned char>(masks[second]);
+	return true;
+}
+
+size_t LiteralSearcher::find(std::string_view haystack, size_t from) const
+{
+	size_t length;
+	return find(haystack, from, length);
+}
+
+size_t LiteralSearcher::find(std::string_view haystack, size_t from, size_t& length) const
+{
+	const size_t nlen = needle_.size();
+	length = nlen;
+	if (from > haystack.size()) {
+		return npos;
+	}
+	if (nlen == 0) {
+		return from;
+	}
+	const auto* hay = reinterpret_cast<const unsigned char*>(haystack.data()) + from;
+	const size_t len = haystack.size() - from;
+	Found found{ 0, nlen };
+	size_t r = npos;
+	switch (folding_) {
+	case CaseFolding::None:
+		if (nlen == 1) {
+			const void* hit = std::memchr(hay, needle_[0], len);
+			return hit == nullptr ? npos
+				: from + static_cast<size_t>(static_cast<const unsigned char*>(hit) - hay);
+		}
+		r = activeKernel().exact(hay, len, Probe{ rare1_, rare2_, nlen, value1_, value2_, 0, 0 },
+			ExactVerify{ reinterpret_cast<const unsigned char*>(needle_.data()), nlen }, found);
+		break;
+	case CaseFolding::Ascii:
+		r = activeKernel().ascii(hay, len, Probe{ rare1_, rare2_, nlen, value1_, value2_, mask1_, mask2_ },
+			AsciiFoldVerify{ reinterpret_cast<const unsigned char*>(folded_.data()),
+				reinterpret_cast<const unsigned char*>(foldMask_.data()), nlen }, found);
+		break;
+	case CaseFolding::Unicode:
+		r = findUnicode(hay, len, found.start, found.length);
+		break;
+	}
+	if (r == npos) {
+		return npos;
+	}
+	length = found.length;
+	return from + found.start;
+}
+
+size_t LiteralSearcher::findUnicode(const unsigned char* hay, size_t len, size_t& start, size_t& length) const
+{
+	const UnicodeFoldVerify verify{ forms_.data(), forms_.size(), anchor_ };
+	Found found{ 0, 0 };
+	size_t cand = npos;
+	if (!hasPrefilter_) {
+		// No byte is fixed (e.g. sharp s, whose forms are 2 and 3 bytes): try every position
+		for (size_t p = 0; p + minLength_ <= len && cand == npos; ++p) {
+			if (verify(hay, len, p, found)) {
+				cand = p;
+			}
+		}
+	}
+	else {
+		cand = activeKernel().unicode(hay, len,
+			Probe{ rare1_, rare2_, span_, value1_, value2_, mask1_, mask2_ }, verify, found);
+		// When the code points before the anchor have forms of different
+		// lengths, a match anchored a little later can still begin further left
+		Found other{ 0, 0 };
+		for (size_t q = cand + 1; cand != npos && q <= cand + slack_ && q + span_ <= len; ++q) {
+			if (verify(hay, len, q, other) && other.start < found.start) {
+				found = other;
+			}
+		}
+	}
+	start = found.start;
+	length = found.length;
+	return cand;
+}
+
+const char* LiteralSearcher::kernelName()
+{
+	return activeKernel().name;
+}
@@ -0,0 +1,85 @@
+#ifndef LITERAL_SEARCH_H
+#define LITERAL_SEARCH_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "case_fold.h"
+
+/**
+ * @brief Vectorized substring search over arbitrary byte buffers.
+ *
+ * The needle is preprocessed once: two of its rarest bytes (by a static
+ * byte-frequency table) are used as a SIMD prefilter, and only positions
+ * where both line up are verified with memcmp. The kernel (AVX2, SSE2, NEON
+ * or scalar memchr) is picked at runtime from the CPU's features.
+ *
+ * Case-insensitive needles keep the same kernels: each prefilter byte is
+ * compared after OR-ing in its case bit (0x20 for an ASCII letter), and
+ * candidates are verified with a vectorized masked compare. A needle with a
+ * non-ASCII letter is matched by Unicode simple case folding instead: each of
+ * its code points may appear in any of its case forms, which can differ in
+ * UTF-8 length (k and the 3-byte Kelvin sign), so matches vary in length. The
+ * prefilter then sits on a run of code points whose forms share a length and
+ * the candidate is verified form by form on both sides of it.
+ */
+class LiteralSearcher {
+public:
+    explicit LiteralSearcher(std::string needle, bool ignoreCase = false);
+
+    /**
+     * @brief Finds the first occurrence of the needle at or after 'from'.
+     * @return Offset into 'haystack', or std::string_view::npos.
+     */
+    size_t find(std::string_view haystack, size_t from = 0) const;
+
+    /**
+     * @brief As find(), also giving the length of the occurrence, which with
+     *        Unicode case folding may differ from the needle's.
+     */
+    size_t find(std::string_view haystack, size_t from, size_t& length) const;
+
+    const std::string& needle() const { return needle_; }
+
+    CaseFolding folding() const { return folding_; }
+
+    /**
+     * @brief Name of the kernel selected for this CPU ("avx2", "sse2", "neon" or "scalar").
+     */
+    static const char* kernelName();
+
+    // The UTF-8 encodings of one needle code point's case forms
+    struct CaseForms {
+        unsigned char count = 0;
+        unsigned char lengths[kMaxCaseForms] = {};
+        char bytes[kMaxCaseForms][4] = {};
+    };
+
+private:
+    void prepareUnicode();
+    bool pickRareBytes(std::string_view values, std::string_view masks, const std::vector<bool>& usable);
+    size_t findUnicode(const unsigned char* hay, size_t len, size_t& start, size_t& length) const;
+
+    std::string needle_;
+    CaseFolding folding_ = CaseFolding::None;
+    size_t rare1_ = 0; // offset of the rarest needle byte (from the anchor with Unicode folding)
+    size_t rare2_ = 0; // offset of the second rarest byte
+    // Prefilter bytes as compared: byte | mask == value
+    unsigned char value1_ = 0;
+    unsigned char value2_ = 0;
+    unsigned char mask1_ = 0;
+    unsigned char mask2_ = 0;
+
+    std::string folded_;          // Ascii: the needle with its letters lowercased
+    std::string foldMask_;        // Ascii: 0x20 under each letter, else 0
+
+    std::vector<CaseForms> forms_; // Unicode: one entry per needle code point
+    size_t anchor_ = 0;           // Unicode: code point the prefilter offsets start at
+    size_t span_ = 0;             // Unicode: shortest match from the anchor on
+    size_t slack_ = 0;            // Unicode: longest minus shortest match before the anchor
+    size_t minLength_ = 0;        // Unicode: shortest match
+    bool hasPrefilter_ = false;   // Unicode: false if no code point's forms share a length
+};
+
+#endif // LITERAL_SEARCH_H
@@ -1,46 +1,442 @@
 #include "dirscan.h"
 
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <filesystem>
+#include <fstream>
 #include <string>
 #include <optional>
+#include <vector>
 
 /*
  * Usage:
- *   ./my_grep_like_util <query> <directory> [--regex] [--ext .txt]
+ *   ./my_grep_like_util <query> <directory> [--regex] [-i] [-S] [--ext *.txt] [--exclude glob] [--exclude-dir glob] [--ignore-files] [--max-filesize size] [--newer-than age] [--older-than age] [--max-depth n] [--no-decompress] [--decompress-threads n] [--index file] [--cache file] [--io-depth n] [--threads n] [--io-threads n] [--adaptive [max]] [--queue-size n] [-l] [--max-count n] [--first n] [--binary mode] [--binary-ext globs] [--progress=json|table] [--quiet] [--output=jsonl|nul|bin] [--output-file path] [--max-line-bytes n] [--stats] [--trace file] [--agents host:port,...] [--shared-tree] [--agent-token token] [--ordered]
+ *   ./my_grep_like_util -f <pattern-file> <directory> [options]
+ *   ./my_grep_like_util --build-index <directory> <index-file>
+ *   ./my_grep_like_util --agent <directory> <[host:]port> [--agent-token token] [--threads n] [--io-threads n] [--io-depth n] [--index file]
  *
  * Examples:
  *   ./my_grep_like_util "some_text" /path/to/search
  *   ./my_grep_like_util "^[A-Z]\\w+" /path/to/search --regex
  *   ./my_grep_like_util "needle" /path/to/search --ext .txt
+ *   ./my_grep_like_util "needle" /path/to/search --ext "*.log,*.txt" --exclude "*.tmp"
+ *   ./my_grep_like_util "needle" /path/to/repo --ignore-files --exclude-dir node_modules
+ *   ./my_grep_like_util "timeout" /var/log -i
+ *   ./my_grep_like_util "ERROR" /var/log --newer-than 1h --max-filesize 100M
+ *   ./my_grep_like_util --build-index /path/to/search search.idx
+ *   ./my_grep_like_util "needle" /path/to/search --index search.idx
+ *   ./my_grep_like_util "needle" /path/to/search -l --first 10
+ *   ./my_grep_like_util -f keywords.txt /path/to/search
+ *   ./my_grep_like_util "needle" /path/to/search --progress=json
+ *   ./my_grep_like_util "needle" /path/to/search --output=jsonl | jq .file
+ *   DIRSCAN_AGENT_TOKEN=secret ./my_grep_like_util --agent /archive 0.0.0.0:7070
+ *   DIRSCAN_AGENT_TOKEN=secret ./my_grep_like_util "needle" . --agents node1:7070,node2:7070
  */
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program
+              << " <query> <directory> [options]\n"
+              << "       " << program << " -f <pattern-file> <directory> [options]\n"
+              << "       " << program << " --build-index <directory> <index-file>\n"
+              << "       " << program << " --agent <directory> <[host:]port> [--agent-token token]\n"
+              << "                    [--threads n] [--io-threads n] [--io-depth n] [--index file]\n"
+              << "  --regex           Interpret <query> (or each line of -f) as a regular expression\n"
+              << "  -i, --ignore-case Match letters in either case (non-ASCII ones too)\n"
+              << "  -S, --smart-case  Ignore case unless the query has an uppercase letter\n"
+              << "  --ext <globs>     Only scan files matching these globs (comma-separated, repeatable)\n"
+              << "  --exclude <globs> Skip files matching these globs (comma-separated, repeatable)\n"
+              << "  --exclude-dir <globs> Do not enter directories matching these globs (comma-separated,\n"
+              << "                    repeatable); a glob with '/' is matched against the relative path\n"
+              << "  --ignore-files    Skip what .gitignore and .ignore files exclude, and .git directories\n"
+              << "  --max-filesize <size> Skip files larger than size (bytes, or with a K, M or G suffix)\n"
+              << "  --newer-than <age> Only scan files modified within age (e.g. 90s, 30m, 1h, 7d)\n"
+              << "  --older-than <age> Only scan files not modified within age\n"
+              << "  --max-depth <n>   Descend at most n directories below <directory> (0: its files only)\n"
+              << "  --no-decompress   Search .gz, .xz and .zst files as they are instead of decompressed\n"
+              << "  --decompress-threads <n> Threads inflating compressed files (default: half of --threads)\n"
+              << "  --index <file>    Use a trigram index from --build-index to skip files\n"
+              << "  --cache <file>    Reuse results for files unchanged since the last run with this cache\n"
+              << "  --io-depth <n>    Keep up to n file reads in flight (io_uring/IOCP) for slow storage\n"
+              << "  --threads <n>     Matcher threads (default: one per core)\n"
+              << "  --io-threads <n>  Directory walker threads (default: --threads)\n"
+              << "  --adaptive [max]  Grow or shrink the matcher threads while scanning, up to max\n"
+              << "                    (default 4 per core), starting from --threads\n"
+              << "  --queue-size <n>  Files queued between the walker and the matchers (default 10000)\n"
+              << "  -l                Only list the files that match (stops reading each at its first match)\n"
+              << "  --max-count <n>   Stop reading a file after n matching lines\n"
+              << "  --first <n>       Stop the whole scan after n matching files\n"
+              << "  --binary <mode>   Binary files: 'report' a match (default), 'skip' or search as 'text'\n"
+              << "  --binary-ext <globs> Treat files matching these globs as binary, whatever their contents\n"
+              << "  --progress=<mode> 'table' redraws the status in place, 'json' prints one JSON line\n"
+              << "                    per update (default: table on a terminal, else a final summary)\n"
+              << "  --quiet           No status output\n"
+              << "  --output=<format> 'jsonl', 'nul' or 'bin' records with file, line, byte offset\n"
+              << "                    and spans, to stdout (default 'text': search_results.txt)\n"
+              << "  --output-file <path> Write the results to path ('-' for stdout)\n"
+              << "  --max-line-bytes <n> Cut lines in jsonl/nul/bin records to n bytes\n"
+              << "  --stats           Print per-stage timings (walk, queues, open, read, decompress, match, output)\n"
+              << "  --trace <file>    Write a Chrome trace (chrome://tracing, Perfetto) of the scan's threads\n"
+              << "  --agents <list>   Spread the scan over these agents (host:port, comma-separated,\n"
+              << "                    repeatable); <directory> is then relative to each agent's root\n"
+              << "  --shared-tree     The agents see the same tree: any of them may search any subtree\n"
+              << "  --agent-token <t> Secret shared by agents and coordinator (default: $DIRSCAN_AGENT_TOKEN);\n"
+              << "                    an agent listens on loopback unless given a host such as 0.0.0.0\n"
+              << "  --ordered         Write results sorted by file path\n";
+}
+
+// Parses a non-negative count such as "--io-depth 64".
+template <typename Count>
+static bool parseCount(const char* text, Count& value) {
+    const char* end = text + std::strlen(text);
+    auto result = std::from_chars(text, end, value);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+// Parses a size such as "4096", "64K" or "2G" (binary multiples).
+static bool parseSize(const char* text, uint64_t& value) {
+    const char* end = text + std::strlen(text);
+    auto result = std::from_chars(text, end, value);
+    if (result.ec != std::errc() || result.ptr == text) {
+        return false;
+    }
+    if (result.ptr == end) {
+        return true;
+    }
+    if (result.ptr + 1 != end) {
+        return false;
+    }
+    unsigned shift = 0;
+    switch (*result.ptr) {
+    case 'K': case 'k': shift = 10; break;
+    case 'M': case 'm': shift = 20; break;
+    case 'G': case 'g': shift = 30; break;
+    default: return false;
+    }
+    if (value > (UINT64_MAX >> shift)) {
+        return false;
+    }
+    value <<= shift;
+    return true;
+}
+
+// Parses an age such as "90", "90s", "30m", "1h" or "7d" (seconds without a unit).
+static bool parseAge(const char* text, std::chrono::seconds& age) {
+    const char* end = text + std::strlen(text);
+    long long count = 0;
+    auto result = std::from_chars(text, end, count);
+    if (result.ec != std::errc() || result.ptr == text || count < 0) {
+        return false;
+    }
+    long long unit = 1;
+    if (result.ptr != end) {
+        if (result.ptr + 1 != end) {
+            return false;
+        }
+        switch (*result.ptr) {
+        case 's': unit = 1; break;
+        case 'm': unit = 60; break;
+        case 'h': unit = 3600; break;
+        case 'd': unit = 86400; break;
+        default: return false;
+        }
+    }
+    age = std::chrono::seconds(count * unit);
+    return true;
+}
+
+// Sets 'limit' to the time 'age' ago for --newer-than / --older-than.
+static bool parseAgeOption(const char* name, const std::string& value,
+                           std::optional<std::chrono::system_clock::time_point>& limit) {
+    std::chrono::seconds age;
+    if (!parseAge(value.c_str(), age)) {
+        std::cerr << "Error: " << name << " expects an age such as 90s, 30m, 1h or 7d\n";
+        return false;
+    }
+    limit = std::chrono::system_clock::now() - age;
+    return true;
+}
+
+// Matches "--name=value" or "--name value" at argv[i], advancing i past the value.
+static bool optionValue(const char* name, int argc, char** argv, int& i, std::string& value) {
+    const size_t length = std::strlen(name);
+    if (std::strncmp(argv[i], name, length) != 0) {
+        return false;
+    }
+    if (argv[i][length] == '=') {
+        value = argv[i] + length + 1;
+        return true;
+    }
+    if (argv[i][length] == '\0' && i + 1 < argc) {
+        value = argv[++i];
+        return true;
+    }
+    return false;
+}
+
+// Reads a pattern file for -f: one pattern per line, blank lines skipped.
+static bool readPatterns(const char* path, std::vector<std::string>& patterns) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Error: Could not read pattern file " << path << "\n";
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            patterns.push_back(line);
+        }
+    }
+    if (patterns.empty()) {
+        std::cerr << "Error: No patterns in " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
 int main(int argc, char** argv) {
     if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] 
-                  << " <query> <directory> [--regex] [--ext .xyz]\n";
+        printUsage(argv[0]);
         return 1;
     }
 
-    std::string query = argv[1];
-    std::filesystem::path directory = argv[2];
-    if (!std::filesystem::exists(directory) || !std::filesystem::is_directory(directory)) {
-        std::cerr << "Error: The specified path is not a directory or does not exist.\n";
-        return 1;
+    if (std::string(argv[1]) == "--build-index") {
+        if (argc != 4) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        return buildSearchIndex(argv[2], argv[3]) ? 0 : 1;
     }
 
-    bool use_regex = false;
-    std::optional<std::string> extensionFilter;
+    // "--agent <directory> <[host:]port>" serves scans of the directory to coordinators
+    if (std::string(argv[1]) == "--agent") {
+        if (argc < 4) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        AgentOptions agent;
+        agent.root = argv[2];
+        agent.address = argv[3];
+        if (const char* token = std::getenv("DIRSCAN_AGENT_TOKEN")) {
+            agent.token = token;
+        }
+        for (int i = 4; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--agent-token" && i + 1 < argc) {
+                agent.token = argv[++i];
+            } else if (arg == "--threads" && i + 1 < argc && parseCount(argv[i + 1], agent.numThreads)) {
+                ++i;
+            } else if (arg == "--io-threads" && i + 1 < argc && parseCount(argv[i + 1], agent.ioThreads)) {
+                ++i;
+            } else if (arg == "--io-depth" && i + 1 < argc && parseCount(argv[i + 1], agent.ioDepth)) {
+                ++i;
+            } else if (arg == "--index" && i + 1 < argc) {
+                agent.indexPath = argv[++i];
+            } else {
+                std::cerr << "Error: Unknown or incomplete agent option: " << arg << "\n";
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        return serveAgent(agent) ? 0 : 1;
+    }
+
+    // "-f <file>" takes the place of <query>: one pattern per line
+    ScanOptions options;
+    int firstOption = 3;
+    if (std::string(argv[1]) == "-f") {
+        if (argc < 4 || !readPatterns(argv[2], options.patterns)) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        firstOption = 4;
+    } else {
+        options.query = argv[1];
+    }
+    std::filesystem::path directory = argv[firstOption - 1];
+
+    bool orderedOutput = false;
+    ClusterOptions cluster;
+    if (const char* token = std::getenv("DIRSCAN_AGENT_TOKEN")) {
+        cluster.token = token;
+    }
+    ProgressMode progress = ProgressMode::Auto;
+    OutputOptions output;
+    std::string value;
 
-    for (int i = 3; i < argc; ++i) {
+    for (int i = firstOption; i < argc; ++i) {
         std::string arg = argv[i];
         if (arg == "--regex") {
-            use_regex = true;
+            options.useRegex = true;
+        } else if (arg == "-i" || arg == "--ignore-case") {
+            options.ignoreCase = true;
+        } else if (arg == "-S" || arg == "--smart-case") {
+            options.smartCase = true;
         } else if (arg == "--ext" && i + 1 < argc) {
-            extensionFilter = argv[++i]; // e.g. ".txt"
+            options.includePatterns.push_back(argv[++i]); // e.g. "*.txt" or ".txt"
+        } else if (arg == "--exclude" && i + 1 < argc) {
+            options.excludePatterns.push_back(argv[++i]);
+        } else if (arg == "--exclude-dir" && i + 1 < argc) {
+            options.excludeDirPatterns.push_back(argv[++i]);
+        } else if (arg == "--ignore-files") {
+            options.ignoreFiles = true;
+        } else if (optionValue("--max-filesize", argc, argv, i, value)) {
+            if (!parseSize(value.c_str(), options.maxFileSize)) {
+                std::cerr << "Error: --max-filesize expects a size such as 4096, 64K or 2G\n";
+                return 1;
+            }
+        } else if (optionValue("--newer-than", argc, argv, i, value)) {
+            if (!parseAgeOption("--newer-than", value, options.modifiedAfter)) {
+                return 1;
+            }
+        } else if (optionValue("--older-than", argc, argv, i, value)) {
+            if (!parseAgeOption("--older-than", value, options.modifiedBefore)) {
+                return 1;
+            }
+        } else if (optionValue("--max-depth", argc, argv, i, value)) {
+            unsigned depth = 0;
+            if (!parseCount(value.c_str(), depth)) {
+                std::cerr << "Error: --max-depth expects a number\n";
+                return 1;
+            }
+            options.maxDepth = depth;
+        } else if (arg == "--no-decompress") {
+            options.decompress = false;
+        } else if (arg == "--decompress-threads" && i + 1 < argc) {
+            if (!parseCount(argv[++i], options.decompressThreads) || options.decompressThreads == 0) {
+                std::cerr << "Error: --decompress-threads expects a positive number\n";
+                return 1;
+            }
+        } else if (arg == "--index" && i + 1 < argc) {
+            options.indexPath = argv[++i];
+        } else if (arg == "--cache" && i + 1 < argc) {
+            options.cachePath = argv[++i];
+        } else if (arg == "--io-depth" && i + 1 < argc) {
+            if (!parseCount(argv[++i], options.ioDepth)) {
+                std::cerr << "Error: --io-depth expects a number\n";
+                return 1;
+            }
+        } else if (arg == "--threads" && i + 1 < argc) {
+            if (!parseCount(argv[++i], options.numThreads) || options.numThreads == 0) {
+                std::cerr << "Error: --threads expects a positive number\n";
+                return 1;
+            }
+        } else if (arg == "--io-threads" && i + 1 < argc) {
+            if (!parseCount(argv[++i], options.ioThreads) || options.ioThreads == 0) {
+                std::cerr << "Error: --io-threads expects a positive number\n";
+                return 1;
+            }
+        } else if (arg == "--adaptive") {
+            options.adaptiveThreads = true;
+            if (i + 1 < argc && parseCount(argv[i + 1], options.maxThreads)) {
+                ++i;
+            }
+        } else if (arg == "--queue-size" && i + 1 < argc) {
+            if (!parseCount(argv[++i], options.queueSize) || options.queueSize == 0) {
+                std::cerr << "Error: --queue-size expects a positive number\n";
+                return 1;
+            }
+        } else if (arg == "-l") {
+            options.filesWithMatches = true;
+        } else if (arg == "--max-count" && i + 1 < argc) {
+            if (!parseCount(argv[++i], options.maxCount)) {
+                std::cerr << "Error: --max-count expects a number\n";
+                return 1;
+            }
+        } else if (arg == "--first" && i + 1 < argc) {
+            if (!parseCount(argv[++i], options.maxFiles)) {
+                std::cerr << "Error: --first expects a number\n";
+                return 1;
+            }
+        } else if (arg == "--binary" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "report") {
+                options.binaryFiles = BinaryFiles::Report;
+            } else if (mode == "skip") {
+                options.binaryFiles = BinaryFiles::Skip;
+            } else if (mode == "text") {
+                options.binaryFiles = BinaryFiles::Text;
+            } else {
+                std::cerr << "Error: --binary expects report, skip or text\n";
+                return 1;
+            }
+        } else if (arg == "--binary-ext" && i + 1 < argc) {
+            options.binaryPatterns.push_back(argv[++i]);
+        } else if (optionValue("--progress", argc, argv, i, value)) {
+            const std::string& mode = value;
+            if (mode == "table") {
+                progress = ProgressMode::Table;
+            } else if (mode == "json") {
+                progress = ProgressMode::Json;
+            } else if (mode == "auto") {
+                progress = ProgressMode::Auto;
+            } else {
+                std::cerr << "Error: --progress expects table, json or auto\n";
+                return 1;
+            }
+        } else if (arg == "--quiet") {
+            progress = ProgressMode::Quiet;
+        } else if (optionValue("--output", argc, argv, i, value)) {
+            if (value == "text") {
+                output.format = OutputFormat::Text;
+            } else if (value == "jsonl") {
+                output.format = OutputFormat::JsonLines;
+            } else if (value == "nul") {
+                output.format = OutputFormat::Nul;
+            } else if (value == "bin") {
+                output.format = OutputFormat::Binary;
+            } else {
+                std::cerr << "Error: --output expects text, jsonl, nul or bin\n";
+                return 1;
+            }
+        } else if (optionValue("--output-file", argc, argv, i, value)) {
+            output.path = value;
+        } else if (arg == "--max-line-bytes" && i + 1 < argc) {
+            if (!parseCount(argv[++i], output.maxLineBytes)) {
+                std::cerr << "Error: --max-line-bytes expects a number\n";
+                return 1;
+            }
+        } else if (arg == "--stats") {
+            output.stats = true;
+        } else if (optionValue("--trace", argc, argv, i, value)) {
+            output.tracePath = value;
+        } else if (arg == "--agents" && i + 1 < argc) {
+            std::string list = argv[++i];
+            for (size_t start = 0; start <= list.size();) {
+                size_t comma = std::min(list.find(',', start), list.size());
+                if (comma > start) {
+                    cluster.agents.push_back(list.substr(start, comma - start));
+                }
+                start = comma + 1;
+            }
+        } else if (arg == "--shared-tree") {
+            cluster.sharedTree = true;
+        } else if (arg == "--agent-token" && i + 1 < argc) {
+            cluster.token = argv[++i];
+        } else if (arg == "--ordered") {
+            orderedOutput = true; // sort results by path
+        } else {
+            std::cerr << "Error: Unknown option: " << arg << "\n";
+            printUsage(argv[0]);
+            return 1;
         }
     }
 
-    searchInDirectory(query, directory, use_regex, extensionFilter);
+    // With agents, the directory is theirs to check
+    if (!cluster.agents.empty()) {
+        return searchCluster(options, cluster, directory, orderedOutput, progress, output) ? 0 : 1;
+    }
+    if (!std::filesystem::exists(directory) || !std::filesystem::is_directory(directory)) {
+        std::cerr << "Error: The specified path is not a directory or does not exist.\n";
+        return 1;
+    }
+
+    searchInDirectory(options, directory, orderedOutput, progress, output);
 
     return 0;
 }
@@ -0,0 +1,213 @@
+#include "matcher.h"
+
+#include <algorithm>
+#include "case_fold.h"
+#include "literal_search.h"
+#include "multi_literal.h"
+
+namespace {
+
+// Plain substring search, used when --regex is not given.
+class LiteralMatcher final : public Matcher {
+public:
+	LiteralMatcher(const std::string& query, bool ignoreCase)
+		: Matcher(query, false), searcher_(query, ignoreCase) {}
+
+	bool matches(std::string_view line) const override
+	{
+		return searcher_.find(line) != std::string_view::npos;
+	}
+
+	size_t findAll(std::string_view line, std::vector<MatchSpan>& spans) const override
+	{
+		if (searcher_.needle().empty()) {
+			spans.push_back(MatchSpan{ 0, 0 });
+			return 1;
+		}
+		// With Unicode case folding an occurrence may be longer or shorter than the needle
+		size_t found = 0;
+		size_t length = 0;
+		for (size_t pos = searcher_.find(line, 0, length); pos != std::string_view::npos && found < kMaxSpans;
+			pos = searcher_.find(line, pos + length, length)) {
+			spans.push_back(MatchSpan{ pos, length });
+			++found;
+		}
+		return found;
+	}
+
+	size_t findCandidate(std::string_view text, size_t from) const override
+	{
+		return searcher_.find(text, from);
+	}
+
+private:
+	LiteralSearcher searcher_;
+};
+
+// The patterns joined by newlines, as the matcher's query text.
+std::string joinPatterns(const std::vector<std::string>& patterns)
+{
+	std::string joined;
+	for (const auto& pattern : patterns) {
+		if (!joined.empty()) {
+			joined += '\n';
+		}
+		joined += pattern;
+	}
+	return joined;
+}
+
+// Literal patterns searched by one Aho-Corasick automaton.
+class MultiLiteralMatcher final : public Matcher {
+public:
+	MultiLiteralMatcher(const std::vector<std::string>& patterns, bool ignoreCase)
+		: Matcher(joinPatterns(patterns), false), automaton_(patterns, ignoreCase) {}
+
+	bool matches(std::string_view line) const override
+	{
+		return automaton_.findFirst(line) != std::string_view::npos;
+	}
+
+	size_t findAll(std::string_view line, std::vector<MatchSpan>& spans) const override
+	{
+		return automaton_.findAll(line, spans, kMaxSpans);
+	}
+
+	size_t findCandidate(std::string_view text, size_t from) const override
+	{
+		return automaton_.findFirst(text, from);
+	}
+
+private:
+	AhoCorasick automaton_;
+};
+
+// Patterns matched one by one. For regexes, one alternation of all of them
+// decides whether a line matches at all, and only matching lines are run
+// through each pattern; literals that need Unicode case folding have none.
+class PatternSetMatcher final : public Matcher {
+public:
+	PatternSetMatcher(const std::vector<std::string>& patterns, bool use_regex, std::unique_ptr<Matcher> combined,
+		std::vector<std::unique_ptr<Matcher>> members, std::vector<size_t> indexes)
+		: Matcher(joinPatterns(patterns), use_regex), combined_(std::move(combined)),
+		  members_(std::move(members)), indexes_(std::move(indexes)) {}
+
+	bool matches(std::string_view line) const override
+	{
+		if (combined_) {
+			return combined_->matches(line);
+		}
+		return std::any_of(members_.begin(), members_.end(),
+			[&](const auto& member) { return member->matches(line); });
+	}
+
+	size_t findAll(std::string_view line, std::vector<MatchSpan>& spans) const override
+	{
+		if (combined_ && !combined_->matches(line)) {
+			return 0;
+		}
+		// Every pattern's spans, then the leftmost-longest ones that do not overlap
+		thread_local std::vector<MatchSpan> hits;
+		hits.clear();
+		for (size_t m = 0; m < members_.size(); ++m) {
+			const size_t first = hits.size();
+			members_[m]->findAll(line, hits);
+			for (size_t h = first; h < hits.size(); ++h) {
+				hits[h].pattern = indexes_[m];
+			}
+		}
+		std::sort(hits.begin(), hits.end(), [](const MatchSpan& a, const MatchSpan& b) {
+			return a.offset != b.offset ? a.offset < b.offset : a.length > b.length;
+		});
+		size_t found = 0;
+		size_t end = 0;
+		for (const auto& hit : hits) {
+			if (found == kMaxSpans) {
+				break;
+			}
+			if (hit.offset >= end) {
+				spans.push_back(hit);
+				end = hit.offset + hit.length;
+				++found;
+			}
+		}
+		return found;
+	}
+
+	size_t takeAbandonedLines() const override
+	{
+		size_t lines = combined_ ? combined_->takeAbandonedLines() : 0;
+		for (const auto& member : members_) {
+			lines += member->takeAbandonedLines();
+		}
+		return lines;
+	}
+
+private:
+	std::unique_ptr<Matcher> combined_;   // nullptr if there is no alternation or it does not compile
+	std::vector<std::unique_ptr<Matcher>> members_;
+	std::vector<size_t> indexes_;         // pattern index of each member
+};
+
+} // namespace
+
+std::unique_ptr<Matcher> Matcher::compile(const std::string& query,
+	bool use_regex,
+	bool ignore_case,
+	std::string& error)
+{
+	if (use_regex) {
+		return makeRegexMatcher(query, ignore_case, error);
+	}
+	return std::make_unique<LiteralMatcher>(query, ignore_case);
+}
+
+std::unique_ptr<Matcher> Matcher::compileSet(const std::vector<std::string>& patterns,
+	bool use_regex,
+	bool ignore_case,
+	std::string& error)
+{
+	std::vector<size_t> indexes;
+	for (size_t p = 0; p < patterns.size(); ++p) {
+		if (!patterns[p].empty()) {
+			indexes.push_back(p);
+		}
+	}
+	if (indexes.empty()) {
+		error = "No patterns to search for";
+		return nullptr;
+	}
+	if (patterns.size() == 1) {
+		return compile(patterns[0], use_regex, ignore_case, error);
+	}
+	if (!use_regex) {
+		// The automaton folds ASCII letters only; a pattern with a non-ASCII
+		// letter makes the set fall back to one Unicode-aware searcher per pattern
+		const bool needsUnicode = ignore_case && std::any_of(patterns.begin(), patterns.end(),
+			[](const std::string& pattern) { return literalFolding(pattern) == CaseFolding::Unicode; });
+		if (!needsUnicode) {
+			return std::make_unique<MultiLiteralMatcher>(patterns, ignore_case);
+		}
+		std::vector<std::unique_ptr<Matcher>> members;
+		for (size_t p : indexes) {
+			members.push_back(std::make_unique<LiteralMatcher>(patterns[p], true));
+		}
+		return std::make_unique<PatternSetMatcher>(patterns, false, nullptr, std::move(members), std::move(indexes));
+	}
+
+	std::vector<std::unique_ptr<Matcher>> members;
+	std::string alternation;
+	for (size_t p : indexes) {
+		auto member = makeRegexMatcher(patterns[p], ignore_case, error);
+		if (!member) {
+			return nullptr;
+		}
+		members.push_back(std::move(member));
+		alternation += (alternation.empty() ? "(?:" : "|(?:") + patterns[p] + ")";
+	}
+	// Back-references or engine limits can make the alternation fail; the
+	// members are then tried one by one.
+	std::string ignored;
+	std::unique_ptr<Matcher> combined = makeRegexMatcher(alternation, ignore_case, ignored);
+	return std::make_unique<PatternSetMatcher>(patterns, true, std::move(combined), std::move(members), std::move(indexes));
+}
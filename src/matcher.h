@@ -0,0 +1,124 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Where one match lies within a line, in bytes, and which pattern of
+ *        a multi-pattern matcher it is (0 for a single query).
+ */
+struct MatchSpan {
+    size_t offset;
+    size_t length;
+    size_t pattern = 0;
+};
+
+/**
+ * @brief A compiled search query (plain substring or regex).
+ *
+ * Built once per scan and shared read-only by all worker threads, so the
+ * regex is compiled a single time and an invalid pattern is reported up front.
+ * The regex engine is chosen at configure time (DIRSCAN_REGEX_BACKEND).
+ */
+class Matcher {
+public:
+    virtual ~Matcher() = default;
+
+    /**
+     * @brief Compiles the query.
+     * @param query Substring or regex query
+     * @param use_regex If true, 'query' is interpreted as a regular expression
+     * @param ignore_case If true, letters match in either case: a literal by
+     *                    ASCII or Unicode folding (literal_search.h), a regex
+     *                    as its engine folds
+     * @param error Receives a description of the problem if compilation fails
+     * @return The compiled matcher, or nullptr if the regex is invalid.
+     */
+    static std::unique_ptr<Matcher> compile(const std::string& query,
+                                            bool use_regex,
+                                            bool ignore_case,
+                                            std::string& error);
+
+    /**
+     * @brief Compiles several queries searched in one pass: literals into an
+     *        Aho-Corasick automaton (multi_literal.h), regexes into a set
+     *        whose combined alternation screens lines before each pattern
+     *        reports its own spans. MatchSpan::pattern is the index into
+     *        'patterns'. Empty patterns are ignored; patterns cannot span lines.
+     * @return nullptr (and sets 'error') if no pattern is usable or a regex is invalid.
+     */
+    static std::unique_ptr<Matcher> compileSet(const std::vector<std::string>& patterns,
+                                               bool use_regex,
+                                               bool ignore_case,
+                                               std::string& error);
+
+    /**
+     * @brief Returns true if 'line' contains a match for the query.
+     *        Safe to call concurrently from several threads.
+     */
+    virtual bool matches(std::string_view line) const = 0;
+
+    /**
+     * @brief Appends the leftmost non-overlapping matches in 'line' to
+     *        'spans', in order, stopping after kMaxSpans. An empty match
+     *        (e.g. "^") gives a span of length 0.
+     * @return The number of spans appended; 0 if 'line' does not match.
+     *         Safe to call concurrently like matches().
+     */
+    virtual size_t findAll(std::string_view line, std::vector<MatchSpan>& spans) const = 0;
+
+    // Spans recorded per line at most; enough to highlight any snippet, and a
+    // bound on the memory a line made of a million hits can take.
+    static constexpr size_t kMaxSpans = 1024;
+
+    /**
+     * @brief How many lines this thread's matches() and findAll() calls gave
+     *        up on since the last call, and resets the count. A backtracking
+     *        engine gives up at its match or depth limit, and the line is
+     *        then taken as not matching (findAll() keeps the spans found
+     *        before). The default never gives up.
+     */
+    virtual size_t takeAbandonedLines() const { return 0; }
+
+    /**
+     * @brief Returns the first offset at or after 'from' (a line start) where a
+     *        match may begin, or npos if the rest of 'text' cannot match.
+     *        Callers confirm candidates with matches() on the enclosing line.
+     *        The default treats every line as a candidate.
+     */
+    virtual size_t findCandidate(std::string_view text, size_t from) const
+    {
+        return from < text.size() ? from : std::string_view::npos;
+    }
+
+    const std::string& query() const { return query_; }
+    bool isRegex() const { return useRegex_; }
+
+protected:
+    Matcher(std::string query, bool use_regex)
+        : query_(std::move(query)), useRegex_(use_regex) {}
+
+private:
+    std::string query_;
+    bool useRegex_;
+};
+
+/**
+ * @brief Builds a matcher for 'pattern' with the configured regex backend.
+ *        Implemented by exactly one of the matcher_<backend>.cpp files.
+ * @param ignoreCase Case-insensitive matching: Unicode-aware with RE2 and
+ *                   PCRE2, ASCII letters with the other backends
+ * @return nullptr (and sets 'error') if the pattern does not compile.
+ */
+std::unique_ptr<Matcher> makeRegexMatcher(const std::string& pattern, bool ignoreCase, std::string& error);
+
+/**
+ * @brief Name of the regex backend compiled into this build (e.g. "re2").
+ */
+const char* regexBackendName();
+
+#endif // MATCHER_H
@@ -0,0 +1,188 @@
+// Hyperscan regex backend: SIMD automata, linear time in the input size.
+// The compiled databases are shared; each thread needs its own scratch space,
+// cloned lazily from one process-wide prototype that is grown to fit every
+// database compiled, so a thread switching between matchers (as -f does on
+// every line) keeps using the same scratch. Match starts are only tracked by
+// a second database used for spans, so matches() stays fast.
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <hs/hs.h>
+#include "matcher.h"
+
+namespace {
+
+// The prototype every thread's scratch is cloned from. It only ever grows, so
+// a clone fits every database that existed when it was made; 'generation'
+// counts the changes, telling threads when to clone again.
+struct SharedScratch {
+	std::mutex mutex;
+	hs_scratch_t* prototype = nullptr;
+	std::atomic<uint64_t> generation{ 0 };
+
+	~SharedScratch() { hs_free_scratch(prototype); }
+};
+
+SharedScratch& sharedScratch()
+{
+	static SharedScratch shared;
+	return shared;
+}
+
+// Grows the prototype to fit 'db'
+bool fitScratch(const hs_database_t* db)
+{
+	SharedScratch& shared = sharedScratch();
+	std::lock_guard<std::mutex> lock(shared.mutex);
+	if (hs_alloc_scratch(db, &shared.prototype) != HS_SUCCESS) {
+		return false;
+	}
+	shared.generation.fetch_add(1, std::memory_order_release);
+	return true;
+}
+
+// This thread's clone of the prototype, made again after the prototype grew;
+// freed when the thread exits.
+hs_scratch_t* threadScratch()
+{
+	struct Slot {
+		uint64_t generation = 0;
+		hs_scratch_t* scratch = nullptr;
+		~Slot() { hs_free_scratch(scratch); }
+	};
+	thread_local Slot slot;
+	SharedScratch& shared = sharedScratch();
+	if (slot.generation != shared.generation.load(std::memory_order_acquire)) {
+		std::lock_guard<std::mutex> lock(shared.mutex);
+		hs_free_scratch(slot.scratch);
+		slot.scratch = nullptr;
+		slot.generation = 0;
+		if (hs_clone_scratch(shared.prototype, &slot.scratch) != HS_SUCCESS) {
+			return nullptr;
+		}
+		slot.generation = shared.generation.load(std::memory_order_relaxed);
+	}
+	return slot.scratch;
+}
+
+class HyperscanMatcher final : public Matcher {
+public:
+	HyperscanMatcher(const std::string& pattern, hs_database_t* db, hs_database_t* spanDb)
+		: Matcher(pattern, true), db_(db), spanDb_(spanDb) {}
+
+	~HyperscanMatcher() override
+	{
+		hs_free_database(spanDb_);
+		hs_free_database(db_);
+	}
+
+	bool matches(std::string_view line) const override
+	{
+		hs_scratch_t* scratch = threadScratch();
+		if (scratch == nullptr) {
+			return false;
+		}
+		bool found = false;
+		hs_scan(db_, line.data(), static_cast<unsigned int>(line.size()), 0, scratch,
+			[](unsigned int, unsigned long long, unsigned long long, unsigned int, void* ctx) -> int {
+				*static_cast<bool*>(ctx) = true;
+				return 1; // stop at the first match
+			},
+			&found);
+		return found;
+	}
+
+	size_t findAll(std::string_view line, std::vector<MatchSpan>& spans) const override
+	{
+		if (spanDb_ == nullptr) {
+			// The pattern cannot track match starts: the whole line is the span.
+			if (!matches(line)) {
+				return 0;
+			}
+			spans.push_back(MatchSpan{ 0, line.size() });
+			return 1;
+		}
+		hs_scratch_t* scratch = threadScratch();
+		if (scratch == nullptr) {
+			return 0;
+		}
+
+		// Matches arrive by end offset, each from the leftmost start for that
+		// end; they are resolved afterwards like the other backends do: in order
+		// of start, the longest at each start, skipping what overlaps a span
+		// already kept (an empty one blocks its own offset only). Consecutive
+		// matches from one start only grow, so they are merged as they come.
+		// Past kMaxCandidates the line is resolved from what was found so far.
+		static constexpr size_t kMaxCandidates = 16 * kMaxSpans;
+		thread_local std::vector<MatchSpan> candidates;
+		candidates.clear();
+		hs_scan(spanDb_, line.data(), static_cast<unsigned int>(line.size()), 0, scratch,
+			[](unsigned int, unsigned long long from, unsigned long long to, unsigned int, void* ctx) -> int {
+				auto& found = *static_cast<std::vector<MatchSpan>*>(ctx);
+				if (!found.empty() && found.back().offset == from) {
+					found.back().length = static_cast<size_t>(to - from);
+					return 0;
+				}
+				found.push_back(MatchSpan{ static_cast<size_t>(from), static_cast<size_t>(to - from) });
+				return found.size() == kMaxCandidates ? 1 : 0; // 1 stops scanning
+			},
+			&candidates);
+		std::sort(candidates.begin(), candidates.end(), [](const MatchSpan& a, const MatchSpan& b) {
+			return a.offset != b.offset ? a.offset < b.offset : a.length > b.length;
+		});
+		size_t found = 0;
+		size_t next = 0; // first offset a span may start at
+		for (const MatchSpan& span : candidates) {
+			if (found == kMaxSpans) {
+				break;
+			}
+			if (span.offset < next) {
+				continue; // overlaps the span kept, or starts at an empty one
+			}
+			spans.push_back(span);
+			++found;
+			next = span.offset + std::max<size_t>(span.length, 1);
+		}
+		return found;
+	}
+
+private:
+	hs_database_t* db_;
+	hs_database_t* spanDb_;    // with HS_FLAG_SOM_LEFTMOST; nullptr if the pattern does not support it
+};
+
+} // namespace
+
+std::unique_ptr<Matcher> makeRegexMatcher(const std::string& pattern, bool ignoreCase, std::string& error)
+{
+	const unsigned caseFlag = ignoreCase ? HS_FLAG_CASELESS : 0;
+	hs_database_t* db = nullptr;
+	hs_compile_error_t* compileError = nullptr;
+	if (hs_compile(pattern.c_str(), HS_FLAG_SINGLEMATCH | HS_FLAG_ALLOWEMPTY | caseFlag, HS_MODE_BLOCK,
+		nullptr, &db, &compileError) != HS_SUCCESS) {
+		error = "Invalid regex: " + pattern + " - " + compileError->message;
+		hs_free_compile_error(compileError);
+		return nullptr;
+	}
+
+	hs_database_t* spanDb = nullptr;
+	if (hs_compile(pattern.c_str(), HS_FLAG_SOM_LEFTMOST | HS_FLAG_ALLOWEMPTY | caseFlag, HS_MODE_BLOCK,
+		nullptr, &spanDb, &compileError) != HS_SUCCESS) {
+		hs_free_compile_error(compileError);
+		spanDb = nullptr;
+	}
+
+	if (!fitScratch(db) || (spanDb != nullptr && !fitScratch(spanDb))) {
+		hs_free_database(spanDb);
+		hs_free_database(db);
+		error = "Could not allocate Hyperscan scratch space for: " + pattern;
+		return nullptr;
+	}
+	return std::make_unique<HyperscanMatcher>(pattern, db, spanDb);
+}
+
+const char* regexBackendName()
+{
+	return "hyperscan";
+}
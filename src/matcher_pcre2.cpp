@@ -0,0 +1,120 @@
+// PCRE2 regex backend, JIT-compiled. Still a backtracking engine, so a match
+// limit bounds the work per line instead of letting a worker stall; the lines
+// it gives up on are counted for the scanner to report.
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+#include <cstdint>
+#include <utility>
+#include "matcher.h"
+
+namespace {
+
+class Pcre2Matcher final : public Matcher {
+public:
+	Pcre2Matcher(const std::string& pattern, pcre2_code* code, pcre2_match_context* context)
+		: Matcher(pattern, true), code_(code), context_(context) {}
+
+	~Pcre2Matcher() override
+	{
+		pcre2_match_context_free(context_);
+		pcre2_code_free(code_);
+	}
+
+	bool matches(std::string_view line) const override
+	{
+		return match(line, 0, threadMatchData());
+	}
+
+	size_t findAll(std::string_view line, std::vector<MatchSpan>& spans) const override
+	{
+		pcre2_match_data* data = threadMatchData();
+		size_t found = 0;
+		size_t pos = 0;
+		while (found < kMaxSpans && pos <= line.size() && match(line, pos, data)) {
+			const PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(data);
+			spans.push_back(MatchSpan{ ovector[0], ovector[1] - ovector[0] });
+			++found;
+			pos = ovector[1] > ovector[0] ? ovector[1] : ovector[0] + 1;
+			// After an empty match, resume at the next character, not inside one
+			while (pos < line.size() && (static_cast<unsigned char>(line[pos]) & 0xc0) == 0x80) {
+				++pos;
+			}
+		}
+		return found;
+	}
+
+	size_t takeAbandonedLines() const override
+	{
+		return std::exchange(abandonedLines, 0);
+	}
+
+private:
+	// Lines given up on by this thread, over all patterns
+	static thread_local size_t abandonedLines;
+
+	// False if there is no match from 'pos', or the match or depth limit was
+	// reached first (counted: the line was not really searched)
+	bool match(std::string_view line, size_t pos, pcre2_match_data* data) const
+	{
+		const int rc = pcre2_match(code_, reinterpret_cast<PCRE2_SPTR>(line.data()), line.size(),
+			pos, 0, data, context_);
+		if (rc < 0 && rc != PCRE2_ERROR_NOMATCH) {
+			++abandonedLines; // PCRE2_ERROR_MATCHLIMIT or PCRE2_ERROR_DEPTHLIMIT
+		}
+		return rc >= 0;
+	}
+
+	// Match data is per-thread scratch; the compiled code is shared.
+	static pcre2_match_data* threadMatchData()
+	{
+		struct Slot {
+			pcre2_match_data* data = nullptr;
+			~Slot() { pcre2_match_data_free(data); }
+		};
+		thread_local Slot slot;
+		if (slot.data == nullptr) {
+			slot.data = pcre2_match_data_create(1, nullptr);
+		}
+		return slot.data;
+	}
+
+	pcre2_code* code_;
+	pcre2_match_context* context_;
+};
+
+thread_local size_t Pcre2Matcher::abandonedLines = 0;
+
+} // namespace
+
+std::unique_ptr<Matcher> makeRegexMatcher(const std::string& pattern, bool ignoreCase, std::string& error)
+{
+	int errorCode = 0;
+	PCRE2_SIZE errorOffset = 0;
+	uint32_t options = ignoreCase ? PCRE2_CASELESS : 0;
+#ifdef PCRE2_MATCH_INVALID_UTF
+	// Match by code point, so -i folds non-ASCII letters as RE2 does; bytes
+	// that are not UTF-8 match no character instead of failing the line
+	options |= PCRE2_UTF | PCRE2_MATCH_INVALID_UTF;
+#endif
+	pcre2_code* code = pcre2_compile(reinterpret_cast<PCRE2_SPTR>(pattern.data()), pattern.size(),
+		options, &errorCode, &errorOffset, nullptr);
+	if (code == nullptr) {
+		PCRE2_UCHAR message[256];
+		pcre2_get_error_message(errorCode, message, sizeof(message));
+		error = "Invalid regex: " + pattern + " - " + reinterpret_cast<const char*>(message);
+		return nullptr;
+	}
+
+	// JIT is optional: if unavailable pcre2_match falls back to the interpreter.
+	pcre2_jit_compile(code, PCRE2_JIT_COMPLETE);
+
+	pcre2_match_context* context = pcre2_match_context_create(nullptr);
+	pcre2_set_match_limit(context, 1000000);
+	pcre2_set_depth_limit(context, 10000);
+	return std::make_unique<Pcre2Matcher>(pattern, code, context);
+}
+
+const char* regexBackendName()
+{
+	return "pcre2";
+}
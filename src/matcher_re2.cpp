@@ -0,0 +1,59 @@
+// RE2 regex backend: linear-time automaton matching, no backtracking.
+// RE2 objects are thread-safe for concurrent matching.
+#include <re2/re2.h>
+#include "matcher.h"
+
+namespace {
+
+class Re2Matcher final : public Matcher {
+public:
+	Re2Matcher(const std::string& pattern, std::unique_ptr<RE2> compiled)
+		: Matcher(pattern, true), re_(std::move(compiled)) {}
+
+	bool matches(std::string_view line) const override
+	{
+		return RE2::PartialMatch(re2::StringPiece(line.data(), line.size()), *re_);
+	}
+
+	size_t findAll(std::string_view line, std::vector<MatchSpan>& spans) const override
+	{
+		// Matching from 'pos' inside the whole line keeps ^, \b and friends right.
+		const re2::StringPiece text(line.data(), line.size());
+		size_t found = 0;
+		size_t pos = 0;
+		re2::StringPiece match;
+		while (found < kMaxSpans && pos <= line.size()
+			&& re_->Match(text, pos, line.size(), RE2::UNANCHORED, &match, 1)) {
+			const size_t offset = static_cast<size_t>(match.data() - line.data());
+			spans.push_back(MatchSpan{ offset, match.size() });
+			++found;
+			pos = offset + (match.empty() ? 1 : match.size());
+		}
+		return found;
+	}
+
+private:
+	std::unique_ptr<RE2> re_;
+};
+
+} // namespace
+
+std::unique_ptr<Matcher> makeRegexMatcher(const std::string& pattern, bool ignoreCase, std::string& error)
+{
+	RE2::Options options;
+	options.set_log_errors(false);
+	options.set_max_mem(64 << 20); // room for the DFA on large alternations
+	options.set_case_sensitive(!ignoreCase); // UTF-8 mode: folds non-ASCII letters too
+
+	auto re = std::make_unique<RE2>(pattern, options);
+	if (!re->ok()) {
+		error = "Invalid regex: " + pattern + " - " + re->error();
+		return nullptr;
+	}
+	return std::make_unique<Re2Matcher>(pattern, std::move(re));
+}
+
+const char* regexBackendName()
+{
+	return "re2";
+}
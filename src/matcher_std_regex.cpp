@@ -0,0 +1,51 @@
+// Fallback regex backend: std::regex (ECMAScript grammar).
+// Backtracking, so pathological patterns can be slow; prefer RE2 or Hyperscan.
+#include <regex>
+#include "matcher.h"
+
+namespace {
+
+class StdRegexMatcher final : public Matcher {
+public:
+	StdRegexMatcher(const std::string& pattern, std::regex compiled)
+		: Matcher(pattern, true), pattern_(std::move(compiled)) {}
+
+	bool matches(std::string_view line) const override
+	{
+		return std::regex_search(line.begin(), line.end(), pattern_);
+	}
+
+	size_t findAll(std::string_view line, std::vector<MatchSpan>& spans) const override
+	{
+		// regex_iterator steps over empty matches by itself
+		size_t found = 0;
+		for (std::cregex_iterator it(line.data(), line.data() + line.size(), pattern_), end;
+			it != end && found < kMaxSpans; ++it) {
+			spans.push_back(MatchSpan{ static_cast<size_t>(it->position(0)), static_cast<size_t>(it->length(0)) });
+			++found;
+		}
+		return found;
+	}
+
+private:
+	std::regex pattern_;
+};
+
+} // namespace
+
+std::unique_ptr<Matcher> makeRegexMatcher(const std::string& pattern, bool ignoreCase, std::string& error)
+{
+	try {
+		const auto flags = ignoreCase ? std::regex::ECMAScript | std::regex::icase : std::regex::ECMAScript;
+		return std::make_unique<StdRegexMatcher>(pattern, std::regex(pattern, flags));
+	}
+	catch (const std::regex_error& e) {
+		error = "Invalid regex: " + pattern + " - " + e.what();
+		return nullptr;
+	}
+}
+
+const char* regexBackendName()
+{
+	return "std";
+}
@@ -0,0 +1,143 @@
+#include "multi_literal.h"
+
+#include <algorithm>
+#include <deque>
+
+AhoCorasick::AhoCorasick(const std::vector<std::string>& patterns, bool ignoreCase)
+{
+	// Equivalence classes: one per byte used in a pattern (one per letter if
+	// case is ignored), 0 for the rest
+	for (const auto& pattern : patterns) {
+		for (unsigned char c : pattern) {
+			if (classOf_[c] != 0) {
+				continue;
+			}
+			classOf_[c] = static_cast<uint8_t>(numClasses_);
+			const unsigned char lower = c | 0x20;
+			if (ignoreCase && lower >= 'a' && lower <= 'z') {
+				classOf_[c ^ 0x20] = static_cast<uint8_t>(numClasses_);
+			}
+			++numClasses_;
+		}
+	}
+	if (numClasses_ > 256) {
+		// Every byte value is used: one class per byte, none left over
+		for (int c = 0; c < 256; ++c) {
+			classOf_[c] = static_cast<uint8_t>(c);
+		}
+		numClasses_ = 256;
+	}
+
+	// Trie; missing transitions are kNone until the breadth-first pass
+	constexpr uint32_t kNone = UINT32_MAX;
+	auto addState = [&]() {
+		next_.resize(next_.size() + numClasses_, kNone);
+		output_.push_back(-1);
+		return static_cast<uint32_t>(output_.size() - 1);
+	};
+	addState();
+	lengths_.reserve(patterns.size());
+	for (size_t p = 0; p < patterns.size(); ++p) {
+		lengths_.push_back(static_cast<uint32_t>(patterns[p].size()));
+		if (patterns[p].empty()) {
+			continue;
+		}
+		uint32_t state = 0;
+		for (unsigned char c : patterns[p]) {
+			uint32_t& edge = next_[state * numClasses_ + classOf_[c]];
+			if (edge == kNone) {
+				uint32_t child = addState();
+				next_[state * numClasses_ + classOf_[c]] = child; // 'edge' may have moved
+				state = child;
+			}
+			else {
+				state = edge;
+			}
+		}
+		if (output_[state] < 0) {
+			output_[state] = static_cast<int32_t>(p); // duplicates report the first
+		}
+	}
+
+	// Failure links in breadth-first order, folded into the transitions
+	const size_t numStates = output_.size();
+	std::vector<uint32_t> fail(numStates, 0);
+	outLink_.assign(numStates, 0);
+	match_.assign(numStates, -1);
+	std::deque<uint32_t> queue;
+	for (uint32_t c = 0; c < numClasses_; ++c) {
+		uint32_t& edge = next_[c];
+		if (edge == kNone) {
+			edge = 0;
+		}
+		else {
+			queue.push_back(edge);
+		}
+	}
+	while (!queue.empty()) {
+		const uint32_t state = queue.front();
+		queue.pop_front();
+		const uint32_t f = fail[state];
+		outLink_[state] = output_[f] >= 0 ? f : outLink_[f];
+		match_[state] = output_[state] >= 0 ? output_[state] : match_[f];
+		for (uint32_t c = 0; c < numClasses_; ++c) {
+			uint32_t& edge = next_[state * numClasses_ + c];
+			if (edge == kNone) {
+				edge = next_[f * numClasses_ + c];
+			}
+			else {
+				fail[edge] = next_[f * numClasses_ + c];
+				queue.push_back(edge);
+			}
+		}
+	}
+}
+
+size_t AhoCorasick::findFirst(std::string_view text, size_t from) const
+{
+	uint32_t state = 0;
+	for (size_t i = from; i < text.size(); ++i) {
+		state = step(state, static_cast<unsigned char>(text[i]));
+		if (match_[state] >= 0) {
+			return i + 1 - lengths_[match_[state]];
+		}
+	}
+	return std::string_view::npos;
+}
+
+size_t AhoCorasick::findAll(std::string_view text, std::vector<MatchSpan>& spans, size_t limit) const
+{
+	// Collect every occurrence, then keep the leftmost-longest ones that do
+	// not overlap. The scratch list is per thread and reused.
+	thread_local std::vector<MatchSpan> hits;
+	hits.clear();
+	const size_t maxHits = 16 * std::max<size_t>(limit, 1);
+	uint32_t state = 0;
+	for (size_t i = 0; i < text.size() && hits.size() < maxHits; ++i) {
+		state = step(state, static_cast<unsigned char>(text[i]));
+		if (match_[state] < 0) {
+			continue;
+		}
+		for (uint32_t s = output_[state] >= 0 ? state : outLink_[state]; s != 0; s = outLink_[s]) {
+			const uint32_t length = lengths_[output_[s]];
+			hits.push_back(MatchSpan{ i + 1 - length, length, static_cast<size_t>(output_[s]) });
+		}
+	}
+	std::sort(hits.begin(), hits.end(), [](const MatchSpan& a, const MatchSpan& b) {
+		return a.offset != b.offset ? a.offset < b.offset : a.length > b.length;
+	});
+
+	size_t found = 0;
+	size_t end = 0;
+	for (const auto& hit : hits) {
+		if (found == limit) {
+			break;
+		}
+		if (hit.offset >= end) {
+			spans.push_back(hit);
+			end = hit.offset + hit.length;
+			++found;
+		}
+	}
+	return found;
+}
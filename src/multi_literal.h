@@ -0,0 +1,59 @@
+#ifndef MULTI_LITERAL_H
+#define MULTI_LITERAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "matcher.h"
+
+/**
+ * @brief Aho-Corasick automaton over a set of literal patterns: one pass over
+ *        the text finds every occurrence of every pattern.
+ *
+ * The automaton is a full DFA (failure links folded into the transitions), so
+ * each input byte costs one table lookup. Bytes that occur in no pattern share
+ * one equivalence class, which keeps the table at states x (distinct bytes + 1)
+ * entries instead of states x 256. Read-only after construction, so it is
+ * shared by all worker threads. Empty patterns never match.
+ *
+ * With 'ignoreCase', the two cases of an ASCII letter share a class, so
+ * case-insensitive matching costs nothing extra; non-ASCII bytes are compared
+ * as they are (see Matcher::compileSet for patterns that need Unicode folding).
+ */
+class AhoCorasick {
+public:
+    explicit AhoCorasick(const std::vector<std::string>& patterns, bool ignoreCase = false);
+
+    /**
+     * @brief Start of the first match to end at or after 'from' (every match
+     *        found starts at or after 'from'), or npos if there is none.
+     */
+    size_t findFirst(std::string_view text, size_t from = 0) const;
+
+    /**
+     * @brief Appends the leftmost-longest non-overlapping matches in 'text'
+     *        to 'spans' (tagged with their pattern index), at most 'limit'.
+     * @return The number of spans appended.
+     */
+    size_t findAll(std::string_view text, std::vector<MatchSpan>& spans, size_t limit) const;
+
+    size_t stateCount() const { return match_.size(); }
+
+private:
+    uint32_t step(uint32_t state, unsigned char byte) const
+    {
+        return next_[state * numClasses_ + classOf_[byte]];
+    }
+
+    uint8_t classOf_[256] = {};
+    uint32_t numClasses_ = 1;
+    std::vector<uint32_t> next_;      // [state * numClasses_ + class] -> state
+    std::vector<int32_t> output_;     // pattern spelled by the state itself, or -1
+    std::vector<int32_t> match_;      // longest pattern ending in the state, or -1
+    std::vector<uint32_t> outLink_;   // next shorter suffix state with an output, 0 = none
+    std::vector<uint32_t> lengths_;   // per pattern
+};
+
+#endif // MULTI_LITERAL_H
@@ -0,0 +1,149 @@
+#include "parallel_walker.h"
+
+#include <chrono>
+#include <system_error>
+#include <thread>
+#include "ignore_rules.h"
+#include "stage_timer.h"
+
+ParallelWalker::ParallelWalker(unsigned numThreads)
+	: numThreads_(numThreads == 0 ? 1 : numThreads)
+{
+	deques_.reserve(numThreads_);
+	for (unsigned i = 0; i < numThreads_; ++i) {
+		deques_.push_back(std::make_unique<WorkDeque>());
+	}
+}
+
+void ParallelWalker::walk(const std::filesystem::path& root, WalkVisitor& visitor, const IgnoreFilter* ignore,
+	unsigned maxDepth)
+{
+	for (auto& deque : deques_) {
+		deque->dirs.clear(); // left over if an earlier walk was stopped
+	}
+	ignore_ = ignore && !ignore->empty() ? ignore : nullptr;
+	rootLength_ = rootPathLength(root);
+	maxDepth_ = maxDepth;
+	pendingDirs_.store(1, std::memory_order_relaxed);
+	deques_[0]->dirs.push_back(WorkItem{ root, nullptr, 0 });
+
+	StageProfile* profile = StageProfile::current();
+	std::vector<std::thread> threads;
+	threads.reserve(numThreads_);
+	for (unsigned i = 0; i < numThreads_; ++i) {
+		threads.emplace_back([this, i, &visitor, profile]() {
+			ProfileScope scope(profile, "walker", static_cast<int>(i));
+			run(i, visitor);
+		});
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+}
+
+void ParallelWalker::run(unsigned worker, WalkVisitor& visitor)
+{
+	using namespace std::chrono_literals;
+	unsigned idleRounds = 0;
+	while (!visitor.stopRequested()) {
+		WorkItem item;
+		if (popLocal(worker, item) || steal(worker, item)) {
+			idleRounds = 0;
+			visitDirectory(item, worker, visitor);
+			pendingDirs_.fetch_sub(1, std::memory_order_acq_rel);
+			continue;
+		}
+
+		visitor.onIdle(worker);
+		// Nothing queued anywhere and nobody still visiting: the walk is done.
+		if (pendingDirs_.load(std::memory_order_acquire) == 0) {
+			break;
+		}
+		// Someone is still visiting a directory and may publish more work.
+		if (++idleRounds < 64) {
+			std::this_thread::yield();
+		}
+		else {
+			std::this_thread::sleep_for(100us);
+		}
+	}
+}
+
+void ParallelWalker::visitDirectory(const WorkItem& item, unsigned worker, WalkVisitor& visitor)
+{
+	StageTimer timer(Stage::Walk);
+	const std::filesystem::path& dir = item.dir;
+	const std::shared_ptr<const IgnoreRules> rules = ignore_ ? ignore_->enter(dir, rootLength_, item.rules) : nullptr;
+	std::error_code ec;
+	std::filesystem::directory_iterator it(dir,
+		std::filesystem::directory_options::skip_permission_denied, ec);
+	if (ec) {
+		visitor.onError("Error scanning directory: " + dir.string() + " - " + ec.message());
+		return;
+	}
+
+	for (const std::filesystem::directory_iterator end; it != end; it.increment(ec)) {
+		if (visitor.stopRequested()) {
+			return;
+		}
+		if (ec) {
+			visitor.onError("Error reading an entry in: " + dir.string() + " - " + ec.message());
+			break;
+		}
+		const auto& entry = *it;
+
+		// Like recursive_directory_iterator, do not descend through directory symlinks.
+		std::error_code typeEc;
+		if (entry.is_directory(typeEc) && !entry.is_symlink(typeEc)) {
+			// An ignored directory, or one below the depth limit, is never read
+			if (item.depth >= maxDepth_
+				|| (ignore_ && ignore_->ignores(rules.get(), entry.path(), rootLength_, true))) {
+				continue;
+			}
+			pendingDirs_.fetch_add(1, std::memory_order_relaxed);
+			pushLocal(worker, WorkItem{ entry.path(), rules, item.depth + 1 });
+			continue;
+		}
+		if (entry.is_regular_file(typeEc)) {
+			if (!ignore_ || !ignore_->ignores(rules.get(), entry.path(), rootLength_, false)) {
+				visitor.onFile(entry, worker);
+			}
+		}
+		else if (typeEc) {
+			visitor.onError("Error reading an entry: " + entry.path().string() + " - " + typeEc.message());
+		}
+	}
+}
+
+bool ParallelWalker::popLocal(unsigned worker, WorkItem& item)
+{
+	WorkDeque& own = *deques_[worker];
+	std::lock_guard<std::mutex> lock(own.mutex);
+	if (own.dirs.empty()) {
+		return false;
+	}
+	item = std::move(own.dirs.back());
+	own.dirs.pop_back();
+	return true;
+}
+
+bool ParallelWalker::steal(unsigned worker, WorkItem& item)
+{
+	for (unsigned offset = 1; offset < numThreads_; ++offset) {
+		WorkDeque& victim = *deques_[(worker + offset) % numThreads_];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.dirs.empty()) {
+			item = std::move(victim.dirs.front());
+			victim.dirs.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void ParallelWalker::pushLocal(unsigned worker, WorkItem item)
+{
+	WorkDeque& own = *deques_[worker];
+	std::lock_guard<std::mutex> lock(own.mutex);
+	own.dirs.push_back(std::move(item));
+}
@@ -0,0 +1,146 @@
+#ifndef PARALLEL_WALKER_H
+#define PARALLEL_WALKER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+class IgnoreFilter;
+class IgnoreRules;
+
+/**
+ * @brief Callbacks for ParallelWalker. Called concurrently from the walker
+ *        threads; 'worker' identifies the calling thread (0..numThreads-1) so
+ *        implementations can keep per-thread state without locking.
+ */
+class WalkVisitor {
+public:
+    virtual ~WalkVisitor() = default;
+
+    // A regular file (or symlink to one) was found.
+    virtual void onFile(const std::filesystem::directory_entry& entry, unsigned worker) = 0;
+
+    // The walker thread has no local work left (it is about to steal or exit);
+    // a good moment to flush anything buffered for 'worker'.
+    virtual void onIdle(unsigned /*worker*/) {}
+
+    // A directory or entry could not be read.
+    virtual void onError(const std::string& message) = 0;
+
+    // Polled between entries; once true, the walk ends without visiting
+    // the rest of the tree.
+    virtual bool stopRequested() const { return false; }
+};
+
+/**
+ * @brief Recursive directory enumeration on several threads.
+ *
+ * Directories are the work items: each thread owns a deque, pushes the
+ * subdirectories it discovers onto the back and pops from the back (depth
+ * first, good locality), while idle threads steal from the front of other
+ * threads' deques (the oldest, usually largest, subtrees). Permission-denied
+ * directories are skipped and directory symlinks are not followed, matching
+ * recursive_directory_iterator with skip_permission_denied.
+ *
+ * With an IgnoreFilter, each directory's ignore files are read before its
+ * entries, and excluded subdirectories are never queued, so a whole ignored
+ * subtree costs one check. Each queued directory carries the rules in force
+ * above it.
+ */
+class ParallelWalker {
+public:
+    static constexpr unsigned kUnlimitedDepth = ~0u;
+
+    explicit ParallelWalker(unsigned numThreads);
+
+    /**
+     * @brief Walks 'root' and blocks until every directory below it was
+     *        visited, or until the visitor asks to stop.
+     * @param ignore Skips what it excludes (may be null); must outlive the walk
+     * @param maxDepth Directories deeper than this below 'root' are not entered
+     *                 (0: only the files directly in 'root')
+     */
+    void walk(const std::filesystem::path& root, WalkVisitor& visitor, const IgnoreFilter* ignore = nullptr,
+              unsigned maxDepth = kUnlimitedDepth);
+
+private:
+    struct WorkItem {
+        std::filesystem::path dir;
+        std::shared_ptr<const IgnoreRules> rules; // in force in its parent
+        unsigned depth = 0;                        // directories below the root
+    };
+
+    struct alignas(64) WorkDeque {
+        std::mutex mutex;
+        std::deque<WorkItem> dirs;
+    };
+
+    void run(unsigned worker, WalkVisitor& visitor);
+    void visitDirectory(const WorkItem& item, unsigned worker, WalkVisitor& visitor);
+    bool popLocal(unsigned worker, WorkItem& item);
+    bool steal(unsigned worker, WorkItem& item);
+    void pushLocal(unsigned worker, WorkItem item);
+
+    unsigned numThreads_;
+    const IgnoreFilter* ignore_ = nullptr;
+    size_t rootLength_ = 0;
+    unsigned maxDepth_ = kUnlimitedDepth;
+    std::vector<std::unique_ptr<WorkDeque>> deques_;
+    std::atomic<size_t> pendingDirs_{ 0 }; // queued or being visited
+};
+
+/**
+ * @brief Length of 'root' in the byte form withRelativePath() slices.
+ */
+inline size_t rootPathLength(const std::filesystem::path& root)
+{
+    if constexpr (std::is_same_v<std::filesystem::path::value_type, char>) {
+        return root.native().size();
+    }
+    else {
+        return root.generic_u8string().size();
+    }
+}
+
+/**
+ * @brief Calls 'fn' with the path of 'file', found by walking a root of
+ *        'rootLength' bytes, relative to that root with '/' separators.
+ *        On POSIX this is a view of the native bytes and does not allocate;
+ *        elsewhere it is a temporary UTF-8 copy.
+ */
+template <typename Fn>
+decltype(auto) withRelativePath(std::basic_string_view<std::filesystem::path::value_type> file,
+                                size_t rootLength, Fn&& fn)
+{
+    auto relativeOf = [rootLength](std::string_view path) {
+        std::string_view relative = path.substr(std::min(rootLength, path.size()));
+        while (!relative.empty() && relative.front() == '/') {
+            relative.remove_prefix(1);
+        }
+        return relative;
+    };
+    if constexpr (std::is_same_v<std::filesystem::path::value_type, char>) {
+        return fn(relativeOf(file));
+    }
+    else {
+        auto u8 = std::filesystem::path(file).generic_u8string();  // '/' separators, UTF-8
+        return fn(relativeOf(std::string_view(reinterpret_cast<const char*>(u8.data()), u8.size())));
+    }
+}
+
+template <typename Fn>
+decltype(auto) withRelativePath(const std::filesystem::path& file, size_t rootLength, Fn&& fn)
+{
+    return withRelativePath(std::basic_string_view<std::filesystem::path::value_type>(file.native()),
+                            rootLength, std::forward<Fn>(fn));
+}
+
+#endif // PARALLEL_WALKER_H
@@ -0,0 +1,131 @@
+#include "path_arena.h"
+
+#include <algorithm>
+#include <new>
+
+// Slab header, followed by its characters.
+struct PathSlab {
+	std::atomic<uint32_t> refs{ 1 };
+	size_t capacity = 0;
+
+	NativeChar* chars() { return reinterpret_cast<NativeChar*>(this + 1); }
+
+	static PathSlab* create(size_t capacity)
+	{
+		void* memory = ::operator new(sizeof(PathSlab) + capacity * sizeof(NativeChar));
+		PathSlab* slab = new (memory) PathSlab;
+		slab->capacity = capacity;
+		return slab;
+	}
+
+	void acquire() { refs.fetch_add(1, std::memory_order_relaxed); }
+
+	void release()
+	{
+		if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			this->~PathSlab();
+			::operator delete(this);
+		}
+	}
+};
+
+static_assert(sizeof(PathSlab) % alignof(NativeChar) == 0);
+
+PathRef PathRef::copyOf(NativeView native)
+{
+	PathSlab* slab = PathSlab::create(native.size() + 1);
+	std::copy(native.begin(), native.end(), slab->chars());
+	slab->chars()[native.size()] = NativeChar();
+	return PathRef(slab, slab->chars(), static_cast<uint32_t>(native.size()));
+}
+
+PathRef::PathRef(const std::filesystem::path& path)
+	: PathRef(copyOf(path.native()))
+{
+}
+
+PathRef::PathRef(const PathRef& other)
+	: slab_(other.slab_), data_(other.data_), size_(other.size_)
+{
+	if (slab_) {
+		slab_->acquire();
+	}
+}
+
+PathRef::PathRef(PathRef&& other) noexcept
+	: slab_(other.slab_), data_(other.data_), size_(other.size_)
+{
+	other.slab_ = nullptr;
+	other.data_ = nullptr;
+	other.size_ = 0;
+}
+
+PathRef& PathRef::operator=(const PathRef& other)
+{
+	if (this != &other) {
+		PathRef copy(other);
+		*this = std::move(copy);
+	}
+	return *this;
+}
+
+PathRef& PathRef::operator=(PathRef&& other) noexcept
+{
+	if (this != &other) {
+		release();
+		slab_ = other.slab_;
+		data_ = other.data_;
+		size_ = other.size_;
+		other.slab_ = nullptr;
+		other.data_ = nullptr;
+		other.size_ = 0;
+	}
+	return *this;
+}
+
+void PathRef::release()
+{
+	if (slab_) {
+		slab_->release();
+		slab_ = nullptr;
+		data_ = nullptr;
+		size_ = 0;
+	}
+}
+
+PathArena::~PathArena()
+{
+	if (slab_) {
+		slab_->release();
+	}
+}
+
+PathArena::PathArena(PathArena&& other) noexcept
+	: slab_(other.slab_), used_(other.used_), slabs_(other.slabs_)
+{
+	other.slab_ = nullptr;
+	other.used_ = 0;
+}
+
+PathRef PathArena::store(NativeView path)
+{
+	const size_t needed = path.size() + 1;
+	if (needed > kSlabChars) {
+		++slabs_;
+		return PathRef::copyOf(path);
+	}
+	if (!slab_ || slab_->capacity - used_ < needed) {
+		if (slab_) {
+			slab_->release(); // freed once the last path in it is done with
+		}
+		slab_ = PathSlab::create(kSlabChars);
+		used_ = 0;
+		++slabs_;
+	}
+	NativeChar* chars = slab_->chars() + used_;
+	std::copy(path.begin(), path.end(), chars);
+	chars[path.size()] = NativeChar();
+	used_ += needed;
+	slab_->acquire();
+	return PathRef(slab_, chars, static_cast<uint32_t>(path.size()));
+}
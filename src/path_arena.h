@@ -0,0 +1,89 @@
+#ifndef PATH_ARENA_H
+#define PATH_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+using NativeChar = std::filesystem::path::value_type;
+using NativeView = std::basic_string_view<NativeChar>;
+
+struct PathSlab;
+
+/**
+ * @brief A file path stored in a PathArena slab: the native characters,
+ *        NUL-terminated, so it can be opened or stat'ed without a copy.
+ *
+ * Holding a PathRef keeps its slab alive. Copies share the slab (one atomic
+ * increment); the last reference to a full slab frees it. Safe to pass between
+ * threads, as the file queue does.
+ */
+class PathRef {
+public:
+    PathRef() = default;
+
+    // A path outside any arena (tests, one-off callers): gets a slab of its own.
+    PathRef(const std::filesystem::path& path);
+
+    PathRef(const PathRef& other);
+    PathRef(PathRef&& other) noexcept;
+    PathRef& operator=(const PathRef& other);
+    PathRef& operator=(PathRef&& other) noexcept;
+    ~PathRef() { release(); }
+
+    bool empty() const { return size_ == 0; }
+    NativeView native() const { return NativeView(data_, size_); }
+    const NativeChar* c_str() const { return data_ ? data_ : kEmpty; }
+
+    // A std::filesystem::path copy (allocates); only for reporting.
+    std::filesystem::path toPath() const { return std::filesystem::path(native()); }
+
+private:
+    friend class PathArena;
+    static constexpr NativeChar kEmpty[1] = {};
+
+    PathRef(PathSlab* slab, const NativeChar* data, uint32_t size) : slab_(slab), data_(data), size_(size) {}
+    static PathRef copyOf(NativeView native);
+    void release();
+
+    PathSlab* slab_ = nullptr;
+    const NativeChar* data_ = nullptr;
+    uint32_t size_ = 0;
+};
+
+/**
+ * @brief Bump allocator for paths, one per producing thread (not thread-safe).
+ *
+ * Paths are copied back to back into slabs of kSlabChars characters, so
+ * queueing a file costs a copy and an atomic increment instead of a heap
+ * allocation; a slab is allocated per few hundred paths and freed once the
+ * arena moved on and every PathRef into it is gone. Paths longer than a slab
+ * get a slab of their own.
+ */
+class PathArena {
+public:
+    static constexpr size_t kSlabChars = 32 * 1024;
+
+    PathArena() = default;
+    ~PathArena();
+
+    PathArena(const PathArena&) = delete;
+    PathArena& operator=(const PathArena&) = delete;
+    PathArena(PathArena&& other) noexcept;
+    PathArena& operator=(PathArena&&) = delete;
+
+    PathRef store(NativeView path);
+    PathRef store(const std::filesystem::path& path) { return store(NativeView(path.native())); }
+
+    // Slabs allocated so far (for tests and statistics).
+    size_t slabCount() const { return slabs_; }
+
+private:
+    PathSlab* slab_ = nullptr;   // current slab; the arena holds one reference to it
+    size_t used_ = 0;
+    size_t slabs_ = 0;
+};
+
+#endif // PATH_ARENA_H
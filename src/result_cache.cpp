@@ -0,0 +1,214 @@
+#include "result_cache.h"
+
+#include <chrono>
+#include <fstream>
+#include <system_error>
+#include "byte_codec.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+// File layout (integers little-endian, strings as u32 length + bytes):
+//   magic[8]  queryKey  root (UTF-8)  u64 entryCount
+//   entryCount x { path, u64 size, i64 mtime, u64 inode, u32 lineCount,
+//                  lineCount x { u64 lineNumber, u64 offset, line } }
+constexpr char kMagic[8] = { 'D', 'S', 'C', 'A', 'C', 'H', 'E', '2' };
+
+int64_t nowNanos()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::string utf8Of(const std::filesystem::path& path)
+{
+	auto u8 = path.u8string();
+	return std::string(reinterpret_cast<const char*>(u8.data()), u8.size());
+}
+
+} // namespace
+
+bool readFileStamp(const std::filesystem::path& path, FileStamp& stamp)
+{
+	return readFileStamp(path.c_str(), stamp);
+}
+
+bool readFileStamp(const std::filesystem::path::value_type* nativePath, FileStamp& stamp)
+{
+#ifdef _WIN32
+	const std::filesystem::path path(nativePath);
+	std::error_code ec;
+	stamp.size = std::filesystem::file_size(path, ec);
+	auto written = ec ? std::filesystem::file_time_type{} : std::filesystem::last_write_time(path, ec);
+	if (ec) {
+		return false;
+	}
+	stamp.mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::clock_cast<std::chrono::system_clock>(written).time_since_epoch()).count();
+	stamp.inode = 0;
+	return true;
+#else
+	struct stat st;
+	if (::stat(nativePath, &st) != 0) {
+		return false;
+	}
+	stamp.size = static_cast<uint64_t>(st.st_size);
+#if defined(__APPLE__)
+	stamp.mtime = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	stamp.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+	stamp.inode = static_cast<uint64_t>(st.st_ino);
+	return true;
+#endif
+}
+
+bool readFileStamp(const std::filesystem::directory_entry& entry, FileStamp& stamp)
+{
+#ifdef _WIN32
+	// directory_iterator caches size and write time from FindNextFileW
+	std::error_code ec;
+	stamp.size = entry.file_size(ec);
+	auto written = ec ? std::filesystem::file_time_type{} : entry.last_write_time(ec);
+	if (ec) {
+		return false;
+	}
+	stamp.mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::clock_cast<std::chrono::system_clock>(written).time_since_epoch()).count();
+	stamp.inode = 0;
+	return true;
+#else
+	// POSIX listings (d_type) carry no size or time
+	return readFileStamp(entry.path().c_str(), stamp);
+#endif
+}
+
+std::unique_ptr<ResultCache> ResultCache::open(const std::filesystem::path& cachePath, std::string queryKey)
+{
+	std::unique_ptr<ResultCache> cache(new ResultCache(cachePath, std::move(queryKey)));
+	cache->load();
+	return cache;
+}
+
+void ResultCache::clearLoaded()
+{
+	entries_.clear();
+	loadedRoot_.clear();
+	reader_.close();
+}
+
+void ResultCache::load()
+{
+	clearLoaded();
+	std::string error;
+	if (!reader_.open(cachePath_, error)) {
+		return; // first run
+	}
+
+	ByteCursor in{ reader_.contents() };
+	if (in.bytes(sizeof(kMagic)) != std::string_view(kMagic, sizeof(kMagic)) || in.sized() != queryKey_) {
+		clearLoaded(); // another format or another query
+		return;
+	}
+	loadedRoot_ = std::string(in.sized());
+	const uint64_t count = in.u64();
+	for (uint64_t i = 0; i < count && in.ok; ++i) {
+		std::string_view path = in.sized();
+		CachedFile file;
+		file.stamp.size = in.u64();
+		file.stamp.mtime = static_cast<int64_t>(in.u64());
+		file.stamp.inode = in.u64();
+		const uint32_t lineCount = in.u32();
+		for (uint32_t l = 0; l < lineCount && in.ok; ++l) {
+			const size_t lineNumber = static_cast<size_t>(in.u64());
+			const uint64_t offset = in.u64();
+			file.lines.push_back(LineMatch{ lineNumber, in.sized(), 0, 0, offset });
+		}
+		entries_.emplace(path, std::move(file));
+	}
+	if (!in.atEnd()) {
+		clearLoaded(); // truncated or corrupt: start over
+	}
+}
+
+void ResultCache::beginRun(const std::filesystem::path& root, unsigned numSlots)
+{
+	root_ = utf8Of(root);
+	if (root_ != loadedRoot_) {
+		entries_.clear();
+	}
+	recordBefore_ = nowNanos() - 1000000000; // one second
+	slots_.assign(numSlots, Slot{});
+}
+
+const std::vector<LineMatch>* ResultCache::lookup(std::string_view relativePath, const FileStamp& stamp) const
+{
+	auto it = entries_.find(relativePath);
+	if (it == entries_.end() || !(it->second.stamp == stamp)) {
+		return nullptr;
+	}
+	return &it->second.lines;
+}
+
+void ResultCache::record(unsigned slot, std::string_view relativePath, const FileStamp& stamp,
+	const std::vector<LineMatch>& lines)
+{
+	if (stamp.mtime >= recordBefore_) {
+		return;
+	}
+	Slot& out = slots_[slot];
+	putBytes(out.data, relativePath);
+	putU64(out.data, stamp.size);
+	putU64(out.data, static_cast<uint64_t>(stamp.mtime));
+	putU64(out.data, stamp.inode);
+	putU32(out.data, static_cast<uint32_t>(lines.size()));
+	for (const auto& line : lines) {
+		putU64(out.data, line.lineNumber);
+		putU64(out.data, line.offset);
+		putBytes(out.data, line.line);
+	}
+	out.count++;
+}
+
+bool ResultCache::save(std::string& error)
+{
+	// Every recorded entry is a copy, so the loaded file can be released first.
+	clearLoaded();
+
+	std::string header(kMagic, sizeof(kMagic));
+	putBytes(header, queryKey_);
+	putBytes(header, root_);
+	uint64_t count = 0;
+	for (const auto& slot : slots_) {
+		count += slot.count;
+	}
+	putU64(header, count);
+
+	std::filesystem::path tmpPath = cachePath_;
+	tmpPath += ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		file.write(header.data(), static_cast<std::streamsize>(header.size()));
+		for (const auto& slot : slots_) {
+			file.write(slot.data.data(), static_cast<std::streamsize>(slot.data.size()));
+		}
+		if (!file) {
+			error = "Could not write cache " + tmpPath.string();
+			return false;
+		}
+	}
+	slots_.clear();
+
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, cachePath_, ec);
+	if (ec) {
+		error = "Could not write cache " + cachePath_.string() + " - " + ec.message();
+		std::filesystem::remove(tmpPath, ec);
+		return false;
+	}
+	load();
+	return true;
+}
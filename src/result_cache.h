@@ -0,0 +1,121 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "file_reader.h"
+#include "scanner.h"
+
+/**
+ * @brief What identifies one version of a file: size, modification time
+ *        (nanoseconds since the Unix epoch) and inode (0 where unavailable).
+ */
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t inode = 0;
+
+    bool operator==(const FileStamp&) const = default;
+};
+
+/**
+ * @brief Reads the stamp of 'path' with a single stat call.
+ * @return false if the file cannot be stat'ed.
+ */
+bool readFileStamp(const std::filesystem::path& path, FileStamp& stamp);
+bool readFileStamp(const std::filesystem::path::value_type* path, FileStamp& stamp);
+
+/**
+ * @brief Same, for an entry found by a directory walk: from the attributes the
+ *        listing already returned where the platform provides them (Windows),
+ *        else with one stat call.
+ */
+bool readFileStamp(const std::filesystem::directory_entry& entry, FileStamp& stamp);
+
+/**
+ * @brief Per-file match results of the last run of one query over one tree,
+ *        so unchanged files can be reported again without being opened.
+ *
+ * Loaded read-only at the start of a run and consulted concurrently; the new
+ * contents are recorded through per-thread slots and replace the file in
+ * save(). The cache is disposable: a missing, corrupt or foreign cache file
+ * simply starts out empty.
+ */
+class ResultCache {
+public:
+    /**
+     * @brief Opens 'cachePath' and keeps its entries if they were produced by
+     *        the same 'queryKey' (query text plus anything affecting results).
+     */
+    static std::unique_ptr<ResultCache> open(const std::filesystem::path& cachePath, std::string queryKey);
+
+    /**
+     * @brief Starts recording with 'numSlots' per-thread slots. Entries loaded
+     *        for a root other than 'root' are dropped.
+     */
+    void beginRun(const std::filesystem::path& root, unsigned numSlots);
+
+    /**
+     * @brief True if a previous run recorded 'relativePath' (cheap; lets
+     *        callers skip the stat for files that could never hit).
+     */
+    bool contains(std::string_view relativePath) const { return entries_.count(relativePath) != 0; }
+
+    /**
+     * @brief The cached matches of 'relativePath' if its stamp is unchanged,
+     *        else nullptr. The lines stay valid until save().
+     */
+    const std::vector<LineMatch>* lookup(std::string_view relativePath, const FileStamp& stamp) const;
+
+    /**
+     * @brief Records the results of one file for the next run. Only one thread
+     *        may use a given 'slot'. Files modified in the last second are not
+     *        recorded, since a later write could keep the same stamp.
+     */
+    void record(unsigned slot, std::string_view relativePath, const FileStamp& stamp,
+                const std::vector<LineMatch>& lines);
+
+    /**
+     * @brief Replaces the cache file with what was recorded and loads it as the
+     *        state for the next run.
+     * @return false (and sets 'error') if it could not be written.
+     */
+    bool save(std::string& error);
+
+    size_t size() const { return entries_.size(); }
+
+private:
+    struct CachedFile {
+        FileStamp stamp;
+        std::vector<LineMatch> lines;
+    };
+
+    ResultCache(std::filesystem::path cachePath, std::string queryKey)
+        : cachePath_(std::move(cachePath)), queryKey_(std::move(queryKey)) {}
+
+    void load();
+    void clearLoaded();
+
+    std::filesystem::path cachePath_;
+    std::string queryKey_;
+
+    FileReader reader_;                 // bytes of the loaded cache file
+    std::string loadedRoot_;
+    std::unordered_map<std::string_view, CachedFile> entries_;
+
+    std::string root_;                  // UTF-8 root of the current run
+    int64_t recordBefore_ = 0;          // only stamps older than this are recorded
+    struct alignas(64) Slot {
+        std::string data;               // encoded entries
+        uint64_t count = 0;
+    };
+    std::vector<Slot> slots_;           // one per recording thread
+};
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,136 @@
+#include "result_writer.h"
+
+#include <algorithm>
+#include "stage_timer.h"
+
+ResultWriter::ResultWriter(std::ostream& out, bool ordered, bool streaming)
+	: out_(out), ordered_(ordered), streaming_(streaming && !ordered)
+{
+	thread_ = std::thread([this, profile = StageProfile::current()]() {
+		ProfileScope scope(profile, "writer");
+		run();
+	});
+}
+
+ResultWriter::~ResultWriter()
+{
+	finish();
+}
+
+void ResultWriter::submit(std::string& data, std::string_view sortKey)
+{
+	if (data.empty()) {
+		return;
+	}
+	StageTimer timer(Stage::Submit);
+	std::string replacement;
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (!ordered_) {
+			spaceFreed_.wait(lock, [this]() { return queue_.size() < kMaxQueued || finished_; });
+		}
+		queue_.push_back(Item{ std::string(sortKey), std::move(data) });
+		if (!freeBuffers_.empty()) {
+			replacement = std::move(freeBuffers_.back());
+			freeBuffers_.pop_back();
+		}
+	}
+	cond_.notify_one();
+	data = std::move(replacement);
+	data.clear();
+}
+
+void ResultWriter::finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		finished_ = true;
+	}
+	cond_.notify_one();
+	spaceFreed_.notify_all();
+	if (thread_.joinable()) {
+		thread_.join();
+	}
+}
+
+void ResultWriter::run()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		cond_.wait(lock, [this]() { return !queue_.empty() || finished_; });
+		if (queue_.empty()) {
+			break; // finished and drained
+		}
+
+		Item item = std::move(queue_.front());
+		queue_.pop_front();
+		lock.unlock();
+		spaceFreed_.notify_one();
+
+		if (ordered_) {
+			sorted_.push_back(std::move(item));
+			lock.lock();
+			continue;
+		}
+
+		{
+			StageTimer timer(Stage::Write);
+			out_.write(item.data.data(), static_cast<std::streamsize>(item.data.size()));
+		}
+		item.data.clear();
+
+		lock.lock();
+		if (item.data.capacity() <= ResultWriter::kBufferSize * 2) {
+			freeBuffers_.push_back(std::move(item.data));
+		}
+		if (streaming_ && queue_.empty()) {
+			lock.unlock();
+			StageTimer timer(Stage::Write);
+			out_.flush();
+			lock.lock();
+		}
+	}
+	lock.unlock();
+
+	StageTimer timer(Stage::Write);
+	if (ordered_) {
+		writeSorted();
+	}
+	out_.flush();
+}
+
+void ResultWriter::writeSorted()
+{
+	std::stable_sort(sorted_.begin(), sorted_.end(),
+		[](const Item& a, const Item& b) { return a.sortKey < b.sortKey; });
+
+	// Coalesce the blocks into large writes.
+	std::string chunk;
+	chunk.reserve(kBufferSize);
+	for (auto& item : sorted_) {
+		if (chunk.size() + item.data.size() > kBufferSize && !chunk.empty()) {
+			out_.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+			chunk.clear();
+		}
+		chunk += item.data;
+	}
+	out_.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+	sorted_.clear();
+}
+
+void ResultBuffer::endFile(std::string_view path)
+{
+	if (writer_.isOrdered()) {
+		writer_.submit(data_, path);
+	}
+	else if (writer_.isStreaming() || data_.size() >= ResultWriter::kBufferSize) {
+		writer_.submit(data_);
+	}
+}
+
+void ResultBuffer::flush()
+{
+	if (!writer_.isOrdered()) {
+		writer_.submit(data_);
+	}
+}
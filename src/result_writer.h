@@ -0,0 +1,133 @@
+#ifndef RESULT_WRITER_H
+#define RESULT_WRITER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief Dedicated thread that writes formatted results to a stream.
+ *
+ * Workers format into their own ResultBuffer and only hand over full
+ * buffers, so there is one queue hand-off and one large write per buffer
+ * instead of a lock and a flush per matching file. At most kMaxQueued
+ * buffers wait for the writer: past that, submit() blocks until one is
+ * written, so output that is read slowly slows the scan down rather than
+ * piling up in memory.
+ *
+ * In ordered mode each file's block is kept separately and everything is
+ * written sorted by path when the scan finishes, so output is identical
+ * from run to run regardless of thread scheduling.
+ *
+ * In streaming mode (records read by another program as they come) every
+ * file's block is handed over, and the stream is flushed each time the
+ * writer has emptied its queue: a match is not held back in a worker's
+ * buffer while it searches a large file, and a burst still goes out in few
+ * writes.
+ */
+class ResultWriter {
+public:
+    static constexpr size_t kBufferSize = 256 * 1024;
+    static constexpr size_t kMaxQueued = 32;   // unordered mode; ordered blocks are kept until the end anyway
+
+    ResultWriter(std::ostream& out, bool ordered, bool streaming = false);
+    ~ResultWriter();
+
+    ResultWriter(const ResultWriter&) = delete;
+    ResultWriter& operator=(const ResultWriter&) = delete;
+
+    bool isOrdered() const { return ordered_; }
+    bool isStreaming() const { return streaming_; }
+
+    /**
+     * @brief Queues 'data' for writing; 'data' is replaced by an empty,
+     *        recycled buffer. 'sortKey' is only used in ordered mode. In
+     *        unordered mode, waits while kMaxQueued buffers are queued.
+     */
+    void submit(std::string& data, std::string_view sortKey = {});
+
+    /**
+     * @brief Writes everything still queued, flushes and stops the thread.
+     */
+    void finish();
+
+private:
+    struct Item {
+        std::string sortKey;
+        std::string data;
+    };
+
+    void run();
+    void writeSorted();
+
+    std::ostream& out_;
+    const bool ordered_;
+    const bool streaming_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::condition_variable spaceFreed_;   // a queued buffer was taken
+    std::deque<Item> queue_;
+    std::vector<std::string> freeBuffers_; // written buffers kept for reuse
+    bool finished_ = false;
+
+    std::vector<Item> sorted_; // ordered mode: all blocks, written at the end
+    std::thread thread_;
+};
+
+/**
+ * @brief Per-worker output buffer feeding a ResultWriter. Not thread-safe.
+ */
+class ResultBuffer {
+public:
+    explicit ResultBuffer(ResultWriter& writer) : writer_(writer) {}
+    ~ResultBuffer() { flush(); }
+
+    ResultBuffer(const ResultBuffer&) = delete;
+    ResultBuffer& operator=(const ResultBuffer&) = delete;
+
+    /**
+     * @brief Buffer to format the next file's block into.
+     */
+    std::string& data() { return data_; }
+
+    /**
+     * @brief Marks the end of one file's block. In unordered mode the buffer
+     *        is only handed over once it is full, or at once when streaming;
+     *        in ordered mode every block is handed over with its path as the
+     *        sort key.
+     */
+    void endFile(std::string_view path);
+
+    void flush();
+
+private:
+    ResultWriter& writer_;
+    std::string data_;
+};
+
+/**
+ * @brief The path as narrow bytes for output: on POSIX the native string,
+ *        elsewhere a converted copy in 'scratch'.
+ */
+inline const std::string& pathBytes(const std::filesystem::path& path, std::string& scratch)
+{
+    if constexpr (std::is_same_v<std::filesystem::path::value_type, char>) {
+        (void)scratch;
+        return path.native();
+    }
+    else {
+        scratch = path.string();
+        return scratch;
+    }
+}
+
+#endif // RESULT_WRITER_H
@@ -0,0 +1,911 @@
+#include "scanner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+#include "adaptive_pool.h"
+#include "async_reader.h"
+#include "bounded_file_queue.h"
+#include "case_fold.h"
+#include "decompress.h"
+#include "file_reader.h"
+#include "file_search.h"
+#include "glob.h"
+#include "ignore_rules.h"
+#include "matcher.h"
+#include "parallel_walker.h"
+#include "result_cache.h"
+#include "stage_timer.h"
+#include "trigram_index.h"
+
+// Include/exclude file globs from --ext and --exclude, the trigram index
+// from --index with the query's candidates selected, the names of files
+// treated as binary (--binary-ext), and the subtrees the walker prunes
+// (--exclude-dir, ignore files).
+struct Scanner::FileFilter {
+	GlobSet globs;
+	std::unique_ptr<IgnoreFilter> ignore;
+	std::unique_ptr<TrigramIndex> index;
+	GlobSet binaryNames;
+};
+
+namespace {
+
+/**
+ * @brief Walker callbacks that filter files (globs, trigram index, result cache) and hand
+ *        them to the file queue in per-walker-thread batches. Each walker thread
+ *        copies its paths into its own PathArena, so queueing does not allocate.
+ */
+class QueueingVisitor final : public WalkVisitor {
+public:
+	QueueingVisitor(BoundedFileQueue& queue,
+		const std::function<bool(const std::filesystem::directory_entry&, unsigned)>& filter,
+		const std::function<void(const std::string&)>& onError,
+		unsigned numWalkers)
+		: queue_(queue), filter_(filter), onError_(onError), pending_(numWalkers), arenas_(numWalkers)
+	{
+		for (auto& batch : pending_) {
+			batch.reserve(PUSH_BATCH_SIZE);
+		}
+	}
+
+	void onFile(const std::filesystem::directory_entry& entry, unsigned worker) override
+	{
+		if (!filter_(entry, worker)) {
+			return;
+		}
+
+		// A partial batch is flushed early whenever the workers have run dry.
+		auto& batch = pending_[worker];
+		batch.push_back(arenas_[worker].store(entry.path()));
+		if (batch.size() >= PUSH_BATCH_SIZE || queue_.isEmpty()) {
+			queue_.pushBatch(batch);
+		}
+	}
+
+	void onIdle(unsigned worker) override
+	{
+		queue_.pushBatch(pending_[worker]);
+	}
+
+	void onError(const std::string& message) override
+	{
+		onError_(message);
+	}
+
+	bool stopRequested() const override
+	{
+		return queue_.isCancelled();
+	}
+
+	// Hands over whatever is still buffered; call after the walk has finished.
+	void flushAll()
+	{
+		for (auto& batch : pending_) {
+			queue_.pushBatch(batch);
+		}
+	}
+
+private:
+	static constexpr size_t PUSH_BATCH_SIZE = 64;
+
+	BoundedFileQueue& queue_;
+	const std::function<bool(const std::filesystem::directory_entry&, unsigned)>& filter_;
+	const std::function<void(const std::string&)>& onError_;
+	std::vector<std::vector<PathRef>> pending_; // one batch per walker thread
+	std::vector<PathArena> arenas_;             // likewise
+};
+
+// Checks a file against the globs using its path relative to the scan root.
+bool acceptsRelative(const GlobSet& globs, std::string_view relative)
+{
+	size_t slash = relative.rfind('/');
+	std::string_view name = slash == std::string_view::npos ? relative : relative.substr(slash + 1);
+	return globs.accepts(relative, name);
+}
+
+// Publishes the file a worker is starting on (as UTF-8) and resets its per-file hits
+void publishCurrentFile(WorkerStatus& status, NativeView filePath)
+{
+	if constexpr (std::is_same_v<std::filesystem::path::value_type, char>) {
+		status.beginFile(filePath); // POSIX: native bytes, no copy
+	}
+	else {
+		auto u8 = std::filesystem::path(filePath).u8string();  // std::u8string
+		status.beginFile(std::string_view(reinterpret_cast<const char*>(u8.data()), u8.size()));
+	}
+}
+
+// The path a queued file is reported under. Only matching files get one, so
+// files that do not match never allocate a std::filesystem::path.
+std::filesystem::path reportedPath(const PathRef& filePath)
+{
+	return filePath.toPath();
+}
+
+const std::filesystem::path& reportedPath(const std::filesystem::path& filePath)
+{
+	return filePath;
+}
+
+// An unchanged file found by the walker whose results come from the cache.
+struct CachedHit {
+	std::filesystem::path path;
+	FileStamp stamp;
+	const std::vector<LineMatch>* lines;
+};
+
+// Serializes calls to a plain callback for Scanner::run(directory, callback).
+class CallbackHandler final : public ScanHandler {
+public:
+	explicit CallbackHandler(const std::function<void(const FileMatches&)>& callback)
+		: callback_(callback) {}
+
+	void onFileMatches(const FileMatches& file, unsigned) override
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		callback_(file);
+	}
+
+private:
+	const std::function<void(const FileMatches&)>& callback_;
+	std::mutex mutex_;
+};
+
+} // namespace
+
+bool ScanOptions::foldsCase() const
+{
+	if (ignoreCase) {
+		return true;
+	}
+	if (!smartCase) {
+		return false;
+	}
+	if (patterns.empty()) {
+		return !hasUppercase(query, useRegex);
+	}
+	return std::none_of(patterns.begin(), patterns.end(),
+		[&](const std::string& pattern) { return hasUppercase(pattern, useRegex); });
+}
+
+std::unique_ptr<Scanner> Scanner::create(const ScanOptions& options, std::string& error)
+{
+	// Compile the query once; every worker shares it read-only.
+	const bool multiPattern = !options.patterns.empty();
+	const bool ignoreCase = options.foldsCase();
+	std::unique_ptr<Matcher> matcher = multiPattern
+		? Matcher::compileSet(options.patterns, options.useRegex, ignoreCase, error)
+		: Matcher::compile(options.query, options.useRegex, ignoreCase, error);
+	if (!matcher) {
+		return nullptr;
+	}
+
+	// Compile the file globs once; they are matched on every directory entry
+	auto filter = std::make_unique<FileFilter>();
+	std::vector<std::string> includes = options.includePatterns;
+	if (options.filePattern.has_value()) {
+		includes.push_back(options.filePattern.value());
+	}
+	for (const auto& pattern : includes) {
+		if (!filter->globs.addInclude(pattern, options.patternsIgnoreCase, error)) {
+			return nullptr;
+		}
+	}
+	for (const auto& pattern : options.excludePatterns) {
+		if (!filter->globs.addExclude(pattern, options.patternsIgnoreCase, error)) {
+			return nullptr;
+		}
+	}
+
+	if (options.ignoreFiles || !options.excludeDirPatterns.empty()) {
+		filter->ignore = std::make_unique<IgnoreFilter>(options.ignoreFiles
+			? std::vector<std::string>{ ".gitignore", ".ignore" } : std::vector<std::string>{});
+		for (const auto& pattern : options.excludeDirPatterns) {
+			if (!filter->ignore->addExcludeDir(pattern, options.patternsIgnoreCase, error)) {
+				return nullptr;
+			}
+		}
+	}
+
+	for (const auto& pattern : options.binaryPatterns) {
+		if (!filter->binaryNames.addInclude(pattern, options.patternsIgnoreCase, error)) {
+			return nullptr;
+		}
+	}
+
+	// Load the index and work out which indexed files can contain the query
+	if (options.indexPath.has_value()) {
+		filter->index = TrigramIndex::load(options.indexPath.value(), error);
+		if (!filter->index) {
+			return nullptr;
+		}
+		// A file may hold any one of several patterns; without case, in any
+		// of the case forms the matcher accepts
+		auto queryOf = [&](const std::string& query) {
+			if (options.useRegex) {
+				return TrigramQuery::fromRegex(query, ignoreCase);
+			}
+			return TrigramQuery::fromLiteral(query, ignoreCase ? literalFolding(query) : CaseFolding::None);
+		};
+		if (multiPattern) {
+			TrigramQuery any;
+			any.kind = TrigramQuery::Kind::Or;
+			for (const auto& pattern : options.patterns) {
+				if (!pattern.empty()) {
+					any.children.push_back(queryOf(pattern));
+				}
+			}
+			filter->index->select(std::move(any));
+		}
+		else {
+			filter->index->select(queryOf(options.query));
+		}
+	}
+
+	if (filter->globs.empty() && !filter->index && filter->binaryNames.empty() && !filter->ignore) {
+		filter.reset();
+	}
+
+	// Cached results are only valid for the same query, regex engine, case
+	// handling, match limit and binary-file handling
+	std::unique_ptr<ResultCache> cache;
+	if (options.cachePath.has_value()) {
+		std::string key = std::string(options.useRegex ? "regex:" : "literal:")
+			+ (options.useRegex ? regexBackendName() : "") + "\n" + options.query;
+		for (const auto& pattern : options.patterns) {
+			key += "\npattern:" + pattern;
+		}
+		if (ignoreCase) {
+			key += "\nignore-case";
+		}
+		if (options.matchLimit() != 0) {
+			key += "\nmax:" + std::to_string(options.matchLimit());
+		}
+		key += "\nbinary:" + std::to_string(static_cast<int>(options.binaryFiles));
+		if (options.decompress) {
+			key += "\ndecompress";
+		}
+		for (const auto& pattern : options.binaryPatterns) {
+			key += ":" + pattern;
+		}
+		cache = ResultCache::open(options.cachePath.value(), std::move(key));
+	}
+
+	return std::unique_ptr<Scanner>(new Scanner(options, std::move(matcher), std::move(filter), std::move(cache)));
+}
+
+Scanner::Scanner(const ScanOptions& options, std::unique_ptr<Matcher> matcher,
+	std::unique_ptr<FileFilter> filter, std::unique_ptr<ResultCache> cache)
+	: options_(options),
+	  numThreads_(options.numThreads != 0 ? options.numThreads
+		: std::max(1u, std::thread::hardware_concurrency())),
+	  poolSize_(!options.adaptiveThreads ? numThreads_
+		: std::max(numThreads_, options.maxThreads != 0 ? options.maxThreads
+			: 4 * std::max(1u, std::thread::hardware_concurrency()))),
+	  walkerThreads_(options.ioThreads != 0 ? options.ioThreads : numThreads_),
+	  matcher_(std::move(matcher)),
+	  filter_(std::move(filter)),
+	  cache_(std::move(cache)),
+	  workerStatus_(poolSize_ + 1)
+{
+}
+
+Scanner::~Scanner() = default;
+
+StatusSnapshot Scanner::progress() const
+{
+	StatusSnapshot snapshot = snapshotStatus(workerStatus_);
+	snapshot.errors = errorCount_.load(std::memory_order_acquire);
+	return snapshot;
+}
+
+std::string Scanner::lastError() const
+{
+	std::lock_guard<std::mutex> lock(errorMutex_);
+	return lastError_;
+}
+
+void Scanner::reportError(const std::string& message, ScanHandler& handler)
+{
+	{
+		std::lock_guard<std::mutex> lock(errorMutex_);
+		lastError_ = message;
+		errorCount_.fetch_add(1, std::memory_order_release);
+	}
+	handler.onError(message);
+}
+
+void Scanner::cancel()
+{
+	std::lock_guard<std::mutex> lock(cancelMutex_);
+	cancelled_ = true;
+	if (cancelQueues_) {
+		cancelQueues_();
+	}
+}
+
+void Scanner::run(const std::filesystem::path& directory,
+	const std::function<void(const FileMatches&)>& callback)
+{
+	CallbackHandler handler(callback);
+	run(directory, handler);
+}
+
+void Scanner::run(const std::filesystem::path& directory, ScanHandler& handler)
+{
+	// 1. Create a bounded queue with a capacity to handle concurrency without storing everything
+	BoundedFileQueue fileQueue(options_.queueSize);
+
+	const std::function<void(const std::string&)> onError =
+		[this, &handler](const std::string& message) { reportError(message, handler); };
+
+	// The index only speaks for the tree it was built from
+	const TrigramIndex* index = filter_ ? filter_->index.get() : nullptr;
+	if (index) {
+		std::error_code ec;
+		std::filesystem::path root = std::filesystem::weakly_canonical(directory, ec);
+		if (root != index->root()) {
+			onError("Index was built for " + index->root().string() + ", scanning without it");
+			index = nullptr;
+		}
+	}
+
+	// Unchanged files are reported from the cache by one extra worker slot
+	const unsigned cacheSlot = poolSize_;
+	std::vector<std::vector<CachedHit>> cachedHits(walkerThreads_); // per walker thread
+	if (cache_) {
+		std::error_code ec;
+		cache_->beginRun(std::filesystem::weakly_canonical(directory, ec), poolSize_ + 1);
+	}
+
+	const size_t rootLength = rootPathLength(directory);
+	auto namedBinary = [&](NativeView filePath) {
+		return filter_ && !filter_->binaryNames.empty()
+			&& withRelativePath(filePath, rootLength, [&](std::string_view relative) {
+				return acceptsRelative(filter_->binaryNames, relative);
+			});
+	};
+	// Size and time limits are checked from the walk's stat, shared with the cache lookup
+	const bool metadataLimits = options_.maxFileSize != 0 || options_.modifiedAfter || options_.modifiedBefore;
+	auto withinLimits = [this](const FileStamp& stamp) {
+		auto nanos = [](std::chrono::system_clock::time_point time) {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+		};
+		return (options_.maxFileSize == 0 || stamp.size <= options_.maxFileSize)
+			&& (!options_.modifiedAfter || stamp.mtime >= nanos(*options_.modifiedAfter))
+			&& (!options_.modifiedBefore || stamp.mtime <= nanos(*options_.modifiedBefore));
+	};
+	const std::function<bool(const std::filesystem::directory_entry&, unsigned)> filter =
+		[&, index, rootLength](const std::filesystem::directory_entry& entry, unsigned walker) {
+			if (!filter_ && !cache_ && !metadataLimits) {
+				return true;
+			}
+			return withRelativePath(entry.path(), rootLength, [&](std::string_view relative) {
+				if (filter_) {
+					if (!acceptsRelative(filter_->globs, relative)) {
+						return false;
+					}
+					if (index && (index->isIndexFile(entry) || !index->mayMatch(relative, entry))) {
+						return false;
+					}
+					if (options_.binaryFiles == BinaryFiles::Skip && !filter_->binaryNames.empty()
+						&& acceptsRelative(filter_->binaryNames, relative)) {
+						return false;
+					}
+				}
+				FileStamp stamp;
+				bool stamped = false;
+				if (metadataLimits) {
+					// A file that cannot be stat'ed is queued, so the worker reports why
+					stamped = readFileStamp(entry, stamp);
+					if (stamped && !withinLimits(stamp)) {
+						return false;
+					}
+				}
+				if (cache_ && cache_->contains(relative) && (stamped || readFileStamp(entry, stamp))) {
+					if (const std::vector<LineMatch>* lines = cache_->lookup(relative, stamp)) {
+						cachedHits[walker].push_back(CachedHit{ entry.path(), stamp, lines });
+						return false;
+					}
+				}
+				return true;
+			});
+		};
+
+	// With an I/O depth, a read stage keeps that many reads in flight and the
+	// workers below only match the buffers it fills
+	const bool asyncReads = options_.ioDepth > 0;
+	BoundedQueue<LoadedFile> loadedQueue(asyncReads ? std::max<size_t>(options_.ioDepth, 2 * poolSize_) : 2);
+
+	// Workers hand compressed files to a decompress stage, whose threads inflate
+	// them while the workers go on matching; the contents come back through a
+	// second queue. The file queue's capacity bounds the paths waiting.
+	const bool decompressing = options_.decompress && (canDecompress(Compression::Gzip)
+		|| canDecompress(Compression::Xz) || canDecompress(Compression::Zstd));
+	const unsigned inflaterThreads = !decompressing ? 0
+		: options_.decompressThreads != 0 ? options_.decompressThreads : std::max(1u, numThreads_ / 2);
+	BoundedFileQueue compressedQueue(decompressing ? options_.queueSize : 2);
+	BoundedQueue<LoadedFile> inflatedQueue(std::max(2u, 2 * inflaterThreads));
+	DecompressStage inflater(compressedQueue, inflatedQueue, options_.decompressLimit);
+
+	// Cancelling the queues stops the walker, the read stage and the workers
+	// at their next step; cancel() does it from outside the run
+	auto cancelQueues = [&]() {
+		fileQueue.cancel();
+		loadedQueue.cancel();
+		compressedQueue.cancel();
+		inflatedQueue.cancel();
+	};
+	{
+		std::lock_guard<std::mutex> lock(cancelMutex_);
+		cancelQueues_ = cancelQueues;
+		if (cancelled_) {
+			cancelQueues();
+		}
+	}
+
+	// Reports a matching file unless the --first limit is used up. The file
+	// that reaches the limit cancels the queues.
+	const size_t matchLimit = options_.matchLimit();
+	std::atomic<size_t> reportedFiles{ 0 };
+	auto reportMatches = [&](const std::filesystem::path& filePath, const std::vector<LineMatch>& lines,
+		const std::vector<MatchSpan>& spans, bool binary, unsigned worker) {
+		if (options_.maxFiles != 0) {
+			size_t rank = reportedFiles.fetch_add(1, std::memory_order_relaxed);
+			if (rank >= options_.maxFiles) {
+				return;
+			}
+			if (rank + 1 == options_.maxFiles) {
+				cancelQueues();
+			}
+		}
+		StageTimer timer(Stage::Format);
+		handler.onFileMatches(FileMatches{ filePath, lines, spans, binary }, worker);
+	};
+
+	handler.onStart(cache_ ? poolSize_ + 1 : poolSize_);
+
+	// Producer thread enumerates the directory tree with a pool of walker
+	// threads that steal subdirectories from each other
+	StageProfile* profile = StageProfile::current();
+	std::thread producer([&]() {
+		ProfileScope scope(profile, "producer");
+		ParallelWalker walker(walkerThreads_);
+		QueueingVisitor visitor(fileQueue, filter, onError, walkerThreads_);
+		walker.walk(directory, visitor, filter_ ? filter_->ignore.get() : nullptr,
+			options_.maxDepth.value_or(ParallelWalker::kUnlimitedDepth));
+		visitor.flushAll();
+		fileQueue.setFinished();
+
+		// Replay the cached files while the workers drain the queue. The cache
+		// keeps lines only, so their spans are found again (matching lines only).
+		if (cache_) {
+			WorkerStatus& status = workerStatus_[cacheSlot];
+			std::vector<LineMatch> lines;
+			std::vector<MatchSpan> spans;
+			for (const auto& hits : cachedHits) {
+				for (const auto& hit : hits) {
+					if (fileQueue.isCancelled()) {
+						break;
+					}
+					publishCurrentFile(status, hit.path.native());
+					status.addHit(hit.lines->size());
+					status.endFile();
+					if (!hit.lines->empty()) {
+						lines.clear();
+						spans.clear();
+						for (const auto& line : *hit.lines) {
+							const size_t firstSpan = spans.size();
+							lines.push_back(LineMatch{ line.lineNumber, line.line, firstSpan,
+								matcher_->findAll(line.line, spans), line.offset });
+						}
+						reportMatches(hit.path, lines, spans, false, cacheSlot);
+					}
+					withRelativePath(hit.path, rootLength, [&](std::string_view relative) {
+						cache_->record(cacheSlot, relative, hit.stamp, *hit.lines);
+					});
+				}
+			}
+			handler.onWorkerDone(cacheSlot);
+		}
+		});
+
+	AsyncReader asyncReader(fileQueue, loadedQueue, options_.ioDepth);
+	std::thread readStage;
+	if (asyncReads) {
+		readStage = std::thread([&]() {
+			ProfileScope scope(profile, "read stage");
+			asyncReader.run();
+			loadedQueue.setFinished();
+			});
+	}
+
+	std::atomic<unsigned> inflatersLeft{ inflaterThreads };
+	std::vector<std::thread> inflaters;
+	for (unsigned t = 0; t < inflaterThreads; ++t) {
+		inflaters.emplace_back([&, t]() {
+			ProfileScope scope(profile, "decompress", static_cast<int>(t));
+			inflater.run(onError);
+			if (inflatersLeft.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				inflatedQueue.setFinished();
+			}
+			});
+	}
+	std::atomic<unsigned> walkedWorkers{ 0 }; // workers done with the file (or loaded) queue
+
+	// Files of at least two chunks are searched by several workers at once
+	const size_t chunkSize = poolSize_ > 1 ? options_.chunkSize : 0;
+	ChunkBoard chunkBoard;
+	std::atomic<unsigned> busyWorkers{ 0 }; // workers holding (or waiting for) a batch
+
+	// Workers [activeWorkers, poolSize_) are parked; only the adaptive
+	// controller below changes the count
+	const bool adaptive = options_.adaptiveThreads;
+	std::atomic<unsigned> activeWorkers{ numThreads_ };
+	std::vector<WorkerLoad> loads(poolSize_);
+	auto workDrained = [&]() { return asyncReads ? loadedQueue.isDrained() : fileQueue.isDrained(); };
+
+	// 2. Spawn consumer (worker) threads
+	std::vector<std::thread> workers;
+	workers.reserve(poolSize_);
+
+	for (unsigned int i = 0; i < poolSize_; ++i) {
+		workers.emplace_back([&, i]() {
+			ProfileScope scope(profile, "worker", static_cast<int>(i));
+			WorkerStatus& status = workerStatus_[i];
+			WorkerLoad& load = loads[i];
+			FileReader reader; // per-thread, reuses its read buffer across files
+			std::vector<LineMatch> matches;
+			std::vector<MatchSpan> spans;
+			std::string error;
+
+			// A backtracking regex may give up on lines: say so, as the file was
+			// not fully searched
+			auto reportAbandonedLines = [&](const auto& filePath) {
+				if (const size_t lines = matcher_->takeAbandonedLines(); lines != 0) {
+					reportError("Regex match limit hit on " + std::to_string(lines) + " line(s) of "
+						+ std::filesystem::path(filePath.native()).string() + ", taken as not matching", handler);
+				}
+			};
+
+			// Caches and reports one completely searched file. The cache has no
+			// notion of binary files, so binary matches are searched again next time.
+			auto finishFile = [&](const auto& filePath, const std::vector<LineMatch>& lines,
+				const std::vector<MatchSpan>& lineSpans, const FileStamp* stamp, bool binary) {
+				status.endFile();
+				if (stamp && !(binary && !lines.empty())) {
+					withRelativePath(NativeView(filePath.native()), rootLength, [&](std::string_view relative) {
+						cache_->record(i, relative, *stamp, lines);
+					});
+				}
+				// Matches point into the file's buffer: report before it is released.
+				if (!lines.empty()) {
+					reportMatches(reportedPath(filePath), lines, lineSpans, binary, i);
+				}
+			};
+
+			auto searchChunk = [&](ChunkedFile& file, size_t index) {
+				if (fileQueue.isCancelled()) {
+					file.skip(); // nothing more is reported
+					return;
+				}
+				publishCurrentFile(status, file.path().native());
+				StageTimer timer(Stage::Match);
+				const bool last = file.search(index, *matcher_, status);
+				timer.stop();
+				reportAbandonedLines(file.path());
+				if (last) {
+					finishFile(file.path(), file.merged(), file.mergedSpans(),
+						file.stamped ? &file.stamp : nullptr, file.binary);
+				}
+			};
+
+			// Helps with other workers' large files; true if it searched anything.
+			auto helpWithChunks = [&]() {
+				std::shared_ptr<ChunkedFile> file;
+				size_t index = 0;
+				bool helped = false;
+				while (chunkBoard.claim(file, index)) {
+					searchChunk(*file, index);
+					helped = true;
+				}
+				return helped;
+			};
+
+			// Scans the files the decompress stage hands back; defined below scanFile,
+			// which calls it while waiting for room in the decompress stage's queue.
+			std::function<bool()> helpWithInflated;
+
+			// False if the stage no longer takes files
+			auto handOff = [&](const PathRef& filePath) {
+				PathRef item = filePath;
+				while (!compressedQueue.tryPush(std::move(item))) {
+					if (compressedQueue.isFinished()) {
+						return false;
+					}
+					if (!helpWithInflated()) {
+						std::this_thread::yield();
+					}
+				}
+				return true;
+			};
+			FileBuffer inflatedHere;
+
+			// 'preloaded' holds the contents if the read stage already read them, or
+			// the decompress stage inflated them ('inflated': such files are not cached)
+			auto scanFile = [&](const PathRef& filePath, const LoadedFile* preloaded, bool inflated) {
+				publishCurrentFile(status, filePath.native());
+				// Stamp before reading, so a write during the scan invalidates the
+				// entry. (Preloaded files were read just before; a write since then
+				// gives an mtime too recent for the cache to record.)
+				FileStamp stamp;
+				bool stamped = cache_ && !inflated && readFileStamp(filePath.c_str(), stamp);
+				std::string_view data;
+				if (preloaded && preloaded->loaded) {
+					data = preloaded->buffer.view();
+				}
+				else if (reader.open(filePath.c_str(), error)) {
+					data = reader.contents();
+				}
+				else {
+					reportError(error, handler);
+					return;
+				}
+
+				// Compressed files are recognized by their magic bytes and come back
+				// inflated. Once the stage's input is closed, only a cancelled scan
+				// may drop one; otherwise it is inflated here.
+				if (const Compression kind = decompressing && !inflated ? detectCompression(data) : Compression::None;
+					canDecompress(kind)) {
+					if (handOff(filePath) || compressedQueue.isCancelled()) {
+						return;
+					}
+					bool decompressed;
+					{
+						StageTimer timer(Stage::Decompress);
+						decompressed = decompress(kind, data, inflatedHere, options_.decompressLimit, error);
+					}
+					if (!decompressed) {
+						reportError("Could not decompress: " + filePath.toPath().string() + " - " + error, handler);
+						return;
+					}
+					data = inflatedHere.view();
+					inflated = true;
+					stamped = false;
+				}
+
+				// The first block is in memory already, so the binary check costs no I/O.
+				// A binary file is only searched for whether it matches at all.
+				bool binary = false;
+				if (options_.binaryFiles != BinaryFiles::Text) {
+					binary = looksBinary(data) || namedBinary(filePath.native());
+					if (binary && options_.binaryFiles == BinaryFiles::Skip) {
+						matches.clear();
+						spans.clear();
+						finishFile(filePath, matches, spans, stamped ? &stamp : nullptr, true);
+						return;
+					}
+				}
+				const size_t limit = binary ? 1 : matchLimit;
+
+				// Large files are split so that idle workers can share them
+				if (chunkSize != 0 && !inflated && data.size() >= 2 * chunkSize) {
+					auto owned = std::make_unique<FileReader>();
+					if (owned->open(filePath.c_str(), error) && owned->contents().size() >= 2 * chunkSize) {
+						reader.close();
+						auto file = std::make_shared<ChunkedFile>(filePath.toPath(), std::move(owned), chunkSize, limit);
+						file->stamp = stamp;
+						file->stamped = stamped;
+						file->binary = binary;
+						chunkBoard.publish(file);
+						for (size_t index = 0; file->claim(index);) {
+							searchChunk(*file, index);
+						}
+						return;
+					}
+				}
+
+				{
+					StageTimer timer(Stage::Match);
+					searchContents(data, *matcher_, matches, spans, status, limit);
+				}
+				reportAbandonedLines(filePath);
+				finishFile(filePath, matches, spans, stamped ? &stamp : nullptr, binary);
+			};
+
+			helpWithInflated = [&]() {
+				bool helped = false;
+				LoadedFile file;
+				while (decompressing && inflatedQueue.tryPop(file)) {
+					if (!fileQueue.isCancelled()) {
+						scanFile(file.path, &file, true);
+					}
+					inflater.recycle(file);
+					helped = true;
+				}
+				return helped;
+			};
+
+			// Parks while this worker is beyond the current pool size
+			auto parkWhileInactive = [&]() {
+				for (unsigned seen = activeWorkers.load(std::memory_order_acquire); i >= seen;
+					seen = activeWorkers.load(std::memory_order_acquire)) {
+					activeWorkers.wait(seen, std::memory_order_acquire);
+				}
+			};
+
+			// Takes batches from 'queue' until it is drained. In adaptive mode the
+			// time spent waiting and working is booked for the controller.
+			auto drain = [&](auto& queue, auto& batch, auto&& batchSize, auto&& process) {
+				using Clock = std::chrono::steady_clock;
+				auto nanosSince = [](Clock::time_point start) {
+					return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+						Clock::now() - start).count());
+				};
+				while (true) {
+					if (adaptive) {
+						parkWhileInactive();
+					}
+					helpWithChunks();
+					helpWithInflated();
+					busyWorkers.fetch_add(1, std::memory_order_acq_rel);
+					const Clock::time_point waitStart = adaptive ? Clock::now() : Clock::time_point{};
+					if (queue.popBatch(batch, batchSize()) == 0) {
+						busyWorkers.fetch_sub(1, std::memory_order_acq_rel);
+						break;
+					}
+					Clock::time_point workStart{};
+					uint64_t cpuStart = 0;
+					if (adaptive) {
+						WorkerLoad::add(load.idleNanos, nanosSince(waitStart));
+						workStart = Clock::now();
+						cpuStart = threadCpuNanos();
+					}
+					for (auto& item : batch) {
+						process(item);
+					}
+					if (adaptive) {
+						WorkerLoad::add(load.busyNanos, nanosSince(workStart));
+						WorkerLoad::add(load.cpuNanos, threadCpuNanos() - cpuStart);
+					}
+					busyWorkers.fetch_sub(1, std::memory_order_acq_rel);
+				}
+			};
+
+			if (asyncReads) {
+				std::vector<LoadedFile> batch;
+				drain(loadedQueue, batch, []() { return size_t(4); }, [&](LoadedFile& file) {
+					if (!fileQueue.isCancelled()) {
+						scanFile(file.path, &file, false);
+					}
+					asyncReader.recycle(file);
+				});
+			}
+			else {
+				// Take more than one path only when the queue is deep, so a few
+				// large files at the end are still spread across threads.
+				std::vector<PathRef> batch;
+				auto batchSize = [&]() {
+					const unsigned active = std::max(1u, activeWorkers.load(std::memory_order_relaxed));
+					return std::clamp<size_t>(fileQueue.size() / (2 * active), 1, 32);
+				};
+				drain(fileQueue, batch, batchSize, [&](const PathRef& filePath) {
+					if (!fileQueue.isCancelled()) {
+						scanFile(filePath, nullptr, false);
+					}
+				});
+			}
+
+			// The last worker past the file queue ends the decompress stage's input
+			if (walkedWorkers.fetch_add(1, std::memory_order_acq_rel) + 1 == poolSize_) {
+				compressedQueue.setFinished();
+			}
+
+			// The queue is drained, but a worker still holding a file may yet
+			// split it, and compressed files may still come back: stay around to
+			// take chunks and inflated files until every worker is done.
+			for (unsigned idle = 0; ; ) {
+				if (helpWithChunks() || helpWithInflated()) {
+					idle = 0;
+					continue;
+				}
+				if (busyWorkers.load(std::memory_order_acquire) == 0 && chunkBoard.empty()
+					&& (!decompressing || inflatedQueue.isDrained())) {
+					break;
+				}
+				if (++idle < 64) {
+					std::this_thread::yield();
+				}
+				else {
+					std::this_thread::sleep_for(std::chrono::microseconds(100));
+				}
+			}
+			reader.close();
+			handler.onWorkerDone(i);
+			});
+	}
+
+	// The controller resizes the pool every 100 ms from the workers' busy,
+	// CPU and idle time (see adaptPoolSize), and wakes every parked worker
+	// once the queue is drained so they can exit
+	std::thread controller;
+	if (adaptive) {
+		controller = std::thread([&]() {
+			using Clock = std::chrono::steady_clock;
+			struct Totals {
+				uint64_t busy = 0, cpu = 0, idle = 0;
+			};
+			std::vector<Totals> seen(poolSize_);
+			Clock::time_point sampleStart = Clock::now();
+			while (!workDrained()) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				const Clock::time_point now = Clock::now();
+				if (now - sampleStart < std::chrono::milliseconds(100)) {
+					continue;
+				}
+				PoolSample sample;
+				sample.active = activeWorkers.load(std::memory_order_relaxed);
+				sample.maxWorkers = poolSize_;
+				sample.cores = std::max(1u, std::thread::hardware_concurrency());
+				sample.queued = fileQueue.size() + (asyncReads ? loadedQueue.size() : 0);
+				sample.intervalNanos = static_cast<uint64_t>(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(now - sampleStart).count());
+				for (unsigned w = 0; w < poolSize_; ++w) {
+					Totals current{ loads[w].busyNanos.load(std::memory_order_relaxed),
+						loads[w].cpuNanos.load(std::memory_order_relaxed),
+						loads[w].idleNanos.load(std::memory_order_relaxed) };
+					if (w < sample.active) {
+						sample.busyNanos += current.busy - seen[w].busy;
+						sample.cpuNanos += current.cpu - seen[w].cpu;
+						sample.idleNanos += current.idle - seen[w].idle;
+					}
+					seen[w] = current;
+				}
+				const double load = systemLoadAverage();
+				sample.otherLoad = load < 0 ? -1 : load - sample.active;
+
+				const unsigned next = adaptPoolSize(sample);
+				if (next != sample.active) {
+					activeWorkers.store(next, std::memory_order_release);
+					activeWorkers.notify_all();
+				}
+				sampleStart = now;
+			}
+			activeWorkers.store(poolSize_, std::memory_order_release);
+			activeWorkers.notify_all();
+			});
+	}
+
+	// 3. Wait for producer to finish
+	producer.join();
+	if (readStage.joinable()) {
+		readStage.join();
+	}
+
+	// 4. Wait for all consumers
+	if (controller.joinable()) {
+		controller.join();
+	}
+	for (auto& w : workers) {
+		w.join();
+	}
+	for (auto& t : inflaters) {
+		t.join();
+	}
+	{
+		std::lock_guard<std::mutex> lock(cancelMutex_);
+		cancelQueues_ = nullptr;
+	}
+
+	// 5. Keep this run's results for the next one. A cancelled scan saw only
+	//    part of the tree, so the previous cache is kept instead.
+	if (cache_ && !fileQueue.isCancelled()) {
+		std::string error;
+		if (!cache_->save(error)) {
+			reportError(error, handler);
+		}
+	}
+}
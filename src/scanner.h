@@ -0,0 +1,224 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "matcher.h"
+#include "worker_status.h"
+
+class ResultCache;
+
+/**
+ * @brief What to do with files that look binary (see looksBinary() in file_search.h).
+ */
+enum class BinaryFiles {
+    Report,   // search until the first match and report "binary file matches"
+    Skip,     // do not search them
+    Text      // search them like any other file
+};
+
+/**
+ * @brief Settings for one scan.
+ */
+struct ScanOptions {
+    std::string query;                       // Substring or regex query
+    bool useRegex = false;                   // Interpret 'query' as a regular expression
+    bool ignoreCase = false;                 // Match letters in either case (-i)
+    bool smartCase = false;                  // Ignore case unless the query has an uppercase letter
+    std::vector<std::string> patterns;       // Several queries searched in one pass (-f); replaces
+                                             // 'query' if not empty. MatchSpan::pattern indexes it.
+    std::optional<std::string> filePattern;  // Wildcard like "*.txt" applied to file names
+    std::vector<std::string> includePatterns; // More globs (see glob.h); a file must match one
+    std::vector<std::string> excludePatterns; // Globs for files to skip
+    std::vector<std::string> excludeDirPatterns; // Globs for directories not to enter at all
+    bool ignoreFiles = false;                 // Honour .gitignore and .ignore files (ignore_rules.h)
+    uint64_t maxFileSize = 0;                 // Skip files larger than this many bytes; 0 = no limit
+    std::optional<std::chrono::system_clock::time_point> modifiedAfter;  // Skip files last written before
+    std::optional<std::chrono::system_clock::time_point> modifiedBefore; // Skip files last written after
+    std::optional<unsigned> maxDepth;         // Enter at most this many directory levels (0 = root only)
+    bool patternsIgnoreCase = true;           // Match file globs case-insensitively (ASCII)
+    std::optional<std::filesystem::path> indexPath; // Trigram index to narrow the files (trigram_index.h)
+    std::optional<std::filesystem::path> cachePath; // Per-file results reused across runs (result_cache.h)
+    unsigned numThreads = 0;                 // Matcher (worker) threads; 0 = hardware_concurrency()
+    unsigned ioThreads = 0;                  // Directory walker threads; 0 = numThreads
+    bool adaptiveThreads = false;            // Grow or shrink the workers while the scan runs (adaptive_pool.h),
+                                             // starting from numThreads
+    unsigned maxThreads = 0;                 // Adaptive upper bound; 0 = 4 x hardware_concurrency()
+    size_t queueSize = 10000;                // Capacity of the file queue
+    size_t chunkSize = 8 << 20;              // Files of two chunks or more are split and searched
+                                             // by several workers (file_search.h); 0 = never
+    unsigned ioDepth = 0;                    // Reads kept in flight by an async read stage
+                                             // (async_reader.h); 0 = workers read their own files
+    bool filesWithMatches = false;           // Only whether a file matches: stop at its first match (-l)
+    size_t maxCount = 0;                     // Stop reading a file after this many matching lines; 0 = all
+    size_t maxFiles = 0;                     // Stop the scan after this many matching files (--first); 0 = all
+    BinaryFiles binaryFiles = BinaryFiles::Report;
+    std::vector<std::string> binaryPatterns; // Globs of files treated as binary without a look at their bytes
+    bool decompress = true;                  // Search gzip, xz and zstd files decompressed (decompress.h)
+    unsigned decompressThreads = 0;          // Threads inflating them; 0 = one per two matcher threads
+    size_t decompressLimit = size_t(1) << 30; // Larger decompressed contents are reported as errors
+
+    // Matching lines reported per file at most: 1 for filesWithMatches, else maxCount (0 = no limit).
+    size_t matchLimit() const { return filesWithMatches ? 1 : maxCount; }
+
+    // Whether the query is matched case-insensitively, after smart case.
+    bool foldsCase() const;
+};
+
+/**
+ * @brief One matching line. 'line' points into the file's bytes (without the
+ *        trailing newline) and is only valid during the callback. Its matches
+ *        are spans[firstSpan, firstSpan + spanCount) of the FileMatches.
+ */
+struct LineMatch {
+    size_t lineNumber;
+    std::string_view line;
+    size_t firstSpan = 0;
+    size_t spanCount = 0;
+    uint64_t offset = 0;      // byte offset of 'line' in the file
+};
+
+/**
+ * @brief All matching lines of one file, in line order, and where each match
+ *        lies in its line. For a binary file (BinaryFiles::Report) 'lines'
+ *        only holds the first matching line.
+ */
+struct FileMatches {
+    const std::filesystem::path& path;
+    const std::vector<LineMatch>& lines;
+    const std::vector<MatchSpan>& spans;
+    bool binary = false;
+
+    // The matches of one of 'lines'.
+    std::span<const MatchSpan> spansOf(const LineMatch& line) const
+    {
+        return std::span<const MatchSpan>(spans.data() + line.firstSpan, line.spanCount);
+    }
+};
+
+/**
+ * @brief Receives scan results. Called concurrently from the worker threads;
+ *        'worker' (0..numWorkers-1) identifies the caller so implementations
+ *        can keep per-thread buffers without locking.
+ */
+class ScanHandler {
+public:
+    virtual ~ScanHandler() = default;
+
+    // Before any worker starts.
+    virtual void onStart(unsigned /*numWorkers*/) {}
+
+    // A file with at least one match was scanned.
+    virtual void onFileMatches(const FileMatches& file, unsigned worker) = 0;
+
+    // Worker 'worker' will not call back again; flush its per-thread state.
+    virtual void onWorkerDone(unsigned /*worker*/) {}
+
+    // A file or directory could not be read. May be called from any thread.
+    virtual void onError(const std::string& /*message*/) {}
+};
+
+/**
+ * @brief A self-contained directory search. All state is per instance, so
+ *        several scanners can run at the same time in one process.
+ *
+ * Usage:
+ *     std::string error;
+ *     auto scanner = Scanner::create(options, error);
+ *     scanner->run(directory, [](const FileMatches& file) { ... });
+ */
+class Scanner {
+public:
+    /**
+     * @brief Validates the options and compiles the query and file pattern.
+     * @return nullptr (and sets 'error') if the query or pattern is invalid.
+     */
+    static std::unique_ptr<Scanner> create(const ScanOptions& options, std::string& error);
+
+    ~Scanner();
+
+    Scanner(const Scanner&) = delete;
+    Scanner& operator=(const Scanner&) = delete;
+
+    /**
+     * @brief Scans 'directory' recursively and blocks until it is done.
+     *        Safe to call again afterwards; counters keep accumulating.
+     *        With a result cache, unchanged files are not opened: their cached
+     *        matches are reported by one extra worker (numWorkers + 1 in
+     *        ScanHandler::onStart) after the walk, and the cache is rewritten
+     *        at the end.
+     *        With ScanOptions::adaptiveThreads, numWorkers is the largest
+     *        pool size; the workers beyond the current size stay parked.
+     *        With ScanOptions::maxFiles, the walk, the read stage and the
+     *        workers are cancelled once that many files were reported; the
+     *        cache is then left as it was.
+     */
+    void run(const std::filesystem::path& directory, ScanHandler& handler);
+
+    /**
+     * @brief Convenience overload: 'callback' is invoked for each matching
+     *        file, serialized so it needs no locking of its own.
+     */
+    void run(const std::filesystem::path& directory,
+             const std::function<void(const FileMatches&)>& callback);
+
+    /**
+     * @brief Stops the scan as the ScanOptions::maxFiles limit does: the walk,
+     *        the read stage and the workers end at their next step, and run()
+     *        returns without rewriting the cache. A run started afterwards
+     *        ends at once too. Thread-safe.
+     */
+    void cancel();
+
+    /**
+     * @brief Progress so far; may be called from any thread while run() is active.
+     */
+    StatusSnapshot progress() const;
+
+    /**
+     * @brief The most recent error message, or "none". Takes a lock; poll
+     *        progress().errors and call this only when the count changes.
+     */
+    std::string lastError() const;
+
+    const ScanOptions& options() const { return options_; }
+    const Matcher& matcher() const { return *matcher_; }
+
+private:
+    struct FileFilter;
+
+    Scanner(const ScanOptions& options, std::unique_ptr<Matcher> matcher,
+            std::unique_ptr<FileFilter> filter, std::unique_ptr<ResultCache> cache);
+
+    void reportError(const std::string& message, ScanHandler& handler);
+
+    ScanOptions options_;
+    unsigned numThreads_;      // workers started
+    unsigned poolSize_;        // workers that can exist: numThreads_, or the adaptive maximum
+    unsigned walkerThreads_;
+    std::unique_ptr<Matcher> matcher_;
+    std::unique_ptr<FileFilter> filter_;
+    std::unique_ptr<ResultCache> cache_;
+    std::vector<WorkerStatus> workerStatus_;  // one per pool slot, plus one for cached replays
+
+    std::atomic<size_t> errorCount_{ 0 };
+    mutable std::mutex errorMutex_;
+    std::string lastError_ = "none";
+
+    std::mutex cancelMutex_;
+    bool cancelled_ = false;                // guarded by cancelMutex_
+    std::function<void()> cancelQueues_;    // the running scan's, while run() is active
+};
+
+#endif // SCANNER_H
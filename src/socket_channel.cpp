@@ -0,0 +1,329 @@
+#include "socket_channel.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include "byte_codec.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace {
+
+#ifdef _WIN32
+constexpr SocketHandle kNoSocket = INVALID_SOCKET;
+
+// Winsock needs initializing once per process before the first socket
+bool startNetworking(std::string& error)
+{
+	static const int status = []() {
+		WSADATA data;
+		return WSAStartup(MAKEWORD(2, 2), &data);
+	}();
+	if (status != 0) {
+		error = "could not initialize Winsock";
+		return false;
+	}
+	return true;
+}
+
+void closeSocket(SocketHandle socket)
+{
+	closesocket(socket);
+}
+
+int waitReadable(SocketHandle socket, int timeoutMs)
+{
+	WSAPOLLFD entry{ socket, POLLRDNORM, 0 };
+	return WSAPoll(&entry, 1, timeoutMs);
+}
+
+std::string lastSocketError()
+{
+	return "socket error " + std::to_string(WSAGetLastError());
+}
+
+constexpr int kSendFlags = 0;
+constexpr int kShutdownBoth = SD_BOTH;
+#else
+constexpr SocketHandle kNoSocket = -1;
+
+bool startNetworking(std::string&)
+{
+	return true;
+}
+
+void closeSocket(SocketHandle socket)
+{
+	close(socket);
+}
+
+int waitReadable(SocketHandle socket, int timeoutMs)
+{
+	pollfd entry{ socket, POLLIN, 0 };
+	int ready;
+	do {
+		ready = poll(&entry, 1, timeoutMs);
+	} while (ready < 0 && errno == EINTR);
+	return ready;
+}
+
+std::string lastSocketError()
+{
+	return std::strerror(errno);
+}
+
+// A peer that went away must not kill the process with SIGPIPE
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+constexpr int kShutdownBoth = SHUT_RDWR;
+#endif
+
+struct AddressList {
+	addrinfo* head = nullptr;
+	~AddressList()
+	{
+		if (head != nullptr) {
+			freeaddrinfo(head);
+		}
+	}
+};
+
+bool resolve(const std::string& host, const std::string& port, bool passive, AddressList& list, std::string& error)
+{
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	const int status = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &list.head);
+	if (status != 0) {
+		error = "cannot resolve " + (host.empty() ? std::string("*") : host) + ": " + gai_strerror(status);
+		return false;
+	}
+	return true;
+}
+
+} // namespace
+
+bool splitAddress(std::string_view address, std::string& host, std::string& port, std::string& error)
+{
+	std::string_view portText = address;
+	host.clear();
+	if (!address.empty() && address.front() == '[') {
+		const size_t close = address.find(']');
+		if (close == std::string_view::npos || address.substr(close + 1, 1) != ":") {
+			error = "malformed address: " + std::string(address);
+			return false;
+		}
+		host = address.substr(1, close - 1);
+		portText = address.substr(close + 2);
+	}
+	else if (const size_t colon = address.rfind(':'); colon != std::string_view::npos) {
+		host = address.substr(0, colon);
+		portText = address.substr(colon + 1);
+	}
+	unsigned number = 0;
+	const auto result = std::from_chars(portText.data(), portText.data() + portText.size(), number);
+	if (portText.empty() || result.ec != std::errc() || result.ptr != portText.data() + portText.size()
+		|| number > 65535) {
+		error = "expected [host:]port, got " + std::string(address);
+		return false;
+	}
+	port = portText;
+	return true;
+}
+
+Channel::Channel(SocketHandle socket, std::string peer)
+	: socket_(socket), peer_(std::move(peer))
+{
+	// Frames are small and answered one at a time: do not wait to coalesce them
+	int on = 1;
+	setsockopt(socket_, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+}
+
+Channel::~Channel()
+{
+	closeSocket(socket_);
+}
+
+std::unique_ptr<Channel> Channel::connect(const std::string& address, std::string& error)
+{
+	std::string host, port;
+	AddressList addresses;
+	if (!splitAddress(address, host, port, error) || !startNetworking(error)
+		|| !resolve(host, port, false, addresses, error)) {
+		return nullptr;
+	}
+	error = "no address to connect to";
+	for (const addrinfo* entry = addresses.head; entry != nullptr; entry = entry->ai_next) {
+		const SocketHandle socket = ::socket(entry->ai_family, entry->ai_socktype, entry->ai_protocol);
+		if (socket == kNoSocket) {
+			error = lastSocketError();
+			continue;
+		}
+		if (::connect(socket, entry->ai_addr, static_cast<int>(entry->ai_addrlen)) == 0) {
+			return std::unique_ptr<Channel>(new Channel(socket, address));
+		}
+		error = "cannot connect to " + address + ": " + lastSocketError();
+		closeSocket(socket);
+	}
+	return nullptr;
+}
+
+bool Channel::send(uint8_t type, std::string_view payload)
+{
+	std::string header;
+	putU32(header, static_cast<uint32_t>(payload.size() + 1));
+	header.push_back(static_cast<char>(type));
+	std::lock_guard<std::mutex> lock(sendMutex_);
+	return sendAll(header.data(), header.size()) && sendAll(payload.data(), payload.size());
+}
+
+bool Channel::receive(uint8_t& type, std::string& payload, std::string& error)
+{
+	char header[5];
+	if (!receiveAll(header, sizeof(header))) {
+		error = "connection to " + peer_ + " closed";
+		return false;
+	}
+	ByteCursor in{ std::string_view(header, 4) };
+	const uint32_t size = in.u32();
+	if (size == 0 || size - 1 > kMaxPayload) {
+		error = "malformed frame from " + peer_;
+		return false;
+	}
+	type = static_cast<uint8_t>(header[4]);
+	payload.resize(size - 1);
+	if (!receiveAll(payload.data(), payload.size())) {
+		error = "connection to " + peer_ + " closed mid-frame";
+		return false;
+	}
+	return true;
+}
+
+bool Channel::readable(std::chrono::milliseconds timeout)
+{
+	return waitReadable(socket_, static_cast<int>(timeout.count())) != 0;
+}
+
+void Channel::shutdown()
+{
+	::shutdown(socket_, kShutdownBoth);
+}
+
+bool Channel::sendAll(const char* data, size_t size)
+{
+	while (size > 0) {
+		const int chunk = static_cast<int>(std::min<size_t>(size, 1 << 30));
+		const auto sent = ::send(socket_, data, chunk, kSendFlags);
+		if (sent <= 0) {
+#ifndef _WIN32
+			if (sent < 0 && errno == EINTR) {
+				continue;
+			}
+#endif
+			return false;
+		}
+		data += sent;
+		size -= static_cast<size_t>(sent);
+	}
+	return true;
+}
+
+bool Channel::receiveAll(char* data, size_t size)
+{
+	while (size > 0) {
+		const int chunk = static_cast<int>(std::min<size_t>(size, 1 << 30));
+		const auto received = ::recv(socket_, data, chunk, 0);
+		if (received <= 0) {
+#ifndef _WIN32
+			if (received < 0 && errno == EINTR) {
+				continue;
+			}
+#endif
+			return false;
+		}
+		data += received;
+		size -= static_cast<size_t>(received);
+	}
+	return true;
+}
+
+Listener::Listener(SocketHandle socket, unsigned short port)
+	: socket_(socket), port_(port)
+{
+}
+
+Listener::~Listener()
+{
+	closeSocket(socket_);
+}
+
+std::unique_ptr<Listener> Listener::listen(const std::string& address, std::string& error)
+{
+	std::string host, port;
+	AddressList addresses;
+	if (!splitAddress(address, host, port, error) || !startNetworking(error)) {
+		return nullptr;
+	}
+	if (host.empty()) {
+		host = "127.0.0.1"; // other hosts only when asked for
+	}
+	if (!resolve(host, port, true, addresses, error)) {
+		return nullptr;
+	}
+	error = "no address to listen on";
+	for (const addrinfo* entry = addresses.head; entry != nullptr; entry = entry->ai_next) {
+		const SocketHandle socket = ::socket(entry->ai_family, entry->ai_socktype, entry->ai_protocol);
+		if (socket == kNoSocket) {
+			error = lastSocketError();
+			continue;
+		}
+		int on = 1;
+		setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+		sockaddr_storage bound{};
+		socklen_t boundSize = sizeof(bound);
+		if (::bind(socket, entry->ai_addr, static_cast<int>(entry->ai_addrlen)) != 0 || ::listen(socket, 16) != 0
+			|| getsockname(socket, reinterpret_cast<sockaddr*>(&bound), &boundSize) != 0) {
+			error = "cannot listen on " + address + ": " + lastSocketError();
+			closeSocket(socket);
+			continue;
+		}
+		const unsigned short boundPort = ntohs(bound.ss_family == AF_INET6
+			? reinterpret_cast<const sockaddr_in6*>(&bound)->sin6_port
+			: reinterpret_cast<const sockaddr_in*>(&bound)->sin_port);
+		return std::unique_ptr<Listener>(new Listener(socket, boundPort));
+	}
+	return nullptr;
+}
+
+std::unique_ptr<Channel> Listener::accept(std::chrono::milliseconds timeout)
+{
+	if (waitReadable(socket_, static_cast<int>(timeout.count())) <= 0) {
+		return nullptr;
+	}
+	sockaddr_storage peer{};
+	socklen_t peerSize = sizeof(peer);
+	const SocketHandle socket = ::accept(socket_, reinterpret_cast<sockaddr*>(&peer), &peerSize);
+	if (socket == kNoSocket) {
+		return nullptr;
+	}
+	char host[NI_MAXHOST] = "?";
+	char port[NI_MAXSERV] = "?";
+	getnameinfo(reinterpret_cast<const sockaddr*>(&peer), peerSize, host, sizeof(host), port, sizeof(port),
+		NI_NUMERICHOST | NI_NUMERICSERV);
+	return std::unique_ptr<Channel>(new Channel(socket, std::string(host) + ":" + port));
+}
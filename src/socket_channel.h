@@ -0,0 +1,119 @@
+#ifndef SOCKET_CHANNEL_H
+#define SOCKET_CHANNEL_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+using SocketHandle = std::uintptr_t; // SOCKET, without pulling in winsock2.h
+#else
+using SocketHandle = int;
+#endif
+
+/**
+ * @brief A connected TCP stream carrying framed messages: a little-endian
+ *        u32 with the size of what follows, a u8 message type, then the
+ *        payload. Sending is thread-safe (frames are never interleaved);
+ *        receiving is for one thread at a time.
+ */
+class Channel {
+public:
+    static constexpr size_t kMaxPayload = size_t(64) << 20; // larger frames are a protocol error
+
+    /**
+     * @brief Connects to "host:port" ("[v6-address]:port" for IPv6).
+     * @return nullptr (and sets 'error') if no address of the host accepts.
+     */
+    static std::unique_ptr<Channel> connect(const std::string& address, std::string& error);
+
+    ~Channel();
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    /**
+     * @brief Sends one frame. Thread-safe.
+     * @return false once the connection is broken or shut down.
+     */
+    bool send(uint8_t type, std::string_view payload);
+
+    /**
+     * @brief Blocks for the next frame.
+     * @return false (and sets 'error') if the peer closed the connection, it
+     *         broke, or the frame is larger than kMaxPayload.
+     */
+    bool receive(uint8_t& type, std::string& payload, std::string& error);
+
+    /**
+     * @brief Waits up to 'timeout' for something to receive: a frame, or the
+     *        peer closing or breaking the connection.
+     */
+    bool readable(std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Ends the connection in both directions; a receive() blocked in
+     *        another thread returns false. Thread-safe.
+     */
+    void shutdown();
+
+    // The address of the other end, for messages
+    const std::string& peer() const { return peer_; }
+
+private:
+    friend class Listener;
+
+    Channel(SocketHandle socket, std::string peer);
+
+    bool sendAll(const char* data, size_t size);
+    bool receiveAll(char* data, size_t size);
+
+    SocketHandle socket_;
+    std::string peer_;
+    std::mutex sendMutex_;
+};
+
+/**
+ * @brief A listening TCP socket handing out Channels.
+ */
+class Listener {
+public:
+    /**
+     * @brief Listens on "[host:]port"; without a host, on the loopback
+     *        interface only ("0.0.0.0:port" or "[::]:port" for all of them).
+     *        Port 0 picks a free port (see port()).
+     */
+    static std::unique_ptr<Listener> listen(const std::string& address, std::string& error);
+
+    ~Listener();
+
+    Listener(const Listener&) = delete;
+    Listener& operator=(const Listener&) = delete;
+
+    /**
+     * @brief Waits up to 'timeout' for a connection.
+     * @return nullptr if none arrived in time.
+     */
+    std::unique_ptr<Channel> accept(std::chrono::milliseconds timeout);
+
+    unsigned short port() const { return port_; }
+
+private:
+    Listener(SocketHandle socket, unsigned short port);
+
+    SocketHandle socket_;
+    unsigned short port_;
+};
+
+/**
+ * @brief Splits "host:port", "[v6-address]:port" or a bare "port" (host
+ *        left empty).
+ * @return false (and sets 'error') if the port is missing or not a number.
+ */
+bool splitAddress(std::string_view address, std::string& host, std::string& port, std::string& error);
+
+#endif // SOCKET_CHANNEL_H
@@ -0,0 +1,225 @@
+#include "stage_timer.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include "json_text.h"
+
+namespace {
+
+constexpr const char* kStageNames[kStageCount] = {
+	"walk", "queue push", "queue pop", "open", "read", "decompress", "match", "format", "submit", "write",
+};
+
+// Microseconds with three decimals, as Chrome traces expect.
+void appendMicros(std::string& out, uint64_t nanos)
+{
+	char digits[32];
+	auto result = std::to_chars(digits, digits + sizeof(digits), nanos / 1000);
+	out.append(digits, result.ptr);
+	const unsigned fraction = static_cast<unsigned>(nanos % 1000);
+	out += '.';
+	out += static_cast<char>('0' + fraction / 100);
+	out += static_cast<char>('0' + fraction / 10 % 10);
+	out += static_cast<char>('0' + fraction % 10);
+}
+
+void appendNumber(std::string& out, uint64_t value)
+{
+	char digits[24];
+	auto result = std::to_chars(digits, digits + sizeof(digits), value);
+	out.append(digits, result.ptr);
+}
+
+} // namespace
+
+const char* stageName(Stage stage)
+{
+	return kStageNames[static_cast<size_t>(stage)];
+}
+
+void StageHistogram::merge(const StageHistogram& other)
+{
+	for (unsigned b = 0; b < kBuckets; ++b) {
+		buckets_[b] += other.buckets_[b];
+	}
+	count_ += other.count_;
+	total_ += other.total_;
+	max_ = other.max_ > max_ ? other.max_ : max_;
+}
+
+uint64_t StageHistogram::upperBound(unsigned bucket)
+{
+	if (bucket < kSubBuckets) {
+		return bucket;
+	}
+	const unsigned exponent = bucket / kSubBuckets + 1;
+	const uint64_t step = uint64_t(1) << (exponent - 2);
+	const uint64_t lower = (kSubBuckets + bucket % kSubBuckets) * step;
+	return lower + (step - 1);
+}
+
+uint64_t StageHistogram::percentile(double q) const
+{
+	if (count_ == 0) {
+		return 0;
+	}
+	const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(count_))));
+	uint64_t seen = 0;
+	for (unsigned b = 0; b < kBuckets; ++b) {
+		seen += buckets_[b];
+		if (seen >= rank) {
+			return std::min(upperBound(b), max_);
+		}
+	}
+	return max_;
+}
+
+void ThreadProfile::record(Stage stage, uint64_t startNanos, uint64_t endNanos)
+{
+	const uint64_t duration = endNanos - startNanos;
+	stages[static_cast<size_t>(stage)].add(duration);
+	if (owner->trace_ && duration >= kMinTraceNanos) {
+		if (events.size() < kMaxTraceEvents) {
+			events.push_back(Event{ stage, startNanos - owner->startNanos_, duration });
+		}
+		else {
+			++droppedEvents;
+		}
+	}
+}
+
+StageProfile::StageProfile(bool trace)
+	: trace_(trace), startNanos_(profileClockNanos())
+{
+}
+
+StageProfile* StageProfile::current()
+{
+	ThreadProfile* thread = currentThreadProfile();
+	return thread ? thread->owner : nullptr;
+}
+
+ThreadProfile* StageProfile::attach(std::string name)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	ThreadProfile& thread = threads_.emplace_back();
+	thread.owner = this;
+	thread.name = std::move(name);
+	return &thread;
+}
+
+std::array<StageHistogram, kStageCount> StageProfile::totals() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::array<StageHistogram, kStageCount> totals;
+	for (const auto& thread : threads_) {
+		for (size_t s = 0; s < kStageCount; ++s) {
+			totals[s].merge(thread.stages[s]);
+		}
+	}
+	return totals;
+}
+
+void StageProfile::writeReport(std::ostream& out) const
+{
+#if !DIRSCAN_PROFILING
+	out << "Stage timers are compiled out (DIRSCAN_PROFILING=0)\n";
+#endif
+	const auto totals = this->totals();
+	char line[160];
+	std::snprintf(line, sizeof(line), "%-11s %10s %11s %9s %9s %9s %9s %10s\n",
+		"stage", "count", "total ms", "mean us", "p50 us", "p90 us", "p99 us", "max us");
+	out << line;
+	for (size_t s = 0; s < kStageCount; ++s) {
+		const StageHistogram& h = totals[s];
+		if (h.count() == 0) {
+			continue;
+		}
+		auto micros = [](uint64_t nanos) { return static_cast<double>(nanos) / 1e3; };
+		std::snprintf(line, sizeof(line), "%-11s %10llu %11.3f %9.2f %9.2f %9.2f %9.2f %10.2f\n",
+			kStageNames[s], static_cast<unsigned long long>(h.count()),
+			static_cast<double>(h.totalNanos()) / 1e6,
+			micros(h.totalNanos()) / static_cast<double>(h.count()),
+			micros(h.percentile(0.5)), micros(h.percentile(0.9)), micros(h.percentile(0.99)),
+			micros(h.maxNanos()));
+		out << line;
+	}
+}
+
+bool StageProfile::writeTrace(const std::filesystem::path& path, std::string& error) const
+{
+	if (!trace_) {
+		error = "Tracing was not enabled for this profile";
+		return false;
+	}
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		error = "Could not write trace " + path.string();
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::string chunk = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	auto separate = [&]() {
+		if (!first) {
+			chunk += ",\n";
+		}
+		first = false;
+	};
+	for (size_t t = 0; t < threads_.size(); ++t) {
+		const ThreadProfile& thread = threads_[t];
+		separate();
+		chunk += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":";
+		appendNumber(chunk, t + 1);
+		chunk += ",\"args\":{";
+		appendJsonBytes(chunk, "name", thread.name);
+		if (thread.droppedEvents != 0) {
+			chunk += ",\"dropped_events\":";
+			appendNumber(chunk, thread.droppedEvents);
+		}
+		chunk += "}}";
+		for (const auto& event : thread.events) {
+			separate();
+			chunk += "{\"name\":\"";
+			chunk += kStageNames[static_cast<size_t>(event.stage)];
+			chunk += "\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+			appendNumber(chunk, t + 1);
+			chunk += ",\"ts\":";
+			appendMicros(chunk, event.start);
+			chunk += ",\"dur\":";
+			appendMicros(chunk, event.duration);
+			chunk += '}';
+			if (chunk.size() >= 1 << 16) {
+				file.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+				chunk.clear();
+			}
+		}
+	}
+	chunk += "\n]}\n";
+	file.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+	if (!file) {
+		error = "Could not write trace " + path.string();
+		return false;
+	}
+	return true;
+}
+
+#if DIRSCAN_PROFILING
+
+ProfileScope::ProfileScope(StageProfile* profile, const char* role, int index)
+	: previous_(currentThreadProfile())
+{
+	if (profile) {
+		std::string name = role;
+		if (index >= 0) {
+			name += " " + std::to_string(index);
+		}
+		currentThreadProfile() = profile->attach(std::move(name));
+	}
+}
+
+#endif // DIRSCAN_PROFILING
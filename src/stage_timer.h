@@ -0,0 +1,244 @@
+#ifndef STAGE_TIMER_H
+#define STAGE_TIMER_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Set to 0 (CMake: -DDIRSCAN_PROFILING=OFF) to compile every StageTimer and
+// ProfileScope down to nothing.
+#ifndef DIRSCAN_PROFILING
+#define DIRSCAN_PROFILING 1
+#endif
+
+/**
+ * @brief The steps of a scan that are timed. Stages nest where the code does:
+ *        a walk includes its queue pushes, and formatting includes the
+ *        hand-off to the writer.
+ */
+enum class Stage : unsigned {
+    Walk,        // enumerating one directory
+    QueuePush,   // putting paths or loaded files into a queue, waiting included
+    QueuePop,    // taking them out, waiting included
+    Open,        // opening a file and reading its size
+    Read,        // reading or mapping its contents
+    Decompress,  // inflating a compressed file (decompress.h)
+    Match,       // searching the contents
+    Format,      // formatting a matching file's results
+    Submit,      // handing a full buffer to the writer (the results lock)
+    Write        // the writer thread writing to the output stream
+};
+
+constexpr size_t kStageCount = 10;
+
+const char* stageName(Stage stage);
+
+/**
+ * @brief Latency histogram with four buckets per power of two (within 25%)
+ *        from 1 ns up, plus exact count, total and maximum.
+ */
+class StageHistogram {
+public:
+    static constexpr unsigned kSubBuckets = 4;
+    static constexpr unsigned kBuckets = 64 * kSubBuckets;
+
+    void add(uint64_t nanos)
+    {
+        ++buckets_[bucketOf(nanos)];
+        ++count_;
+        total_ += nanos;
+        max_ = nanos > max_ ? nanos : max_;
+    }
+
+    void merge(const StageHistogram& other);
+
+    uint64_t count() const { return count_; }
+    uint64_t totalNanos() const { return total_; }
+    uint64_t maxNanos() const { return max_; }
+
+    /**
+     * @brief Upper bound of the bucket holding quantile 'q' (0..1); 0 if empty.
+     */
+    uint64_t percentile(double q) const;
+
+private:
+    static unsigned bucketOf(uint64_t nanos)
+    {
+        if (nanos < kSubBuckets) {
+            return static_cast<unsigned>(nanos);
+        }
+        unsigned exponent = 63;
+        while ((nanos >> exponent) == 0) {
+            --exponent;
+        }
+        const unsigned sub = static_cast<unsigned>(nanos >> (exponent - 2)) & (kSubBuckets - 1);
+        return (exponent - 1) * kSubBuckets + sub;
+    }
+
+    static uint64_t upperBound(unsigned bucket);
+
+    uint64_t count_ = 0;
+    uint64_t total_ = 0;
+    uint64_t max_ = 0;
+    std::array<uint64_t, kBuckets> buckets_{};
+};
+
+class StageProfile;
+
+/**
+ * @brief What one thread recorded. Only that thread writes to it.
+ */
+struct ThreadProfile {
+    struct Event {
+        Stage stage;
+        uint64_t start;      // nanoseconds since the profile started
+        uint64_t duration;
+    };
+
+    // Trace events shorter than this are only counted in the histograms.
+    static constexpr uint64_t kMinTraceNanos = 1000;
+    static constexpr size_t kMaxTraceEvents = 1 << 20;
+
+    StageProfile* owner = nullptr;
+    std::string name;
+    std::array<StageHistogram, kStageCount> stages;
+    std::vector<Event> events;  // only when tracing
+    uint64_t droppedEvents = 0;
+
+    void record(Stage stage, uint64_t startNanos, uint64_t endNanos);
+};
+
+inline ThreadProfile*& currentThreadProfile()
+{
+    thread_local ThreadProfile* profile = nullptr;
+    return profile;
+}
+
+inline uint64_t profileClockNanos()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * @brief Per-stage timings of one scan, collected from every thread attached
+ *        to it with a ProfileScope.
+ *
+ * Threads record into their own ThreadProfile without locking; the results
+ * are merged when they are read, which must only happen after the attached
+ * threads are done (e.g. after Scanner::run returns). Threads started by the
+ * scan attach themselves to the profile of the thread that started it.
+ */
+class StageProfile {
+public:
+    /**
+     * @param trace Also keep a timeline of events for writeTrace().
+     */
+    explicit StageProfile(bool trace = false);
+
+    StageProfile(const StageProfile&) = delete;
+    StageProfile& operator=(const StageProfile&) = delete;
+
+    /**
+     * @brief The profile the calling thread is attached to, or nullptr.
+     */
+    static StageProfile* current();
+
+    /**
+     * @brief The histograms of every thread, merged per stage.
+     */
+    std::array<StageHistogram, kStageCount> totals() const;
+
+    /**
+     * @brief Writes a table of count, total and latency percentiles per stage.
+     */
+    void writeReport(std::ostream& out) const;
+
+    /**
+     * @brief Writes the timeline in Chrome trace event format (chrome://tracing,
+     *        Perfetto): one track per thread.
+     * @return false (and sets 'error') if tracing is off or the file could not be written.
+     */
+    bool writeTrace(const std::filesystem::path& path, std::string& error) const;
+
+private:
+    friend class ProfileScope;
+    friend struct ThreadProfile;
+    ThreadProfile* attach(std::string name);
+
+    const bool trace_;
+    const uint64_t startNanos_;
+    mutable std::mutex mutex_;
+    std::deque<ThreadProfile> threads_;  // stable addresses
+};
+
+#if DIRSCAN_PROFILING
+
+/**
+ * @brief Attaches the calling thread to 'profile' (nothing if it is null)
+ *        for the scope's lifetime, named "<role>" or "<role> <index>" in traces.
+ */
+class ProfileScope {
+public:
+    ProfileScope(StageProfile* profile, const char* role, int index = -1);
+    ~ProfileScope() { currentThreadProfile() = previous_; }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    ThreadProfile* previous_;
+};
+
+/**
+ * @brief Times its scope as 'stage' if the thread is attached to a profile;
+ *        otherwise costs one thread-local load and a branch.
+ */
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage)
+        : profile_(currentThreadProfile()), stage_(stage), start_(profile_ ? profileClockNanos() : 0) {}
+
+    ~StageTimer() { stop(); }
+
+    // Ends the stage before the end of the scope.
+    void stop()
+    {
+        if (profile_) {
+            profile_->record(stage_, start_, profileClockNanos());
+            profile_ = nullptr;
+        }
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    ThreadProfile* profile_;
+    Stage stage_;
+    uint64_t start_;
+};
+
+#else
+
+class ProfileScope {
+public:
+    ProfileScope(StageProfile*, const char*, int = -1) {}
+};
+
+class StageTimer {
+public:
+    explicit StageTimer(Stage) {}
+    void stop() {}
+};
+
+#endif // DIRSCAN_PROFILING
+
+#endif // STAGE_TIMER_H
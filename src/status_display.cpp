@@ -0,0 +1,154 @@
+#include "status_display.h"
+
+#include <charconv>
+#include "json_text.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr size_t kMaxShownPath = 60;
+
+void appendNumber(std::string& out, uint64_t value)
+{
+	char digits[24];
+	auto result = std::to_chars(digits, digits + sizeof(digits), value);
+	out.append(digits, result.ptr);
+}
+
+// Table cell: control characters would move the cursor and break the redraw.
+void appendPrintable(std::string& out, std::string_view text)
+{
+	for (unsigned char c : text) {
+		out += c < 0x20 || c == 0x7f ? '?' : static_cast<char>(c);
+	}
+}
+
+} // namespace
+
+StatusRenderer::StatusRenderer(std::ostream& out, ProgressMode mode, bool terminal)
+	: out_(out), mode_(mode),
+	  inPlace_(mode == ProgressMode::Table || (mode == ProgressMode::Auto && terminal)),
+	  start_(std::chrono::steady_clock::now())
+{
+}
+
+void StatusRenderer::update(const StatusSnapshot& status, const std::string& lastError)
+{
+	if (mode_ == ProgressMode::Json) {
+		drawJson(status, lastError, false);
+	}
+	else if (inPlace_) {
+		drawTable(status, lastError, true);
+	}
+}
+
+void StatusRenderer::finish(const StatusSnapshot& status, const std::string& lastError)
+{
+	if (mode_ == ProgressMode::Json) {
+		drawJson(status, lastError, true);
+	}
+	else if (mode_ != ProgressMode::Quiet) {
+		drawTable(status, lastError, inPlace_);
+	}
+}
+
+void StatusRenderer::drawTable(const StatusSnapshot& status, const std::string& lastError, bool inPlace)
+{
+	std::string_view current = status.currentFile;
+	const bool shortened = current.size() > kMaxShownPath;
+	if (shortened) {
+		current.remove_prefix(current.size() - (kMaxShownPath - 3));
+	}
+
+	std::vector<std::string> lines(7);
+	lines[0] = lines[6] = "----------------------------------------------------";
+	lines[1] = "| Files Scanned: ";
+	appendNumber(lines[1], status.filesScanned);
+	lines[2] = shortened ? "| Current File:  ..." : "| Current File:  ";
+	appendPrintable(lines[2], current);
+	lines[3] = "| Total hits:    ";
+	appendNumber(lines[3], status.totalHits);
+	lines[4] = "|";
+	lines[5] = "| Last Error:    ";
+	appendPrintable(lines[5], lastError.substr(0, kMaxShownPath));
+
+	frame_.clear();
+	if (!inPlace || lines_.empty()) {
+		for (const auto& line : lines) {
+			frame_ += line;
+			frame_ += '\n';
+		}
+	}
+	else {
+		size_t first = 0;
+		while (first < lines.size() && lines[first] == lines_[first]) {
+			++first;
+		}
+		if (first == lines.size()) {
+			return; // nothing changed
+		}
+		// Up to the first changed line, then rewrite changed lines and step over the rest
+		frame_ += "\033[";
+		appendNumber(frame_, lines.size() - first);
+		frame_ += 'A';
+		for (size_t i = first; i < lines.size(); ++i) {
+			if (lines[i] != lines_[i]) {
+				frame_ += "\r\033[2K";
+				frame_ += lines[i];
+			}
+			frame_ += '\n';
+		}
+	}
+	out_.write(frame_.data(), static_cast<std::streamsize>(frame_.size()));
+	out_.flush();
+	lines_ = std::move(lines);
+}
+
+void StatusRenderer::drawJson(const StatusSnapshot& status, const std::string& lastError, bool done)
+{
+	if (!done && status.filesScanned == lastFiles_ && status.totalHits == lastHits_ && status.errors == lastErrors_) {
+		return;
+	}
+	lastFiles_ = status.filesScanned;
+	lastHits_ = status.totalHits;
+	lastErrors_ = status.errors;
+
+	const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start_);
+	frame_ = "{\"files\":";
+	appendNumber(frame_, status.filesScanned);
+	frame_ += ",\"hits\":";
+	appendNumber(frame_, status.totalHits);
+	frame_ += ",\"errors\":";
+	appendNumber(frame_, status.errors);
+	frame_ += ",\"elapsed_ms\":";
+	appendNumber(frame_, static_cast<uint64_t>(elapsed.count()));
+	if (done) {
+		frame_ += ",\"done\":true";
+	}
+	else {
+		frame_ += ',';
+		appendJsonBytes(frame_, "current", status.currentFile);
+	}
+	if (status.errors > 0) {
+		frame_ += ',';
+		appendJsonBytes(frame_, "last_error", lastError);
+	}
+	frame_ += "}\n";
+	out_.write(frame_.data(), static_cast<std::streamsize>(frame_.size()));
+	out_.flush();
+}
+
+bool isTerminal(std::FILE* stream)
+{
+#ifdef _WIN32
+	return _isatty(_fileno(stream)) != 0;
+#else
+	return isatty(fileno(stream)) != 0;
+#endif
+}
@@ -0,0 +1,69 @@
+#ifndef STATUS_DISPLAY_H
+#define STATUS_DISPLAY_H
+
+#include <chrono>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "worker_status.h"
+
+/**
+ * @brief How searchInDirectory shows progress while it scans.
+ */
+enum class ProgressMode {
+    Auto,    // Table on a terminal; otherwise only the final summary
+    Table,   // Status table redrawn in place (ANSI cursor movement)
+    Json,    // One compact JSON object per line when the counters change (--progress=json)
+    Quiet    // Nothing at all (--quiet)
+};
+
+/**
+ * @brief Draws StatusSnapshots to a stream.
+ *
+ * The table is drawn once; later frames move the cursor up to the first line
+ * that changed and rewrite only the lines that differ, so an idle scan sends
+ * nothing and a busy one a few short lines per tick. Frames are built in one
+ * string and written with a single call. Not thread-safe: one monitor thread
+ * owns the renderer.
+ */
+class StatusRenderer {
+public:
+    /**
+     * @param terminal Whether 'out' is a terminal; Auto draws the table only then.
+     */
+    StatusRenderer(std::ostream& out, ProgressMode mode, bool terminal);
+
+    /**
+     * @brief Draws the progress so far, if anything changed since the last frame.
+     */
+    void update(const StatusSnapshot& status, const std::string& lastError);
+
+    /**
+     * @brief Draws the final state; on a non-terminal this is the only output.
+     */
+    void finish(const StatusSnapshot& status, const std::string& lastError);
+
+    ProgressMode mode() const { return mode_; }
+
+private:
+    void drawTable(const StatusSnapshot& status, const std::string& lastError, bool inPlace);
+    void drawJson(const StatusSnapshot& status, const std::string& lastError, bool done);
+
+    std::ostream& out_;
+    ProgressMode mode_;
+    bool inPlace_;                       // Table redraws over the previous frame
+    std::vector<std::string> lines_;     // last frame drawn, one entry per line
+    std::string frame_;                  // reused output buffer
+    size_t lastFiles_ = SIZE_MAX;        // JSON: counters of the last line written
+    size_t lastHits_ = SIZE_MAX;
+    size_t lastErrors_ = 0;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * @brief Whether 'stream' (stdout or stderr) is an interactive terminal.
+ */
+bool isTerminal(std::FILE* stream);
+
+#endif // STATUS_DISPLAY_H
@@ -0,0 +1,279 @@
+#include "structured_output.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include "byte_codec.h"
+#include "json_text.h"
+
+namespace {
+
+void appendNumber(std::string& out, uint64_t value)
+{
+	char digits[24];
+	auto result = std::to_chars(digits, digits + sizeof(digits), value);
+	out.append(digits, result.ptr);
+}
+
+void putU8(std::string& out, uint8_t v)
+{
+	out.push_back(static_cast<char>(v));
+}
+
+// Bytes of a line that are written: all of it, or at most maxLineBytes
+size_t keptBytes(std::string_view line, size_t maxLineBytes)
+{
+	return maxLineBytes != 0 ? std::min(line.size(), maxLineBytes) : line.size();
+}
+
+// Cuts a span of a line whose text was cut to 'kept' bytes: false if the
+// span starts beyond them and is dropped
+bool clipSpan(MatchSpan& span, size_t lineSize, size_t kept)
+{
+	if (kept == lineSize) {
+		return true;
+	}
+	if (span.offset >= kept) {
+		return false;
+	}
+	span.length = std::min(span.length, kept - span.offset);
+	return true;
+}
+
+} // namespace
+
+StructuredResultHandler::StructuredResultHandler(ResultWriter& writer, OutputFormat format, bool namesOnly,
+	bool multiplePatterns, size_t maxLineBytes)
+	: writer_(writer), format_(format), namesOnly_(namesOnly), multiplePatterns_(multiplePatterns),
+	  maxLineBytes_(maxLineBytes)
+{
+}
+
+void StructuredResultHandler::onStart(unsigned numWorkers)
+{
+	buffers_.clear();
+	for (unsigned i = 0; i < numWorkers; ++i) {
+		buffers_.push_back(std::make_unique<ResultBuffer>(writer_));
+	}
+	pathScratch_.assign(numWorkers, Scratch{});
+}
+
+void StructuredResultHandler::onFileMatches(const FileMatches& file, unsigned worker)
+{
+	ResultBuffer& output = *buffers_[worker];
+	const std::string& path = pathBytes(file.path, pathScratch_[worker].text);
+	switch (format_) {
+	case OutputFormat::JsonLines:
+		appendJson(output.data(), file, path);
+		break;
+	case OutputFormat::Nul:
+		appendNul(output.data(), file, path);
+		break;
+	case OutputFormat::Binary:
+		appendBinary(output.data(), file, path);
+		break;
+	case OutputFormat::Text:
+		break; // TextResultHandler's job
+	}
+	output.endFile(path);
+}
+
+void StructuredResultHandler::onWorkerDone(unsigned worker)
+{
+	buffers_[worker]->flush();
+}
+
+void StructuredResultHandler::appendJson(std::string& out, const FileMatches& file, const std::string& path) const
+{
+	if (namesOnly_ || file.binary) {
+		out += '{';
+		appendJsonBytes(out, "file", path);
+		out += file.binary && !namesOnly_ ? ",\"binary\":true}\n" : "}\n";
+		return;
+	}
+	for (const auto& m : file.lines) {
+		const bool truncated = maxLineBytes_ != 0 && m.line.size() > maxLineBytes_;
+		std::string_view text = truncated ? m.line.substr(0, maxLineBytes_) : m.line;
+		if (truncated && !isValidUtf8(text)) {
+			// Do not cut a character in half: back up to its first byte
+			size_t cut = text.size();
+			while (cut > 0 && (static_cast<unsigned char>(m.line[cut]) & 0xc0) == 0x80) {
+				--cut;
+			}
+			if (isValidUtf8(m.line.substr(0, cut))) {
+				text = m.line.substr(0, cut);
+			}
+		}
+		out += '{';
+		appendJsonBytes(out, "file", path);
+		out += ",\"line\":";
+		appendNumber(out, m.lineNumber);
+		out += ",\"offset\":";
+		appendNumber(out, m.offset);
+		out += ',';
+		appendJsonBytes(out, "text", text);
+		if (truncated) {
+			out += ",\"truncated\":true";
+		}
+		out += ",\"spans\":[";
+		bool first = true;
+		for (MatchSpan span : file.spansOf(m)) {
+			if (!clipSpan(span, m.line.size(), text.size())) {
+				continue;
+			}
+			out += first ? "[" : ",[";
+			appendNumber(out, span.offset);
+			out += ',';
+			appendNumber(out, span.length);
+			if (multiplePatterns_) {
+				out += ',';
+				appendNumber(out, span.pattern);
+			}
+			out += ']';
+			first = false;
+		}
+		out += "]}\n";
+	}
+}
+
+void StructuredResultHandler::appendNul(std::string& out, const FileMatches& file, const std::string& path) const
+{
+	if (namesOnly_) {
+		out.append(path).push_back('\0');
+		return;
+	}
+	for (const auto& m : file.lines) {
+		out.append(path).push_back('\0');
+		appendNumber(out, m.lineNumber);
+		out.push_back('\0');
+		appendNumber(out, m.offset);
+		out.push_back('\0');
+		if (file.binary) {
+			out.append("binary").push_back('\0');
+			out.append("0").push_back('\0');
+			out.push_back('\0');
+			continue;
+		}
+		const size_t size = keptBytes(m.line, maxLineBytes_);
+		bool first = true;
+		for (MatchSpan span : file.spansOf(m)) {
+			if (!clipSpan(span, m.line.size(), size)) {
+				continue;
+			}
+			if (!first) {
+				out.push_back(',');
+			}
+			appendNumber(out, span.offset);
+			out.push_back('+');
+			appendNumber(out, span.length);
+			if (multiplePatterns_) {
+				out.push_back('/');
+				appendNumber(out, span.pattern);
+			}
+			first = false;
+		}
+		out.push_back('\0');
+		appendNumber(out, m.line.size());
+		out.push_back('\0');
+		out.append(m.line.data(), size).push_back('\0');
+	}
+}
+
+void StructuredResultHandler::appendBinary(std::string& out, const FileMatches& file, const std::string& path) const
+{
+	appendBinaryRecord(out, file, path, namesOnly_, maxLineBytes_);
+}
+
+void appendBinaryRecord(std::string& out, const FileMatches& file, std::string_view path, bool namesOnly,
+	size_t maxLineBytes)
+{
+	const size_t start = out.size();
+	putU32(out, 0); // recordSize, patched below
+	putBytes(out, path);
+	putU8(out, static_cast<uint8_t>((file.binary ? 1 : 0) | (namesOnly ? 2 : 0)));
+	const bool withLines = !namesOnly;
+	putU32(out, withLines ? static_cast<uint32_t>(file.lines.size()) : 0);
+	for (size_t l = 0; withLines && l < file.lines.size(); ++l) {
+		const LineMatch& m = file.lines[l];
+		putU64(out, m.lineNumber);
+		putU64(out, m.offset);
+		const size_t size = file.binary ? 0 : keptBytes(m.line, maxLineBytes);
+		const size_t lineSize = file.binary ? 0 : m.line.size();
+		const auto spans = file.spansOf(m);
+		const size_t spanCountAt = out.size();
+		putU32(out, 0); // spanCount, patched below
+		uint32_t spanCount = 0;
+		for (MatchSpan span : spans) {
+			if (!clipSpan(span, lineSize, size)) {
+				continue;
+			}
+			putU32(out, static_cast<uint32_t>(span.offset));
+			putU32(out, static_cast<uint32_t>(span.length));
+			putU32(out, static_cast<uint32_t>(span.pattern));
+			++spanCount;
+		}
+		std::string count;
+		putU32(count, spanCount);
+		std::memcpy(out.data() + spanCountAt, count.data(), 4);
+		putU64(out, lineSize);
+		putBytes(out, m.line.substr(0, size));
+	}
+	std::string size;
+	putU32(size, static_cast<uint32_t>(out.size() - start - 4));
+	std::memcpy(out.data() + start, size.data(), 4);
+}
+
+bool readBinaryRecord(ByteCursor& in, BinaryRecord& record)
+{
+	const uint32_t recordSize = in.u32();
+	if (!in.ok || recordSize > in.data.size() - in.pos) {
+		return false;
+	}
+	const size_t end = in.pos + recordSize;
+	// What the record has left: counts are checked against it, so a corrupt
+	// one cannot make the loops below run (and allocate) far past its end
+	auto left = [&]() { return in.pos <= end ? end - in.pos : 0; };
+	record.path = in.sized();
+	const uint64_t flags = in.unsignedOf(1);
+	record.binary = (flags & 1) != 0;
+	record.namesOnly = (flags & 2) != 0;
+	record.lines.clear();
+	record.spans.clear();
+	record.lineSizes.clear();
+	const uint32_t lineCount = in.u32();
+	if (lineCount > left() / (8 + 8 + 4 + 8 + 4)) {
+		return false;
+	}
+	for (uint32_t l = 0; l < lineCount && in.ok; ++l) {
+		LineMatch m;
+		m.lineNumber = static_cast<size_t>(in.u64());
+		m.offset = in.u64();
+		m.firstSpan = record.spans.size();
+		m.spanCount = in.u32();
+		if (m.spanCount > left() / (4 + 4 + 4)) {
+			return false;
+		}
+		for (size_t s = 0; s < m.spanCount && in.ok; ++s) {
+			MatchSpan span;
+			span.offset = in.u32();
+			span.length = in.u32();
+			span.pattern = in.u32();
+			record.spans.push_back(span);
+		}
+		const uint64_t lineSize = in.u64();
+		m.line = in.sized();
+		if (lineSize < m.line.size()) {
+			return false;
+		}
+		// Spans must lie within the text they mark, which is printed from them
+		for (size_t s = m.firstSpan; !record.binary && s < record.spans.size(); ++s) {
+			const MatchSpan& span = record.spans[s];
+			if (span.offset > m.line.size() || span.length > m.line.size() - span.offset) {
+				return false;
+			}
+		}
+		record.lines.push_back(m);
+		record.lineSizes.push_back(lineSize);
+	}
+	return in.ok && in.pos == end;
+}
@@ -0,0 +1,120 @@
+#ifndef STRUCTURED_OUTPUT_H
+#define STRUCTURED_OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "result_writer.h"
+#include "scanner.h"
+
+/**
+ * @brief Result layouts: the human-readable text file, or one of the
+ *        machine-readable streams written by StructuredResultHandler.
+ */
+enum class OutputFormat {
+    Text,       // search_results.txt layout (text_output.h)
+    JsonLines,  // one JSON object per matching line
+    Nul,        // NUL-terminated fields
+    Binary      // length-prefixed little-endian records
+};
+
+/**
+ * @brief Writes results for downstream tools: every match carries its file,
+ *        line number, byte offset of the line in the file and the match spans,
+ *        with the line's raw bytes (no ANSI, no escaping beyond what the
+ *        format needs, and no truncation unless 'maxLineBytes' is set).
+ *
+ * JsonLines, one object per line:
+ *     {"file":"a/b.txt","line":3,"offset":120,"text":"...","spans":[[4,6],[20,6]]}
+ *   A span is [offset in the line, length], with the pattern index as a third
+ *   element when several patterns are searched. Paths or lines that are not
+ *   valid UTF-8 are given as "file_base64" / "text_base64". A cut line has
+ *   "truncated":true. A binary file gives {"file":...,"binary":true}, and
+ *   -l {"file":...}.
+ *
+ * Nul, six NUL-terminated fields per matching line:
+ *     path \0 line \0 offset \0 spans \0 length \0 text \0
+ *   with spans as "offset+length" (plus "/pattern" for several patterns),
+ *   comma-separated, and length the size of the whole line: more than the
+ *   text's if it was cut. A binary file has the field "binary" in place of
+ *   the spans, length 0 and an empty text; -l writes "path\0" only.
+ *
+ * Binary, one record per matching file (integers little-endian):
+ *     u32 recordSize  u32 pathSize path  u8 flags (1 binary, 2 names only)
+ *     u32 lineCount  lineCount x { u64 line, u64 offset, u32 spanCount,
+ *         spanCount x { u32 offset, u32 length, u32 pattern },
+ *         u64 length, u32 size, text }
+ *   where recordSize counts the bytes after itself and length is the size
+ *   of the whole line, more than the text's if it was cut (0 in a binary
+ *   file).
+ *
+ * In a cut line, a span is cut at the end of the text, and one that starts
+ * beyond it is left out.
+ *
+ * Each worker formats into its own ResultBuffer, as TextResultHandler does,
+ * so records of one file are never interleaved with another's.
+ */
+class StructuredResultHandler final : public ScanHandler {
+public:
+    /**
+     * @param multiplePatterns Report the pattern index of each span (-f with several patterns)
+     * @param maxLineBytes Cut lines to this many bytes; 0 = full lines
+     */
+    StructuredResultHandler(ResultWriter& writer, OutputFormat format, bool namesOnly = false,
+                            bool multiplePatterns = false, size_t maxLineBytes = 0);
+
+    void onStart(unsigned numWorkers) override;
+    void onFileMatches(const FileMatches& file, unsigned worker) override;
+    void onWorkerDone(unsigned worker) override;
+
+private:
+    void appendJson(std::string& out, const FileMatches& file, const std::string& path) const;
+    void appendNul(std::string& out, const FileMatches& file, const std::string& path) const;
+    void appendBinary(std::string& out, const FileMatches& file, const std::string& path) const;
+
+    ResultWriter& writer_;
+    OutputFormat format_;
+    bool namesOnly_;
+    bool multiplePatterns_;
+    size_t maxLineBytes_;
+    std::vector<std::unique_ptr<ResultBuffer>> buffers_; // one per worker
+
+    struct alignas(64) Scratch {
+        std::string text;                 // path conversion where paths are not narrow
+    };
+    std::vector<Scratch> pathScratch_;   // one per worker
+};
+
+/**
+ * @brief Appends one Binary record (layout above) for 'file' to 'out'.
+ */
+void appendBinaryRecord(std::string& out, const FileMatches& file, std::string_view path, bool namesOnly,
+                        size_t maxLineBytes = 0);
+
+/**
+ * @brief One Binary record read back by readBinaryRecord(). 'path' and the
+ *        lines point into the buffer it was read from.
+ */
+struct BinaryRecord {
+    std::string_view path;
+    bool binary = false;
+    bool namesOnly = false;
+    std::vector<LineMatch> lines;
+    std::vector<MatchSpan> spans;
+    std::vector<uint64_t> lineSizes;        // of each whole line, before any cut
+};
+
+struct ByteCursor;
+
+/**
+ * @brief Reads the next record from 'in' into 'record' (reusing its vectors).
+ * @return false if the data ends early, the record's size does not add up,
+ *         a count is more than the rest of the record can hold, or a span of
+ *         a text line reaches past the line.
+ */
+bool readBinaryRecord(ByteCursor& in, BinaryRecord& record);
+
+#endif // STRUCTURED_OUTPUT_H
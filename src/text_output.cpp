@@ -0,0 +1,187 @@
+#include "text_output.h"
+
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <span>
+#include <string_view>
+
+namespace {
+
+// How each byte of a matched line is written: printable ASCII (excluding
+// DEL = 127) and tab as-is, everything else as \x?? with two hex digits.
+struct EscapeTable {
+	char text[256][4];
+	unsigned char size[256];
+
+	constexpr EscapeTable() : text{}, size{}
+	{
+		constexpr char hex[] = "0123456789abcdef";
+		for (int c = 0; c < 256; ++c) {
+			if ((c >= 32 && c < 127) || c == '\t') {
+				text[c][0] = static_cast<char>(c);
+				size[c] = 1;
+			}
+			else {
+				text[c][0] = '\\';
+				text[c][1] = 'x';
+				text[c][2] = hex[c >> 4];
+				text[c][3] = hex[c & 15];
+				size[c] = 4;
+			}
+		}
+	}
+};
+
+constexpr EscapeTable kEscapes;
+
+constexpr std::string_view kHighlightOn = "\033[31m";
+constexpr std::string_view kHighlightOff = "\033[0m";
+
+// Appends 'text' with unprintable bytes escaped; runs of printable bytes are
+// copied with one append.
+void appendEscaped(std::string& out, std::string_view text)
+{
+	size_t run = 0;
+	for (size_t i = 0; i < text.size(); ++i) {
+		const unsigned char c = static_cast<unsigned char>(text[i]);
+		if (kEscapes.size[c] != 1) {
+			out.append(text.data() + run, i - run);
+			out.append(kEscapes.text[c], kEscapes.size[c]);
+			run = i + 1;
+		}
+	}
+	out.append(text.data() + run, text.size() - run);
+}
+
+void appendNumber(std::string& out, size_t value)
+{
+	char digits[24];
+	auto result = std::to_chars(digits, digits + sizeof(digits), value);
+	out.append(digits, result.ptr);
+}
+
+/**
+ * @brief Appends a line truncated around its first match, with every match in
+ *        that window highlighted and unprintable bytes escaped.
+ * @param line The line of text to process
+ * @param spans Where the matches lie in 'line', in order (from the matcher)
+ * @param maxContext Maximum number of characters to include around the match
+ */
+void appendSnippet(std::string& out, std::string_view line, std::span<const MatchSpan> spans, size_t maxContext)
+{
+	if (spans.empty()) {
+		// Nothing to highlight: just truncate the line if it's very long
+		if (line.size() > maxContext) {
+			appendEscaped(out, line.substr(0, maxContext));
+			out.append("...(truncated)");
+		}
+		else {
+			appendEscaped(out, line);
+		}
+		return;
+	}
+
+	// Include up to maxContext/2 characters on either side of the first
+	// match, or up to the line boundaries.
+	const size_t contextRadius = maxContext / 2;
+	const MatchSpan& first = spans.front();
+	const size_t start = (first.offset > contextRadius) ? first.offset - contextRadius : 0;
+	const size_t end = std::min(first.offset + first.length + contextRadius, line.size());
+
+	if (start > 0) {
+		out.append("... ");
+	}
+	size_t pos = start;
+	for (const MatchSpan& span : spans) {
+		if (span.offset >= end) {
+			break;
+		}
+		if (span.length == 0) {
+			continue; // an empty match has nothing to highlight
+		}
+		const size_t spanEnd = std::min(span.offset + span.length, end);
+		appendEscaped(out, line.substr(pos, span.offset - pos));
+		out.append(kHighlightOn);
+		appendEscaped(out, line.substr(span.offset, spanEnd - span.offset));
+		out.append(kHighlightOff);
+		pos = spanEnd;
+	}
+	appendEscaped(out, line.substr(pos, end - pos));
+	if (end < line.size()) {
+		out.append(" ...");
+	}
+}
+
+} // namespace
+
+TextResultHandler::TextResultHandler(ResultWriter& writer, bool namesOnly, std::vector<std::string> patterns)
+	: writer_(writer), namesOnly_(namesOnly), patterns_(std::move(patterns))
+{
+}
+
+void TextResultHandler::onStart(unsigned numWorkers)
+{
+	buffers_.clear();
+	for (unsigned i = 0; i < numWorkers; ++i) {
+		buffers_.push_back(std::make_unique<ResultBuffer>(writer_));
+	}
+	pathScratch_.assign(numWorkers, Scratch{});
+}
+
+void TextResultHandler::onFileMatches(const FileMatches& file, unsigned worker)
+{
+	// Format straight into this thread's output buffer; the writer thread takes
+	// it once it is full. Nothing here allocates once the buffer has grown.
+	ResultBuffer& output = *buffers_[worker];
+	const std::string& pathStr = pathBytes(file.path, pathScratch_[worker].text);
+	std::string& block = output.data();
+	if (namesOnly_) {
+		block.append(pathStr).append("\n");
+		output.endFile(pathStr);
+		return;
+	}
+	if (file.binary) {
+		// Its "lines" are arbitrary bytes, not worth printing
+		block.append("Binary file matches: ").append(pathStr).append("\n\n");
+		output.endFile(pathStr);
+		return;
+	}
+	block.append("Matches in file: ").append(pathStr).append(" (");
+	appendNumber(block, file.lines.size());
+	block.append(" hits)\n");
+	for (const auto& m : file.lines) {
+		// A 180-char window around the match
+		const auto spans = file.spansOf(m);
+		block.append("    Line ");
+		appendNumber(block, m.lineNumber);
+		if (patterns_.size() > 1) {
+			// Each pattern found in the line, once, in order of first appearance
+			block.append(" [");
+			bool first = true;
+			for (size_t s = 0; s < spans.size(); ++s) {
+				const size_t pattern = spans[s].pattern;
+				auto seen = [&](const MatchSpan& earlier) { return earlier.pattern == pattern; };
+				if (pattern >= patterns_.size() || std::any_of(spans.begin(), spans.begin() + s, seen)) {
+					continue;
+				}
+				if (!first) {
+					block.append(", ");
+				}
+				appendEscaped(block, patterns_[pattern]);
+				first = false;
+			}
+			block.append("]");
+		}
+		block.append(": ");
+		appendSnippet(block, m.line, spans, 180);
+		block.append("\n");
+	}
+	block.append("\n"); // extra blank line
+	output.endFile(pathStr);
+}
+
+void TextResultHandler::onWorkerDone(unsigned worker)
+{
+	buffers_[worker]->flush();
+}
@@ -0,0 +1,42 @@
+#ifndef TEXT_OUTPUT_H
+#define TEXT_OUTPUT_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "result_writer.h"
+#include "scanner.h"
+
+/**
+ * @brief Formats results in the search_results.txt layout:
+ *
+ *     Matches in file: /path/to/file (N hits)
+ *         Line X: [Truncated line, matches highlighted]
+ *
+ * ("Binary file matches: /path/to/file" for binary files; with several
+ * 'patterns', "Line X [pattern, ...]:" names the ones found in the line),
+ * or, with 'namesOnly' (-l), just one matching file path per line.
+ * Each worker formats into its own ResultBuffer, handed to 'writer' when full.
+ */
+class TextResultHandler final : public ScanHandler {
+public:
+    explicit TextResultHandler(ResultWriter& writer, bool namesOnly = false,
+                               std::vector<std::string> patterns = {});
+
+    void onStart(unsigned numWorkers) override;
+    void onFileMatches(const FileMatches& file, unsigned worker) override;
+    void onWorkerDone(unsigned worker) override;
+
+private:
+    ResultWriter& writer_;
+    bool namesOnly_;
+    std::vector<std::string> patterns_;
+    std::vector<std::unique_ptr<ResultBuffer>> buffers_; // one per worker
+
+    struct alignas(64) Scratch {
+        std::string text;                 // path conversion where paths are not narrow
+    };
+    std::vector<Scratch> pathScratch_;   // one per worker
+};
+
+#endif // TEXT_OUTPUT_H
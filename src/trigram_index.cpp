@@ -0,0 +1,804 @@
+#include "trigram_index.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+#include <thread>
+#include "byte_codec.h"
+#include "decompress.h"
+#include "parallel_walker.h"
+
+namespace {
+
+// File layout (all integers little-endian):
+//   magic[8]  u32 fileCount  u32 trigramCount  u32 rootLength  root (UTF-8)
+//   fileCount   x { u64 size, i64 mtime, u32 pathLength, path (UTF-8, '/') }
+//   trigramCount x { u32 trigram, u32 postingCount, u64 postingOffset }
+//   u64 postingsLength  postings (per trigram: varint deltas of file ids)
+constexpr char kMagic[8] = { 'D', 'S', 'T', 'R', 'I', 'G', 'R', '1' };
+constexpr uint32_t kTrigramSpace = 1u << 24;
+
+std::string utf8Of(const std::filesystem::path& path)
+{
+	auto u8 = path.u8string();
+	return std::string(reinterpret_cast<const char*>(u8.data()), u8.size());
+}
+
+std::filesystem::path pathOfUtf8(std::string_view bytes)
+{
+	return std::filesystem::path(std::u8string(reinterpret_cast<const char8_t*>(bytes.data()), bytes.size()));
+}
+
+int64_t mtimeOf(const std::filesystem::directory_entry& entry, std::error_code& ec)
+{
+	return static_cast<int64_t>(entry.last_write_time(ec).time_since_epoch().count());
+}
+
+bool isSameFile(const std::filesystem::directory_entry& entry, const std::filesystem::path& canonical)
+{
+	if (entry.path().filename() != canonical.filename()) {
+		return false;
+	}
+	std::error_code ec;
+	return std::filesystem::weakly_canonical(entry.path(), ec) == canonical && !ec;
+}
+
+struct IndexedFile {
+	std::filesystem::path path;
+	std::string relative;
+	uint64_t size;
+	int64_t mtime;
+};
+
+// Collects every file (with the metadata the index is keyed on) per walker thread.
+class CollectingVisitor final : public WalkVisitor {
+public:
+	CollectingVisitor(size_t rootLength, const std::filesystem::path& indexPath, unsigned numWalkers)
+		: rootLength_(rootLength), indexPath_(indexPath), files_(numWalkers) {}
+
+	void onFile(const std::filesystem::directory_entry& entry, unsigned worker) override
+	{
+		if (isSameFile(entry, indexPath_)) {
+			return;
+		}
+		std::error_code ec;
+		uint64_t size = entry.file_size(ec);
+		int64_t mtime = ec ? 0 : mtimeOf(entry, ec);
+		if (ec) {
+			return; // not indexed, so always scanned
+		}
+		std::string relative = withRelativePath(entry.path(), rootLength_,
+			[](std::string_view r) { return std::string(r); });
+		files_[worker].push_back(IndexedFile{ entry.path(), std::move(relative), size, mtime });
+	}
+
+	void onError(const std::string&) override {}
+
+	std::vector<IndexedFile> takeAll()
+	{
+		std::vector<IndexedFile> all;
+		for (auto& list : files_) {
+			std::move(list.begin(), list.end(), std::back_inserter(all));
+		}
+		return all;
+	}
+
+private:
+	size_t rootLength_;
+	const std::filesystem::path& indexPath_;
+	std::vector<std::vector<IndexedFile>> files_;
+};
+
+// Appends the distinct trigrams of 'data' that do not span a newline to 'out'.
+// 'seen' is a 2^24-bit scratch set, all clear on entry and on return.
+void collectTrigrams(std::string_view data, std::vector<uint64_t>& seen, std::vector<uint32_t>& out)
+{
+	out.clear();
+	uint32_t trigram = 0;
+	size_t run = 0;
+	for (char ch : data) {
+		if (ch == '\n') {
+			run = 0;
+			continue;
+		}
+		trigram = ((trigram << 8) | static_cast<unsigned char>(ch)) & (kTrigramSpace - 1);
+		if (++run >= 3) {
+			uint64_t& word = seen[trigram >> 6];
+			const uint64_t bit = uint64_t{ 1 } << (trigram & 63);
+			if ((word & bit) == 0) {
+				word |= bit;
+				out.push_back(trigram);
+			}
+		}
+	}
+	for (uint32_t t : out) {
+		seen[t >> 6] = 0;
+	}
+}
+
+std::vector<uint32_t> intersectSorted(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+{
+	std::vector<uint32_t> out;
+	std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out));
+	return out;
+}
+
+std::vector<uint32_t> unionSorted(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+{
+	std::vector<uint32_t> out;
+	std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out));
+	return out;
+}
+
+TrigramQuery allOf(std::vector<TrigramQuery> parts)
+{
+	TrigramQuery q;
+	for (auto& part : parts) {
+		if (part.kind == TrigramQuery::Kind::And) {
+			std::move(part.children.begin(), part.children.end(), std::back_inserter(q.children));
+		}
+		else if (!part.isAll()) {
+			q.children.push_back(std::move(part));
+		}
+	}
+	if (q.children.size() == 1) {
+		return std::move(q.children.front());
+	}
+	q.kind = q.children.empty() ? TrigramQuery::Kind::All : TrigramQuery::Kind::And;
+	return q;
+}
+
+TrigramQuery anyOf(std::vector<TrigramQuery> branches)
+{
+	for (const auto& branch : branches) {
+		if (branch.isAll()) {
+			return TrigramQuery{};
+		}
+	}
+	if (branches.size() == 1) {
+		return std::move(branches.front());
+	}
+	TrigramQuery q;
+	q.kind = TrigramQuery::Kind::Or;
+	q.children = std::move(branches);
+	return q;
+}
+
+/**
+ * @brief Reduces a regex to the literal runs every match must contain.
+ *        Any construct it cannot reason about safely makes the whole
+ *        result All, so the reduction never rejects a matching file.
+ */
+class RegexReducer {
+public:
+	RegexReducer(std::string_view pattern, bool ignoreCase)
+		: p_(pattern), folding_(ignoreCase ? CaseFolding::Unicode : CaseFolding::None) {}
+
+	TrigramQuery reduce()
+	{
+		TrigramQuery q = alternation();
+		if (failed_ || pos_ != p_.size()) {
+			return TrigramQuery{};
+		}
+		return q;
+	}
+
+private:
+	enum class Repeat { Once, Optional, OneOrMore };
+
+	bool at(char c) const { return pos_ < p_.size() && p_[pos_] == c; }
+
+	TrigramQuery alternation()
+	{
+		std::vector<TrigramQuery> branches;
+		branches.push_back(concatenation());
+		while (!failed_ && at('|')) {
+			++pos_;
+			branches.push_back(concatenation());
+		}
+		return anyOf(std::move(branches));
+	}
+
+	TrigramQuery concatenation()
+	{
+		std::vector<TrigramQuery> parts;
+		std::string run;
+		auto flush = [&]() {
+			parts.push_back(TrigramQuery::fromLiteral(run, folding_));
+			run.clear();
+		};
+		while (!failed_ && pos_ < p_.size() && !at('|') && !at(')')) {
+			if (at('(')) {
+				flush();
+				TrigramQuery group = groupAtom();
+				if (quantifier() != Repeat::Optional) {
+					parts.push_back(std::move(group));
+				}
+				continue;
+			}
+			int literal = atom();
+			Repeat repeat = quantifier();
+			if (literal < 0 || repeat == Repeat::Optional) {
+				flush();
+				continue;
+			}
+			run.push_back(static_cast<char>(literal));
+			if (repeat == Repeat::OneOrMore) {
+				// "ab+c": "ab" and "bc" are both required, "abc" is not.
+				flush();
+				run.push_back(static_cast<char>(literal));
+			}
+		}
+		flush();
+		return allOf(std::move(parts));
+	}
+
+	TrigramQuery groupAtom()
+	{
+		++pos_; // '('
+		if (at('?')) {
+			std::string_view rest = p_.substr(pos_);
+			if (rest.rfind("?:", 0) == 0) {
+				pos_ += 2;
+			}
+			else if (isNamedGroup(rest)) {
+				size_t close = p_.find('>', pos_);
+				if (close == std::string_view::npos) {
+					failed_ = true;
+					return TrigramQuery{};
+				}
+				pos_ = close + 1;
+			}
+			else {
+				failed_ = true; // inline flags, lookaround, comments...
+				return TrigramQuery{};
+			}
+		}
+		TrigramQuery inner = alternation();
+		if (!at(')')) {
+			failed_ = true;
+			return TrigramQuery{};
+		}
+		++pos_;
+		return inner;
+	}
+
+	// "?P<name>" or "?<name>", but not the lookbehinds "?<=" and "?<!".
+	static bool isNamedGroup(std::string_view rest)
+	{
+		size_t nameAt = rest.rfind("?P<", 0) == 0 ? 3 : rest.rfind("?<", 0) == 0 ? 2 : 0;
+		return nameAt != 0 && rest.size() > nameAt && rest[nameAt] != '=' && rest[nameAt] != '!';
+	}
+
+	// Consumes one atom; returns its byte if it is a literal character, else -1.
+	int atom()
+	{
+		const char c = p_[pos_++];
+		switch (c) {
+		case '\\':
+			return escape();
+		case '[':
+			skipClass();
+			return -1;
+		case '.': case '^': case '$': case '{':
+			return -1;
+		case '*': case '+': case '?':
+			failed_ = true;
+			return -1;
+		default:
+			return static_cast<unsigned char>(c);
+		}
+	}
+
+	int escape()
+	{
+		if (pos_ >= p_.size()) {
+			failed_ = true;
+			return -1;
+		}
+		const char e = p_[pos_++];
+		if (!std::isalnum(static_cast<unsigned char>(e))) {
+			return static_cast<unsigned char>(e);
+		}
+		if (std::strchr("dDwWsSbBAzZGnrtfvaehHRNK", e) != nullptr) {
+			return -1;
+		}
+		if (std::isdigit(static_cast<unsigned char>(e))) {
+			while (pos_ < p_.size() && std::isdigit(static_cast<unsigned char>(p_[pos_]))) {
+				++pos_; // backreference or octal
+			}
+			return -1;
+		}
+		if (e == 'x' || e == 'p' || e == 'P') {
+			if (at('{')) {
+				size_t close = p_.find('}', pos_);
+				if (close == std::string_view::npos) {
+					failed_ = true;
+					return -1;
+				}
+				pos_ = close + 1;
+			}
+			else {
+				size_t width = e == 'x' ? 2 : 1;
+				while (width-- > 0 && pos_ < p_.size()
+					&& (e != 'x' || std::isxdigit(static_cast<unsigned char>(p_[pos_])))) {
+					++pos_;
+				}
+			}
+			return -1;
+		}
+		if (e == 'c' && pos_ < p_.size()) {
+			++pos_;
+			return -1;
+		}
+		failed_ = true; // \Q...\E and anything else we do not model
+		return -1;
+	}
+
+	void skipClass()
+	{
+		if (at('^')) {
+			++pos_;
+		}
+		if (at(']')) {
+			++pos_;
+		}
+		while (pos_ < p_.size() && !at(']')) {
+			if (at('\\')) {
+				pos_ += 2;
+			}
+			else if (p_.substr(pos_, 2) == "[:") {
+				size_t close = p_.find(":]", pos_ + 2);
+				pos_ = close == std::string_view::npos ? p_.size() : close + 2;
+			}
+			else {
+				++pos_;
+			}
+		}
+		if (pos_ >= p_.size()) {
+			failed_ = true;
+			return;
+		}
+		++pos_; // ']'
+	}
+
+	Repeat quantifier()
+	{
+		Repeat repeat = Repeat::Once;
+		if (at('?') || at('*')) {
+			++pos_;
+			repeat = Repeat::Optional;
+		}
+		else if (at('+')) {
+			++pos_;
+			repeat = Repeat::OneOrMore;
+		}
+		else if (at('{')) {
+			size_t i = pos_ + 1;
+			size_t min = 0;
+			bool digits = false;
+			while (i < p_.size() && std::isdigit(static_cast<unsigned char>(p_[i]))) {
+				min = std::min<size_t>(min * 10 + static_cast<size_t>(p_[i] - '0'), 1000);
+				digits = true;
+				++i;
+			}
+			size_t close = p_.find('}', i);
+			if (!digits || close == std::string_view::npos) {
+				return Repeat::Once; // a literal '{', left for atom()
+			}
+			pos_ = close + 1;
+			repeat = min == 0 ? Repeat::Optional : Repeat::OneOrMore;
+		}
+		else {
+			return Repeat::Once;
+		}
+		if (at('?') || at('+')) {
+			++pos_; // lazy or possessive
+		}
+		return repeat;
+	}
+
+	std::string_view p_;
+	CaseFolding folding_;
+	size_t pos_ = 0;
+	bool failed_ = false;
+};
+
+} // namespace
+
+TrigramQuery TrigramQuery::fromLiteral(std::string_view needle, CaseFolding folding)
+{
+	// Runs of bytes a match must contain, each known exactly or up to ASCII
+	// case; a code point whose case forms differ otherwise ends the run
+	struct Byte {
+		unsigned char value;
+		bool bothCases;
+	};
+	auto isLetter = [](uint32_t c) { return c < 0x80 && (c | 0x20) >= 'a' && (c | 0x20) <= 'z'; };
+	std::vector<std::vector<Byte>> runs(1);
+	for (size_t pos = 0; pos < needle.size();) {
+		const size_t begin = pos;
+		bool known = true;
+		bool bothCases = false;
+		if (folding == CaseFolding::Unicode) {
+			const uint32_t codePoint = decodeUtf8(needle, pos);
+			uint32_t forms[kMaxCaseForms];
+			const size_t count = caseForms(codePoint, forms);
+			bothCases = count == 2 && isLetter(codePoint) && isLetter(forms[1]);
+			known = (codePoint & kInvalidUtf8) == 0 && (count == 1 || bothCases);
+		}
+		else {
+			bothCases = folding == CaseFolding::Ascii && isLetter(static_cast<unsigned char>(needle[pos]));
+			++pos;
+		}
+		if (!known) {
+			if (!runs.back().empty()) {
+				runs.emplace_back();
+			}
+			continue;
+		}
+		for (size_t i = begin; i < pos; ++i) {
+			runs.back().push_back(Byte{ static_cast<unsigned char>(needle[i]), bothCases });
+		}
+	}
+
+	// Each window of three bytes, as the sorted list of its spellings
+	std::vector<std::vector<uint32_t>> windows;
+	for (const auto& run : runs) {
+		for (size_t i = 0; i + 3 <= run.size(); ++i) {
+			std::vector<uint32_t> spellings{ 0 };
+			for (size_t k = i; k < i + 3; ++k) {
+				std::vector<uint32_t> longer;
+				for (uint32_t prefix : spellings) {
+					longer.push_back((prefix << 8) | run[k].value);
+					if (run[k].bothCases) {
+						longer.push_back((prefix << 8) | (run[k].value ^ 0x20u));
+					}
+				}
+				spellings = std::move(longer);
+			}
+			std::sort(spellings.begin(), spellings.end());
+			windows.push_back(std::move(spellings));
+		}
+	}
+	std::sort(windows.begin(), windows.end());
+	windows.erase(std::unique(windows.begin(), windows.end()), windows.end());
+
+	std::vector<TrigramQuery> parts;
+	for (const auto& spellings : windows) {
+		std::vector<TrigramQuery> alternatives;
+		for (uint32_t t : spellings) {
+			TrigramQuery q;
+			q.kind = Kind::Trigram;
+			q.trigram = t;
+			alternatives.push_back(q);
+		}
+		parts.push_back(anyOf(std::move(alternatives)));
+	}
+	return allOf(std::move(parts));
+}
+
+TrigramQuery TrigramQuery::fromRegex(std::string_view pattern, bool ignoreCase)
+{
+	return RegexReducer(pattern, ignoreCase).reduce();
+}
+
+bool TrigramIndex::build(const std::filesystem::path& root,
+	const std::filesystem::path& indexPath,
+	unsigned numThreads,
+	BuildStats& stats,
+	std::string& error)
+{
+	numThreads = std::max(1u, numThreads);
+	std::error_code ec;
+	const std::filesystem::path canonicalIndex = std::filesystem::weakly_canonical(indexPath, ec);
+	const std::filesystem::path canonicalRoot = std::filesystem::weakly_canonical(root, ec);
+	if (ec) {
+		error = "Cannot resolve " + root.string() + " - " + ec.message();
+		return false;
+	}
+
+	// 1. Enumerate the tree with the same walker the scanner uses
+	std::vector<IndexedFile> files;
+	{
+		ParallelWalker walker(numThreads);
+		CollectingVisitor visitor(rootPathLength(root), canonicalIndex, numThreads);
+		walker.walk(root, visitor);
+		files = visitor.takeAll();
+	}
+	std::sort(files.begin(), files.end(),
+		[](const IndexedFile& a, const IndexedFile& b) { return a.relative < b.relative; });
+
+	// 2. Extract trigrams in parallel; each thread keeps its own posting lists
+	using Postings = std::unordered_map<uint32_t, std::vector<uint32_t>>;
+	std::vector<Postings> partial(numThreads);
+	std::vector<char> readable(files.size(), 0);
+	std::atomic<size_t> next{ 0 };
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < numThreads; ++t) {
+		threads.emplace_back([&, t]() {
+			FileReader reader;
+			FileBuffer inflated;
+			std::vector<uint64_t> seen(kTrigramSpace / 64, 0);
+			std::vector<uint32_t> trigrams;
+			std::vector<uint32_t> inflatedTrigrams;
+			std::string readError;
+			for (size_t id; (id = next.fetch_add(1, std::memory_order_relaxed)) < files.size();) {
+				if (!reader.open(files[id].path, readError)) {
+					continue;
+				}
+				const std::string_view contents = reader.contents();
+				collectTrigrams(contents, seen, trigrams);
+				// The scanner searches compressed files decompressed (raw with
+				// --no-decompress), so they are indexed by both; one it cannot
+				// decompress stays out of the index and is scanned to report why
+				if (const Compression kind = detectCompression(contents); canDecompress(kind)) {
+					if (!decompress(kind, contents, inflated, DecompressStage::kDefaultLimit, readError)) {
+						continue;
+					}
+					collectTrigrams(inflated.view(), seen, inflatedTrigrams);
+					trigrams.insert(trigrams.end(), inflatedTrigrams.begin(), inflatedTrigrams.end());
+					std::sort(trigrams.begin(), trigrams.end());
+					trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+				}
+				readable[id] = 1;
+				for (uint32_t trigram : trigrams) {
+					partial[t][trigram].push_back(static_cast<uint32_t>(id));
+				}
+			}
+			});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	// 3. Number the readable files densely; unreadable ones stay out of the
+	//    index so they are always scanned
+	std::vector<uint32_t> finalId(files.size(), 0);
+	std::string out(kMagic, sizeof(kMagic));
+	std::string fileTable;
+	uint32_t fileCount = 0;
+	for (size_t id = 0; id < files.size(); ++id) {
+		if (!readable[id]) {
+			continue;
+		}
+		finalId[id] = fileCount++;
+		putU64(fileTable, files[id].size);
+		putU64(fileTable, static_cast<uint64_t>(files[id].mtime));
+		putU32(fileTable, static_cast<uint32_t>(files[id].relative.size()));
+		fileTable += files[id].relative;
+		stats.bytes += files[id].size;
+	}
+
+	Postings& merged = partial[0];
+	for (unsigned t = 1; t < numThreads; ++t) {
+		for (auto& [trigram, ids] : partial[t]) {
+			auto& target = merged[trigram];
+			target.insert(target.end(), ids.begin(), ids.end());
+		}
+		Postings().swap(partial[t]);
+	}
+	std::vector<uint32_t> keys;
+	keys.reserve(merged.size());
+	for (const auto& kv : merged) {
+		keys.push_back(kv.first);
+	}
+	std::sort(keys.begin(), keys.end());
+
+	std::string trigramTable;
+	std::string postings;
+	for (uint32_t trigram : keys) {
+		std::vector<uint32_t>& ids = merged[trigram];
+		for (auto& id : ids) {
+			id = finalId[id];
+		}
+		std::sort(ids.begin(), ids.end());
+		putU32(trigramTable, trigram);
+		putU32(trigramTable, static_cast<uint32_t>(ids.size()));
+		putU64(trigramTable, postings.size());
+		uint32_t previous = 0;
+		for (uint32_t id : ids) {
+			putVarint(postings, id - previous);
+			previous = id;
+		}
+		std::vector<uint32_t>().swap(ids);
+	}
+
+	const std::string rootBytes = utf8Of(canonicalRoot);
+	putU32(out, fileCount);
+	putU32(out, static_cast<uint32_t>(keys.size()));
+	putU32(out, static_cast<uint32_t>(rootBytes.size()));
+	out += rootBytes;
+	out += fileTable;
+	out += trigramTable;
+	putU64(out, postings.size());
+	out += postings;
+
+	// 4. Write next to the target and rename, so readers never see a partial index
+	std::filesystem::path tmpPath = indexPath;
+	tmpPath += ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!file.write(out.data(), static_cast<std::streamsize>(out.size()))) {
+			error = "Could not write index " + tmpPath.string();
+			return false;
+		}
+	}
+	std::filesystem::rename(tmpPath, indexPath, ec);
+	if (ec) {
+		error = "Could not write index " + indexPath.string() + " - " + ec.message();
+		std::filesystem::remove(tmpPath, ec);
+		return false;
+	}
+
+	stats.files = fileCount;
+	stats.trigrams = keys.size();
+	return true;
+}
+
+std::unique_ptr<TrigramIndex> TrigramIndex::load(const std::filesystem::path& indexPath, std::string& error)
+{
+	std::unique_ptr<TrigramIndex> index(new TrigramIndex());
+	if (!index->reader_.open(indexPath, error)) {
+		return nullptr;
+	}
+	std::error_code ec;
+	index->indexPath_ = std::filesystem::weakly_canonical(indexPath, ec);
+
+	ByteCursor in{ index->reader_.contents() };
+	if (in.bytes(sizeof(kMagic)) != std::string_view(kMagic, sizeof(kMagic))) {
+		error = "Not a dirscan index: " + indexPath.string();
+		return nullptr;
+	}
+	const uint32_t fileCount = in.u32();
+	const uint32_t trigramCount = in.u32();
+	index->root_ = pathOfUtf8(in.sized());
+
+	index->files_.reserve(fileCount);
+	index->ids_.reserve(fileCount);
+	for (uint32_t id = 0; id < fileCount && in.ok; ++id) {
+		FileRecord record;
+		record.size = in.u64();
+		record.mtime = static_cast<int64_t>(in.u64());
+		index->files_.push_back(record);
+		index->ids_.emplace(in.sized(), id);
+	}
+
+	index->trigrams_.reserve(trigramCount);
+	for (uint32_t i = 0; i < trigramCount && in.ok; ++i) {
+		TrigramEntry entry;
+		entry.trigram = in.u32();
+		entry.count = in.u32();
+		entry.offset = in.u64();
+		if (!index->trigrams_.empty() && index->trigrams_.back().trigram >= entry.trigram) {
+			in.ok = false;
+		}
+		index->trigrams_.push_back(entry);
+	}
+	index->postings_ = in.bytes(in.u64());
+	for (const auto& entry : index->trigrams_) {
+		if (entry.offset > index->postings_.size() || entry.count > fileCount) {
+			in.ok = false;
+		}
+	}
+
+	if (!in.atEnd()) {
+		error = "Index file is corrupt: " + indexPath.string();
+		return nullptr;
+	}
+	return index;
+}
+
+std::vector<uint32_t> TrigramIndex::postingList(uint32_t trigram) const
+{
+	auto it = std::lower_bound(trigrams_.begin(), trigrams_.end(), trigram,
+		[](const TrigramEntry& e, uint32_t t) { return e.trigram < t; });
+	std::vector<uint32_t> ids;
+	if (it == trigrams_.end() || it->trigram != trigram) {
+		return ids;
+	}
+	ids.reserve(it->count);
+	size_t pos = static_cast<size_t>(it->offset);
+	uint32_t id = 0;
+	for (uint32_t i = 0; i < it->count; ++i) {
+		uint32_t delta = 0;
+		for (int shift = 0; pos < postings_.size() && shift < 35; shift += 7) {
+			const auto byte = static_cast<unsigned char>(postings_[pos++]);
+			delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0) {
+				break;
+			}
+		}
+		id += delta;
+		if (id >= files_.size()) {
+			break; // corrupt tail; the ids so far are still sorted
+		}
+		ids.push_back(id);
+	}
+	return ids;
+}
+
+std::vector<uint32_t> TrigramIndex::evaluate(const TrigramQuery& query, bool& all) const
+{
+	all = false;
+	switch (query.kind) {
+	case TrigramQuery::Kind::All:
+		all = true;
+		return {};
+	case TrigramQuery::Kind::Trigram:
+		return postingList(query.trigram);
+	case TrigramQuery::Kind::And: {
+		std::vector<uint32_t> result;
+		bool constrained = false;
+		for (const auto& child : query.children) {
+			bool childAll = false;
+			std::vector<uint32_t> ids = evaluate(child, childAll);
+			if (childAll) {
+				continue;
+			}
+			result = constrained ? intersectSorted(result, ids) : std::move(ids);
+			constrained = true;
+			if (result.empty()) {
+				break;
+			}
+		}
+		all = !constrained;
+		return result;
+	}
+	case TrigramQuery::Kind::Or: {
+		std::vector<uint32_t> result;
+		for (const auto& child : query.children) {
+			bool childAll = false;
+			std::vector<uint32_t> ids = evaluate(child, childAll);
+			if (childAll) {
+				all = true;
+				return {};
+			}
+			result = unionSorted(result, ids);
+		}
+		return result;
+	}
+	}
+	all = true;
+	return {};
+}
+
+void TrigramIndex::select(const TrigramQuery& query)
+{
+	bool all = false;
+	std::vector<uint32_t> ids = evaluate(query, all);
+	candidates_.assign(files_.size(), all);
+	for (uint32_t id : ids) {
+		candidates_[id] = true;
+	}
+}
+
+size_t TrigramIndex::candidateCount() const
+{
+	if (candidates_.empty()) {
+		return files_.size();
+	}
+	return static_cast<size_t>(std::count(candidates_.begin(), candidates_.end(), true));
+}
+
+bool TrigramIndex::mayMatch(std::string_view relativePath, const std::filesystem::directory_entry& entry) const
+{
+	auto it = ids_.find(relativePath);
+	if (it == ids_.end()) {
+		return true; // new since the index was built
+	}
+	const FileRecord& record = files_[it->second];
+	std::error_code ec;
+	if (entry.file_size(ec) != record.size || ec || mtimeOf(entry, ec) != record.mtime || ec) {
+		return true; // changed since the index was built
+	}
+	return candidates_.empty() || candidates_[it->second];
+}
+
+bool TrigramIndex::isIndexFile(const std::filesystem::directory_entry& entry) const
+{
+	return isSameFile(entry, indexPath_);
+}
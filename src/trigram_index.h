@@ -0,0 +1,143 @@
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "case_fold.h"
+#include "file_reader.h"
+
+/**
+ * @brief The trigrams a file must contain to possibly match a query, as an
+ *        AND/OR tree. A node of kind All places no requirement.
+ *
+ * Derived conservatively: a file that can match the query always satisfies
+ * its TrigramQuery, while a file that satisfies it may still not match.
+ */
+struct TrigramQuery {
+    enum class Kind { All, Trigram, And, Or };
+
+    Kind kind = Kind::All;
+    uint32_t trigram = 0;                 // Kind::Trigram
+    std::vector<TrigramQuery> children;   // Kind::And / Kind::Or
+
+    /**
+     * @brief Every trigram of 'needle' (All if it is shorter than three bytes).
+     *        With case folding, a trigram with letters is required in any of
+     *        its ASCII case variants (an Or), and code points with non-ASCII
+     *        case forms (U+00E9, also k with the Kelvin sign) are not required.
+     */
+    static TrigramQuery fromLiteral(std::string_view needle, CaseFolding folding = CaseFolding::None);
+
+    /**
+     * @brief Requirements implied by the literal runs of a regex, respecting
+     *        alternation, groups and optional quantifiers. Constructs it does
+     *        not understand (inline flags, lookaround, \Q...\E) yield All.
+     *        'ignoreCase' folds the runs like CaseFolding::Unicode.
+     */
+    static TrigramQuery fromRegex(std::string_view pattern, bool ignoreCase = false);
+
+    bool isAll() const { return kind == Kind::All; }
+};
+
+/**
+ * @brief An on-disk trigram index of a directory tree, for narrowing a query
+ *        down to the files that can contain it.
+ *
+ * The index records, for every file, its path relative to the indexed root,
+ * its size and modification time, and for every trigram (three consecutive
+ * bytes within one line) the sorted list of files containing it. Files whose
+ * size or mtime no longer match, and files the index has never seen, are
+ * always treated as candidates, so a stale index only costs speed.
+ * Compressed files (decompress.h) are indexed by their raw and their
+ * decompressed contents, so they stay candidates with or without
+ * ScanOptions::decompress.
+ *
+ * A loaded index is read-only and may be consulted from several threads.
+ */
+class TrigramIndex {
+public:
+    struct BuildStats {
+        size_t files = 0;         // files written to the index
+        size_t trigrams = 0;      // distinct trigrams
+        uint64_t bytes = 0;       // file bytes indexed
+    };
+
+    /**
+     * @brief Walks 'root' on 'numThreads' threads and writes an index of every
+     *        readable file to 'indexPath' (replaced atomically).
+     * @return false (and sets 'error') if the index could not be written.
+     */
+    static bool build(const std::filesystem::path& root,
+                      const std::filesystem::path& indexPath,
+                      unsigned numThreads,
+                      BuildStats& stats,
+                      std::string& error);
+
+    /**
+     * @brief Opens an index written by build().
+     * @return nullptr (and sets 'error') if it is missing or malformed.
+     */
+    static std::unique_ptr<TrigramIndex> load(const std::filesystem::path& indexPath,
+                                              std::string& error);
+
+    /**
+     * @brief Marks the indexed files that satisfy 'query' as candidates.
+     *        Until select() is called every file is a candidate.
+     */
+    void select(const TrigramQuery& query);
+
+    /**
+     * @brief True unless the index proves the file cannot match: it is indexed
+     *        with this size and mtime and was not selected.
+     * @param relativePath Path relative to the indexed root, '/' separators
+     */
+    bool mayMatch(std::string_view relativePath, const std::filesystem::directory_entry& entry) const;
+
+    /**
+     * @brief True if 'entry' is the index file itself (which is never scanned).
+     */
+    bool isIndexFile(const std::filesystem::directory_entry& entry) const;
+
+    /**
+     * @brief The root the index was built for (weakly canonical).
+     */
+    const std::filesystem::path& root() const { return root_; }
+
+    size_t fileCount() const { return files_.size(); }
+    size_t candidateCount() const;
+
+private:
+    struct FileRecord {
+        uint64_t size;
+        int64_t mtime;
+    };
+
+    struct TrigramEntry {
+        uint32_t trigram;
+        uint32_t count;     // number of files in the posting list
+        uint64_t offset;    // byte offset into postings_
+    };
+
+    TrigramIndex() = default;
+
+    // Evaluates 'query' to sorted file ids; sets 'all' instead for Kind::All.
+    std::vector<uint32_t> evaluate(const TrigramQuery& query, bool& all) const;
+    std::vector<uint32_t> postingList(uint32_t trigram) const;
+
+    FileReader reader_;                     // keeps the index bytes mapped or loaded
+    std::filesystem::path root_;
+    std::filesystem::path indexPath_;
+    std::vector<FileRecord> files_;
+    std::unordered_map<std::string_view, uint32_t> ids_;  // relative path -> file id
+    std::vector<TrigramEntry> trigrams_;    // sorted by trigram
+    std::string_view postings_;             // varint-delta encoded file ids
+    std::vector<bool> candidates_;
+};
+
+#endif // TRIGRAM_INDEX_H
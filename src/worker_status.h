@@ -0,0 +1,128 @@
+#ifndef WORKER_STATUS_H
+#define WORKER_STATUS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Progress counters owned by one worker thread.
+ *
+ * Only the owning thread writes (plain relaxed stores, no read-modify-write),
+ * and each instance sits on its own cache line, so updating them on every hit
+ * costs no more than a local increment. The monitor thread reads all workers'
+ * counters when it redraws. The current file name is published through a
+ * seqlock over atomic words, so readers never block the worker.
+ */
+class alignas(64) WorkerStatus {
+public:
+    // Owner thread: a new file is being scanned.
+    void beginFile(std::string_view path) {
+        const uint32_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed); // odd: write in progress
+        std::atomic_thread_fence(std::memory_order_release);
+
+        // Keep the tail of long paths: the file name is the interesting part.
+        if (path.size() > kMaxPath) {
+            path.remove_prefix(path.size() - kMaxPath);
+        }
+        for (size_t w = 0; w * 8 < path.size(); ++w) {
+            uint64_t word = 0;
+            std::memcpy(&word, path.data() + w * 8, std::min<size_t>(8, path.size() - w * 8));
+            pathWords_[w].store(word, std::memory_order_relaxed);
+        }
+        pathLength_.store(static_cast<uint32_t>(path.size()), std::memory_order_relaxed);
+        startedAt_.store(std::chrono::steady_clock::now().time_since_epoch().count(),
+            std::memory_order_relaxed);
+
+        seq_.store(seq + 2, std::memory_order_release);
+        fileHits_.store(0, std::memory_order_relaxed);
+    }
+
+    // Owner thread: one (or 'count') more matching lines.
+    void addHit(size_t count = 1) {
+        fileHits_.store(fileHits_.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        totalHits_.store(totalHits_.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    }
+
+    // Owner thread: the current file is done.
+    void endFile() {
+        filesScanned_.store(filesScanned_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    size_t filesScanned() const { return filesScanned_.load(std::memory_order_relaxed); }
+    size_t totalHits() const { return totalHits_.load(std::memory_order_relaxed); }
+    size_t fileHits() const { return fileHits_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Any thread: copies the current file name; returns its start time
+     *        (steady_clock ticks, 0 if no file was started yet).
+     */
+    long long currentFile(std::string& out) const {
+        while (true) {
+            const uint32_t before = seq_.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue; // writer is mid-update; it only takes a few stores
+            }
+            const size_t length = pathLength_.load(std::memory_order_relaxed);
+            const long long started = startedAt_.load(std::memory_order_relaxed);
+            char buffer[kMaxPath];
+            for (size_t w = 0; w * 8 < length; ++w) {
+                const uint64_t word = pathWords_[w].load(std::memory_order_relaxed);
+                std::memcpy(buffer + w * 8, &word, std::min<size_t>(8, length - w * 8));
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq_.load(std::memory_order_relaxed) == before) {
+                out.assign(buffer, length);
+                return started;
+            }
+        }
+    }
+
+private:
+    static constexpr size_t kMaxPath = 256;
+
+    std::atomic<size_t> filesScanned_{ 0 };
+    std::atomic<size_t> totalHits_{ 0 };
+    std::atomic<size_t> fileHits_{ 0 };
+
+    std::atomic<uint32_t> seq_{ 0 };
+    std::atomic<uint32_t> pathLength_{ 0 };
+    std::atomic<long long> startedAt_{ 0 };
+    std::array<std::atomic<uint64_t>, kMaxPath / 8> pathWords_{};
+};
+
+/**
+ * @brief Sum of all workers' counters, taken by the monitor thread.
+ */
+struct StatusSnapshot {
+    size_t filesScanned = 0;
+    size_t totalHits = 0;
+    size_t errors = 0;       // errors reported so far (Scanner::progress())
+    std::string currentFile; // most recently started file across workers
+};
+
+inline StatusSnapshot snapshotStatus(const std::vector<WorkerStatus>& workers) {
+    StatusSnapshot snapshot;
+    long long newest = 0;
+    std::string path;
+    for (const auto& worker : workers) {
+        snapshot.filesScanned += worker.filesScanned();
+        snapshot.totalHits += worker.totalHits();
+        const long long started = worker.currentFile(path);
+        if (started > newest) {
+            newest = started;
+            snapshot.currentFile = path;
+        }
+    }
+    return snapshot;
+}
+
+#endif // WORKER_STATUS_H
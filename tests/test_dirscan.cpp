@@ -1,19 +1,591 @@
-#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+#include "adaptive_pool.h"
+#include "async_reader.h"
+#include "byte_codec.h"
+#include "case_fold.h"
+#include "cluster.h"
+#include "decompress.h"
 #include "dirscan.h"
+#include "file_search.h"
+#include "glob.h"
+#include "ignore_rules.h"
+#include "json_text.h"
+#include "literal_search.h"
+#include "matcher.h"
+#include "multi_literal.h"
+#include "path_arena.h"
+#include "result_writer.h"
+#include "socket_channel.h"
+#include "scanner.h"
+#include "stage_timer.h"
+#include "status_display.h"
+#include "trigram_index.h"
 
 namespace fs = std::filesystem;
 
+// Like assert, but also checked (and evaluated) in release builds
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition "\n"; \
+            std::abort(); \
+        } \
+    } while (false)
+
 static void createSampleFile(const fs::path& path, const std::string& content) {
     std::ofstream ofs(path);
     ofs << content;
 }
 
+// Returns true if search_results.txt mentions 'name' anywhere
+static bool resultsMention(const std::string& name) {
+    std::ifstream results("search_results.txt");
+    std::string line;
+    while (std::getline(results, line)) {
+        if (line.find(name) != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Compares the SIMD literal kernel against std::string_view::find on
+// needles placed at every offset, including block and buffer boundaries.
+static void checkLiteralSearch() {
+    const std::string needles[] = { "x", "ab", "needle", "zq", "a somewhat longer needle 1234567890" };
+    for (const auto& needle : needles) {
+        LiteralSearcher searcher(needle);
+        for (size_t len = 0; len < 100; ++len) {
+            std::string hay(len, 'a');
+            for (size_t i = 0; i < len; ++i) {
+                hay[i] = "abcdefg needl\n"[i % 14];
+            }
+            CHECK(searcher.find(hay) == std::string_view(hay).find(needle));
+            for (size_t at = 0; at + needle.size() <= len; ++at) {
+                std::string withNeedle = hay;
+                withNeedle.replace(at, needle.size(), needle);
+                std::string_view view(withNeedle);
+                CHECK(searcher.find(view) == view.find(needle));
+                CHECK(searcher.find(view, at) == view.find(needle, at));
+            }
+        }
+    }
+}
+
+// Case forms, UTF-8 decoding and the smart-case test.
+static void checkCaseFolding() {
+    uint32_t forms[kMaxCaseForms];
+    CHECK(caseForms('k', forms) == 3 && forms[0] == 'k' && forms[1] == 'K' && forms[2] == 0x212A);
+    CHECK(caseForms(0x212A, forms) == 3 && forms[0] == 0x212A);
+    CHECK(caseForms(0xE9, forms) == 2 && forms[1] == 0xC9);           // e acute
+    CHECK(caseForms(0x414, forms) == 2 && forms[1] == 0x434);         // Cyrillic de
+    CHECK(caseForms(0x3C2, forms) == 3);                              // final sigma, sigma, Sigma
+    CHECK(caseForms('1', forms) == 1 && caseForms(0x65E5, forms) == 1);
+
+    size_t pos = 0;
+    const std::string text = "a\xc3\xa9\xe2\x84\xaa\xff";
+    CHECK(decodeUtf8(text, pos) == 'a' && decodeUtf8(text, pos) == 0xE9 && decodeUtf8(text, pos) == 0x212A);
+    CHECK(decodeUtf8(text, pos) == (kInvalidUtf8 | 0xFF) && pos == text.size());
+    pos = 0;
+    CHECK(decodeUtf8("\xc0\xaf", pos) == (kInvalidUtf8 | 0xC0) && pos == 1);  // overlong
+    std::string encoded;
+    appendUtf8(0x212A, encoded);
+    appendUtf8(kInvalidUtf8 | 0xFF, encoded);
+    CHECK(encoded == "\xe2\x84\xaa\xff");
+
+    CHECK(literalFolding("needle") == CaseFolding::Ascii && literalFolding("\xe6\x97\xa5 x") == CaseFolding::Ascii);
+    CHECK(literalFolding("caf\xc3\xa9") == CaseFolding::Unicode);
+    CHECK(!hasUppercase("needle", false) && hasUppercase("neeDle", false) && hasUppercase("\xc3\x89", false));
+    CHECK(!hasUppercase("\\Sneedle\\W\\p{Lu}\\x4F", true) && hasUppercase("\\Sneedle", false));
+    CHECK(hasUppercase("[A-Z]", true));
+}
+
+// Case-insensitive literals agree with a code point by code point reference:
+// ASCII needles fold ASCII letters, others fold every code point, so a match
+// may be longer or shorter than the needle.
+static void checkCaseInsensitiveSearch() {
+    // Letters (with Kelvin sign, long s, both sharp s and Cyrillic er, whose lead bytes
+    // differ), '[' and '{' (0x20 apart but not letters) and filler
+    const std::vector<std::string> alphabet = { "a", "A", "k", "K", "\xe2\x84\xaa", "s", "\xc5\xbf",
+        "\xc3\xa9", "\xc3\x89", "\xc3\x9f", "\xe1\xba\x9e", "\xd1\x80", "\xd0\xa0", "[", "{", " ", "x" };
+    auto sameLetter = [](uint32_t a, uint32_t b) {
+        uint32_t forms[kMaxCaseForms];
+        const size_t count = caseForms(a, forms);
+        return std::find(forms, forms + count, b) != forms + count;
+    };
+    auto reference = [&](std::string_view needle, std::string_view hay, size_t from, size_t& length) {
+        const bool unicode = literalFolding(needle) == CaseFolding::Unicode;
+        for (size_t start = from; start < hay.size(); ++start) {
+            size_t n = 0;
+            size_t h = start;
+            while (n < needle.size() && h < hay.size()) {
+                if (unicode) {
+                    const uint32_t a = decodeUtf8(needle, n);
+                    if (!sameLetter(a, decodeUtf8(hay, h))) {
+                        break;
+                    }
+                }
+                else {
+                    const char a = needle[n++];
+                    const char b = hay[h++];
+                    const bool letter = (a | 0x20) >= 'a' && (a | 0x20) <= 'z';
+                    if (letter ? (a | 0x20) != (b | 0x20) : a != b) {
+                        break;
+                    }
+                }
+                if (n == needle.size()) {
+                    length = h - start;
+                    return start;
+                }
+            }
+        }
+        return std::string_view::npos;
+    };
+
+    const std::string needles[] = { "k", "Ab", "nEeDlE", "[x]", "a somewhat LONGER needle 1234567890",
+        "\xc3\xa9", "x\xc3\x89" "a", "ka\xc3\xa9", "\xc3\x9f", "s\xc3\x9fk", "\xd1\x80" "a" };
+    unsigned seed = 11;
+    for (const auto& needle : needles) {
+        LiteralSearcher searcher(needle, true);
+        for (int round = 0; round < 200; ++round) {
+            std::string hay;
+            for (int i = 0; i < round % 70; ++i) {
+                seed = seed * 1103515245 + 12345;
+                hay += alphabet[(seed >> 16) % alphabet.size()];
+            }
+            if (round % 3 == 0) {
+                hay.insert(hay.size() / 2, needle);  // plant one occurrence
+            }
+            for (size_t from = 0; from <= hay.size(); from += 1 + hay.size() / 7) {
+                size_t expectedLength = 0;
+                size_t length = 0;
+                const size_t expected = reference(needle, hay, from, expectedLength);
+                CHECK(searcher.find(hay, from, length) == expected);
+                CHECK(expected == std::string_view::npos || length == expectedLength);
+            }
+        }
+    }
+
+    LiteralSearcher kelvin("\xc3\xb6k", true);  // o umlaut and k, against upper case and the Kelvin sign
+    size_t length = 0;
+    CHECK(kelvin.folding() == CaseFolding::Unicode);
+    CHECK(kelvin.find("x \xc3\x96\xe2\x84\xaa", 0, length) == 2 && length == 5);
+    CHECK(LiteralSearcher("kelvin", true).find("\xe2\x84\xaa" "elvin") == std::string_view::npos);  // ASCII needle, ASCII folding
+    CHECK(LiteralSearcher("needle", false).find("NEEDLE") == std::string_view::npos);
+}
+
+// Every non-overlapping match of a line is reported, for literals and regexes.
+static void checkMatchSpans() {
+    auto spansOf = [](const std::string& query, bool regex, std::string_view line) {
+        std::string error;
+        auto matcher = Matcher::compile(query, regex, false, error);
+        CHECK(matcher);
+        std::vector<MatchSpan> spans;
+        CHECK(matcher->findAll(line, spans) == spans.size());
+        std::vector<std::pair<size_t, size_t>> found;
+        for (const auto& span : spans) {
+            found.emplace_back(span.offset, span.length);
+        }
+        return found;
+    };
+    using Spans = std::vector<std::pair<size_t, size_t>>;
+    CHECK((spansOf("aa", false, "aaaaa") == Spans{ { 0, 2 }, { 2, 2 } }));
+    CHECK((spansOf("needle", false, "no match") == Spans{}));
+    CHECK((spansOf("ne+dle", true, "needle, neeedle") == Spans{ { 0, 6 }, { 8, 7 } }));
+    CHECK((spansOf("^ab", true, "abab") == Spans{ { 0, 2 } }));
+    // A match ending later but starting earlier wins (Hyperscan reports "x" first)
+    CHECK((spansOf("x|wxyz", true, "wxyz wx") == Spans{ { 0, 4 }, { 6, 1 } }));
+    CHECK((spansOf("b+", true, "abbbcb") == Spans{ { 1, 3 }, { 5, 1 } }));
+    const auto empty = spansOf("x*", true, "axb");  // empty matches advance by one byte
+    CHECK(empty.size() >= 2 && empty[0] == std::make_pair(size_t(0), size_t(0))
+        && empty[1] == std::make_pair(size_t(1), size_t(1)));
+
+    // Without case: spans take the length of what matched
+    auto foldedSpansOf = [](const std::vector<std::string>& patterns, bool regex, std::string_view line) {
+        std::string error;
+        auto matcher = Matcher::compileSet(patterns, regex, true, error);
+        CHECK(matcher);
+        std::vector<MatchSpan> spans;
+        matcher->findAll(line, spans);
+        std::vector<std::pair<size_t, size_t>> found;
+        for (const auto& span : spans) {
+            found.emplace_back(span.offset, span.length);
+        }
+        return found;
+    };
+    CHECK((foldedSpansOf({ "needle" }, false, "NEEDLE, Needle") == Spans{ { 0, 6 }, { 8, 6 } }));
+    CHECK((foldedSpansOf({ "ne+dle" }, true, "NEEDLE") == Spans{ { 0, 6 } }));
+    CHECK((foldedSpansOf({ "\xc3\xb6k" }, false, "\xc3\x96\xe2\x84\xaa \xc3\xb6K") == Spans{ { 0, 5 }, { 6, 3 } }));
+    CHECK((foldedSpansOf({ "foo", "BAR" }, false, "Foo bar") == Spans{ { 0, 3 }, { 4, 3 } }));       // Aho-Corasick
+    CHECK((foldedSpansOf({ "foo", "\xc3\xa9t\xc3\xa9" }, false, "FOO \xc3\x89T\xc3\x89") == Spans{ { 0, 3 }, { 4, 5 } }));
+
+    // RE2 and PCRE2 fold a regex by code point (Cyrillic "pri" against upper case)
+    const std::string_view backend = regexBackendName();
+    if (backend == "re2" || backend == "pcre2") {
+        CHECK((foldedSpansOf({ "\xd0\xbf\xd1\x80\xd0\xb8+" }, true, "x \xd0\x9f\xd0\xa0\xd0\x98") == Spans{ { 2, 6 } }));
+    }
+    // PCRE2 counts the lines it gave up on at its limit; the automata never
+    // give up (and std::regex has no limit, so it is left out)
+    if (backend != "std") {
+        std::string error;
+        auto catastrophic = Matcher::compile("(a+)+$", true, false, error);
+        CHECK(catastrophic);
+        const bool matched = catastrophic->matches(std::string(64, 'a') + "b");
+        CHECK(!matched && catastrophic->takeAbandonedLines() == (backend == "pcre2" ? 1u : 0u));
+        CHECK(catastrophic->takeAbandonedLines() == 0);
+    }
+}
+
+// The Aho-Corasick automaton agrees with a brute-force leftmost-longest scan.
+static void checkAhoCorasick() {
+    const std::vector<std::string> patterns = { "he", "she", "his", "hers", "", "s", "e\xff" };
+    AhoCorasick automaton(patterns);
+    unsigned seed = 7;
+    for (int round = 0; round < 300; ++round) {
+        std::string text;
+        for (int i = 0; i < round % 40; ++i) {
+            seed = seed * 1103515245 + 12345;
+            text += "hers\xff"[(seed >> 16) % 5];
+        }
+        std::vector<MatchSpan> expected;
+        for (size_t i = 0; i < text.size(); ) {
+            size_t best = 0, bestPattern = 0;
+            for (size_t p = 0; p < patterns.size(); ++p) {
+                if (patterns[p].size() > best && text.compare(i, patterns[p].size(), patterns[p]) == 0) {
+                    best = patterns[p].size();
+                    bestPattern = p;
+                }
+            }
+            if (best == 0) {
+                ++i;
+                continue;
+            }
+            expected.push_back(MatchSpan{ i, best, bestPattern });
+            i += best;
+        }
+        std::vector<MatchSpan> found;
+        automaton.findAll(text, found, 1000);
+        CHECK(found.size() == expected.size());
+        for (size_t k = 0; k < found.size(); ++k) {
+            CHECK(found[k].offset == expected[k].offset && found[k].length == expected[k].length
+                && found[k].pattern == expected[k].pattern);
+        }
+        const size_t first = automaton.findFirst(text, 1);
+        size_t firstEnd = std::string::npos;
+        for (size_t p = 0; p < patterns.size(); ++p) {
+            size_t at = patterns[p].empty() || text.size() < 1 ? std::string::npos : text.find(patterns[p], 1);
+            if (at != std::string::npos) {
+                firstEnd = std::min(firstEnd, at + patterns[p].size());
+            }
+        }
+        CHECK((first == std::string::npos) == (firstEnd == std::string::npos));
+        CHECK(first == std::string::npos || (first >= 1 && first < firstEnd));
+    }
+}
+
+// The status table is redrawn in place, line by line, and only when it changed.
+static void checkStatusRenderer() {
+    StatusSnapshot status;
+    status.filesScanned = 3;
+    status.currentFile = "a.txt";
+
+    std::ostringstream table;
+    StatusRenderer renderer(table, ProgressMode::Table, false);
+    renderer.update(status, "none");
+    CHECK(table.str().find("| Files Scanned: 3\n") != std::string::npos);
+    table.str("");
+    renderer.update(status, "none");
+    CHECK(table.str().empty());
+    status.totalHits = 5;
+    renderer.update(status, "none");
+    CHECK(table.str() == "\033[4A\r\033[2K| Total hits:    5\n\n\n\n");
+
+    // Not a terminal: nothing until the final summary, which has no escape codes
+    std::ostringstream piped;
+    StatusRenderer summary(piped, ProgressMode::Auto, false);
+    summary.update(status, "none");
+    CHECK(piped.str().empty());
+    summary.finish(status, "none");
+    CHECK(piped.str().find("| Total hits:    5\n") != std::string::npos);
+    CHECK(piped.str().find('\033') == std::string::npos);
+
+    std::ostringstream json;
+    StatusRenderer progress(json, ProgressMode::Json, true);
+    status.currentFile = "dir/\"quoted\".txt";
+    progress.update(status, "none");
+    progress.update(status, "none");
+    status.errors = 1;
+    progress.finish(status, "Could not open x");
+    const std::string lines = json.str();
+    CHECK(std::count(lines.begin(), lines.end(), '\n') == 2);
+    CHECK(lines.find("{\"files\":3,\"hits\":5,\"errors\":0,") == 0);
+    CHECK(lines.find("\"current\":\"dir/\\\"quoted\\\".txt\"}\n") != std::string::npos);
+    CHECK(lines.find("\"done\":true,\"last_error\":\"Could not open x\"}\n") != std::string::npos);
+
+    std::ostringstream quiet;
+    StatusRenderer silent(quiet, ProgressMode::Quiet, true);
+    silent.update(status, "none");
+    silent.finish(status, "none");
+    CHECK(quiet.str().empty());
+}
+
+// JSON helpers: UTF-8 validation, string escapes and the base64 fallback.
+static void checkJsonText() {
+    CHECK(isValidUtf8("plain ascii, longer than eight bytes"));
+    CHECK(isValidUtf8("\xc3\xa9t\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80"));
+    CHECK(!isValidUtf8("\xc0\xaf"));               // overlong '/'
+    CHECK(!isValidUtf8("\xed\xa0\x80"));           // surrogate
+    CHECK(!isValidUtf8("abcdefgh\xe2\x82"));        // cut short
+    CHECK(!isValidUtf8("\xf4\x90\x80\x80"));       // past U+10FFFF
+
+    std::string out;
+    appendJsonString(out, "a\"b\\c\n\x01");
+    CHECK(out == "\"a\\\"b\\\\c\\n\\u0001\"");
+    for (const char* text : { "", "f", "fo", "foo", "foob", "fooba", "foobar" }) {
+        out.clear();
+        appendBase64(out, text);
+        static const std::vector<std::string> expected = { "", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy" };
+        CHECK(out == expected[std::strlen(text)]);
+    }
+    out.clear();
+    appendJsonBytes(out, "text", "\xff");
+    CHECK(out == "\"text_base64\":\"/w==\"");
+}
+
+// Stage histograms keep percentiles within a bucket (25%) of the exact value.
+static void checkStageHistogram() {
+    StageHistogram histogram;
+    CHECK(histogram.percentile(0.5) == 0);
+    uint64_t total = 0;
+    for (uint64_t nanos = 1; nanos <= 10000; ++nanos) {
+        histogram.add(nanos);
+        total += nanos;
+    }
+    CHECK(histogram.count() == 10000 && histogram.totalNanos() == total && histogram.maxNanos() == 10000);
+    for (double q : { 0.5, 0.9, 0.99 }) {
+        const double exact = q * 10000;
+        const double found = static_cast<double>(histogram.percentile(q));
+        CHECK(found >= exact && found <= exact * 1.25);
+    }
+    CHECK(histogram.percentile(1.0) == 10000);
+
+    StageHistogram other;
+    other.add(uint64_t(1) << 40);
+    histogram.merge(other);
+    CHECK(histogram.count() == 10001 && histogram.maxNanos() == uint64_t(1) << 40);
+}
+
+// Arena paths are NUL-terminated, share slabs and outlive the arena.
+static void checkPathArena() {
+    std::vector<PathRef> refs;
+    {
+        PathArena arena;
+        for (int i = 0; i < 5000; ++i) {
+            refs.push_back(arena.store(std::filesystem::path("dir") / ("file" + std::to_string(i) + ".txt")));
+        }
+        CHECK(arena.slabCount() > 1 && arena.slabCount() < 10);
+
+        const std::filesystem::path::string_type longName(PathArena::kSlabChars + 10, 'x');
+        PathRef big = arena.store(NativeView(longName));
+        CHECK(big.native() == longName && big.c_str()[longName.size()] == 0);
+    }
+    for (int i : { 0, 2500, 4999 }) {
+        const PathRef& ref = refs[i];
+        CHECK(ref.toPath() == std::filesystem::path("dir") / ("file" + std::to_string(i) + ".txt"));
+        CHECK(ref.c_str()[ref.native().size()] == 0);
+    }
+    PathRef copy = refs[7];
+    refs.clear();
+    CHECK(copy.toPath().filename() == "file7.txt");
+    PathRef moved = std::move(copy);
+    CHECK(copy.empty() && copy.c_str()[0] == 0 && !moved.empty());
+
+    PathRef own(std::filesystem::path("own.txt"));
+    CHECK(own.toPath() == "own.txt");
+}
+
+// The adaptive pool grows when workers wait on I/O with a backlog and
+// shrinks when they starve or saturate the cores.
+static void checkAdaptPoolSize() {
+    PoolSample sample;
+    sample.active = 4;
+    sample.minWorkers = 1;
+    sample.maxWorkers = 16;
+    sample.cores = 4;
+    sample.queued = 100;
+    sample.intervalNanos = 100000000;
+    sample.busyNanos = 4 * sample.intervalNanos;
+    sample.cpuNanos = sample.busyNanos / 10;            // blocked on I/O
+    CHECK(adaptPoolSize(sample) == 5);
+    sample.otherLoad = 8;                               // someone else owns the cores
+    CHECK(adaptPoolSize(sample) == 3);
+    sample.otherLoad = -1;
+    sample.queued = 0;                                  // no backlog: stay
+    CHECK(adaptPoolSize(sample) == 4);
+    sample.idleNanos = 5 * sample.intervalNanos;        // starving
+    CHECK(adaptPoolSize(sample) == 3);
+    sample.idleNanos = 0;
+    sample.active = 8;
+    sample.cpuNanos = 4 * sample.intervalNanos;         // all cores busy with 8 threads
+    CHECK(adaptPoolSize(sample) == 7);
+    sample.active = 16;
+    sample.cpuNanos = sample.busyNanos / 10;
+    sample.queued = 100;
+    CHECK(adaptPoolSize(sample) == 16);                // capped at maxWorkers
+}
+
+static bool globMatches(const std::string& pattern, const std::string& text, bool caseInsensitive = false) {
+    std::string error;
+    auto glob = Glob::compile(pattern, caseInsensitive, error);
+    CHECK(glob && error.empty());
+    return glob->matches(text);
+}
+
+// Covers the suffix/prefix/exact fast paths and the generic matcher.
+static void checkGlob() {
+    CHECK(globMatches("*.log", "app.log"));
+    CHECK(!globMatches("*.log", "app.log.1"));
+    CHECK(globMatches(".txt", "notes.txt"));
+    CHECK(globMatches("*.LOG", "app.log", true));
+    CHECK(!globMatches("*.LOG", "app.log"));
+    CHECK(globMatches("Makefile", "Makefile"));
+    CHECK(globMatches("test_*", "test_dirscan.cpp"));
+    CHECK(globMatches("[!s]*.txt", "hit.txt"));
+    CHECK(!globMatches("[!s]*.txt", "skip.txt"));
+    CHECK(globMatches("file?.c", "file1.c"));
+    CHECK(globMatches("**/deepest/*.log", "d0/deeper/deepest/hit0.log"));
+    CHECK(globMatches("**/deepest/*.log", "deepest/hit0.log"));
+    CHECK(!globMatches("d0/*.log", "d0/deeper/hit0.log"));
+    CHECK(globMatches("d0/**", "d0/deeper/deepest/hit0.log"));
+
+    std::string error;
+    CHECK(!Glob::compile("[abc", false, error) && !error.empty());
+
+    GlobSet set;
+    CHECK(set.addInclude("*.log,*.txt", false, error));
+    CHECK(set.addExclude("skip*", false, error));
+    CHECK(set.accepts("a/hit.log", "hit.log"));
+    CHECK(!set.accepts("a/skip.txt", "skip.txt"));
+    CHECK(!set.accepts("a/hit.cpp", "hit.cpp"));
+}
+
+// "first line\nneedle here\n" and "second member needle\n" as gzip members,
+// "xz line\nneedle in xz\n" as xz.
+static const std::string kGzipMember1("\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\x03\x4b\xcb\x2c\x2a\x2e\x51\xc8\xc9\xcc\x4b"
+    "\xe5\xca\x4b\x4d\x4d\xc9\x49\x55\xc8\x48\x2d\x4a\xe5\x02\x00\x01\x17\x81\x0e\x17\x00\x00\x00", 43);
+static const std::string kGzipMember2("\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\x03\x2b\x4e\x4d\xce\xcf\x4b\x51\xc8\x4d\xcd"
+    "\x4d\x4a\x2d\x52\xc8\x4b\x4d\x4d\xc9\x49\xe5\x02\x00\x95\xda\xa4\xc1\x15\x00\x00\x00", 41);
+static const std::string kXzStream("\xfd\x37\x7a\x58\x5a\x00\x00\x04\xe6\xd6\xb4\x46\x02\x00\x21\x01\x16\x00\x00\x00"
+    "\x74\x2f\xe5\xa3\x01\x00\x14\x78\x7a\x20\x6c\x69\x6e\x65\x0a\x6e\x65\x65\x64\x6c\x65\x20\x69\x6e\x20"
+    "\x78\x7a\x0a\x00\x00\x00\x00\x66\x1c\x06\xa2\x4d\x33\xb8\x2c\x00\x01\x2d\x15\x2f\x0b\x71\x6d\x1f\xb6"
+    "\xf3\x7d\x01\x00\x00\x00\x00\x04\x59\x5a", 80);
+
+// Formats are told apart by magic bytes; concatenated members, truncated
+// input and the size limit are handled by each available codec.
+static void checkDecompress() {
+    CHECK(detectCompression(kGzipMember1) == Compression::Gzip);
+    CHECK(detectCompression(kXzStream) == Compression::Xz);
+    CHECK(detectCompression(std::string_view("\x28\xb5\x2f\xfd", 4)) == Compression::Zstd);
+    CHECK(detectCompression("plain text") == Compression::None && detectCompression("") == Compression::None);
+
+    FileBuffer out;
+    std::string error;
+    CHECK(!decompress(Compression::None, "plain text", out, 1 << 20, error) && !error.empty());
+    if (canDecompress(Compression::Gzip)) {
+        CHECK(decompress(Compression::Gzip, kGzipMember1 + kGzipMember2, out, 1 << 20, error));
+        CHECK(out.view() == "first line\nneedle here\nsecond member needle\n");
+        error.clear();
+        CHECK(!decompress(Compression::Gzip, kGzipMember1.substr(0, 30), out, 1 << 20, error) && !error.empty());
+        CHECK(!decompress(Compression::Gzip, kGzipMember1, out, 8, error) && error.find("exceeds") != std::string::npos);
+    }
+    if (canDecompress(Compression::Xz)) {
+        CHECK(decompress(Compression::Xz, kXzStream, out, 1 << 20, error) && out.view() == "xz line\nneedle in xz\n");
+        error.clear();
+        CHECK(!decompress(Compression::Xz, kXzStream.substr(0, 40), out, 1 << 20, error) && !error.empty());
+    }
+}
+
+// gitignore semantics: anchoring, directory-only rules, negation and
+// deeper files overriding their parents.
+static void checkIgnoreRules() {
+    auto root = std::make_shared<IgnoreRules>(nullptr, 0);
+    root->parse("# comment\n*.log\n!keep.log\nbuild/\n/top.txt\ndocs/*.md\n.env\n\n");
+    CHECK(root->ignores("a.log", false) && root->ignores("x/y/a.log", false));
+    CHECK(!root->ignores("keep.log", false) && !root->ignores("x/keep.log", false));
+    CHECK(root->ignores("build", true) && root->ignores("x/build", true) && !root->ignores("build", false));
+    CHECK(root->ignores("top.txt", false) && !root->ignores("x/top.txt", false));
+    CHECK(root->ignores("docs/a.md", false) && !root->ignores("x/docs/a.md", false));
+    CHECK(root->ignores(".env", false) && !root->ignores("a.env", false));
+    CHECK(!root->ignores("src/main.cpp", false));
+
+    // Rules in "sub" see paths relative to it and win over the root's
+    IgnoreRules sub(root, 3);
+    sub.parse("!*.log\r\n/local\n");
+    CHECK(!sub.ignores("sub/a.log", false) && sub.ignores("sub/local", true));
+    CHECK(!sub.ignores("sub/x/local", true) && !sub.ignores("sub/top.txt", false));
+    CHECK(sub.ignores("sub/build", true));
+}
+
+// Regex reduction must stay conservative: unknown syntax means "every file".
+static void checkTrigramQuery() {
+    using Kind = TrigramQuery::Kind;
+    CHECK(TrigramQuery::fromLiteral("ab").isAll());
+    CHECK(TrigramQuery::fromLiteral("abc").kind == Kind::Trigram);
+    CHECK(TrigramQuery::fromLiteral("needle").kind == Kind::And);
+    CHECK(TrigramQuery::fromLiteral("needle").children.size() == 4);
+    CHECK(TrigramQuery::fromRegex("ne+dle").kind == Kind::And);      // "ne" is too short, "edle" is not
+    CHECK(TrigramQuery::fromRegex("needle|haystack").kind == Kind::Or);
+    CHECK(TrigramQuery::fromRegex("needle|xy").isAll());
+    CHECK(TrigramQuery::fromRegex("(needle)?").isAll());
+    CHECK(TrigramQuery::fromRegex("nee?dle").kind == Kind::Trigram); // only "dle"
+    CHECK(TrigramQuery::fromRegex("(?i)needle").isAll());
+    CHECK(TrigramQuery::fromRegex("[a-z]+\\d{2,}").isAll());
+    CHECK(TrigramQuery::fromRegex("foo\\.bar").kind == Kind::And);
+
+    // Without case, each trigram may be spelled in any case; code points with
+    // non-ASCII forms (e acute, k) are not required at all
+    const TrigramQuery folded = TrigramQuery::fromLiteral("a1B", CaseFolding::Ascii);
+    CHECK(folded.kind == Kind::Or && folded.children.size() == 4);
+    CHECK(TrigramQuery::fromLiteral("abcd", CaseFolding::Ascii).kind == Kind::And);
+    CHECK(TrigramQuery::fromLiteral("12\xc3\xa9" "34", CaseFolding::Unicode).isAll());
+    CHECK(TrigramQuery::fromLiteral("\xe6\x97\xa5x", CaseFolding::Unicode).kind == Kind::And);  // U+65E5 is caseless
+    CHECK(TrigramQuery::fromLiteral("akb", CaseFolding::Unicode).isAll());
+    CHECK(TrigramQuery::fromLiteral("akb", CaseFolding::Ascii).kind == Kind::Or);
+    const TrigramQuery foldedRegex = TrigramQuery::fromRegex("abcd", true);
+    CHECK(foldedRegex.kind == Kind::And && foldedRegex.children.size() == 2 && foldedRegex.children[0].kind == Kind::Or);
+    CHECK(TrigramQuery::fromRegex("akb", true).isAll());
+}
+
 int main() {
+    checkLiteralSearch();
+    checkCaseFolding();
+    checkCaseInsensitiveSearch();
+    checkMatchSpans();
+    checkAhoCorasick();
+    checkStatusRenderer();
+    checkJsonText();
+    checkDecompress();
+    checkStageHistogram();
+    checkPathArena();
+    checkAdaptPoolSize();
+    checkGlob();
+    checkIgnoreRules();
+    checkTrigramQuery();
+
     // 1. Create a temporary test directory and test files
     fs::path testDir = fs::temp_directory_path() / "test_files";
     fs::create_directories(testDir);
@@ -53,8 +625,975 @@ int main() {
 	}
 
 	// Then assert the same as before
-	assert(foundNeedleInFile1 && "Should have found 'needle' in file1.txt");
-	assert(!foundNeedleInFile2 && "Should not have found 'needle' in file2.txt");
+	CHECK(foundNeedleInFile1 && "Should have found 'needle' in file1.txt");
+	CHECK(!foundNeedleInFile2 && "Should not have found 'needle' in file2.txt");
+
+	// Regex mode uses the same compiled matcher for every file
+	searchInDirectory("ne+dle", testDir, true, std::nullopt);
+	CHECK(resultsMention("file1.txt") && "Regex should match file1.txt");
+	CHECK(resultsMention("a \033[31mneedle\033[0m here") && "Regex hits are highlighted");
+	CHECK(!resultsMention("file2.txt") && "Regex should not match file2.txt");
+
+	// Line numbers are rebuilt from the raw buffer, both for buffered and
+	// memory-mapped (>= 1 MiB) files
+	fs::path lineDir = testDir / "lines";
+	fs::create_directories(lineDir);
+	createSampleFile(lineDir / "small.txt", "one\nneedle two\nthree\n\nfour needle");
+	std::string big;
+	for (int i = 0; i < 40000; ++i) {
+		big += "filler line without the word\n";
+	}
+	big += "the needle is here\n";
+	createSampleFile(lineDir / "big.txt", big);
+	searchInDirectory("needle", lineDir, false, std::nullopt);
+	CHECK(resultsMention("small.txt (2 hits)"));
+	CHECK(resultsMention("Line 2: "));
+	CHECK(resultsMention("Line 5: "));
+	CHECK(resultsMention("Line 40001: "));
+	searchInDirectory("^four", lineDir, true, std::nullopt);
+	CHECK(resultsMention("Line 5: "));
+	CHECK(!resultsMention("big.txt"));
+
+	// The async read stage delivers the same bytes; large files pass through unread
+	{
+		BoundedFileQueue paths(16);
+		BoundedQueue<LoadedFile> loaded(16);
+		AsyncReader asyncReader(paths, loaded, 4);
+		PathArena arena;
+		for (const auto& entry : fs::directory_iterator(lineDir)) {
+			paths.push(arena.store(entry.path()));
+		}
+		paths.push(arena.store(lineDir / "missing.txt"));  // neither opens nor stats
+		paths.setFinished();
+		asyncReader.run();
+		loaded.setFinished();
+
+		size_t count = 0;
+		LoadedFile file;
+		while (loaded.pop(file)) {
+			if (file.path.toPath().filename() == "missing.txt") {
+				CHECK(!file.loaded);
+				continue;
+			}
+			++count;
+			FileReader reader;
+			std::string error;
+			CHECK(reader.open(file.path.c_str(), error));
+			CHECK(file.loaded == (file.path.toPath().filename() != "big.txt"));
+			CHECK(!file.loaded || file.buffer.view() == reader.contents());
+			asyncReader.recycle(file);
+		}
+		CHECK(count == static_cast<size_t>(std::distance(fs::directory_iterator(lineDir), fs::directory_iterator())));
+
+		std::string error;
+		ScanOptions options;
+		options.query = "four";
+		options.ioDepth = 8;
+		options.numThreads = 2;
+		auto scanner = Scanner::create(options, error);
+		std::vector<size_t> lineNumbers;
+		scanner->run(lineDir, [&](const FileMatches& match) {
+			for (const auto& line : match.lines) {
+				lineNumbers.push_back(line.lineNumber);
+			}
+		});
+		options.ioDepth = 0;
+		std::vector<size_t> expected;
+		Scanner::create(options, error)->run(lineDir, [&](const FileMatches& match) {
+			for (const auto& line : match.lines) {
+				expected.push_back(line.lineNumber);
+			}
+		});
+		std::sort(lineNumbers.begin(), lineNumbers.end());
+		std::sort(expected.begin(), expected.end());
+		CHECK(!expected.empty() && lineNumbers == expected);
+	}
+
+	// Files split into chunks report the same lines, in line order, as whole files
+	for (bool async : { false, true }) {
+		auto collect = [&](size_t chunkSize) {
+			ScanOptions options;
+			options.query = "needle";
+			options.numThreads = 4;
+			options.chunkSize = chunkSize;
+			options.ioDepth = async ? 4 : 0;
+			std::string error;
+			std::vector<std::string> found;
+			Scanner::create(options, error)->run(lineDir, [&](const FileMatches& match) {
+				std::ifstream file(match.path, std::ios::binary);
+				const std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+				for (const auto& line : match.lines) {
+					CHECK(contents.compare(line.offset, line.line.size(), line.line) == 0);
+					found.push_back(match.path.filename().string() + ":" + std::to_string(line.lineNumber)
+						+ ":" + std::to_string(line.offset) + ":" + std::string(line.line));
+				}
+				CHECK(std::is_sorted(match.lines.begin(), match.lines.end(),
+					[](const LineMatch& a, const LineMatch& b) { return a.lineNumber < b.lineNumber; }));
+			});
+			std::sort(found.begin(), found.end());
+			return found;
+		};
+		const auto whole = collect(0);
+		CHECK(!whole.empty());
+		CHECK(collect(7) == whole);       // tiny chunks: many per file, some lines longer than a chunk
+		CHECK(collect(4096) == whole);
+	}
+
+	// Nested directories are walked in parallel; --ext still filters files
+	fs::path treeDir = testDir / "tree";
+	for (int i = 0; i < 8; ++i) {
+		fs::path sub = treeDir / ("d" + std::to_string(i)) / "deeper" / "deepest";
+		fs::create_directories(sub);
+		createSampleFile(sub / ("hit" + std::to_string(i) + ".log"), "needle\n");
+		createSampleFile(sub / ("skip" + std::to_string(i) + ".txt"), "needle\n");
+	}
+	searchInDirectory("needle", treeDir, false, std::string("*.log"));
+	for (int i = 0; i < 8; ++i) {
+		CHECK(resultsMention("hit" + std::to_string(i) + ".log"));
+		CHECK(!resultsMention("skip" + std::to_string(i) + ".txt"));
+	}
+
+	// Include and exclude lists combine; patterns with '/' see the relative path
+	{
+		ScanOptions options;
+		options.query = "needle";
+		options.includePatterns = { "*.log,*.txt" };
+		options.excludePatterns = { "skip*", "d1/**" };
+		searchInDirectory(options, treeDir);
+		CHECK(resultsMention("hit0.log"));
+		CHECK(!resultsMention("hit1.log"));
+		CHECK(!resultsMention("skip0.txt"));
+	}
+
+	// Separate walker/matcher thread counts and an adaptive pool find the same files
+	{
+		auto collect = [&](unsigned threads, unsigned ioThreads, bool adaptive, unsigned ioDepth) {
+			ScanOptions options;
+			options.query = "needle";
+			options.numThreads = threads;
+			options.ioThreads = ioThreads;
+			options.adaptiveThreads = adaptive;
+			options.maxThreads = 6;
+			options.ioDepth = ioDepth;
+			options.queueSize = 4;
+			std::string error;
+			std::vector<std::string> found;
+			Scanner::create(options, error)->run(treeDir, [&](const FileMatches& match) {
+				found.push_back(match.path.filename().string());
+			});
+			std::sort(found.begin(), found.end());
+			return found;
+		};
+		const auto expected = collect(4, 0, false, 0);
+		CHECK(expected.size() == 16);
+		CHECK(collect(1, 3, false, 0) == expected);
+		CHECK(collect(2, 1, true, 0) == expected);
+		CHECK(collect(2, 2, true, 4) == expected);
+	}
+
+	// Ignore files and --exclude-dir prune whole subtrees; nested ignore files refine their parents
+	{
+		fs::path ignoreDir = testDir / "ignored";
+		for (const char* dir : { "src/gen", "node_modules/pkg", ".git/objects", "build", "docs" }) {
+			fs::create_directories(ignoreDir / dir);
+		}
+		createSampleFile(ignoreDir / ".gitignore", "build/\n*.tmp\ngen/\n");
+		createSampleFile(ignoreDir / "docs" / ".ignore", "!*.tmp\n");
+		for (const char* file : { "a.txt", "b.tmp", "src/c.txt", "src/gen/d.txt", "node_modules/pkg/e.txt",
+			".git/objects/f.txt", "build/g.txt", "docs/h.tmp" }) {
+			createSampleFile(ignoreDir / file, "needle\n");
+		}
+		auto collect = [&](bool ignoreFiles, std::vector<std::string> excludeDirs) {
+			ScanOptions options;
+			options.query = "needle";
+			options.numThreads = 2;
+			options.ignoreFiles = ignoreFiles;
+			options.excludeDirPatterns = std::move(excludeDirs);
+			std::string error;
+			std::vector<std::string> found;
+			Scanner::create(options, error)->run(ignoreDir, [&](const FileMatches& match) {
+				found.push_back(fs::relative(match.path, ignoreDir).generic_string());
+			});
+			std::sort(found.begin(), found.end());
+			return found;
+		};
+		CHECK(collect(false, {}).size() == 8);
+		CHECK((collect(true, { "node_modules" }) == std::vector<std::string>{ "a.txt", "docs/h.tmp", "src/c.txt" }));
+		CHECK((collect(false, { "src/gen,.git", "Build" }) == std::vector<std::string>{ "a.txt", "b.tmp",
+			"docs/h.tmp", "node_modules/pkg/e.txt", "src/c.txt" }));
+		ScanOptions options;
+		options.query = "needle";
+		options.excludeDirPatterns = { "[" };
+		std::string error;
+		CHECK(!Scanner::create(options, error) && !error.empty());
+	}
+
+	// Size, modification time and depth limits leave files out before they are queued
+	{
+		fs::path limitDir = testDir / "limits";
+		fs::create_directories(limitDir / "one" / "two");
+		createSampleFile(limitDir / "small.txt", "needle\n");
+		createSampleFile(limitDir / "large.txt", "needle\n" + std::string(4096, 'x'));
+		createSampleFile(limitDir / "old.txt", "needle\n");
+		createSampleFile(limitDir / "one" / "mid.txt", "needle\n");
+		createSampleFile(limitDir / "one" / "two" / "deep.txt", "needle\n");
+		fs::last_write_time(limitDir / "old.txt", fs::file_time_type::clock::now() - std::chrono::hours(48));
+
+		auto collect = [&](auto&& configure) {
+			ScanOptions options;
+			options.query = "needle";
+			options.numThreads = 2;
+			configure(options);
+			std::string error;
+			std::vector<std::string> found;
+			Scanner::create(options, error)->run(limitDir, [&](const FileMatches& match) {
+				found.push_back(match.path.filename().string());
+			});
+			std::sort(found.begin(), found.end());
+			return found;
+		};
+		const auto now = std::chrono::system_clock::now();
+		CHECK((collect([](ScanOptions& o) { o.maxFileSize = 1024; })
+			== std::vector<std::string>{ "deep.txt", "mid.txt", "old.txt", "small.txt" }));
+		CHECK((collect([&](ScanOptions& o) { o.modifiedAfter = now - std::chrono::hours(1); })
+			== std::vector<std::string>{ "deep.txt", "large.txt", "mid.txt", "small.txt" }));
+		CHECK((collect([&](ScanOptions& o) { o.modifiedBefore = now - std::chrono::hours(1); })
+			== std::vector<std::string>{ "old.txt" }));
+		CHECK((collect([](ScanOptions& o) { o.maxDepth = 0; })
+			== std::vector<std::string>{ "large.txt", "old.txt", "small.txt" }));
+		CHECK((collect([](ScanOptions& o) { o.maxDepth = 1; }).size() == 4));
+	}
+
+	// Compressed files are decompressed by their own stage and matched like text
+	if (canDecompress(Compression::Gzip) && canDecompress(Compression::Xz)) {
+		fs::path zipDir = testDir / "compressed";
+		fs::create_directories(zipDir);
+		createSampleFile(zipDir / "a.log.gz", kGzipMember1 + kGzipMember2);
+		createSampleFile(zipDir / "b.log.xz", kXzStream);
+		createSampleFile(zipDir / "c.txt", "plain needle\n");
+		createSampleFile(zipDir / "broken.gz", kGzipMember1.substr(0, 30));
+		auto collect = [&](bool decompress, unsigned ioDepth) {
+			ScanOptions options;
+			options.query = "needle";
+			options.numThreads = 2;
+			options.ioDepth = ioDepth;
+			options.decompress = decompress;
+			std::string error;
+			auto scanner = Scanner::create(options, error);
+			std::vector<std::string> found;
+			scanner->run(zipDir, [&](const FileMatches& match) {
+				for (const auto& line : match.lines) {
+					found.push_back(match.path.filename().string() + ":" + std::to_string(line.lineNumber) + ":"
+						+ std::to_string(line.offset) + ":" + std::string(line.line));
+				}
+			});
+			CHECK(scanner->progress().errors == (decompress ? 1u : 0u));
+			std::sort(found.begin(), found.end());
+			return found;
+		};
+		const std::vector<std::string> expected = { "a.log.gz:2:11:needle here", "a.log.gz:3:23:second member needle",
+			"b.log.xz:2:8:needle in xz", "c.txt:1:0:plain needle" };
+		CHECK(collect(true, 0) == expected);
+		CHECK(collect(true, 4) == expected);
+		// Without the stage the deflated bytes are searched as they are (a tiny xz
+		// stream may store its text uncompressed, so only gzip is checked)
+		const std::vector<std::string> raw = collect(false, 0);
+		CHECK(std::none_of(raw.begin(), raw.end(), [](const std::string& f) { return f.rfind("a.log.gz", 0) == 0; }));
+		CHECK(std::find(raw.begin(), raw.end(), "c.txt:1:0:plain needle") != raw.end());
+	}
+
+	// Several patterns in one pass: literal (Aho-Corasick) and regex sets name the pattern of each span
+	{
+		fs::path multiDir = testDir / "multi";
+		fs::create_directories(multiDir);
+		createSampleFile(multiDir / "a.txt", "alpha and beta\nnothing\ngamma\n");
+		createSampleFile(multiDir / "b.txt", "no keywords here\n");
+		for (bool regex : { false, true }) {
+			ScanOptions options;
+			options.patterns = regex ? std::vector<std::string>{ "al+pha", "be.a", "gam+a" }
+				: std::vector<std::string>{ "alpha", "beta", "gamma" };
+			options.useRegex = regex;
+			std::string error;
+			std::vector<std::string> found;
+			Scanner::create(options, error)->run(multiDir, [&](const FileMatches& match) {
+				for (const auto& line : match.lines) {
+					for (const auto& span : match.spansOf(line)) {
+						found.push_back(std::to_string(line.lineNumber) + ":" + std::to_string(span.offset)
+							+ ":" + std::to_string(span.pattern));
+					}
+				}
+			});
+			std::sort(found.begin(), found.end());
+			CHECK((found == std::vector<std::string>{ "1:0:0", "1:10:1", "3:0:2" }));
+		}
+		ScanOptions options;
+		options.patterns = { "alpha", "beta", "gamma" };
+		searchInDirectory(options, multiDir);
+		CHECK(resultsMention("Line 1 [alpha, beta]: "));
+		CHECK(!resultsMention("b.txt"));
+	}
+
+	// Early exit: per-file match limits, -l output and a global --first limit
+	{
+		BoundedFileQueue paths(8);
+		paths.push(fs::path("a"));
+		paths.cancel();
+		PathRef popped;
+		CHECK(!paths.pop(popped) && paths.isDrained());
+
+		for (size_t chunkSize : { size_t(0), size_t(7) }) {
+			ScanOptions options;
+			options.query = "needle";
+			options.numThreads = 4;
+			options.chunkSize = chunkSize;
+			options.maxCount = 1;
+			std::string error;
+			std::vector<std::string> found;
+			auto scanner = Scanner::create(options, error);
+			scanner->run(lineDir, [&](const FileMatches& match) {
+				CHECK(match.lines.size() == 1);
+				found.push_back(match.path.filename().string() + ":" + std::to_string(match.lines[0].lineNumber));
+			});
+			std::sort(found.begin(), found.end());
+			CHECK((found == std::vector<std::string>{ "big.txt:40001", "small.txt:2" }));
+			CHECK(scanner->progress().totalHits == 2);  // hits counted after the limit, chunked or not
+		}
+
+		ScanOptions options;
+		options.query = "needle";
+		options.filesWithMatches = true;
+		searchInDirectory(options, lineDir);
+		CHECK(resultsMention("small.txt"));
+		CHECK(!resultsMention("Line "));
+
+		for (unsigned ioDepth : { 0u, 4u }) {
+			ScanOptions first;
+			first.query = "needle";
+			first.numThreads = 4;
+			first.ioDepth = ioDepth;
+			first.maxFiles = 3;
+			std::string error;
+			size_t reported = 0;
+			Scanner::create(first, error)->run(treeDir, [&](const FileMatches&) { ++reported; });
+			CHECK(reported == 3);
+		}
+
+		// cancel() stops a scan from outside as --first does, and the runs after it
+		ScanOptions all;
+		all.query = "needle";
+		all.numThreads = 4;
+		std::string error;
+		auto cancelled = Scanner::create(all, error);
+		size_t reported = 0;
+		cancelled->run(treeDir, [&](const FileMatches&) {
+			if (++reported == 1) {
+				cancelled->cancel();
+			}
+		});
+		CHECK(reported >= 1 && reported < 16);
+		reported = 0;
+		cancelled->run(treeDir, [&](const FileMatches&) { ++reported; });
+		CHECK(reported == 0);
+	}
+
+	// Binary files: found by NUL bytes, magic numbers or name; reported once, skipped or searched
+	{
+		fs::path binDir = testDir / "binary";
+		fs::create_directories(binDir);
+		createSampleFile(binDir / "blob.bin", std::string("needle\n\0\0\x01needle\n", 17));
+		createSampleFile(binDir / "photo.png", "\x89PNG\r\nneedle\n");
+		createSampleFile(binDir / "notes.dat", "needle\nneedle\n");
+		createSampleFile(binDir / "plain.txt", "needle\x01\nneedle\n");
+		CHECK(looksBinary(std::string_view("a\0b", 3)) && !looksBinary("plain text"));
+
+		auto scan = [&](BinaryFiles mode) {
+			ScanOptions options;
+			options.query = "needle";
+			options.binaryFiles = mode;
+			options.binaryPatterns = { "*.dat" };
+			std::string error;
+			std::vector<std::string> found;
+			Scanner::create(options, error)->run(binDir, [&](const FileMatches& match) {
+				found.push_back(match.path.filename().string() + (match.binary ? ":binary:" : ":")
+					+ std::to_string(match.lines.size()));
+			});
+			std::sort(found.begin(), found.end());
+			return found;
+		};
+		CHECK((scan(BinaryFiles::Report) == std::vector<std::string>{
+			"blob.bin:binary:1", "notes.dat:binary:1", "photo.png:binary:1", "plain.txt:2" }));
+		CHECK((scan(BinaryFiles::Skip) == std::vector<std::string>{ "plain.txt:2" }));
+		CHECK((scan(BinaryFiles::Text) == std::vector<std::string>{
+			"blob.bin:2", "notes.dat:2", "photo.png:1", "plain.txt:2" }));
+
+		ScanOptions options;
+		options.query = "needle";
+		searchInDirectory(options, binDir);
+		CHECK(resultsMention("Binary file matches: "));
+		CHECK(resultsMention("plain.txt (2 hits)"));
+		CHECK(resultsMention("Line 1: \033[31mneedle\033[0m\\x01"));  // raw highlight, escaped control byte
+	}
+
+	// A trigram index narrows the files; changed and new files are still scanned
+	{
+		fs::path indexDir = testDir / "indexed";
+		fs::remove_all(indexDir);  // the index test edits its files
+		fs::create_directories(indexDir / "sub");
+		createSampleFile(indexDir / "a.txt", "one needle here\n");
+		createSampleFile(indexDir / "sub" / "b.txt", "nothing to see\n");
+		createSampleFile(indexDir / "sub" / "c.txt", "haystack\nneeeedle\n");
+		fs::path indexFile = indexDir / "search.idx";
+		CHECK(buildSearchIndex(indexDir, indexFile));
+
+		std::string error;
+		auto index = TrigramIndex::load(indexFile, error);
+		CHECK(index && index->fileCount() == 3);
+		index->select(TrigramQuery::fromLiteral("needle"));
+		CHECK(index->candidateCount() == 2);  // "neeeedle" has every trigram of "needle"
+		index->select(TrigramQuery::fromLiteral("nothing"));
+		CHECK(index->candidateCount() == 1);
+
+		size_t scanned = 0;
+		auto scanWithIndex = [&](const std::string& query, bool useRegex, bool ignoreCase = false) {
+			ScanOptions options;
+			options.query = query;
+			options.useRegex = useRegex;
+			options.ignoreCase = ignoreCase;
+			options.indexPath = indexFile;
+			auto scanner = Scanner::create(options, error);
+			CHECK(scanner);
+			std::vector<std::string> names;
+			scanner->run(indexDir, [&](const FileMatches& file) {
+				names.push_back(file.path.filename().string());
+			});
+			std::sort(names.begin(), names.end());
+			scanned = scanner->progress().filesScanned;
+			return names;
+		};
+		CHECK(scanWithIndex("needle", false) == std::vector<std::string>{ "a.txt" });
+		CHECK(scanned == 2);
+		CHECK((scanWithIndex("ne+dle", true) == std::vector<std::string>{ "a.txt", "c.txt" }));
+		CHECK(scanWithIndex("NEEDLE", false, true) == std::vector<std::string>{ "a.txt" });
+		CHECK(scanned == 2);  // still narrowed by the index
+		CHECK((scanWithIndex("NE+DLE", true, true) == std::vector<std::string>{ "a.txt", "c.txt" }));
+
+		createSampleFile(indexDir / "sub" / "b.txt", "now with a needle\n");  // size changed
+		createSampleFile(indexDir / "d.txt", "needle too\n");                 // not indexed
+		CHECK((scanWithIndex("needle", false) == std::vector<std::string>{ "a.txt", "b.txt", "d.txt" }));
+		CHECK(scanned == 4);
+
+		ScanOptions missing;
+		missing.query = "needle";
+		missing.indexPath = indexDir / "missing.idx";
+		CHECK(!Scanner::create(missing, error) && !error.empty());
+	}
+
+	// Compressed files are indexed by what the scanner searches in them
+	if (canDecompress(Compression::Gzip)) {
+		fs::path zipIndexDir = testDir / "indexed_gz";
+		fs::remove_all(zipIndexDir);
+		fs::create_directories(zipIndexDir);
+		createSampleFile(zipIndexDir / "plain.txt", "no match here\n");
+		createSampleFile(zipIndexDir / "logs.gz", kGzipMember1 + kGzipMember2);
+		createSampleFile(zipIndexDir / "broken.gz", kGzipMember1.substr(0, 30));
+		fs::path indexFile = testDir / "indexed_gz.idx";
+		const bool built = buildSearchIndex(zipIndexDir, indexFile);
+		CHECK(built);
+
+		std::string error;
+		auto index = TrigramIndex::load(indexFile, error);
+		CHECK(index && index->fileCount() == 2);  // the corrupt file is left out, so always scanned
+		auto scanWithIndex = [&](const std::string& query, bool decompress) {
+			ScanOptions options;
+			options.query = query;
+			options.decompress = decompress;
+			options.indexPath = indexFile;
+			auto scanner = Scanner::create(options, error);
+			CHECK(scanner);
+			std::vector<std::string> names;
+			scanner->run(zipIndexDir, [&](const FileMatches& file) {
+				names.push_back(file.path.filename().string());
+			});
+			return names;
+		};
+		CHECK(scanWithIndex("second member", true) == std::vector<std::string>{ "logs.gz" });
+		CHECK(scanWithIndex("second member", false).empty());
+		CHECK(scanWithIndex(kGzipMember2.substr(10, 6), false) == std::vector<std::string>{ "logs.gz" });
+	}
+
+	// A result cache reports unchanged files without opening them
+	{
+		fs::path cacheDir = testDir / "cached";
+		fs::remove_all(cacheDir);
+		fs::create_directories(cacheDir);
+		const auto past = fs::file_time_type::clock::now() - std::chrono::hours(1);
+		for (const char* name : { "a.txt", "b.txt" }) {
+			createSampleFile(cacheDir / name, std::string(name) == "a.txt" ? "first\nx needle\n" : "nothing\n");
+			fs::last_write_time(cacheDir / name, past);
+		}
+		fs::path cacheFile = testDir / "cached.cache";
+		fs::remove(cacheFile);
+
+		ScanOptions options;
+		options.query = "needle";
+		options.cachePath = cacheFile;
+		auto scanOnce = [&]() {
+			std::string error;
+			auto scanner = Scanner::create(options, error);
+			CHECK(scanner);
+			std::vector<std::string> lines;
+			scanner->run(cacheDir, [&](const FileMatches& file) {
+				for (const auto& line : file.lines) {
+					lines.push_back(file.path.filename().string() + ":" + std::to_string(line.offset) + ":"
+						+ std::string(line.line));
+				}
+			});
+			return lines;
+		};
+		CHECK(scanOnce() == std::vector<std::string>{ "a.txt:6:x needle" });
+		CHECK(fs::exists(cacheFile));
+
+		// Same size, mtime and inode: the stale cached line proves a.txt was not reread
+		createSampleFile(cacheDir / "a.txt", "first\ny needle\n");
+		fs::last_write_time(cacheDir / "a.txt", past);
+		CHECK(scanOnce() == std::vector<std::string>{ "a.txt:6:x needle" });
+
+		// A real change is picked up
+		createSampleFile(cacheDir / "b.txt", "a needle\n");
+		fs::last_write_time(cacheDir / "b.txt", past - std::chrono::minutes(1));
+		auto lines = scanOnce();
+		std::sort(lines.begin(), lines.end());
+		CHECK((lines == std::vector<std::string>{ "a.txt:6:x needle", "b.txt:0:a needle" }));
+
+		// Another query does not reuse the results
+		options.query = "needl";
+		CHECK(scanOnce().size() == 2);
+
+		// Nor does the same query without case: a.txt keeps its size, mtime and
+		// inode but must be reread
+		options.query = "needle";
+		scanOnce();
+		createSampleFile(cacheDir / "a.txt", "first\nz NEEDLE\n");
+		fs::last_write_time(cacheDir / "a.txt", past);
+		options.ignoreCase = true;
+		lines = scanOnce();
+		CHECK(std::find(lines.begin(), lines.end(), "a.txt:6:z NEEDLE") != lines.end());
+	}
+
+	// A streaming writer passes each file's block on and flushes it; a buffered one waits
+	{
+		struct SyncedBuffer final : std::streambuf {
+			std::mutex mutex;
+			std::string pending, flushed;
+			std::streamsize xsputn(const char* data, std::streamsize size) override
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending.append(data, static_cast<size_t>(size));
+				return size;
+			}
+			int overflow(int c) override
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending.push_back(static_cast<char>(c));
+				return c;
+			}
+			int sync() override
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				flushed += pending;
+				pending.clear();
+				return 0;
+			}
+			std::string seen()
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				return flushed;
+			}
+		};
+		for (bool streaming : { true, false }) {
+			SyncedBuffer sink;
+			std::ostream stream(&sink);
+			ResultWriter writer(stream, false, streaming);
+			{
+				ResultBuffer buffer(writer);
+				buffer.data() = "a.txt:1\n";
+				buffer.endFile("a.txt");
+				const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+				while (streaming && sink.seen().empty() && std::chrono::steady_clock::now() < deadline) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+				CHECK(sink.seen() == (streaming ? "a.txt:1\n" : ""));
+			}
+			writer.finish();
+			CHECK(sink.seen() == "a.txt:1\n");
+		}
+
+		// A stalled reader blocks submit() once kMaxQueued buffers wait
+		struct StalledBuffer final : std::streambuf {
+			std::mutex mutex;
+			std::condition_variable released;
+			bool open = false;
+			size_t written = 0;
+			std::streamsize xsputn(const char*, std::streamsize size) override
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				released.wait(lock, [this]() { return open; });
+				written += static_cast<size_t>(size);
+				return size;
+			}
+		};
+		StalledBuffer stalled;
+		std::ostream stream(&stalled);
+		ResultWriter writer(stream, false);
+		std::atomic<size_t> submitted{ 0 };
+		std::thread submitter([&]() {
+			for (size_t i = 0; i < ResultWriter::kMaxQueued + 8; ++i) {
+				std::string block = "x";
+				writer.submit(block);
+				submitted.fetch_add(1);
+			}
+		});
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+		while (submitted.load() <= ResultWriter::kMaxQueued && std::chrono::steady_clock::now() < deadline) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		CHECK(submitted.load() <= ResultWriter::kMaxQueued + 1);  // one in the writer's hands
+		{
+			std::lock_guard<std::mutex> lock(stalled.mutex);
+			stalled.open = true;
+		}
+		stalled.released.notify_all();
+		submitter.join();
+		writer.finish();
+		CHECK(stalled.written == ResultWriter::kMaxQueued + 8);
+	}
+
+	// Structured output: file, line, byte offset and spans, raw bytes, no ANSI
+	{
+		fs::path structDir = testDir / "structured";
+		fs::create_directories(structDir);
+		createSampleFile(structDir / "a.txt", "skip\nx \"needle\" needle\n\xff needle\n");
+		auto readAll = [](const fs::path& path) {
+			std::ifstream file(path, std::ios::binary);
+			return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		};
+		ScanOptions options;
+		options.query = "needle";
+		OutputOptions output;
+		output.format = OutputFormat::JsonLines;
+		output.path = testDir / "out.jsonl";
+		searchInDirectory(options, structDir, true, ProgressMode::Quiet, output);
+		const std::string path = (structDir / "a.txt").string();
+		CHECK(readAll(*output.path) ==
+			"{\"file\":\"" + path + "\",\"line\":2,\"offset\":5,\"text\":\"x \\\"needle\\\" needle\",\"spans\":[[3,6],[11,6]]}\n"
+			"{\"file\":\"" + path + "\",\"line\":3,\"offset\":23,\"text_base64\":\"/yBuZWVkbGU=\",\"spans\":[[2,6]]}\n");
+
+		// A cut line says so, and its spans end where the text does
+		output.path = testDir / "cut.jsonl";
+		output.maxLineBytes = 4;
+		searchInDirectory(options, structDir, true, ProgressMode::Quiet, output);
+		CHECK(readAll(*output.path) ==
+			"{\"file\":\"" + path + "\",\"line\":2,\"offset\":5,\"text\":\"x \\\"n\",\"truncated\":true,\"spans\":[[3,1]]}\n"
+			"{\"file\":\"" + path + "\",\"line\":3,\"offset\":23,\"text_base64\":\"/yBuZQ==\",\"truncated\":true,\"spans\":[[2,2]]}\n");
+
+		output.format = OutputFormat::Nul;
+		output.path = testDir / "out.nul";
+		searchInDirectory(options, structDir, true, ProgressMode::Quiet, output);
+		CHECK(readAll(*output.path) == path + std::string("\0" "2\0" "5\0" "3+1\0" "17\0" "x \"n\0", 17)
+			+ path + std::string("\0" "3\0" "23\0" "2+2\0" "8\0" "\xff ne\0", 17));
+
+		output.format = OutputFormat::Binary;
+		output.path = testDir / "out.bin";
+		output.maxLineBytes = 0;
+		searchInDirectory(options, structDir, true, ProgressMode::Quiet, output);
+		const std::string record = readAll(*output.path);
+		ByteCursor in{ record };
+		CHECK(in.u32() == record.size() - 4);
+		CHECK(in.sized() == path);
+		CHECK(in.bytes(1) == std::string_view("\0", 1) && in.u32() == 2);
+		CHECK(in.u64() == 2 && in.u64() == 5 && in.u32() == 2);
+		CHECK(in.u32() == 3 && in.u32() == 6 && in.u32() == 0);
+		CHECK(in.u32() == 11 && in.u32() == 6 && in.u32() == 0);
+		CHECK(in.u64() == 17 && in.sized() == "x \"needle\" needle");
+		CHECK(in.u64() == 3 && in.u64() == 23 && in.u32() == 1);
+		in.u32(), in.u32(), in.u32();
+		CHECK(in.u64() == 8 && in.sized() == "\xff needle" && in.atEnd());
+
+		// Read back whole; spans past their line and impossible counts fail the record
+		BinaryRecord decoded;
+		ByteCursor again{ record };
+		CHECK(readBinaryRecord(again, decoded) && again.atEnd() && decoded.path == path);
+		CHECK(decoded.lines.size() == 2 && decoded.spans.size() == 3 && decoded.spans[1].offset == 11);
+		CHECK((decoded.lineSizes == std::vector<uint64_t>{ 17, 8 }));
+		auto patched = [&](size_t at, uint32_t value) {
+			std::string copy = record, bytes;
+			putU32(bytes, value);
+			copy.replace(at, 4, bytes);
+			ByteCursor cursor{ copy };
+			return readBinaryRecord(cursor, decoded);
+		};
+		const size_t spanCountAt = 4 + 4 + path.size() + 1 + 4 + 8 + 8;
+		const size_t secondSpanAt = spanCountAt + 4 + 12;  // offset 11, length 6 of 17 bytes
+		CHECK(patched(secondSpanAt + 4, 6) && !patched(secondSpanAt + 4, 7) && !patched(secondSpanAt, 18));
+		CHECK(!patched(spanCountAt, 0x40000000) && !patched(spanCountAt - 16 - 4, 0x40000000));
+		CHECK(!patched(0, static_cast<uint32_t>(record.size())));
+		CHECK(!patched(secondSpanAt + 12, 16));  // shorter than its text
+
+		output.path = testDir / "cut.bin";
+		output.maxLineBytes = 4;
+		searchInDirectory(options, structDir, true, ProgressMode::Quiet, output);
+		const std::string cut = readAll(*output.path);
+		ByteCursor cutIn{ cut };
+		CHECK(readBinaryRecord(cutIn, decoded) && cutIn.atEnd());
+		CHECK(decoded.lines.size() == 2 && decoded.lines[0].line == "x \"n" && decoded.lines[0].spanCount == 1);
+		CHECK(decoded.spans.size() == 2 && decoded.spans[0].length == 1 && decoded.spans[1].length == 2);
+		CHECK((decoded.lineSizes == std::vector<uint64_t>{ 17, 8 }));
+	}
+
+	// Stage timers: every thread the scan starts reports into the caller's profile
+	{
+		StageProfile profile(true);
+		{
+			ProfileScope scope(&profile, "test");
+			OutputOptions output;
+			output.format = OutputFormat::JsonLines;
+			output.path = testDir / "profiled.jsonl";
+			ScanOptions options;
+			options.query = "needle";
+			options.numThreads = 2;
+			searchInDirectory(options, treeDir, false, ProgressMode::Quiet, output);
+		}
+#if DIRSCAN_PROFILING
+		const auto totals = profile.totals();
+		CHECK(totals[static_cast<size_t>(Stage::Match)].count() == 16);
+		CHECK(totals[static_cast<size_t>(Stage::Open)].count() == 16);
+		CHECK(totals[static_cast<size_t>(Stage::Format)].count() == 16);
+		CHECK(totals[static_cast<size_t>(Stage::Walk)].count() >= 8);
+		CHECK(totals[static_cast<size_t>(Stage::Write)].count() >= 1);
+#endif
+		std::ostringstream report;
+		profile.writeReport(report);
+		CHECK(report.str().find("p99 us") != std::string::npos);
+		std::string error;
+		CHECK(profile.writeTrace(testDir / "trace.json", error));
+		std::ifstream trace(testDir / "trace.json");
+		std::string first;
+		std::getline(trace, first);
+		CHECK(first == "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+		CHECK(!StageProfile(false).writeTrace(testDir / "trace.json", error));
+	}
+
+	// Ordered output lists files sorted by path
+	searchInDirectory("needle", treeDir, false, std::nullopt, true);
+	{
+		std::ifstream results("search_results.txt");
+		std::vector<std::string> headers;
+		std::string header;
+		while (std::getline(results, header)) {
+			if (header.rfind("Matches in file: ", 0) == 0) {
+				headers.push_back(header);
+			}
+		}
+		CHECK(headers.size() == 16);
+		CHECK(std::is_sorted(headers.begin(), headers.end()));
+	}
+
+	// The in-process API: two scanners with their own state run concurrently
+	{
+		ScanOptions logOptions;
+		logOptions.query = "needle";
+		logOptions.filePattern = "*.log";
+		ScanOptions txtOptions = logOptions;
+		txtOptions.filePattern = "*.txt";
+
+		std::string error;
+		auto logScanner = Scanner::create(logOptions, error);
+		auto txtScanner = Scanner::create(txtOptions, error);
+		CHECK(logScanner && txtScanner);
+
+		std::vector<std::string> logFiles, txtFiles;
+		std::thread other([&]() {
+			txtScanner->run(treeDir, [&](const FileMatches& file) {
+				txtFiles.push_back(file.path.filename().string());
+			});
+		});
+		logScanner->run(treeDir, [&](const FileMatches& file) {
+			CHECK(file.lines.size() == 1 && file.lines[0].lineNumber == 1);
+			CHECK(file.lines[0].line == "needle");
+			logFiles.push_back(file.path.filename().string());
+		});
+		other.join();
+
+		CHECK(logFiles.size() == 8 && txtFiles.size() == 8);
+		CHECK(logScanner->progress().filesScanned == 8);
+		CHECK(logScanner->progress().totalHits == 8);
+
+		ScanOptions badOptions;
+		badOptions.query = "[";
+		badOptions.useRegex = true;
+		CHECK(!Scanner::create(badOptions, error) && !error.empty());
+	}
+
+	// Agents on this host: a coordinator spreads subtrees over them and merges their records
+	{
+		std::string host, port, error;
+		CHECK(splitAddress("node1:7070", host, port, error) && host == "node1" && port == "7070");
+		CHECK(splitAddress("[::1]:80", host, port, error) && host == "::1" && port == "80");
+		CHECK(splitAddress("9000", host, port, error) && host.empty() && port == "9000");
+		CHECK(!splitAddress("node1:", host, port, error) && !splitAddress("node1:x", host, port, error));
+
+		std::vector<std::unique_ptr<ScanAgent>> agents;
+		std::vector<std::thread> serving;
+		std::vector<std::string> addresses;
+		for (int i = 0; i < 2; ++i) {
+			AgentOptions agentOptions;
+			agentOptions.root = treeDir;
+			agentOptions.address = i == 0 ? "0" : "127.0.0.1:0";  // no host: loopback only
+			agentOptions.token = "s3cret";
+			agentOptions.numThreads = 2;
+			agents.push_back(ScanAgent::create(agentOptions, error));
+			CHECK(agents.back());
+			addresses.push_back("127.0.0.1:" + std::to_string(agents.back()->port()));
+			serving.emplace_back([agent = agents.back().get()]() { agent->serve(); });
+		}
+
+		struct Collector final : ScanHandler {
+			std::mutex mutex;
+			std::vector<std::string> files;
+			size_t errors = 0;
+			void onFileMatches(const FileMatches& file, unsigned) override
+			{
+				CHECK(file.lines.size() == 1 && file.lines[0].line == "needle" && file.spans.size() == 1);
+				std::lock_guard<std::mutex> lock(mutex);
+				files.push_back(file.path.string());
+			}
+			void onError(const std::string&) override
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				++errors;
+			}
+		};
+		bool served = false;
+		auto clusterScan = [&](const ScanOptions& options, std::vector<std::string> names, bool shared,
+			const fs::path& directory, size_t& errors, const std::string& token = "s3cret") {
+			ClusterOptions cluster;
+			cluster.agents = std::move(names);
+			cluster.sharedTree = shared;
+			cluster.token = token;
+			std::string createError;
+			auto scan = ClusterScan::create(options, cluster, createError);
+			CHECK(scan);
+			Collector collector;
+			scan->run(directory, collector);
+			std::sort(collector.files.begin(), collector.files.end());
+			errors = collector.errors;
+			CHECK(scan->progress().errors == errors);
+			served = scan->served();
+			return collector.files;
+		};
+
+		ScanOptions options;
+		options.query = "needle";
+		std::vector<std::string> local;
+		Scanner::create(options, error)->run(treeDir, [&](const FileMatches& file) {
+			local.push_back(fs::absolute(file.path).lexically_normal().string());
+		});
+		std::sort(local.begin(), local.end());
+		CHECK(local.size() == 16);
+
+		// A shared tree is searched once, whichever agent takes each unit
+		size_t errors = 0;
+		CHECK(clusterScan(options, addresses, true, ".", errors) == local && errors == 0 && served);
+
+		// Separate trees are each searched whole, and named by their agent
+		const auto owned = clusterScan(options, addresses, false, "", errors);
+		CHECK(owned.size() == 32 && errors == 0);
+		CHECK(std::count_if(owned.begin(), owned.end(),
+			[&](const std::string& file) { return file.rfind(addresses[1] + ":", 0) == 0; }) == 16);
+		CHECK(std::binary_search(owned.begin(), owned.end(), addresses[1] + ":" + local.back()));
+
+		// Subtrees, depth limits and the filters travel with the query
+		auto found = clusterScan(options, addresses, true, "d3", errors);
+		CHECK(found.size() == 2 && found[0].find("hit3.log") != std::string::npos);
+		ScanOptions limited = options;
+		limited.maxDepth = 2;
+		CHECK(clusterScan(limited, addresses, true, ".", errors).empty());
+		limited.maxDepth = 3;
+		limited.includePatterns = { "*.log" };
+		CHECK(clusterScan(limited, addresses, true, ".", errors).size() == 8);
+
+		// --first closes every connection once enough files were reported
+		ScanOptions first = options;
+		first.maxFiles = 3;
+		CHECK(clusterScan(first, addresses, true, ".", errors).size() == 3 && errors == 0 && served);
+
+		// An unreachable agent is an error; the others do its share
+		const auto refused = addresses[0].substr(0, addresses[0].rfind(':') + 1) + "1";
+		CHECK(clusterScan(options, { refused, addresses[1] }, true, ".", errors) == local && errors == 1);
+
+		// Agents refuse paths outside their tree
+		CHECK(clusterScan(options, addresses, true, "../..", errors).empty() && errors >= 1 && !served);
+
+		// Without the token nothing is served
+		CHECK(clusterScan(options, addresses, true, ".", errors, "s3cres").empty() && errors == 2 && !served);
+		CHECK(clusterScan(options, addresses, true, ".", errors, "s3cret-and-more").empty() && errors == 2);
+		ClusterOptions noToken;
+		noToken.agents = addresses;
+		CHECK(!ClusterScan::create(options, noToken, error) && !error.empty());
+		AgentOptions open;
+		open.root = treeDir;
+		open.address = "127.0.0.1:0";
+		CHECK(!ScanAgent::create(open, error) && !error.empty());
+
+		ScanOptions indexed = options;
+		indexed.indexPath = testDir / "tree.idx";
+		ClusterOptions indexedCluster;
+		indexedCluster.agents = addresses;
+		indexedCluster.token = "s3cret";
+		CHECK(!ClusterScan::create(indexed, indexedCluster, error) && !error.empty());
+
+		// Agents notice the coordinator hanging up after --first and cancel their
+		// units: one agent finds the match while the other is busy with files
+		// that take RE2 long to search
+		const fs::path slowDir = treeDir / "slow";
+		fs::create_directories(slowDir / "busy");
+		fs::create_directories(slowDir / "quick");
+		createSampleFile(slowDir / "quick" / "hit.txt", "needle\n");
+		uint32_t seed = 1;
+		for (int f = 0; f < 100; ++f) {
+			std::string text;
+			for (int i = 0; i < 64 * 1024; ++i) {
+				seed = seed * 1103515245 + 12345;
+				text.push_back(i % 64 == 63 ? '\n' : (seed >> 16) & 1 ? 'a' : 'b');
+			}
+			createSampleFile(slowDir / "busy" / (std::to_string(f) + ".txt"), text);
+		}
+		ScanOptions slow;
+		slow.query = "a[ab]{20}c|needle";
+		slow.useRegex = true;
+		slow.maxFiles = 1;
+		CHECK(clusterScan(slow, addresses, true, "slow", errors).size() == 1 && errors == 0 && served);
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+		while ((agents[0]->activeScans() != 0 || agents[1]->activeScans() != 0)
+			&& std::chrono::steady_clock::now() < deadline) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		CHECK(agents[0]->activeScans() == 0 && agents[1]->activeScans() == 0);
+		fs::remove_all(slowDir);
+
+		for (auto& agent : agents) {
+			agent->stop();
+		}
+		for (auto& thread : serving) {
+			thread.join();
+		}
+	}
+
+	// An invalid regex is rejected once, before any file is scanned
+	fs::remove("search_results.txt");
+	searchInDirectory("(unclosed", testDir, true, std::nullopt);
+	CHECK(!fs::exists("search_results.txt") && "Invalid regex should abort the scan");
 
 	// 4. Clean up
 	/*fs::remove_all(testDir);